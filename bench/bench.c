@@ -0,0 +1,363 @@
+/**
+* @file bench.c
+* @brief Micro-benchmarks for the command queue of the serial module
+*
+* This file measures add()/get_next_command() throughput and add-to-dequeue
+* latency. Each run starts N producer threads that push commands with
+* add_wait() while the main thread consumes them with
+* get_next_command_wait(). Runs cover both queue backends, several pool
+* capacities, command mixes and log sinks.
+*
+* Every command carries the index of its producer (the channel of ON_OFF and
+* EMERGENCY commands, max_time - 1 of SET_PARAMS). Each lane is FIFO, so the
+* consumer matches a dequeued command with the timestamp its producer took
+* before the add by counting per producer and lane.
+*
+* With -c, the commands accepted by each run are recorded to a capture file,
+* see serial_capture.h. Every run starts the file over, so it ends up holding
+* the last one, the mixed command mix on the ring backend, which the replay
+* tool can feed back in, e.g. to train a profile-guided build.
+*
+* Usage: bench [-p producers] [-n commands per producer] [-l] [-c capture]
+*
+* Created on: May 16, 2025
+* @author Zhanibekuly Darkhan
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "serial.h"
+
+/** @brief Maximum number of producer threads, one per channel */
+#define BENCH_MAX_PRODUCERS CHANNEL_COUNT
+
+/** @brief Timestamps kept per producer and lane, must exceed the largest pool */
+#define BENCH_TS_RING 8192
+
+/** @brief Default number of producer threads */
+#define BENCH_DEFAULT_PRODUCERS 4
+
+/** @brief Default number of commands pushed by each producer */
+#define BENCH_DEFAULT_OPS 50000
+
+/** @brief Time the consumer waits for a command before giving up */
+#define BENCH_CONSUMER_TIMEOUT_NS 5000000000LL
+
+/**
+* @brief Command mix of a run
+*/
+typedef struct {
+    /** @brief Name printed in the report */
+    const char *name;
+    /** @brief One command in this many is a SET_PARAMS, 0 for none */
+    unsigned set_params_every;
+    /** @brief One command in this many is an EMERGENCY, 0 for none */
+    unsigned emergency_every;
+} bench_mix_t;
+
+/**
+* @brief State of one producer thread
+*/
+typedef struct {
+    /** @brief Producer thread */
+    pthread_t thread;
+    /** @brief Producer index, carried in every command */
+    int id;
+    /** @brief Number of commands to push */
+    size_t ops;
+    /** @brief Command mix to push */
+    const bench_mix_t *mix;
+    /** @brief Set if an add failed */
+    int failed;
+    /** @brief Timestamps taken before each add, per lane (0=routine, 1=emergency) */
+    uint64_t ts[2][BENCH_TS_RING];
+    /** @brief Commands pushed per lane */
+    size_t pushed[2];
+    /** @brief Commands consumed per lane */
+    size_t consumed[2];
+} bench_producer_t;
+
+/** @brief Pool capacities to run */
+static const size_t bench_pool_sizes[] = { 32, 256, 4096 };
+
+/** @brief Command mixes to run */
+static const bench_mix_t bench_mixes[] = {
+    { "on_off", 0, 0 },
+    { "mixed", 10, 100 }
+};
+
+/** @brief Producer threads of the current run */
+static bench_producer_t producers[BENCH_MAX_PRODUCERS];
+
+/** @brief Capture file recording the accepted commands, NULL for none */
+static const char *capture_path;
+
+/**
+* @brief Get the monotonic clock in nanoseconds
+*
+* @return Current monotonic time in nanoseconds
+*/
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+* @brief Build the i-th command of a producer
+*
+* @param p Producer state
+* @param i Index of the command
+* @param cmd Command to fill
+*/
+static void make_command(const bench_producer_t *p, size_t i, device_command_t *cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+    if (p->mix->emergency_every && i % p->mix->emergency_every == 0) {
+        cmd->command_type = CMD_EMERGENCY;
+        cmd->data.on_off.channel = p->id;
+    } else if (p->mix->set_params_every && i % p->mix->set_params_every == 0) {
+        cmd->command_type = CMD_SET_PARAMS;
+        cmd->data.set_params.min_level = 20;
+        cmd->data.set_params.max_level = 80;
+        cmd->data.set_params.max_time = p->id + 1;
+    } else {
+        cmd->command_type = CMD_ON_OFF;
+        cmd->data.on_off.channel = p->id;
+        cmd->data.on_off.on_off = i & 1;
+    }
+}
+
+/**
+* @brief Main loop of a producer thread
+*
+* @param arg Producer state
+* @return NULL
+*/
+static void *producer_main(void *arg) {
+    bench_producer_t *p = arg;
+    device_command_t cmd;
+
+    for (size_t i = 0; i < p->ops; i++) {
+        make_command(p, i, &cmd);
+        int lane = cmd.command_type == CMD_EMERGENCY;
+        // Published to the consumer by the add itself
+        p->ts[lane][p->pushed[lane] % BENCH_TS_RING] = now_ns();
+        if (add_wait(&cmd, WAIT_FOREVER) != EXIT_SUCCESS) {
+            p->failed = 1;
+            break;
+        }
+        p->pushed[lane]++;
+    }
+    return NULL;
+}
+
+/**
+* @brief Compare two latencies for qsort()
+*/
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+* @brief Get the name of a queue backend
+*/
+static const char *backend_name(queue_backend_t backend) {
+    return backend == QUEUE_BACKEND_RING ? "ring" : "tailq";
+}
+
+/**
+* @brief Get the name of a log sink
+*/
+static const char *sink_name(serial_log_sink_t sink) {
+    switch (sink) {
+        case SERIAL_LOG_SINK_SYSLOG:
+            return "syslog";
+        case SERIAL_LOG_SINK_ASYNC:
+            return "async";
+        default:
+            return "none";
+    }
+}
+
+/**
+* @brief Run one benchmark configuration and print its result line
+*
+* @param backend Queue backend
+* @param pool_size Pool capacity
+* @param mix Command mix
+* @param sink Log sink
+* @param nproducers Number of producer threads
+* @param ops Number of commands per producer
+* @param latencies Buffer for nproducers * ops latencies
+* @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+*/
+static int run_config(queue_backend_t backend, size_t pool_size, const bench_mix_t *mix,
+                      serial_log_sink_t sink, int nproducers, size_t ops, uint64_t *latencies) {
+    serial_options_t opts;
+    size_t total = (size_t)nproducers * ops;
+    size_t done = 0;
+    int result = EXIT_SUCCESS;
+
+    serial_options_default(&opts);
+    opts.queue_backend = backend;
+    opts.pool_capacity = pool_size;
+    opts.log_sink = sink;
+    // A routine add leaves the reserve unused and a producer adds at most one
+    // emergency command between two routine ones, so with one reserved entry
+    // per producer no emergency displaces a routine command the consumer is
+    // waiting for
+    opts.emergency_reserve = mix->emergency_every != 0 ? (size_t)nproducers : 0;
+    opts.capture_path = capture_path;
+    opts.capture_capacity = total;
+    if (init_with_options("/dev/null", B9600, &opts) != EXIT_SUCCESS) {
+        fprintf(stderr, "bench: init failed (%s, pool %zu)\n", backend_name(backend), pool_size);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < nproducers; i++) {
+        memset(&producers[i], 0, sizeof(producers[i]));
+        producers[i].id = i;
+        producers[i].ops = ops;
+        producers[i].mix = mix;
+        if (pthread_create(&producers[i].thread, NULL, producer_main, &producers[i]) != 0) {
+            fprintf(stderr, "bench: cannot start producer %d\n", i);
+            nproducers = i;
+            result = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    while (result == EXIT_SUCCESS && done < total) {
+        device_command_t cmd;
+        if (get_next_command_wait(&cmd, BENCH_CONSUMER_TIMEOUT_NS) != EXIT_SUCCESS) {
+            fprintf(stderr, "bench: consumer timed out after %zu of %zu commands\n", done, total);
+            result = EXIT_FAILURE;
+            break;
+        }
+        uint64_t now = now_ns();
+        int id = cmd.command_type == CMD_SET_PARAMS ? cmd.data.set_params.max_time - 1
+                                                    : cmd.data.on_off.channel;
+        int lane = cmd.command_type == CMD_EMERGENCY;
+        bench_producer_t *p = &producers[id];
+        latencies[done++] = now - p->ts[lane][p->consumed[lane]++ % BENCH_TS_RING];
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    // Unblocks producers still waiting if the run was aborted
+    deinit();
+    for (int i = 0; i < nproducers; i++) {
+        pthread_join(producers[i].thread, NULL);
+        if (producers[i].failed && result == EXIT_SUCCESS) {
+            fprintf(stderr, "bench: producer %d failed to add a command\n", i);
+            result = EXIT_FAILURE;
+        }
+    }
+    if (result != EXIT_SUCCESS) {
+        return result;
+    }
+
+    qsort(latencies, total, sizeof(latencies[0]), compare_u64);
+    printf("%-6s %6zu  %-7s %-7s %12.0f %9llu %9llu %9llu %10llu\n",
+           backend_name(backend), pool_size, mix->name, sink_name(sink),
+           total * 1e9 / (double)elapsed,
+           (unsigned long long)latencies[total / 2],
+           (unsigned long long)latencies[total * 99 / 100],
+           (unsigned long long)latencies[total * 999 / 1000],
+           (unsigned long long)latencies[total - 1]);
+    fflush(stdout);
+    return EXIT_SUCCESS;
+}
+
+/**
+* @brief Print the command line usage
+*
+* @param prog Program name
+*/
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-p producers] [-n commands per producer] [-l] [-c capture]\n"
+            "  -p  producer threads, 1-%d (default %d)\n"
+            "  -n  commands pushed by each producer (default %d)\n"
+            "  -l  also run with the synchronous syslog sink\n"
+            "  -c  record the commands accepted by the last run to a capture file\n",
+            prog, BENCH_MAX_PRODUCERS, BENCH_DEFAULT_PRODUCERS, BENCH_DEFAULT_OPS);
+}
+
+/**
+* @brief Main entry point of the benchmark
+*
+* @param argc Number of arguments
+* @param argv Arguments
+* @return EXIT_SUCCESS if every run succeeded, EXIT_FAILURE otherwise
+*/
+int main(int argc, char *argv[]) {
+    int nproducers = BENCH_DEFAULT_PRODUCERS;
+    long ops = BENCH_DEFAULT_OPS;
+    int with_syslog = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:n:lc:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                nproducers = atoi(optarg);
+                break;
+            case 'n':
+                ops = atol(optarg);
+                break;
+            case 'l':
+                with_syslog = 1;
+                break;
+            case 'c':
+                capture_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (nproducers < 1 || nproducers > BENCH_MAX_PRODUCERS || ops < 1 ||
+        (capture_path != NULL && (unsigned long)nproducers * (unsigned long)ops > CAPTURE_MAX_CAPACITY)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    uint64_t *latencies = malloc((size_t)nproducers * (size_t)ops * sizeof(uint64_t));
+    if (latencies == NULL) {
+        fprintf(stderr, "bench: out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    const queue_backend_t backends[] = { QUEUE_BACKEND_TAILQ, QUEUE_BACKEND_RING };
+    const serial_log_sink_t sinks[] = { SERIAL_LOG_SINK_NONE, SERIAL_LOG_SINK_ASYNC,
+                                        SERIAL_LOG_SINK_SYSLOG };
+    size_t nsinks = with_syslog ? 3 : 2;
+    int result = EXIT_SUCCESS;
+
+    printf("%d producers x %ld commands, latency from add to dequeue in ns\n\n", nproducers, ops);
+    printf("%-6s %6s  %-7s %-7s %12s %9s %9s %9s %10s\n",
+           "queue", "pool", "mix", "log", "ops/s", "p50", "p99", "p999", "max");
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        for (size_t s = 0; s < sizeof(bench_pool_sizes) / sizeof(bench_pool_sizes[0]); s++) {
+            for (size_t m = 0; m < sizeof(bench_mixes) / sizeof(bench_mixes[0]); m++) {
+                for (size_t l = 0; l < nsinks; l++) {
+                    if (run_config(backends[b], bench_pool_sizes[s], &bench_mixes[m], sinks[l],
+                                   nproducers, (size_t)ops, latencies) != EXIT_SUCCESS) {
+                        result = EXIT_FAILURE;
+                    }
+                }
+            }
+        }
+    }
+
+    free(latencies);
+    return result;
+}
@@ -0,0 +1,176 @@
+/**
+* @file replay.c
+* @brief Replay of a command capture through add()
+*
+* This file feeds the commands of a capture file, see serial_capture.h, back
+* into the serial module. By default each command is added at the time it
+* was recorded, relative to the first one, so the module sees the load it
+* saw in production; -x scales the pace and -a adds as fast as possible. The
+* transmit engine drains the pool into the port, /dev/null by default.
+*
+* Usage: replay [-a] [-x factor] [-w] [-r] [-s pool] [-p port] file
+*
+* Created on: May 16, 2025
+* @author Zhanibekuly Darkhan
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "serial.h"
+#include "serial_capture.h"
+
+/** @brief Time to wait for the transmit engine to drain the pool at the end */
+#define REPLAY_DRAIN_TIMEOUT_NS 5000000000ULL
+
+/**
+* @brief Get the monotonic clock in nanoseconds
+*
+* @return Current monotonic time in nanoseconds
+*/
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+* @brief Sleep until a monotonic time
+*
+* @param deadline_ns Monotonic time to wake up at
+*/
+static void sleep_until(uint64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline_ns / 1000000000ULL);
+    ts.tv_nsec = (long)(deadline_ns % 1000000000ULL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+/**
+* @brief Print the command line usage
+*
+* @param prog Program name
+*/
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-a] [-x factor] [-w] [-r] [-s pool] [-p port] file\n"
+            "  -a  add as fast as possible instead of at the recorded pace\n"
+            "  -x  speed factor of the recorded pace (default 1.0)\n"
+            "  -w  wait for room when the pool is full instead of dropping the command\n"
+            "  -r  use the lock-free ring backend\n"
+            "  -s  command pool capacity (default %d)\n"
+            "  -p  serial port to transmit to (default /dev/null)\n",
+            prog, POOL_SIZE);
+}
+
+/**
+* @brief Main entry point of the replay tool
+*
+* @param argc Number of arguments
+* @param argv Arguments
+* @return EXIT_SUCCESS if the capture was replayed, EXIT_FAILURE otherwise
+*/
+int main(int argc, char *argv[]) {
+    const char *port = "/dev/null";
+    int as_fast = 0;
+    int wait_for_room = 0;
+    double factor = 1.0;
+    serial_options_t opts;
+    capture_file_t file;
+    int opt;
+
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    opts.log_sink = SERIAL_LOG_SINK_NONE;
+    while ((opt = getopt(argc, argv, "ax:wrs:p:h")) != -1) {
+        switch (opt) {
+            case 'a':
+                as_fast = 1;
+                break;
+            case 'x':
+                factor = atof(optarg);
+                break;
+            case 'w':
+                wait_for_room = 1;
+                break;
+            case 'r':
+                opts.queue_backend = QUEUE_BACKEND_RING;
+                break;
+            case 's':
+                opts.pool_capacity = (size_t)atol(optarg);
+                break;
+            case 'p':
+                port = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1 || factor <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (serial_capture_map(argv[optind], &file) != EXIT_SUCCESS) {
+        fprintf(stderr, "replay: %s is not a readable capture file\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (init_with_options(port, B9600, &opts) != EXIT_SUCCESS) {
+        fprintf(stderr, "replay: init failed on %s\n", port);
+        serial_capture_unmap(&file);
+        return EXIT_FAILURE;
+    }
+
+    // Pace the adds against the first record, keeping track of how late they run.
+    // Concurrent producers can leave records slightly out of timestamp order;
+    // pacing on the latest timestamp so far adds such a record right away.
+    uint64_t start = now_ns();
+    uint64_t first_ns = file.count > 0 ? file.records[0].timestamp_ns : 0;
+    uint64_t recorded_ns = first_ns;
+    uint64_t max_lag_ns = 0;
+    size_t rejected = 0;
+    for (size_t i = 0; i < file.count; i++) {
+        const capture_record_t *record = &file.records[i];
+        if (!as_fast) {
+            if (record->timestamp_ns > recorded_ns) {
+                recorded_ns = record->timestamp_ns;
+            }
+            uint64_t due = start + (uint64_t)((double)(recorded_ns - first_ns) / factor);
+            uint64_t now = now_ns();
+            if (now < due) {
+                sleep_until(due);
+            } else if (now - due > max_lag_ns) {
+                max_lag_ns = now - due;
+            }
+        }
+        int result = wait_for_room ? add_wait(&record->cmd, WAIT_FOREVER) : add(&record->cmd);
+        if (result != EXIT_SUCCESS) {
+            rejected++;
+        }
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    // Let the transmit engine finish before reporting
+    uint64_t drain_deadline = now_ns() + REPLAY_DRAIN_TIMEOUT_NS;
+    while (get_active_command_count() > 0 && now_ns() < drain_deadline) {
+        sleep_until(now_ns() + 1000000);
+    }
+
+    tx_stats_t tx;
+    get_tx_stats(&tx);
+    printf("%zu records (%llu dropped at capture) replayed in %.3f s, %.0f adds/s\n", file.count,
+           (unsigned long long)file.header->dropped, elapsed / 1e9,
+           elapsed > 0 ? file.count * 1e9 / (double)elapsed : 0.0);
+    printf("rejected %zu, frames written %llu, max lag behind the recorded pace %llu ns\n", rejected,
+           (unsigned long long)tx.frames, (unsigned long long)max_lag_ns);
+
+    deinit();
+    serial_capture_unmap(&file);
+    return EXIT_SUCCESS;
+}
@@ -6,6 +6,11 @@
  * It provides functions for initialization, deinitialization, and command handling.
  * The implementation uses dual queues for active and unused commands.
  *
+ * Each charger is driven through a serial_ctx_t handle returned by
+ * serial_init(), so one process can drive many chargers. Every instance has
+ * its own lock and pools. The functions without a handle (init(), add(), ...)
+ * operate on a built-in default instance.
+ *
  * Created on: May 16, 2025
  * @author Zhanibekuly Darkhan
  */
@@ -16,13 +21,23 @@
 #include <stdlib.h>
 #include <sys/queue.h>
 #include <semaphore.h>
+#include "serial_log.h"
 
-/** @brief Maximum size of the command pool */
+/** @brief Default size of the command pool */
 #define POOL_SIZE 32
 
+/** @brief Largest supported command pool capacity */
+#define POOL_MAX_CAPACITY (1u << 20)
+
+/** @brief Number of charger channels */
+#define CHANNEL_COUNT 8
+
 /** @brief Maximum length for port name string */
 #define MAX_PORT_NAME 30
 
+/** @brief Timeout value that makes the wait functions block indefinitely */
+#define WAIT_FOREVER (-1)
+
 /**
  * @brief Command codes for battery charger
  * @{
@@ -35,6 +50,390 @@
 #define CMD_EMERGENCY 0x65
 /** @} */
 
+/**
+ * @brief Reply codes sent by the battery charger
+ * @{
+ */
+/** @brief Acknowledgement of a command: acked SEQ, command code, status */
+#define RSP_ACK 0x80
+/** @brief Battery level report: channel, level percentage */
+#define RSP_LEVEL 0x81
+/** @brief Charging state report: channel, state */
+#define RSP_STATE 0x82
+/** @brief Fault report: channel, fault code */
+#define RSP_FAULT 0x83
+/** @brief Status of an RSP_ACK for an accepted command */
+#define RSP_ACK_OK 0
+/** @} */
+
+/**
+ * @brief Wire frame layout of the battery charger
+ *
+ * Every command is sent as one frame:
+ * START | SEQ | OPCODE | LEN | PAYLOAD[LEN] | CHECKSUM,
+ * where OPCODE is the command code, PAYLOAD holds the command fields in
+ * structure order and CHECKSUM is the XOR of SEQ through the last payload byte.
+ * Replies from the charger use the same layout with the RSP_* codes.
+ * @{
+ */
+/** @brief Start-of-frame marker */
+#define FRAME_START 0xAA
+/** @brief Size of the frame header (START, SEQ, OPCODE, LEN) */
+#define FRAME_HEADER_SIZE 4
+/** @brief Size of the largest frame payload (SET_PARAMS) */
+#define FRAME_MAX_PAYLOAD 3
+/** @brief Size of the largest encoded frame */
+#define FRAME_MAX_SIZE (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + 1)
+/** @} */
+
+/** @brief Default number of frames packed into one write() by the transmitter */
+#define TX_DEFAULT_FRAMES_PER_WRITE 16
+
+/** @brief Maximum number of frames packed into one write() by the transmitter */
+#define TX_MAX_FRAMES_PER_WRITE 64
+
+/** @brief Number of free entries a thread cache can hold */
+#define THREAD_CACHE_SIZE 16
+
+/** @brief Number of entries moved between a thread cache and the shared pool at once */
+#define THREAD_CACHE_BATCH 8
+
+/** @brief Largest acknowledgement window, a quarter of the sequence number space */
+#define ACK_MAX_WINDOW 64
+
+/** @brief Resolution of the deadlines of add_at() in milliseconds */
+#define TIMER_TICK_MS 1
+
+/** @brief Default time to wait for an acknowledgement before retransmitting */
+#define ACK_DEFAULT_TIMEOUT_MS 100
+
+/** @brief Default number of retransmissions before a command is given up */
+#define ACK_DEFAULT_RETRIES 3
+
+/** @brief Default number of slots of the shared-memory ingress ring */
+#define SHM_DEFAULT_CAPACITY 256
+
+/** @brief Largest number of slots of the shared-memory ingress ring */
+#define SHM_MAX_CAPACITY 65536
+
+/** @brief Maximum length of a shared-memory region name, including the leading slash */
+#define SHM_MAX_NAME 63
+
+/** @brief Default number of records of a command capture file */
+#define CAPTURE_DEFAULT_CAPACITY (1u << 20)
+
+/** @brief Largest number of records of a command capture file */
+#define CAPTURE_MAX_CAPACITY (1u << 26)
+
+/** @brief Default delay before the first automatic reconnection attempt */
+#define RECONNECT_DEFAULT_MIN_MS 10
+
+/** @brief Default upper bound of the delay between automatic reconnection attempts */
+#define RECONNECT_DEFAULT_MAX_MS 2000
+
+/** @brief Default longest wait of the OVERFLOW_BLOCK policy */
+#define OVERFLOW_DEFAULT_TIMEOUT_MS 100
+
+/** @brief Size of the receive ring buffer in bytes, a power of two */
+#define RX_BUFFER_SIZE 4096
+
+/** @brief Number of receive events the event queue can hold */
+#define RX_EVENT_QUEUE_SIZE 256
+
+/**
+ * @brief Types of receive events
+ */
+typedef enum {
+    /** @brief The charger acknowledged a command */
+    RX_EVENT_ACK = 0,
+    /** @brief Battery level of a channel */
+    RX_EVENT_LEVEL,
+    /** @brief Charging state of a channel */
+    RX_EVENT_STATE,
+    /** @brief Fault reported by the charger */
+    RX_EVENT_FAULT
+} rx_event_type_t;
+
+/**
+ * @brief Typed event decoded from a charger reply
+ */
+typedef struct {
+    /** @brief Type of the event, selects the member of data */
+    rx_event_type_t type;
+    /** @brief Sequence number of the reply frame */
+    uint8_t seq;
+    /** @brief Event-specific data */
+    union {
+        /** @brief Data of RX_EVENT_ACK */
+        struct {
+            /** @brief Sequence number of the acknowledged command frame */
+            uint8_t seq;
+            /** @brief Command code of the acknowledged command */
+            uint8_t command_type;
+            /** @brief RSP_ACK_OK or a charger-specific error status */
+            uint8_t status;
+        } ack;
+        /** @brief Data of RX_EVENT_LEVEL */
+        struct {
+            /** @brief Channel number (0-7) */
+            uint8_t channel;
+            /** @brief Battery level percentage (0-100) */
+            uint8_t level;
+        } level;
+        /** @brief Data of RX_EVENT_STATE */
+        struct {
+            /** @brief Channel number (0-7) */
+            uint8_t channel;
+            /** @brief Charger-specific charging state */
+            uint8_t state;
+        } state;
+        /** @brief Data of RX_EVENT_FAULT */
+        struct {
+            /** @brief Channel number (0-7) */
+            uint8_t channel;
+            /** @brief Charger-specific fault code */
+            uint8_t code;
+        } fault;
+    } data;
+} rx_event_t;
+
+/**
+ * @brief Callback receiving decoded events
+ *
+ * @param event Decoded event, valid only during the call
+ * @param user User pointer from serial_options_t.rx_user
+ */
+typedef void (*rx_callback_t)(const rx_event_t *event, void *user);
+
+/**
+ * @brief Statistics of the receive path
+ */
+typedef struct {
+    /** @brief Number of bytes received */
+    uint64_t bytes;
+    /** @brief Number of valid frames decoded into events */
+    uint64_t frames;
+    /** @brief Number of frames with a wrong checksum */
+    uint64_t checksum_errors;
+    /** @brief Number of bytes skipped while searching for a frame start */
+    uint64_t discarded_bytes;
+    /** @brief Number of valid frames with an unknown code or wrong length */
+    uint64_t malformed_frames;
+    /** @brief Number of events dropped because the event queue was full */
+    uint64_t dropped_events;
+} rx_stats_t;
+
+/**
+ * @brief Command queue backends selectable at initialization
+ */
+typedef enum {
+    /** @brief Semaphore-guarded TAILQ pools (default) */
+    QUEUE_BACKEND_TAILQ = 0,
+    /** @brief Fixed-capacity lock-free multi-producer ring of command slots */
+    QUEUE_BACKEND_RING
+} queue_backend_t;
+
+/**
+ * @brief What add() does with a routine command when the pool is full
+ */
+typedef enum {
+    /** @brief Fail the add at once (default) */
+    OVERFLOW_REJECT = 0,
+    /** @brief Wait up to overflow_timeout_ms for an entry to become free */
+    OVERFLOW_BLOCK,
+    /** @brief Discard the oldest pending routine command and queue the new one at the end, TAILQ backend only */
+    OVERFLOW_DROP_OLDEST,
+    /** @brief Overwrite the newest pending command for the same channel or parameters, TAILQ backend only */
+    OVERFLOW_COALESCE
+} overflow_policy_t;
+
+/**
+ * @brief Terminal and driver settings applied to the serial port
+ */
+typedef enum {
+    /** @brief Raw mode, reads return as soon as one byte arrives, driver settings left alone */
+    SERIAL_LINE_DEFAULT = 0,
+    /** @brief Raw mode, reads return on one byte, ASYNC_LOW_LATENCY set in the driver */
+    SERIAL_LINE_LOW_LATENCY,
+    /** @brief Raw mode, reads wait for a whole frame or a pause, ASYNC_LOW_LATENCY cleared */
+    SERIAL_LINE_THROUGHPUT
+} serial_line_profile_t;
+
+/**
+ * @brief Line settings the driver reports after the port was configured
+ */
+typedef struct {
+    /** @brief Whether terminal settings were applied, 0 for /dev/null */
+    int configured;
+    /** @brief Profile that was applied */
+    serial_line_profile_t profile;
+    /** @brief Output rate in bits per second as read back from the driver */
+    uint32_t output_baud;
+    /** @brief Input rate in bits per second as read back from the driver */
+    uint32_t input_baud;
+    /** @brief Whether the rate was set in bits per second rather than with a B* constant */
+    int custom_baud;
+    /** @brief Whether canonical mode, echo, signals and output post-processing are all off */
+    int raw;
+    /** @brief VMIN in effect */
+    uint8_t vmin;
+    /** @brief VTIME in effect, in tenths of a second */
+    uint8_t vtime;
+    /** @brief ASYNC_LOW_LATENCY of the driver: 1 set, 0 clear, -1 not supported by the driver */
+    int low_latency;
+} serial_line_info_t;
+
+/**
+ * @brief CPU placement and scheduling requested for a thread of the module
+ */
+typedef struct {
+    /** @brief CPU to pin the thread to, or -1 to leave its affinity alone */
+    int cpu;
+    /** @brief SCHED_FIFO priority (1-99), or 0 to keep the default scheduling policy */
+    int priority;
+} serial_thread_options_t;
+
+/**
+ * @brief CPU placement and scheduling a thread of the module actually got
+ *
+ * Each request is reported as 1 granted, 0 refused by the system, or -1 not
+ * requested. A refusal is not an error: the thread runs with the settings it
+ * had, which cpu and priority read back.
+ */
+typedef struct {
+    /** @brief Whether the thread is running; the other fields are only valid if it is */
+    int running;
+    /** @brief Outcome of the CPU pinning */
+    int affinity;
+    /** @brief Outcome of the switch to SCHED_FIFO */
+    int sched_fifo;
+    /** @brief CPU the thread is restricted to, or -1 if it may run on several */
+    int cpu;
+    /** @brief SCHED_FIFO priority in effect, 0 under another policy */
+    int priority;
+} serial_thread_info_t;
+
+/**
+ * @brief Real-time settings an instance actually got
+ */
+typedef struct {
+    /** @brief Placement and scheduling of the writer thread of the transmit engine */
+    serial_thread_info_t transmitter;
+    /** @brief Locking of the pool memory: 1 granted, 0 refused for some of it, -1 not requested */
+    int memory_locked;
+    /** @brief Number of bytes of pool memory locked into RAM */
+    size_t locked_bytes;
+} serial_rt_info_t;
+
+/**
+ * @brief Options for initializing the serial communication module
+ *
+ * Use serial_options_default() to fill the structure with default values
+ * before overriding individual fields.
+ */
+typedef struct {
+    /** @brief Queue backend used for the command pool */
+    queue_backend_t queue_backend;
+    /** @brief Initial number of entries in the command pool (1-POOL_MAX_CAPACITY) */
+    size_t pool_capacity;
+    /** @brief Grow the pool instead of rejecting commands when it is full (0=off, 1=on) */
+    int pool_growth;
+    /** @brief Upper bound for the pool capacity in growth mode, 0 for POOL_MAX_CAPACITY */
+    size_t pool_max_capacity;
+    /** @brief Number of entries added by each growth step */
+    size_t pool_chunk_size;
+    /** @brief Replace superseded pending ON_OFF/SET_PARAMS commands in place (0=off, 1=on) */
+    int coalesce;
+    /** @brief Keep free entries in per-thread caches in front of the unused pool (0=off, 1=on) */
+    int thread_cache;
+    /** @brief Log sink; SERIAL_LOG_SINK_ASYNC keeps syslog off the hot path */
+    serial_log_sink_t log_sink;
+    /** @brief Start the transmit engine thread (0=off, 1=on) */
+    int transmitter;
+    /** @brief Maximum frames packed into one write() (1-TX_MAX_FRAMES_PER_WRITE) */
+    size_t tx_frames_per_write;
+    /** @brief Start a receiver thread that reads and parses replies (0=off, 1=on) */
+    int receiver;
+    /** @brief Callback for decoded events, NULL to queue them for get_rx_event() */
+    rx_callback_t rx_callback;
+    /** @brief User pointer passed to rx_callback */
+    void *rx_user;
+    /** @brief Commands in flight awaiting an RSP_ACK, 0 to send without tracking (0-ACK_MAX_WINDOW) */
+    size_t ack_window;
+    /** @brief Time to wait for an acknowledgement before retransmitting, in milliseconds */
+    uint32_t ack_timeout_ms;
+    /** @brief Number of retransmissions before an unacknowledged command is given up */
+    unsigned ack_retries;
+    /** @brief Start a timer thread releasing the commands of add_at() (0=off, 1=on, TAILQ backend only) */
+    int timers;
+    /** @brief Name of a shared-memory ingress ring to create, such as "/battery", or NULL for none */
+    const char *shm_name;
+    /** @brief Number of slots of the shared-memory ingress ring (1-SHM_MAX_CAPACITY) */
+    size_t shm_capacity;
+    /** @brief Reopen the port in the background when it fails (0=off, 1=on) */
+    int auto_reconnect;
+    /** @brief Delay before the first reconnection attempt, doubled after each failure, in milliseconds */
+    uint32_t reconnect_min_ms;
+    /** @brief Upper bound of the delay between reconnection attempts, in milliseconds */
+    uint32_t reconnect_max_ms;
+    /** @brief File recording every accepted command, see serial_capture.h, or NULL for none */
+    const char *capture_path;
+    /** @brief Number of records the capture file is sized for (1-CAPTURE_MAX_CAPACITY) */
+    size_t capture_capacity;
+    /** @brief Terminal and driver settings applied to the port */
+    serial_line_profile_t line_profile;
+    /** @brief Line rate in bits per second, overriding speed, for rates without a B* constant; 0 to use speed */
+    uint32_t baud_rate;
+    /** @brief What add() does with a CMD_SET_PARAMS when the pool is full */
+    overflow_policy_t overflow_set_params;
+    /** @brief What add() does with a CMD_ON_OFF when the pool is full */
+    overflow_policy_t overflow_on_off;
+    /** @brief Longest wait of OVERFLOW_BLOCK, in milliseconds (at least 1) */
+    uint32_t overflow_timeout_ms;
+    /** @brief Pool entries that only emergency commands may take (less than pool_capacity) */
+    size_t emergency_reserve;
+    /** @brief Placement and scheduling of the writer thread of the transmit engine */
+    serial_thread_options_t tx_thread;
+    /** @brief Lock the pool memory into RAM with mlock(), including chunks added by growth (0=off, 1=on) */
+    int lock_memory;
+} serial_options_t;
+
+/**
+ * @brief Statistics of the transmit engine
+ */
+typedef struct {
+    /** @brief Number of frames written to the serial port */
+    uint64_t frames;
+    /** @brief Number of bytes written to the serial port */
+    uint64_t bytes;
+    /** @brief Number of write() system calls made */
+    uint64_t write_calls;
+    /** @brief Number of failed write() system calls */
+    uint64_t write_errors;
+    /** @brief Number of frames dropped after a write error that did not mean the port was gone */
+    uint64_t dropped;
+    /** @brief Average number of frames per write() system call */
+    double frames_per_write;
+    /** @brief Average throughput since the transmitter started */
+    double bytes_per_sec;
+} tx_stats_t;
+
+/**
+ * @brief Statistics of the acknowledgement window
+ */
+typedef struct {
+    /** @brief Number of commands currently waiting for an acknowledgement */
+    size_t in_flight;
+    /** @brief Number of commands acknowledged with RSP_ACK_OK */
+    uint64_t acked;
+    /** @brief Number of commands acknowledged with an error status */
+    uint64_t rejected;
+    /** @brief Number of frames sent again after an acknowledgement timeout */
+    uint64_t retransmits;
+    /** @brief Number of commands given up after the last retransmission */
+    uint64_t timeouts;
+} ack_stats_t;
+
 /**
  * @brief Structure for setting battery charging parameters
  */
@@ -75,6 +474,19 @@ typedef struct {
     } data;
 } device_command_t;
 
+/**
+ * @brief State of the charger kept by set_channel_state()
+ *
+ * The charging parameters apply to the whole charger, since CMD_SET_PARAMS
+ * carries no channel; the on/off status is kept per channel.
+ */
+typedef struct {
+    /** @brief Charging parameters, sent with CMD_SET_PARAMS */
+    cmd_set_params_t params;
+    /** @brief On/off status of each channel (0=off, 1=on), sent with CMD_ON_OFF */
+    uint8_t on_off[CHANNEL_COUNT];
+} charger_state_t;
+
 /**
  * @brief Structure for storing command entries in a queue
  *
@@ -83,10 +495,181 @@ typedef struct {
 struct cmd_entry {
     /** @brief The device command */
     device_command_t cmd;
+    /** @brief Monotonic time at which the command was added, in nanoseconds */
+    uint64_t enqueue_ns;
     /** @brief Queue entry for the sys/queue.h TAILQ macros */
     TAILQ_ENTRY(cmd_entry) entries;
 };
 
+/**
+ * @brief Statistics of the command pool
+ */
+typedef struct {
+    /** @brief Current number of entries in the pool */
+    size_t capacity;
+    /** @brief Upper bound for the capacity */
+    size_t max_capacity;
+    /** @brief Largest number of active commands seen since initialization */
+    size_t high_water_mark;
+    /** @brief Number of times the pool has grown */
+    uint64_t grow_events;
+    /** @brief Number of commands that replaced a pending command */
+    uint64_t coalesced;
+    /** @brief Number of adds and retrievals that reached past their thread cache */
+    uint64_t cache_slow_path;
+} pool_stats_t;
+
+/**
+ * @brief Measured add-to-dequeue latency of emergency commands
+ */
+typedef struct {
+    /** @brief Number of emergency commands dequeued since initialization */
+    uint64_t count;
+    /** @brief Largest observed latency, the measured upper bound */
+    uint64_t max_ns;
+    /** @brief Mean latency */
+    uint64_t mean_ns;
+} emergency_latency_t;
+
+/** @brief Number of buckets of a latency histogram */
+#define HISTOGRAM_BUCKETS 160
+
+/**
+ * @brief Log-linear latency histogram
+ *
+ * Values below 4 ns have a bucket each. Above, every power of two is split
+ * into four equal sub-buckets, so a bucket is at most a quarter of its lower
+ * bound wide. Values beyond the last bucket, about 36 minutes, are counted in
+ * it. serial_histogram_bucket_limit() gives the bounds of each bucket.
+ */
+typedef struct {
+    /** @brief Number of recorded values */
+    uint64_t count;
+    /** @brief Sum of the recorded values */
+    uint64_t sum_ns;
+    /** @brief Largest recorded value */
+    uint64_t max_ns;
+    /** @brief Number of recorded values per bucket */
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} latency_histogram_t;
+
+/**
+ * @brief Counters and latency histograms of an instance
+ *
+ * The counters accumulate over the whole lifetime of the instance. For the
+ * legacy functions this includes every init()/deinit() cycle, so they only
+ * ever grow, as monitoring systems expect from counters.
+ */
+typedef struct {
+    /** @brief Number of commands accepted into the active pool */
+    uint64_t adds;
+    /** @brief Number of commands rejected because they failed validation */
+    uint64_t rejected_invalid;
+    /** @brief Number of commands rejected because the pool was full or the wait timed out */
+    uint64_t rejected_pool_full;
+    /** @brief Number of commands rejected because the instance was not initialized */
+    uint64_t rejected_not_initialized;
+    /** @brief Number of commands taken out of the active pool */
+    uint64_t dequeues;
+    /** @brief Number of commands currently waiting in the active pool */
+    uint64_t active;
+    /** @brief Number of commands of add_at() waiting for their deadline */
+    uint64_t deferred;
+    /** @brief Number of bytes written to the serial port */
+    uint64_t bytes_written;
+    /** @brief Number of write() system calls made on the serial port */
+    uint64_t write_calls;
+    /** @brief Number of frames dropped after a write error that did not mean the port was gone */
+    uint64_t tx_dropped;
+    /** @brief Number of times the serial port was found to have failed */
+    uint64_t port_failures;
+    /** @brief Number of times the serial port was reopened */
+    uint64_t reconnects;
+    /** @brief Non-zero while the serial port is failed and not reopened yet */
+    uint64_t port_down;
+    /** @brief Number of commands generated by set_channel_state() */
+    uint64_t state_commands;
+    /** @brief Number of commands set_channel_state() left out because the state had not changed */
+    uint64_t state_unchanged;
+    /** @brief Number of adds rejected because the pool was full and the policy found no other way */
+    uint64_t overflow_rejected;
+    /** @brief Number of adds that blocked under OVERFLOW_BLOCK */
+    uint64_t overflow_blocked;
+    /** @brief Number of blocked adds that timed out */
+    uint64_t overflow_timeouts;
+    /** @brief Number of pending commands discarded by OVERFLOW_DROP_OLDEST */
+    uint64_t overflow_dropped;
+    /** @brief Number of pending commands overwritten by OVERFLOW_COALESCE */
+    uint64_t overflow_coalesced;
+    /** @brief Number of pending routine commands discarded to make room for an emergency command */
+    uint64_t emergency_displaced;
+    /** @brief Time commands spent in the active pool, from add to dequeue */
+    latency_histogram_t residency;
+    /** @brief Duration of the write() system calls on the serial port */
+    latency_histogram_t write_time;
+} serial_stats_t;
+
+/**
+ * @brief Snapshot of the command pool occupancy
+ */
+typedef struct {
+    /** @brief Number of commands waiting in the active pool */
+    int active;
+    /** @brief Number of unused command slots */
+    int unused;
+} command_counts_t;
+
+/**
+ * @brief Slot of the lock-free command ring
+ *
+ * This structure is used internally by the QUEUE_BACKEND_RING backend. The
+ * sequence number tells producers and the consumer whether the slot is free
+ * or holds a published command for the current lap of the ring. Only its
+ * low 32 bits are kept, which is enough to compare positions less than a
+ * lap apart, so a slot takes 16 bytes and four slots share a cache line.
+ */
+struct cmd_slot {
+    /** @brief Low 32 bits of the ring position for which the slot is ready */
+    uint32_t sequence;
+    /** @brief The device command */
+    device_command_t cmd;
+    /** @brief Monotonic time at which the command was added, in nanoseconds */
+    uint64_t enqueue_ns;
+};
+
+/**
+ * @brief Handle of one serial port instance
+ *
+ * The structure is opaque; create instances with serial_init() and release
+ * them with serial_deinit().
+ */
+typedef struct serial_ctx serial_ctx_t;
+
+/**
+ * @brief Handle of an event loop that transmits for many instances
+ *
+ * The structure is opaque; see serial_reactor_create().
+ */
+typedef struct serial_reactor serial_reactor_t;
+
+/**
+ * @brief Handle of a shared-memory ingress ring attached by another process
+ *
+ * The structure is opaque; see serial_shm_attach().
+ */
+typedef struct serial_shm serial_shm_t;
+
+/**
+ * @brief Fill an options structure with default values
+ *
+ * The defaults select the QUEUE_BACKEND_TAILQ backend with a fixed pool of
+ * POOL_SIZE entries and the transmit engine disabled, which matches the
+ * behavior of init().
+ *
+ * @param opts Pointer to the options structure to fill
+ */
+void serial_options_default(serial_options_t *opts);
+
 /**
  * @brief Initialize the serial communication
  *
@@ -100,6 +683,82 @@ struct cmd_entry {
  */
 int init(const char *port, int speed);
 
+/**
+ * @brief Initialize the serial communication with options
+ *
+ * This function behaves like init() but allows selecting the queue backend
+ * and other module options. Passing NULL for opts is equivalent to init().
+ *
+ * With QUEUE_BACKEND_RING, add() never takes a lock and may be called from
+ * any number of producer threads. get_next_command() is lock-free as well.
+ *
+ * With pool_growth set, the TAILQ backend adds cache-aligned chunks of
+ * pool_chunk_size entries when it runs out of unused entries, up to
+ * pool_max_capacity. Entries already in use are never moved. The ring
+ * backend has a fixed capacity and does not support growth.
+ *
+ * With coalesce set, a CMD_ON_OFF for a channel that already has an ON_OFF
+ * waiting in the active pool replaces the pending command in place, and so
+ * does a CMD_SET_PARAMS while another SET_PARAMS is pending. The replaced
+ * command keeps its position in the queue. Emergency commands are never
+ * coalesced. Coalescing requires the TAILQ backend.
+ *
+ * With thread_cache set, the TAILQ backend keeps up to THREAD_CACHE_SIZE
+ * free entries per thread, so add() takes its entry and the
+ * get_next_command() family returns entries without touching the shared
+ * unused pool. Caches are refilled and drained THREAD_CACHE_BATCH entries at
+ * a time, inside the critical section the operation holds anyway, and an
+ * add() that finds the shared pool empty takes the entries cached by other
+ * threads before the pool grows or the add fails. Up to 16 threads get a
+ * cache of their own; further threads share them.
+ *
+ * With the transmitter option set, a writer thread drains the active pool,
+ * encodes each command with encode_frame() and packs up to
+ * tx_frames_per_write frames into a single write() on the serial port. The
+ * application must not call the get_next_command() family in that mode.
+ *
+ * With the receiver option set, a reader thread reads the replies of the
+ * charger into a ring buffer, parses the frames in place and delivers each
+ * one as an rx_event_t, either to rx_callback on the reader thread or
+ * through the queue read by get_rx_event().
+ *
+ * With ack_window set, the transmitter keeps up to ack_window commands in
+ * flight. Each frame carries its own sequence number, and an RSP_ACK naming
+ * that number retires the command; acknowledgements may arrive in any order.
+ * A command that is not acknowledged within ack_timeout_ms is sent again with
+ * the same sequence number, up to ack_retries times, and then given up. The
+ * window stops sliding while its oldest command is outstanding. Tracking
+ * needs the transmitter, and the replies must reach the receive path through
+ * the receiver option or rx_feed(). ACK events are still delivered to the
+ * application.
+ *
+ * overflow_set_params and overflow_on_off choose what add() does when the
+ * pool has no room for a routine command: reject it, block for up to
+ * overflow_timeout_ms, discard the oldest pending routine command, or
+ * overwrite the pending command it supersedes. When the last two find
+ * nothing to replace, the command is rejected. The batch functions stay
+ * all-or-nothing and always reject, and add_wait() keeps its own timeout.
+ * Routine commands never take the last emergency_reserve entries of the
+ * pool. An emergency command that still finds the pool full discards the
+ * oldest pending routine command on the TAILQ backend; on the ring backend
+ * it is queued over the capacity of the pool, as long as a pending routine
+ * command is left for it to stand in for, and does not appear in the pool
+ * counts. Either way emergencies are never rejected because of routine
+ * traffic.
+ *
+ * tx_thread pins the writer thread to a CPU and runs it under SCHED_FIFO,
+ * and lock_memory locks the pool into RAM, faulting its pages in up front.
+ * Neither makes initialization fail when the system refuses it, which
+ * usually takes CAP_SYS_NICE or a larger RLIMIT_MEMLOCK; get_rt_info()
+ * reports what was granted.
+ *
+ * @param port Serial port name (max 30 characters)
+ * @param speed Communication speed (use B9600, B115200, etc. from termios.h)
+ * @param opts Pointer to the options, or NULL for defaults
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int init_with_options(const char *port, int speed, const serial_options_t *opts);
+
 /**
  * @brief Deinitialize the serial communication
  *
@@ -115,6 +774,10 @@ int deinit(void);
  *
  * This function validates the command and adds it to the active command pool if valid.
  * It takes an entry from the unused command pool.
+ * CMD_EMERGENCY commands go to a separate high-priority lane that is always
+ * drained before routine commands, so they never wait behind a backlog.
+ * When the pool is full, the overflow policy of the command type applies,
+ * see init_with_options().
  * The function is thread-safe.
  *
  * @param cmd Pointer to the command structure to add
@@ -122,22 +785,179 @@ int deinit(void);
  */
 int add(const device_command_t *cmd);
 
+/**
+ * @brief Add a command, blocking while the pool is full
+ *
+ * This function validates the command like add() and then waits until an
+ * unused entry becomes available or the timeout expires. Invalid commands
+ * are rejected immediately. Waiting threads are released with EXIT_FAILURE
+ * when the module is deinitialized.
+ * The function is thread-safe.
+ *
+ * @param cmd Pointer to the command structure to add
+ * @param timeout_ns Relative timeout in nanoseconds, 0 to fail at once if full, or WAIT_FOREVER
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure or timeout
+ */
+int add_wait(const device_command_t *cmd, int64_t timeout_ns);
+
+/**
+ * @brief Add a batch of commands to the active pool
+ *
+ * This function validates every command of the batch and then moves all of
+ * them into the active pool in order, taking the pool lock only once. The
+ * batch is all-or-nothing: if any command is invalid or the unused pool has
+ * no room for the whole batch, nothing is added. Emergency commands are the
+ * exception: when the pool is full they are added one by one like add(),
+ * ahead of the routine commands, which stay all-or-nothing.
+ * The function is thread-safe.
+ *
+ * @param cmds Array of commands to add
+ * @param n Number of commands in the array
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if a command was not added
+ */
+int add_batch(const device_command_t *cmds, size_t n);
+
+/**
+ * @brief Check a command against the device specification
+ *
+ * This function performs the same checks as add(), without logging, so
+ * producers can validate commands once where they are built.
+ *
+ * @param cmd Pointer to the command structure to check
+ * @return EXIT_SUCCESS if valid, EXIT_FAILURE if invalid or NULL pointer
+ */
+int validate_command(const device_command_t *cmd);
+
+/**
+ * @brief Add a batch of commands that already passed validate_command()
+ *
+ * This function behaves like add_batch() but skips the validation, for
+ * trusted producers that check their commands when they build them. Adding
+ * a command that would fail validate_command() is undefined behavior.
+ * The function is thread-safe.
+ *
+ * @param cmds Array of validated commands to add
+ * @param n Number of commands in the array
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int add_prevalidated(const device_command_t *cmds, size_t n);
+
+/**
+ * @brief Add a command to the active pool once a deadline has passed
+ *
+ * The command is validated right away and takes an entry of the pool while
+ * it waits, so the pool must be sized, or allowed to grow, for the deferred
+ * commands as well. A timer thread, started with the timers option, moves
+ * due commands into the active pool with a resolution of TIMER_TICK_MS; a
+ * deadline in the past releases the command on its next tick. Emergency
+ * commands cannot be deferred. Deferred commands count as routine: they
+ * never take the last emergency_reserve entries, and since an emergency
+ * cannot displace a command that is still waiting, a pool full of deferred
+ * commands rejects emergencies unless entries are reserved for them. The
+ * function is thread-safe.
+ *
+ * @param cmd Pointer to the command structure to add
+ * @param deadline_ns Absolute CLOCK_MONOTONIC time in nanoseconds
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int add_at(const device_command_t *cmd, uint64_t deadline_ns);
+
+/**
+ * @brief Bring the charger into a state, sending only what changed
+ *
+ * The module keeps a table of the state the charger was put into by the
+ * commands it queued. This function compares the requested state with that
+ * table and queues a CMD_SET_PARAMS if the parameters differ and a CMD_ON_OFF
+ * for each channel whose status differs, in that order, as one batch. When
+ * nothing changed, nothing is queued, so a controller may call it with the
+ * full state every cycle. The first call after initialization, after
+ * invalidate_channel_state() and after reconnect() sends the whole state.
+ *
+ * The batch is all-or-nothing like add_batch(). If the pool has no room, the
+ * table is left as it was and the next call tries the same changes again.
+ * When a queued command of the table is discarded by an overflow policy or
+ * an emergency command, or overwritten by coalescing with a command from
+ * elsewhere, its field is forgotten and sent again by the next call.
+ * Commands added with the other add functions otherwise bypass the table;
+ * call invalidate_channel_state() after sending such commands.
+ * The function is thread-safe.
+ *
+ * @param state Pointer to the requested state
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized, the state is invalid or the pool is full
+ */
+int set_channel_state(const charger_state_t *state);
+
+/**
+ * @brief Get the requested and the applied state of the charger
+ *
+ * The requested state is the one last passed to set_channel_state(); the
+ * applied state is the one the queued commands put the charger into. They
+ * differ while changes wait for room in the pool. The applied state is not
+ * known while a field of it was lost from the pool, until the next
+ * set_channel_state().
+ *
+ * @param desired Pointer to store the requested state, or NULL
+ * @param applied Pointer to store the applied state, or NULL
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or the applied state is not known
+ */
+int get_channel_state(charger_state_t *desired, charger_state_t *applied);
+
+/**
+ * @brief Forget the applied state of the charger
+ *
+ * The next set_channel_state() sends the whole state again, for example
+ * after the charger was reset or commands were sent around the table.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized
+ */
+int invalidate_channel_state(void);
+
 /**
  * @brief Get the next command from the active pool
  *
  * This function retrieves the next command from the active pool and moves the entry
  * back to the unused pool. It is intended to be called by a consumer thread.
+ * Pending emergency commands are returned first, in the order they were added,
+ * followed by routine commands in FIFO order.
  *
  * @param cmd Pointer to store the retrieved command
  * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE otherwise
  */
 int get_next_command(device_command_t *cmd);
 
+/**
+ * @brief Get the next command, blocking until one arrives
+ *
+ * This function behaves like get_next_command() but sleeps on a condition
+ * variable while the active pool is empty, so the consumer thread wakes up as
+ * soon as a command is added and uses no CPU while idle. Producers only
+ * signal when a thread is actually waiting. Waiting threads are released with
+ * EXIT_FAILURE when the module is deinitialized.
+ *
+ * @param cmd Pointer to store the retrieved command
+ * @param timeout_ns Relative timeout in nanoseconds, 0 to poll, or WAIT_FOREVER
+ * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE on failure or timeout
+ */
+int get_next_command_wait(device_command_t *cmd, int64_t timeout_ns);
+
+/**
+ * @brief Get up to max commands from the active pool in FIFO order
+ *
+ * This function retrieves a contiguous run of the oldest active commands and
+ * returns their entries to the unused pool, taking the pool lock only once.
+ * It is intended to be called by a consumer thread.
+ *
+ * @param out Array to store the retrieved commands
+ * @param max Maximum number of commands to retrieve
+ * @return Number of commands retrieved, 0 if none was available or on error
+ */
+size_t get_next_commands(device_command_t *out, size_t max);
+
 /**
  * @brief Get the number of active commands in the pool
  *
  * This function returns the current number of commands in the active pool.
- * It is thread-safe.
+ * It is thread-safe, lock-free and O(1).
  *
  * @return The number of active commands
  */
@@ -147,10 +967,571 @@ int get_active_command_count(void);
  * @brief Get the number of unused command slots in the pool
  *
  * This function returns the current number of unused command slots.
- * It is thread-safe.
+ * It is thread-safe, lock-free and O(1).
  *
  * @return The number of unused command slots
  */
 int get_unused_command_count(void);
 
+/**
+ * @brief Get a consistent snapshot of the active and unused counts
+ *
+ * Both numbers are read from the same instant, so they can be compared with
+ * each other without racing producers and the consumer. The function is
+ * lock-free and O(1).
+ *
+ * @param counts Pointer to store the snapshot
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_command_counts(command_counts_t *counts);
+
+/**
+ * @brief Encode a command into its wire frame
+ *
+ * @param cmd Pointer to the command to encode
+ * @param seq Sequence number to put into the frame
+ * @param buf Buffer of at least FRAME_MAX_SIZE bytes to store the frame
+ * @return Number of bytes written to buf, 0 if the command type is unknown
+ */
+size_t encode_frame(const device_command_t *cmd, uint8_t seq, uint8_t *buf);
+
+/**
+ * @brief Get the statistics of the transmit engine
+ *
+ * The counters are maintained by the writer thread and can be read at any
+ * time without blocking it.
+ *
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_tx_stats(tx_stats_t *stats);
+
+/**
+ * @brief Get the measured add-to-dequeue latency of emergency commands
+ *
+ * The latency is measured from add() to the moment the command leaves the
+ * emergency lane, through get_next_command() or the transmit engine.
+ *
+ * @param latency Pointer to store the latency figures
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_emergency_latency(emergency_latency_t *latency);
+
+/**
+ * @brief Get the next decoded receive event
+ *
+ * Events are queued in arrival order when no rx_callback is set. The
+ * function is lock-free and never blocks.
+ *
+ * @param event Pointer to store the event
+ * @return EXIT_SUCCESS if an event was retrieved, EXIT_FAILURE if none is pending or on error
+ */
+int get_rx_event(rx_event_t *event);
+
+/**
+ * @brief Feed received bytes to the parser
+ *
+ * This function lets applications that read the port themselves, and
+ * tests, use the receive path without the receiver thread. The bytes may
+ * split frames at any position.
+ *
+ * @param data Received bytes
+ * @param len Number of bytes
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int rx_feed(const uint8_t *data, size_t len);
+
+/**
+ * @brief Get the statistics of the receive path
+ *
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_rx_stats(rx_stats_t *stats);
+
+/**
+ * @brief Get the statistics of the acknowledgement window
+ *
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_ack_stats(ack_stats_t *stats);
+
+/**
+ * @brief Get the statistics of the command pool
+ *
+ * The high-water mark helps sizing pool_capacity: it is the largest number
+ * of commands that were waiting at the same time.
+ *
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_pool_stats(pool_stats_t *stats);
+
+/**
+ * @brief Get the line settings the driver applied to the serial port
+ *
+ * The settings are read back from the driver after the port is configured,
+ * so a rate the driver rounded or a low-latency flag it ignored shows up
+ * here. They are refreshed by reconnect().
+ *
+ * @param info Pointer to store the settings
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_line_info(serial_line_info_t *info);
+
+/**
+ * @brief Get the real-time settings the module was granted
+ *
+ * Reports, for the tx_thread and lock_memory options, whether the system
+ * granted each request and the CPU, priority and locked memory in effect.
+ *
+ * @param info Pointer to store the settings
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int get_rt_info(serial_rt_info_t *info);
+
+/**
+ * @brief Get the counters and latency histograms of the module
+ *
+ * Unlike the other statistics, this function also works while the module is
+ * not initialized, so rejections of that kind can be observed.
+ *
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on NULL pointer
+ */
+int get_stats(serial_stats_t *stats);
+
+/**
+ * @brief Get the exclusive upper bound of a histogram bucket
+ *
+ * Bucket i holds the values from the limit of bucket i - 1, or 0, up to but
+ * not including the limit of bucket i.
+ *
+ * @param index Bucket index (0 to HISTOGRAM_BUCKETS - 1)
+ * @return Upper bound in nanoseconds, UINT64_MAX for the last bucket or an invalid index
+ */
+uint64_t serial_histogram_bucket_limit(size_t index);
+
+/**
+ * @brief Format statistics in the Prometheus text exposition format
+ *
+ * Writes every counter, the active command gauge and both histograms. The
+ * histograms report a cumulative bucket per power of two of nanoseconds,
+ * expressed in seconds. Like snprintf(), the output is truncated to fit buf
+ * and always terminated when size is not 0.
+ *
+ * @param stats Statistics to format
+ * @param labels Labels added to every sample, such as port="ttyS0", or NULL
+ * @param buf Buffer for the text
+ * @param size Size of buf in bytes
+ * @return Length of the full text, not counting the terminator, or -1 on error
+ */
+int serial_format_prometheus(const serial_stats_t *stats, const char *labels, char *buf, size_t size);
+
+/**
+ * @brief Reopen the serial port without touching the command pools
+ *
+ * This function opens the port again under the name and speed given to
+ * init(), applies the terminal settings and puts the new descriptor in place
+ * of the old one. Queued and deferred commands, the acknowledgement window
+ * and the statistics are kept, and the transmitter, receiver and reactor
+ * carry on with the new port.
+ *
+ * When a write, read or hang-up shows that the port has failed, the
+ * transmitter and the reactor stop taking commands out of the active pool
+ * until the port is reopened, so the backlog waits in the pool. The burst
+ * that was being written when the port failed is written again in full on
+ * the new port, so its commands may reach the device twice. With the
+ * auto_reconnect option set, a background thread calls this function with
+ * an exponential backoff between reconnect_min_ms and reconnect_max_ms.
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the port could not be
+ *         reopened; the old descriptor stays in place in that case
+ */
+int reconnect(void);
+
+/**
+ * @brief Create and initialize a serial port instance
+ *
+ * This function behaves like init_with_options() but returns a new instance
+ * instead of initializing the default one. Any number of instances may be
+ * open at the same time, each on its own port. The log sink is shared by the
+ * whole process and selected by the first instance opened.
+ *
+ * @param port Serial port name (max 30 characters)
+ * @param speed Communication speed (use B9600, B115200, etc. from termios.h)
+ * @param opts Pointer to the options, or NULL for defaults
+ * @return Handle of the new instance, or NULL on failure
+ */
+serial_ctx_t *serial_init(const char *port, int speed, const serial_options_t *opts);
+
+/**
+ * @brief Deinitialize and free a serial port instance
+ *
+ * Threads blocked on the instance are released with EXIT_FAILURE, and the
+ * function returns once they have all left. The handle is invalid afterwards.
+ *
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int serial_deinit(serial_ctx_t *ctx);
+
+/**
+ * @brief Reopen the serial port of an instance
+ *
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * @see reconnect()
+ */
+int serial_reconnect(serial_ctx_t *ctx);
+
+/**
+ * @brief Add a command to the active pool of an instance
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the command structure to add
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * @see add()
+ */
+int serial_add(serial_ctx_t *ctx, const device_command_t *cmd);
+
+/**
+ * @brief Add a command to an instance, blocking while its pool is full
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the command structure to add
+ * @param timeout_ns Relative timeout in nanoseconds, 0 to fail at once if full, or WAIT_FOREVER
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure or timeout
+ * @see add_wait()
+ */
+int serial_add_wait(serial_ctx_t *ctx, const device_command_t *cmd, int64_t timeout_ns);
+
+/**
+ * @brief Add a batch of commands to the active pool of an instance
+ *
+ * @param ctx Instance handle
+ * @param cmds Array of commands to add
+ * @param n Number of commands in the array
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * @see add_batch()
+ */
+int serial_add_batch(serial_ctx_t *ctx, const device_command_t *cmds, size_t n);
+
+/**
+ * @brief Add a batch of validated commands to the active pool of an instance
+ *
+ * @param ctx Instance handle
+ * @param cmds Array of validated commands to add
+ * @param n Number of commands in the array
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * @see add_prevalidated()
+ */
+int serial_add_prevalidated(serial_ctx_t *ctx, const device_command_t *cmds, size_t n);
+
+/**
+ * @brief Add a command to the active pool of an instance once a deadline has passed
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the command structure to add
+ * @param deadline_ns Absolute CLOCK_MONOTONIC time in nanoseconds
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * @see add_at()
+ */
+int serial_add_at(serial_ctx_t *ctx, const device_command_t *cmd, uint64_t deadline_ns);
+
+/**
+ * @brief Bring the charger of an instance into a state, sending only what changed
+ *
+ * @param ctx Instance handle
+ * @param state Pointer to the requested state
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * @see set_channel_state()
+ */
+int serial_set_channel_state(serial_ctx_t *ctx, const charger_state_t *state);
+
+/**
+ * @brief Get the requested and the applied charger state of an instance
+ *
+ * @param ctx Instance handle
+ * @param desired Pointer to store the requested state, or NULL
+ * @param applied Pointer to store the applied state, or NULL
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ * @see get_channel_state()
+ */
+int serial_get_channel_state(serial_ctx_t *ctx, charger_state_t *desired, charger_state_t *applied);
+
+/**
+ * @brief Forget the applied charger state of an instance
+ *
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized
+ * @see invalidate_channel_state()
+ */
+int serial_invalidate_channel_state(serial_ctx_t *ctx);
+
+/**
+ * @brief Get the next command from the active pool of an instance
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to store the retrieved command
+ * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE otherwise
+ * @see get_next_command()
+ */
+int serial_get_next_command(serial_ctx_t *ctx, device_command_t *cmd);
+
+/**
+ * @brief Get the next command of an instance, blocking until one arrives
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to store the retrieved command
+ * @param timeout_ns Relative timeout in nanoseconds, 0 to poll, or WAIT_FOREVER
+ * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE on failure or timeout
+ * @see get_next_command_wait()
+ */
+int serial_get_next_command_wait(serial_ctx_t *ctx, device_command_t *cmd, int64_t timeout_ns);
+
+/**
+ * @brief Get up to max commands from the active pool of an instance
+ *
+ * @param ctx Instance handle
+ * @param out Array to store the retrieved commands
+ * @param max Maximum number of commands to retrieve
+ * @return Number of commands retrieved, 0 if none was available or on error
+ * @see get_next_commands()
+ */
+size_t serial_get_next_commands(serial_ctx_t *ctx, device_command_t *out, size_t max);
+
+/**
+ * @brief Get the number of active commands of an instance
+ *
+ * @param ctx Instance handle
+ * @return The number of active commands, 0 for a NULL handle
+ */
+int serial_get_active_command_count(serial_ctx_t *ctx);
+
+/**
+ * @brief Get the number of unused command slots of an instance
+ *
+ * @param ctx Instance handle
+ * @return The number of unused command slots, 0 for a NULL handle
+ */
+int serial_get_unused_command_count(serial_ctx_t *ctx);
+
+/**
+ * @brief Get a consistent snapshot of the counts of an instance
+ *
+ * @param ctx Instance handle
+ * @param counts Pointer to store the snapshot
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ * @see get_command_counts()
+ */
+int serial_get_command_counts(serial_ctx_t *ctx, command_counts_t *counts);
+
+/**
+ * @brief Get the statistics of the transmit engine of an instance
+ *
+ * @param ctx Instance handle
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int serial_get_tx_stats(serial_ctx_t *ctx, tx_stats_t *stats);
+
+/**
+ * @brief Get the emergency command latency of an instance
+ *
+ * @param ctx Instance handle
+ * @param latency Pointer to store the latency figures
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int serial_get_emergency_latency(serial_ctx_t *ctx, emergency_latency_t *latency);
+
+/**
+ * @brief Get the statistics of the command pool of an instance
+ *
+ * @param ctx Instance handle
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int serial_get_pool_stats(serial_ctx_t *ctx, pool_stats_t *stats);
+
+/**
+ * @brief Get the line settings the driver applied to the serial port of an instance
+ *
+ * @param ctx Instance handle
+ * @param info Pointer to store the settings
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ * @see get_line_info()
+ */
+int serial_get_line_info(serial_ctx_t *ctx, serial_line_info_t *info);
+
+/**
+ * @brief Get the real-time settings an instance was granted
+ *
+ * @param ctx Instance handle
+ * @param info Pointer to store the settings
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ * @see get_rt_info()
+ */
+int serial_get_rt_info(serial_ctx_t *ctx, serial_rt_info_t *info);
+
+/**
+ * @brief Get the counters and latency histograms of an instance
+ *
+ * @param ctx Instance handle
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on NULL pointer
+ * @see get_stats()
+ */
+int serial_get_stats(serial_ctx_t *ctx, serial_stats_t *stats);
+
+/**
+ * @brief Get the next decoded receive event of an instance
+ *
+ * @param ctx Instance handle
+ * @param event Pointer to store the event
+ * @return EXIT_SUCCESS if an event was retrieved, EXIT_FAILURE if none is pending or on error
+ * @see get_rx_event()
+ */
+int serial_get_rx_event(serial_ctx_t *ctx, rx_event_t *event);
+
+/**
+ * @brief Feed received bytes to the parser of an instance
+ *
+ * @param ctx Instance handle
+ * @param data Received bytes
+ * @param len Number of bytes
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ * @see rx_feed()
+ */
+int serial_rx_feed(serial_ctx_t *ctx, const uint8_t *data, size_t len);
+
+/**
+ * @brief Get the statistics of the receive path of an instance
+ *
+ * @param ctx Instance handle
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int serial_get_rx_stats(serial_ctx_t *ctx, rx_stats_t *stats);
+
+/**
+ * @brief Get the statistics of the acknowledgement window of an instance
+ *
+ * @param ctx Instance handle
+ * @param stats Pointer to store the statistics
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ * @see get_ack_stats()
+ */
+int serial_get_ack_stats(serial_ctx_t *ctx, ack_stats_t *stats);
+
+/**
+ * @brief Create an I/O reactor and start its event-loop thread
+ *
+ * A reactor replaces the per-instance transmit engine when many chargers are
+ * driven from one process: a single thread waits on epoll for all attached
+ * instances, drains each active pool when commands arrive and writes the
+ * encoded frames with non-blocking writes. A port whose output buffer is full
+ * is resumed on EPOLLOUT without delaying the other ports.
+ *
+ * @return Handle of the new reactor, or NULL on failure
+ */
+serial_reactor_t *serial_reactor_create(void);
+
+/**
+ * @brief Create an I/O reactor with the given placement and scheduling of its thread
+ *
+ * As serial_reactor_create(), then pins the event-loop thread and switches
+ * it to SCHED_FIFO as requested. A refused setting does not make the call
+ * fail; serial_reactor_get_thread_info() reports what was granted.
+ *
+ * @param opts Placement and scheduling of the event-loop thread, or NULL to leave them alone
+ * @return Handle of the new reactor, or NULL on failure or invalid options
+ */
+serial_reactor_t *serial_reactor_create_with_options(const serial_thread_options_t *opts);
+
+/**
+ * @brief Get the placement and scheduling the event-loop thread of a reactor was granted
+ *
+ * @param reactor Reactor handle
+ * @param info Pointer to store the settings
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on NULL pointer
+ */
+int serial_reactor_get_thread_info(serial_reactor_t *reactor, serial_thread_info_t *info);
+
+/**
+ * @brief Attach an instance to a reactor
+ *
+ * The serial port of the instance is switched to O_NONBLOCK and the reactor
+ * starts transmitting its commands, including those already queued. The
+ * instance must not use the transmitter option, and the application must not
+ * call the get_next_command() family on it while it is attached.
+ * get_tx_stats() reports the reactor's counters for the instance.
+ *
+ * @param reactor Reactor handle
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int serial_reactor_add(serial_reactor_t *reactor, serial_ctx_t *ctx);
+
+/**
+ * @brief Detach an instance from its reactor
+ *
+ * A partially written frame burst is completed before returning, and the port
+ * is returned to its original file status flags. Deinitializing an attached
+ * instance detaches it automatically.
+ *
+ * @param reactor Reactor handle
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the instance is not attached to reactor
+ */
+int serial_reactor_remove(serial_reactor_t *reactor, serial_ctx_t *ctx);
+
+/**
+ * @brief Stop a reactor, detach its remaining instances and free it
+ *
+ * @param reactor Reactor handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE for a NULL handle
+ */
+int serial_reactor_destroy(serial_reactor_t *reactor);
+
+/**
+ * @brief Attach to the shared-memory ingress ring of an instance
+ *
+ * An instance initialized with the shm_name option creates a POSIX
+ * shared-memory region holding a process-shared lock-free ring. Other
+ * processes of the same user attach to it by name and enqueue commands
+ * directly into it, without a round trip through the owning process. A
+ * thread of the owner validates the queued commands and moves them into its
+ * active pool; it sleeps on a process-shared semaphore that producers only
+ * post to when it is idle.
+ *
+ * If the owner is deinitialized, the handle stops accepting commands and
+ * the producer must attach again to the new region.
+ *
+ * @param name Name the owner was initialized with
+ * @return Handle on success, NULL if there is no usable region of that name
+ */
+serial_shm_t *serial_shm_attach(const char *name);
+
+/**
+ * @brief Queue a command in a shared-memory ingress ring
+ *
+ * The command is validated here and again by the owner. The function never
+ * blocks and is thread-safe.
+ *
+ * @param shm Handle returned by serial_shm_attach()
+ * @param cmd Pointer to the command structure to add
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the command is invalid,
+ *         the ring is full or the owner has gone away
+ */
+int serial_shm_add(serial_shm_t *shm, const device_command_t *cmd);
+
+/**
+ * @brief Detach from a shared-memory ingress ring and free the handle
+ *
+ * @param shm Handle returned by serial_shm_attach(), or NULL
+ */
+void serial_shm_detach(serial_shm_t *shm);
+
 #endif /* SERIAL_H_ */
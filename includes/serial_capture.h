@@ -0,0 +1,143 @@
+/**
+ * @file serial_capture.h
+ * @brief Binary capture of the accepted commands for forensics and replay
+ *
+ * This header file defines an append-only file format holding every command
+ * accepted into the active pool, with the time it was accepted. The file is
+ * a capture_file_header_t followed by fixed-size capture_record_t records,
+ * so it can be mapped and scanned without any parsing.
+ *
+ * A capture is started with the capture_path option of init_with_options().
+ * The file is sized for capture_capacity records up front and mapped, and
+ * recording a command is an atomic increment and a 16-byte store into the
+ * mapping, without a lock or a system call. Commands accepted once the file
+ * is full are counted as dropped. When the instance is deinitialized the
+ * file is truncated to the records it holds.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#ifndef SERIAL_CAPTURE_H_
+#define SERIAL_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "serial.h"
+
+/** @brief Magic bytes at the start of a capture file */
+#define SERIAL_CAPTURE_MAGIC "SRLCMDLG"
+
+/** @brief Version of the capture file format */
+#define SERIAL_CAPTURE_VERSION 1
+
+/**
+ * @brief Header of a capture file
+ *
+ * Every field is in host byte order.
+ */
+typedef struct {
+    /** @brief SERIAL_CAPTURE_MAGIC, not terminated */
+    char magic[8];
+    /** @brief SERIAL_CAPTURE_VERSION */
+    uint32_t version;
+    /** @brief Size of one record in bytes */
+    uint32_t record_size;
+    /** @brief Number of records the file was sized for */
+    uint64_t capacity;
+    /** @brief Number of records, written when the capture is stopped, 0 while it runs */
+    uint64_t count;
+    /** @brief Number of commands not recorded because the file was full */
+    uint64_t dropped;
+    /** @brief CLOCK_REALTIME time at which the capture started, in nanoseconds */
+    uint64_t start_realtime_ns;
+} capture_file_header_t;
+
+/**
+ * @brief Record of one accepted command
+ */
+typedef struct {
+    /** @brief Time since the start of the capture in nanoseconds */
+    uint64_t timestamp_ns;
+    /** @brief Accepted command */
+    device_command_t cmd;
+    /** @brief Index of the record plus one, stored last once the record is complete */
+    uint32_t sequence;
+} capture_record_t;
+
+/**
+ * @brief Capture file mapped for reading
+ */
+typedef struct {
+    /** @brief Header of the file */
+    const capture_file_header_t *header;
+    /** @brief Complete records, in the order they were claimed */
+    const capture_record_t *records;
+    /** @brief Number of complete records */
+    size_t count;
+    /** @brief Start of the mapping */
+    void *mapping;
+    /** @brief Size of the mapping in bytes */
+    size_t size;
+} capture_file_t;
+
+/** @brief Capture being recorded */
+typedef struct serial_capture serial_capture_t;
+
+/**
+ * @brief Create a capture file and map it for recording
+ *
+ * An existing file at path is replaced.
+ *
+ * @param path Path of the capture file
+ * @param capacity Number of records to size the file for (1-CAPTURE_MAX_CAPACITY)
+ * @return Handle of the capture, or NULL on failure
+ */
+serial_capture_t *serial_capture_start(const char *path, size_t capacity);
+
+/**
+ * @brief Record accepted commands
+ *
+ * Thread-safe and lock-free. The commands of one call are stored as
+ * consecutive records with the same timestamp. Callers take the timestamp
+ * before claiming their records, so the records of concurrent callers are
+ * not necessarily in timestamp order.
+ *
+ * @param capture Handle of the capture
+ * @param cmds Accepted commands
+ * @param n Number of commands
+ * @param now_ns CLOCK_MONOTONIC time at which the commands were accepted
+ */
+void serial_capture_record(serial_capture_t *capture, const device_command_t *cmds, size_t n,
+                           uint64_t now_ns);
+
+/**
+ * @brief Finish a capture file and free the handle
+ *
+ * No thread may record into the capture any more. The header gets the
+ * final count and the file is truncated to the records it holds.
+ *
+ * @param capture Handle of the capture, or NULL
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the file could not be finished
+ */
+int serial_capture_stop(serial_capture_t *capture);
+
+/**
+ * @brief Map a capture file for reading
+ *
+ * Works on files that are still being recorded or whose writer crashed as
+ * well: count stops at the first record that is not complete.
+ *
+ * @param path Path of the capture file
+ * @param file Structure to fill
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the file cannot be mapped or is not a capture
+ */
+int serial_capture_map(const char *path, capture_file_t *file);
+
+/**
+ * @brief Unmap a capture file mapped by serial_capture_map()
+ *
+ * @param file Mapped file
+ */
+void serial_capture_unmap(capture_file_t *file);
+
+#endif /* SERIAL_CAPTURE_H_ */
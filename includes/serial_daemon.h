@@ -0,0 +1,185 @@
+/**
+ * @file serial_daemon.h
+ * @brief Control protocol and configuration of the battery daemon
+ *
+ * This header file defines the messages exchanged with bin/battery over its
+ * Unix control socket, and the functions that read its configuration and
+ * carry out requests, which live apart from main.c so they can be tested.
+ * The socket is of type SOCK_SEQPACKET, so every request and every reply is
+ * one packet and needs no framing of its own.
+ * Each packet starts with a daemon_header_t, followed by a payload whose
+ * length is what remains of the packet. Multi-byte fields are in host byte
+ * order, since the socket never leaves the host.
+ *
+ * Requests and their replies:
+ * - DAEMON_MSG_SUBMIT: daemon_command_t records for one port; the reply has
+ *   no payload. A single command is added like add(), under the overflow
+ *   policy of the port; more commands are added like add_batch().
+ * - DAEMON_MSG_PORTS: no payload; the reply holds the NUL-terminated names
+ *   of the ports in the order of their indices.
+ * - DAEMON_MSG_STATS: no payload; the reply holds the serial_stats_t of the
+ *   port, as laid out by this version of serial.h.
+ * - DAEMON_MSG_METRICS: no payload; the reply holds the statistics of the
+ *   port in the Prometheus text format, labeled with the port name.
+ *
+ * Every reply echoes the type, port and id of its request, so a client may
+ * keep several requests in flight on one connection.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#ifndef SERIAL_DAEMON_H_
+#define SERIAL_DAEMON_H_
+
+#include <stdint.h>
+#include <sys/un.h>
+#include "serial.h"
+
+/** @brief Control socket used when the configuration names none */
+#define DAEMON_DEFAULT_SOCKET "/run/battery.sock"
+
+/** @brief Configuration file used when none is given on the command line */
+#define DAEMON_DEFAULT_CONFIG "/etc/battery.conf"
+
+/** @brief Maximum number of ports of one daemon */
+#define DAEMON_MAX_PORTS 64
+
+/** @brief Maximum number of commands in one DAEMON_MSG_SUBMIT */
+#define DAEMON_MAX_BATCH 1024
+
+/** @brief Longest name of a port */
+#define DAEMON_MAX_NAME 32
+
+/**
+ * @brief Message types of the control protocol
+ */
+typedef enum {
+    /** @brief Add a batch of commands to the active pool of a port */
+    DAEMON_MSG_SUBMIT = 1,
+    /** @brief List the names of the ports */
+    DAEMON_MSG_PORTS,
+    /** @brief Get the counters and latency histograms of a port */
+    DAEMON_MSG_STATS,
+    /** @brief Get the statistics of a port in the Prometheus text format */
+    DAEMON_MSG_METRICS
+} daemon_msg_t;
+
+/**
+ * @brief Status of a reply
+ */
+typedef enum {
+    /** @brief Request carried out */
+    DAEMON_OK = 0,
+    /** @brief Packet too short, payload of the wrong size or unknown type */
+    DAEMON_ERR_MALFORMED,
+    /** @brief No port with that index */
+    DAEMON_ERR_PORT,
+    /** @brief A command of the batch failed validation, nothing was added */
+    DAEMON_ERR_INVALID,
+    /** @brief The port did not accept a command, typically because its pool was full */
+    DAEMON_ERR_REJECTED
+} daemon_status_t;
+
+/**
+ * @brief Header of every request and reply
+ */
+typedef struct {
+    /** @brief Message type, see daemon_msg_t */
+    uint8_t type;
+    /** @brief Index of the port, in the order of the configuration */
+    uint8_t port;
+    /** @brief Status of a reply, see daemon_status_t; 0 in requests */
+    uint8_t status;
+    /** @brief Reserved, 0 */
+    uint8_t reserved;
+    /** @brief Chosen by the client and echoed in the reply */
+    uint32_t id;
+} daemon_header_t;
+
+/**
+ * @brief Command of a DAEMON_MSG_SUBMIT
+ *
+ * The arguments are the bytes of the data union of device_command_t, in
+ * order: min_level, max_level and max_time for CMD_SET_PARAMS, on_off and
+ * channel for CMD_ON_OFF and CMD_EMERGENCY.
+ */
+typedef struct {
+    /** @brief Command type (CMD_SET_PARAMS, CMD_ON_OFF, CMD_EMERGENCY) */
+    uint8_t command_type;
+    /** @brief Command arguments */
+    uint8_t args[3];
+} daemon_command_t;
+
+/** @brief Largest packet of the protocol: a submit of DAEMON_MAX_BATCH commands or a metrics reply */
+#define DAEMON_MAX_PACKET (sizeof(daemon_header_t) + 64 * 1024)
+
+/**
+ * @brief Port of the configuration
+ */
+typedef struct {
+    /** @brief Name used in the protocol and in metric labels */
+    char name[DAEMON_MAX_NAME + 1];
+    /** @brief Device of the serial port */
+    char device[MAX_PORT_NAME + 1];
+    /** @brief Line rate in bits per second */
+    uint32_t baud;
+    /** @brief Options of the instance */
+    serial_options_t opts;
+    /** @brief Instance, NULL until opened */
+    serial_ctx_t *ctx;
+} daemon_port_t;
+
+/**
+ * @brief Configuration of the daemon
+ */
+typedef struct {
+    /** @brief Path of the control socket */
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    /** @brief Placement and scheduling of the reactor thread */
+    serial_thread_options_t reactor;
+    /** @brief Configured ports */
+    daemon_port_t ports[DAEMON_MAX_PORTS];
+    /** @brief Number of configured ports */
+    size_t nports;
+} daemon_config_t;
+
+/**
+ * @brief Apply one key=value option of a port line
+ *
+ * The options are backend (tailq, ring), pool, growth (maximum capacity),
+ * coalesce, emergency_reserve, overflow (reject, drop_oldest, coalesce),
+ * profile (default, low_latency, throughput), reconnect and lock_memory.
+ * overflow=block is refused: the daemon serves every client from one
+ * thread, which a blocked add() would stall.
+ *
+ * @param opts Options of the port
+ * @param key Option name
+ * @param text Option value
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE for an unknown option or value
+ */
+int serial_daemon_parse_port_option(serial_options_t *opts, const char *key, const char *text);
+
+/**
+ * @brief Read the configuration file
+ *
+ * The configuration has one directive per line, see main.c; errors are
+ * reported on stderr with the line they were found on.
+ *
+ * @param path Path of the file
+ * @param cfg Configuration to fill
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the file cannot be read or is malformed
+ */
+int serial_daemon_parse_config(const char *path, daemon_config_t *cfg);
+
+/**
+ * @brief Carry out one request and build its reply
+ *
+ * @param cfg Configuration, with the instances of its ports open
+ * @param request Request packet
+ * @param len Length of the request packet
+ * @param reply Buffer for the reply packet, DAEMON_MAX_PACKET bytes
+ * @return Length of the reply packet
+ */
+size_t serial_daemon_handle_request(daemon_config_t *cfg, const uint8_t *request, size_t len, uint8_t *reply);
+
+#endif /* SERIAL_DAEMON_H_ */
@@ -0,0 +1,38 @@
+/**
+ * @file serial_line.h
+ * @brief Terminal and driver configuration of the serial port
+ *
+ * This header file defines the function that puts an open serial port into
+ * the raw mode used by the module and applies a line profile. It lives in a
+ * translation unit of its own because rates in bits per second need the
+ * Linux termios2 interface, whose headers cannot be combined with
+ * <termios.h>.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#ifndef SERIAL_LINE_H_
+#define SERIAL_LINE_H_
+
+#include <stdint.h>
+#include "serial.h"
+
+/**
+ * @brief Configure an open terminal and read back what the driver applied
+ *
+ * Sets raw mode, the rate and the VMIN/VTIME of the profile with a single
+ * TCSETS2, then sets or clears ASYNC_LOW_LATENCY with TIOCSSERIAL when the
+ * profile asks for it. A driver without TIOCSSERIAL is not an error; info
+ * reports low_latency as -1 then.
+ *
+ * @param fd Descriptor of the open terminal
+ * @param speed Rate as a B* constant from termios.h, used when baud_rate is 0
+ * @param baud_rate Rate in bits per second, or 0 to use speed
+ * @param profile Line profile to apply
+ * @param info Structure filled with the settings read back from the driver
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the terminal settings could not be applied
+ */
+int serial_line_configure(int fd, int speed, uint32_t baud_rate, serial_line_profile_t profile,
+                          serial_line_info_t *info);
+
+#endif /* SERIAL_LINE_H_ */
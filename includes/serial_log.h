@@ -0,0 +1,149 @@
+/**
+ * @file serial_log.h
+ * @brief Log sink for the serial communication module
+ *
+ * This header file defines the logging interface used by the serial module.
+ * Messages go through the SERIAL_LOG() macro, which drops messages above the
+ * compile-time SERIAL_LOG_LEVEL entirely, rate-limits each call site and
+ * hands the rest to the selected sink. The asynchronous sink copies messages
+ * into an in-memory ring that a background thread flushes to syslog, so
+ * logging never blocks the caller.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#ifndef SERIAL_LOG_H_
+#define SERIAL_LOG_H_
+
+#include <stdint.h>
+#include <syslog.h>
+
+/**
+ * @brief Most verbose syslog priority compiled into the module
+ *
+ * Messages with a less severe priority are removed at compile time. Release
+ * builds define it as LOG_WARNING so the LOG_INFO tracing of the hot path
+ * costs nothing.
+ */
+#ifndef SERIAL_LOG_LEVEL
+#define SERIAL_LOG_LEVEL LOG_DEBUG
+#endif
+
+/** @brief Maximum number of messages per call site and rate-limit window */
+#define SERIAL_LOG_RATE_BURST 20
+
+/** @brief Length of a rate-limit window in seconds */
+#define SERIAL_LOG_RATE_WINDOW 1
+
+/** @brief Number of messages the asynchronous ring can hold */
+#define SERIAL_LOG_RING_SIZE 256
+
+/** @brief Maximum length of a formatted message, including the terminator */
+#define SERIAL_LOG_MSG_MAX 160
+
+/**
+ * @brief Log sinks
+ */
+typedef enum {
+    /** @brief Write every message synchronously with syslog() (default) */
+    SERIAL_LOG_SINK_SYSLOG = 0,
+    /** @brief Queue messages in memory and flush them from a background thread */
+    SERIAL_LOG_SINK_ASYNC,
+    /** @brief Discard every message */
+    SERIAL_LOG_SINK_NONE
+} serial_log_sink_t;
+
+/**
+ * @brief Rate-limit state of one call site
+ *
+ * SERIAL_LOG() keeps one of these per call site, so each message type has
+ * its own budget of SERIAL_LOG_RATE_BURST messages per window.
+ */
+typedef struct {
+    /** @brief Start of the current window in seconds */
+    int64_t window;
+    /** @brief Number of messages seen in the current window */
+    uint32_t count;
+    /** @brief Number of messages suppressed in the previous windows */
+    uint32_t suppressed;
+} serial_log_ratelimit_t;
+
+/**
+ * @brief Log a message through the module's sink
+ *
+ * The priority must be a syslog priority. Messages less severe than
+ * SERIAL_LOG_LEVEL compile out; the others are subject to the runtime level,
+ * the sink and the per-call-site rate limit.
+ */
+#define SERIAL_LOG(priority, ...)                                          \
+    do {                                                                   \
+        if ((priority) <= SERIAL_LOG_LEVEL && serial_log_enabled(priority)) { \
+            static serial_log_ratelimit_t serial_log_ratelimit_;           \
+            if (serial_log_ratelimit(&serial_log_ratelimit_, (priority))) { \
+                serial_log_write((priority), __VA_ARGS__);                 \
+            }                                                              \
+        }                                                                  \
+    } while (0)
+
+/**
+ * @brief Open the log sink
+ *
+ * Opens syslog with the module's identity and, for SERIAL_LOG_SINK_ASYNC,
+ * starts the flusher thread. Calls are reference counted; only the first
+ * open selects the sink.
+ *
+ * @param sink Sink to use
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int serial_log_open(serial_log_sink_t sink);
+
+/**
+ * @brief Close the log sink
+ *
+ * The last close flushes pending asynchronous messages, stops the flusher
+ * thread and closes syslog. Messages logged afterwards go to syslog directly.
+ */
+void serial_log_close(void);
+
+/**
+ * @brief Set the runtime log threshold
+ *
+ * @param priority Most verbose syslog priority to log
+ */
+void serial_log_set_level(int priority);
+
+/**
+ * @brief Check whether a priority passes the runtime threshold and sink
+ *
+ * @param priority Syslog priority of the message
+ * @return Non-zero if the message would be logged
+ */
+int serial_log_enabled(int priority);
+
+/**
+ * @brief Apply the rate limit of a call site
+ *
+ * @param ratelimit Rate-limit state of the call site
+ * @param priority Syslog priority of the message
+ * @return Non-zero if the message may be logged
+ */
+int serial_log_ratelimit(serial_log_ratelimit_t *ratelimit, int priority);
+
+/**
+ * @brief Format and log a message
+ *
+ * Use SERIAL_LOG() instead of calling this function directly.
+ *
+ * @param priority Syslog priority of the message
+ * @param format printf-style format string
+ */
+void serial_log_write(int priority, const char *format, ...);
+
+/**
+ * @brief Get the number of messages dropped because the async ring was full
+ *
+ * @return Number of dropped messages
+ */
+uint64_t serial_log_dropped(void);
+
+#endif /* SERIAL_LOG_H_ */
@@ -0,0 +1,40 @@
+/**
+ * @file serial_sched.h
+ * @brief CPU placement and real-time scheduling of the module's threads
+ *
+ * This header file defines the functions that pin a thread of the module to
+ * a CPU and switch it to SCHED_FIFO. They live in a translation unit of
+ * their own because the affinity interface needs _GNU_SOURCE, which the rest
+ * of the module does not define.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#ifndef SERIAL_SCHED_H_
+#define SERIAL_SCHED_H_
+
+#include <pthread.h>
+#include "serial.h"
+
+/**
+ * @brief Check thread options against the CPU and priority ranges of the system
+ *
+ * @param opts Requested placement and scheduling
+ * @return 1 if the options are valid, 0 otherwise
+ */
+int serial_sched_valid(const serial_thread_options_t *opts);
+
+/**
+ * @brief Apply placement and scheduling to a running thread and read back what it got
+ *
+ * A setting the system refuses, typically for lack of CAP_SYS_NICE or a CPU
+ * outside the cpuset of the process, is logged and reported in info but is
+ * not an error; the thread keeps running with what it had.
+ *
+ * @param thread Thread to configure
+ * @param opts Requested placement and scheduling
+ * @param info Structure filled with the outcome and the settings in effect
+ */
+void serial_sched_apply(pthread_t thread, const serial_thread_options_t *opts, serial_thread_info_t *info);
+
+#endif /* SERIAL_SCHED_H_ */
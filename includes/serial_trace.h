@@ -0,0 +1,183 @@
+/**
+ * @file serial_trace.h
+ * @brief Hot-path event tracing for the serial communication module
+ *
+ * This header file defines trace points that follow individual commands
+ * through the module: add, dequeue, frame encoding, write() and
+ * acknowledgement. Each thread records timestamped binary events into its own
+ * ring, so tracing needs no lock and can stay on in production. After an
+ * incident the rings are dumped to a file with serial_trace_dump().
+ *
+ * Tracing is compiled in unless SERIAL_TRACE_ENABLED is defined as 0, and is
+ * off at runtime until serial_trace_enable() is called. While it is off, a
+ * trace point costs a single load and a predictable branch.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#ifndef SERIAL_TRACE_H_
+#define SERIAL_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Whether the trace points are compiled into the module
+ *
+ * Define as 0 to remove every trace point at compile time.
+ */
+#ifndef SERIAL_TRACE_ENABLED
+#define SERIAL_TRACE_ENABLED 1
+#endif
+
+/** @brief Number of events each per-thread ring keeps, the oldest are overwritten */
+#ifndef SERIAL_TRACE_RING_SIZE
+#define SERIAL_TRACE_RING_SIZE 1024
+#endif
+
+/** @brief Maximum number of threads that can record events at the same time */
+#define SERIAL_TRACE_MAX_THREADS 32
+
+/** @brief Magic bytes at the start of a trace dump */
+#define SERIAL_TRACE_MAGIC "SRLTRACE"
+
+/** @brief Version of the trace dump format */
+#define SERIAL_TRACE_VERSION 1
+
+/**
+ * @brief Trace points
+ */
+typedef enum {
+    /** @brief Command accepted into the active pool, arg is the command key */
+    TRACE_ADD = 1,
+    /** @brief Command taken out of the active pool, arg is the command key */
+    TRACE_DEQUEUE,
+    /** @brief Command encoded into a frame, arg is the sequence number << 16 | command key */
+    TRACE_ENCODE,
+    /** @brief write() call on the serial port returned, arg is the number of bytes or UINT32_MAX on error */
+    TRACE_WRITE,
+    /** @brief Frame acknowledged by the device, arg is its sequence number */
+    TRACE_ACK,
+    /** @brief Frame queued for retransmission, arg is its sequence number */
+    TRACE_RETRANSMIT
+} trace_point_t;
+
+/**
+ * @brief Key identifying a command in trace events
+ *
+ * The command type in bits 8-15 and, for commands with one, the channel in
+ * bits 0-7.
+ */
+#define TRACE_COMMAND_KEY(type, channel) ((uint32_t)(((type) & 0xff) << 8 | ((channel) & 0xff)))
+
+/**
+ * @brief Recorded trace event, as stored in a dump
+ */
+typedef struct {
+    /** @brief Monotonic time of the event in nanoseconds */
+    uint64_t timestamp_ns;
+    /** @brief Argument of the trace point */
+    uint32_t arg;
+    /** @brief Trace point (trace_point_t) */
+    uint16_t point;
+    /** @brief Index of the per-thread ring that recorded the event */
+    uint16_t thread;
+} trace_event_t;
+
+/**
+ * @brief Header of a trace dump, followed by count events in time order
+ *
+ * Every field is in host byte order.
+ */
+typedef struct {
+    /** @brief SERIAL_TRACE_MAGIC, not terminated */
+    char magic[8];
+    /** @brief SERIAL_TRACE_VERSION */
+    uint32_t version;
+    /** @brief Size of one event in bytes */
+    uint32_t event_size;
+    /** @brief Number of events following the header */
+    uint64_t count;
+    /** @brief Number of events lost because every ring was taken */
+    uint64_t dropped;
+} trace_file_header_t;
+
+/** @brief Runtime switch read by every trace point, use serial_trace_enable() */
+extern int serial_trace_on;
+
+#if SERIAL_TRACE_ENABLED
+/**
+ * @brief Record an event if tracing is enabled
+ *
+ * @param point Trace point (trace_point_t)
+ * @param arg Argument of the trace point
+ */
+#define SERIAL_TRACE(point, arg)                                      \
+    do {                                                              \
+        if (__builtin_expect(SERIAL_TRACE_ACTIVE(), 0)) {             \
+            serial_trace_record((point), (arg));                      \
+        }                                                             \
+    } while (0)
+
+/** @brief Check whether tracing is enabled, to guard the preparation of several events */
+#define SERIAL_TRACE_ACTIVE() __atomic_load_n(&serial_trace_on, __ATOMIC_RELAXED)
+#else
+#define SERIAL_TRACE(point, arg) do { } while (0)
+#define SERIAL_TRACE_ACTIVE() 0
+#endif
+
+/**
+ * @brief Turn tracing on or off at runtime
+ *
+ * @param on Non-zero to record events
+ */
+void serial_trace_enable(int on);
+
+/**
+ * @brief Record an event in the ring of the calling thread
+ *
+ * Use SERIAL_TRACE() instead of calling this function directly. The first
+ * event of a thread claims a ring, which the thread keeps until it exits.
+ * The ring then goes back to a free list with its events, which stay
+ * readable until another thread claims the ring.
+ *
+ * @param point Trace point (trace_point_t)
+ * @param arg Argument of the trace point
+ */
+void serial_trace_record(trace_point_t point, uint32_t arg);
+
+/**
+ * @brief Copy the recorded events in time order
+ *
+ * Events recorded concurrently with the copy may be missing from it.
+ *
+ * @param out Array to store the events
+ * @param max Capacity of out
+ * @return Number of events stored in out
+ */
+size_t serial_trace_snapshot(trace_event_t *out, size_t max);
+
+/**
+ * @brief Write the recorded events to a file
+ *
+ * The file starts with a trace_file_header_t followed by the events in time
+ * order.
+ *
+ * @param path Path of the file to create or truncate
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+int serial_trace_dump(const char *path);
+
+/**
+ * @brief Forget every recorded event
+ */
+void serial_trace_clear(void);
+
+/**
+ * @brief Get the number of events lost because every ring was taken
+ *
+ * @return Number of dropped events
+ */
+uint64_t serial_trace_dropped(void);
+
+#endif /* SERIAL_TRACE_H_ */
@@ -0,0 +1,55 @@
+# Build profiles shared by the top-level, test and bench Makefiles
+#
+#   PROFILE=debug    no optimization, every log level compiled in (default)
+#   PROFILE=release  -O3 -march=$(MARCH) with LTO, log calls below LOG_LEVEL compiled out
+#   PROFILE=pgo-gen  release build instrumented to record a training profile
+#   PROFILE=pgo-use  release build optimized with the recorded profile
+#
+# Every profile but debug builds into a directory of its own under bin/, so
+# the test and bench binaries of two profiles can be compared side by side.
+# The two PGO profiles share bin/pgo, where the training data is written next
+# to the objects it belongs to. `make pgo` runs the whole PGO flow.
+
+# DEBUG=n from before the profiles existed selects the release profile
+ifeq ($(DEBUG),n)
+PROFILE ?= release
+endif
+PROFILE ?= debug
+
+# Target of the release profiles; use e.g. MARCH=x86-64-v3 for a portable binary
+MARCH ?= native
+
+# Link-time optimization of the release profiles (y/n)
+LTO ?= y
+
+# Most verbose syslog priority compiled in, see serial_log.h
+ifneq ($(PROFILE),debug)
+LOG_LEVEL ?= LOG_WARNING
+endif
+
+PROFILE_CFLAGS = -g
+ifdef LOG_LEVEL
+PROFILE_CFLAGS += -DSERIAL_LOG_LEVEL=$(LOG_LEVEL)
+endif
+
+ifeq ($(PROFILE),debug)
+PROFILE_DIR =
+else
+PROFILE_CFLAGS += -O3 -march=$(MARCH)
+ifeq ($(LTO),y)
+PROFILE_CFLAGS += -flto=auto
+endif
+ifeq ($(PROFILE),release)
+PROFILE_DIR = /release
+else ifeq ($(PROFILE),pgo-gen)
+PROFILE_DIR = /pgo
+# The module is multi-threaded; racy counter updates would skew the profile
+PROFILE_CFLAGS += -fprofile-generate -fprofile-update=atomic
+else ifeq ($(PROFILE),pgo-use)
+PROFILE_DIR = /pgo
+# Code the training never reached is optimized as usual rather than for size
+PROFILE_CFLAGS += -fprofile-use -fprofile-partial-training -Wno-missing-profile
+else
+$(error Unknown PROFILE=$(PROFILE), use debug, release, pgo-gen or pgo-use)
+endif
+endif
@@ -2,17 +2,356 @@
  * @file main.c
  * @brief Main entry point for the multi-channel battery charger application
  *
- * This file contains the main function for the battery charger application.
+ * This file implements bin/battery, a service that drives every charger of a
+ * host from one process. It reads a configuration listing the ports, opens an
+ * instance of the serial module per port, attaches all of them to a single
+ * reactor and accepts commands and statistics requests on a Unix control
+ * socket, see serial_daemon.h for the protocol. The service stays in the
+ * foreground and logs to stderr, as service managers expect.
+ *
+ * The configuration has one directive per line; # starts a comment:
+ *
+ *     socket /run/battery.sock
+ *     reactor cpu=2 priority=50
+ *     port charger0 /dev/ttyUSB0 115200 profile=low_latency reconnect=1
+ *     port charger1 /dev/ttyUSB1 250000 pool=256 overflow=drop_oldest
+ *
+ * The options of a port are backend (tailq, ring), pool, growth (maximum
+ * capacity), coalesce, emergency_reserve, overflow (reject, drop_oldest,
+ * coalesce), profile (default, low_latency, throughput), reconnect and
+ * lock_memory. overflow=block is not offered, since one blocked command
+ * would stall the control socket of every port. Port indices in the
+ * protocol follow the order of the port lines.
+ *
+ * Usage: battery [-c config]
  *
  * Created on: May 11, 2025
  * @author Zhanibekuly Darkhan
  */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "serial.h"
+#include "serial_daemon.h"
+
+/** @brief Maximum number of control connections served at the same time */
+#define DAEMON_MAX_CLIENTS 64
+
+/** @brief Backlog of the listening control socket */
+#define DAEMON_LISTEN_BACKLOG 16
+
+/** @brief Pipe written by the signal handler to wake the main loop */
+static int signal_pipe[2] = { -1, -1 };
+
+/** @brief Configuration of the running daemon */
+static daemon_config_t config;
+
+/** @brief Buffer of the request being served */
+static uint8_t request_buf[DAEMON_MAX_PACKET];
+
+/** @brief Buffer of the reply being sent */
+static uint8_t reply_buf[DAEMON_MAX_PACKET];
+
+/**
+ * @brief Wake the main loop on SIGINT and SIGTERM
+ *
+ * @param sig Signal number (unused)
+ */
+static void on_signal(int sig) {
+    int saved = errno;
+    ssize_t n = write(signal_pipe[1], "", 1);
+
+    (void)sig;
+    (void)n;
+    errno = saved;
+}
+
+/**
+ * @brief Get the termios speed constant of a rate
+ *
+ * Standard rates use their B* constant; the others are set in bits per
+ * second through the baud_rate option.
+ *
+ * @param baud Rate in bits per second
+ * @return B* constant, or 0 if the rate has none
+ */
+static int speed_constant(uint32_t baud) {
+    static const struct {
+        uint32_t baud;
+        int speed;
+    } speeds[] = {
+        { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 }, { 19200, B19200 },
+        { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 }
+    };
+
+    for (size_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+        if (speeds[i].baud == baud) {
+            return speeds[i].speed;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Open the instances of every configured port and attach them to a reactor
+ *
+ * @param cfg Configuration
+ * @param reactor Reactor to attach the instances to
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if a port could not be opened
+ */
+static int open_ports(daemon_config_t *cfg, serial_reactor_t *reactor) {
+    for (size_t i = 0; i < cfg->nports; i++) {
+        daemon_port_t *port = &cfg->ports[i];
+        int speed = speed_constant(port->baud);
+
+        if (speed == 0) {
+            port->opts.baud_rate = port->baud;
+            speed = B9600;
+        }
+        port->ctx = serial_init(port->device, speed, &port->opts);
+        if (port->ctx == NULL) {
+            fprintf(stderr, "battery: cannot open port %s on %s\n", port->name, port->device);
+            return EXIT_FAILURE;
+        }
+        if (serial_reactor_add(reactor, port->ctx) != EXIT_SUCCESS) {
+            fprintf(stderr, "battery: cannot attach port %s to the reactor\n", port->name);
+            return EXIT_FAILURE;
+        }
+
+        serial_rt_info_t rt;
+        serial_get_rt_info(port->ctx, &rt);
+        fprintf(stderr, "battery: port %zu %s on %s at %lu bit/s%s\n", i, port->name, port->device,
+                (unsigned long)port->baud,
+                rt.memory_locked == 0 ? ", memory lock refused" : rt.memory_locked == 1 ? ", memory locked" : "");
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Close every open instance of the configuration
+ *
+ * @param cfg Configuration
+ */
+static void close_ports(daemon_config_t *cfg) {
+    for (size_t i = 0; i < cfg->nports; i++) {
+        if (cfg->ports[i].ctx != NULL) {
+            serial_deinit(cfg->ports[i].ctx);
+            cfg->ports[i].ctx = NULL;
+        }
+    }
+}
+
+/**
+ * @brief Create the listening control socket
+ *
+ * A socket left behind by a previous run is replaced; any other file at the
+ * path is left alone and makes the call fail.
+ *
+ * @param path Path of the socket
+ * @return Descriptor of the socket, or -1 on failure
+ */
+static int open_control_socket(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "battery: cannot create control socket: %s\n", strerror(errno));
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, DAEMON_LISTEN_BACKLOG) != 0) {
+        fprintf(stderr, "battery: cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Serve the control socket until SIGINT or SIGTERM
+ *
+ * Clients are non-blocking; one that does not read its replies in time is
+ * disconnected rather than holding up the others.
+ *
+ * @param cfg Configuration
+ * @param listen_fd Listening control socket
+ */
+static void serve(daemon_config_t *cfg, int listen_fd) {
+    struct pollfd fds[2 + DAEMON_MAX_CLIENTS];
+    nfds_t nfds = 2;
+
+    fds[0].fd = signal_pipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = listen_fd;
+    fds[1].events = POLLIN;
+    for (;;) {
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "battery: poll failed: %s\n", strerror(errno));
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            break;
+        }
+
+        // Serve the clients, compacting the array over those that left
+        nfds_t kept = 2;
+        for (nfds_t i = 2; i < nfds; i++) {
+            int keep = 1;
+            if (fds[i].revents & POLLIN) {
+                ssize_t n = recv(fds[i].fd, request_buf, sizeof(request_buf), MSG_DONTWAIT);
+                if (n > 0) {
+                    size_t len = serial_daemon_handle_request(cfg, request_buf, (size_t)n, reply_buf);
+                    keep = send(fds[i].fd, reply_buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)len;
+                } else {
+                    keep = n < 0 && (errno == EAGAIN || errno == EINTR);
+                }
+            } else if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                keep = 0;
+            }
+            if (keep) {
+                fds[kept++] = fds[i];
+            } else {
+                close(fds[i].fd);
+            }
+        }
+        nfds = kept;
+
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0 && nfds == 2 + DAEMON_MAX_CLIENTS) {
+                fprintf(stderr, "battery: too many control connections\n");
+                close(fd);
+            } else if (fd >= 0) {
+                fcntl(fd, F_SETFD, FD_CLOEXEC);
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                fds[nfds].fd = fd;
+                fds[nfds].events = POLLIN;
+                fds[nfds].revents = 0;
+                nfds++;
+            }
+        }
+    }
+    for (nfds_t i = 2; i < nfds; i++) {
+        close(fds[i].fd);
+    }
+}
+
+/**
+ * @brief Install the handlers that stop the service
+ *
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+static int setup_signals(void) {
+    struct sigaction sa;
+
+    if (pipe(signal_pipe) != 0) {
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(signal_pipe[i], F_SETFL, fcntl(signal_pipe[i], F_GETFL) | O_NONBLOCK);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGINT, &sa, NULL) != 0 || sigaction(SIGTERM, &sa, NULL) != 0) {
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Print the command line usage
+ *
+ * @param prog Program name
+ */
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c config]\n"
+            "  -c  configuration file (default %s)\n",
+            prog, DAEMON_DEFAULT_CONFIG);
+}
 
 /**
  * @brief Main entry point
  *
+ * @param argc Number of arguments
+ * @param argv Arguments
  * @return Exit status of the application
  */
-int main() {
-    return 0;
+int main(int argc, char *argv[]) {
+    const char *config_path = DAEMON_DEFAULT_CONFIG;
+    int result = EXIT_FAILURE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                config_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (serial_daemon_parse_config(config_path, &config) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (setup_signals() != EXIT_SUCCESS) {
+        fprintf(stderr, "battery: cannot install signal handlers\n");
+        return EXIT_FAILURE;
+    }
+
+    serial_reactor_t *reactor = serial_reactor_create_with_options(&config.reactor);
+    if (reactor == NULL) {
+        fprintf(stderr, "battery: cannot start the reactor\n");
+        return EXIT_FAILURE;
+    }
+    serial_thread_info_t thread;
+    serial_reactor_get_thread_info(reactor, &thread);
+    if (thread.affinity == 0 || thread.sched_fifo == 0) {
+        fprintf(stderr, "battery: reactor thread settings refused, running on cpu %d at priority %d\n",
+                thread.cpu, thread.priority);
+    }
+
+    if (open_ports(&config, reactor) == EXIT_SUCCESS) {
+        int listen_fd = open_control_socket(config.socket_path);
+        if (listen_fd >= 0) {
+            fprintf(stderr, "battery: serving %zu ports on %s\n", config.nports, config.socket_path);
+            serve(&config, listen_fd);
+            close(listen_fd);
+            unlink(config.socket_path);
+            result = EXIT_SUCCESS;
+        }
+    }
+
+    serial_reactor_destroy(reactor);
+    close_ports(&config);
+    fprintf(stderr, "battery: stopped\n");
+    return result;
 }
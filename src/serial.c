@@ -9,407 +9,5635 @@
  * Created on: May 16, 2025
  * @author Zhanibekuly Darkhan
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include "serial.h"
+#include "serial_capture.h"
+#include "serial_line.h"
+#include "serial_log.h"
+#include "serial_sched.h"
+#include "serial_trace.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <fcntl.h>
-#include <termios.h>
 #include <unistd.h>
-#include <syslog.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** @brief Size of a cache line, used to align pool chunks */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief Start a structure member on its own cache line
+ *
+ * Marks the first member of each group of fields written by one side of the
+ * queue, so producers, consumers and the I/O threads do not false-share.
+ * SERIAL_COMPACT_LAYOUT drops the padding for memory-constrained builds.
+ */
+#ifdef SERIAL_COMPACT_LAYOUT
+#define CACHE_ALIGNED
+#else
+#define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
+#endif
+
+/**
+ * @brief Chunk of pool entries allocated in one piece
+ *
+ * The header occupies the first cache line of the allocation and the entries
+ * follow on the next one. Chunks are never moved or freed before deinit(),
+ * so entries in use stay valid while the pool grows.
+ */
+struct pool_chunk {
+    /** @brief Next chunk in the list */
+    struct pool_chunk *next;
+    /** @brief Number of entries in the chunk */
+    size_t count;
+};
+
+/** @brief Get the first entry of a pool chunk */
+#define CHUNK_ENTRIES(chunk) ((struct cmd_entry *)((char *)(chunk) + CACHE_LINE_SIZE))
+
+/** @brief Number of thread caches per instance */
+#define THREAD_CACHE_SLOTS 16
+
+/**
+ * @brief Free entries cached for the threads mapped to one slot
+ *
+ * The lock is normally only taken by one thread, it matters when more
+ * threads than slots share a cache and when other threads steal entries.
+ */
+struct entry_cache {
+    /** @brief Mutex protecting the cache */
+    pthread_mutex_t lock CACHE_ALIGNED;
+    /** @brief Number of cached entries */
+    size_t count;
+    /** @brief Cached entries, used as a stack */
+    struct cmd_entry *entries[THREAD_CACHE_SIZE];
+};
+
+/** @brief Thread cache slot of the calling thread plus one, 0 until first use */
+static __thread unsigned thread_cache_slot = 0;
+
+/** @brief Number of thread cache slots handed out so far */
+static unsigned thread_cache_slots_used = 0;
+
+/** @brief Set while the calling thread queues the commands of set_channel_state() */
+static __thread int state_table_push = 0;
+
+/** @brief Index of the pending SET_PARAMS entry in pending_entries */
+#define COALESCE_SET_PARAMS CHANNEL_COUNT
+
+/**
+ * @brief Lock-free ring of command slots
+ *
+ * The producer and consumer positions sit on cache lines of their own, apart
+ * from the read-only slot pointer and capacity.
+ */
+struct cmd_ring {
+    /** @brief Array of slots, aligned to a cache line */
+    struct cmd_slot *slots;
+    /** @brief Number of slots */
+    size_t capacity;
+    /** @brief Next ring position to be claimed by a producer */
+    size_t enqueue_pos CACHE_ALIGNED;
+    /** @brief Next ring position to be claimed by the consumer */
+    size_t dequeue_pos CACHE_ALIGNED;
+};
+
+/** @brief Magic number marking an initialized shared-memory ingress region */
+#define SHM_MAGIC 0x53524c51u
+
+/** @brief Version of the shared-memory ingress layout */
+#define SHM_VERSION 1
+
+/** @brief Number of commands the ingress thread moves into the pool at once */
+#define SHM_DRAIN_BATCH 32
+
+/** @brief Time the ingress thread waits for room in a full pool before checking for shutdown */
+#define SHM_RETRY_NS 10000000LL
+
+/**
+ * @brief Shared-memory ingress region
+ *
+ * Mapped by the owning instance and by every attached producer, at
+ * different addresses, so it holds no pointers. The ring follows the same
+ * protocol as struct cmd_ring, with the positions and slots in the region.
+ */
+struct shm_region {
+    /** @brief SHM_MAGIC, stored last when the region is ready */
+    uint32_t magic;
+    /** @brief SHM_VERSION */
+    uint32_t version;
+    /** @brief Number of slots */
+    uint32_t capacity;
+    /** @brief Set once the owner stopped draining the ring */
+    int closed;
+    /** @brief Process-shared semaphore waking the ingress thread */
+    sem_t doorbell;
+    /** @brief Set while the ingress thread sleeps on the doorbell */
+    int consumer_idle;
+    /** @brief Next ring position to be claimed by a producer */
+    size_t enqueue_pos CACHE_ALIGNED;
+    /** @brief Next ring position to be drained by the owner, published for producers and never read back */
+    size_t dequeue_pos CACHE_ALIGNED;
+    /** @brief Slots of the ring */
+    struct cmd_slot slots[] CACHE_ALIGNED;
+};
+
+/**
+ * @brief Mapping of a shared-memory ingress region in a producer process
+ */
+struct serial_shm {
+    /** @brief Mapped region */
+    struct shm_region *region;
+    /** @brief Size of the mapping in bytes */
+    size_t size;
+    /** @brief Number of slots, checked against the mapping once at attach */
+    size_t capacity;
+};
+
+/** @brief Shift of the active count inside command_counts */
+#define COUNT_ACTIVE_SHIFT 32
+
+/** @brief Mask of the unused count inside command_counts */
+#define COUNT_UNUSED_MASK 0xFFFFFFFFu
+
+/** @brief Delta that moves one entry from the unused to the active count */
+#define COUNT_MOVE_TO_ACTIVE ((UINT64_C(1) << COUNT_ACTIVE_SHIFT) - 1)
+
+/** @brief Delta that moves one entry from the active to the unused count */
+#define COUNT_MOVE_TO_UNUSED (UINT64_C(1) - (UINT64_C(1) << COUNT_ACTIVE_SHIFT))
+
+/** @brief Length of a timer wheel tick in nanoseconds */
+#define TIMER_TICK_NS ((uint64_t)TIMER_TICK_MS * 1000000u)
+
+/** @brief Number of bits of the tick selecting a slot of one wheel level */
+#define TIMER_WHEEL_BITS 6
+
+/** @brief Number of slots of each wheel level */
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+
+/** @brief Number of wheel levels, covering 2^24 ticks (4.6 hours of 1 ms) */
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * @brief Condition that threads can block on until the pools change
+ *
+ * The generation is bumped under wait_mutex on every wake-up, so a thread
+ * that found nothing to do can tell whether a change happened between its
+ * attempt and taking the mutex.
+ */
+struct wait_point {
+    /** @brief Condition variable on the monotonic clock */
+    pthread_cond_t cond;
+    /** @brief Incremented on every wake-up */
+    unsigned generation;
+    /** @brief Number of threads currently waiting */
+    int waiters;
+};
+
+/**
+ * @brief Slot of the receive event queue
+ */
+struct rx_event_slot {
+    /** @brief Queue position for which the slot is ready */
+    size_t sequence;
+    /** @brief Decoded event */
+    rx_event_t event;
+};
+
+/**
+ * @brief Command of the acknowledgement window
+ */
+struct ack_slot {
+    /** @brief Command, kept for retransmission */
+    device_command_t cmd;
+    /** @brief Monotonic time at which the command is sent again or given up */
+    uint64_t deadline_ns;
+    /** @brief Number of retransmissions so far */
+    unsigned retries;
+    /** @brief Sequence number of the frame */
+    uint8_t seq;
+    /** @brief Whether the command still waits for its acknowledgement */
+    int in_flight;
+};
+
+/** @brief Get the byte at an offset from the parse position of the receive ring */
+#define RX_AT(ctx, offset) ((ctx)->rx_buf[((ctx)->rx_tail + (offset)) & (RX_BUFFER_SIZE - 1)])
+
+/** @brief Queue of active command entries */
+TAILQ_HEAD(active_cmd_queue, cmd_entry);
+
+/** @brief Queue of unused command entries */
+TAILQ_HEAD(unused_cmd_queue, cmd_entry);
+
+/**
+ * @brief State of one serial port instance
+ *
+ * Every instance has its own port, lock, pools, wait points and transmit
+ * engine, so instances never contend with each other. The wait mutex and
+ * conditions live as long as the structure itself; everything else is set up
+ * by ctx_init() and torn down by ctx_deinit().
+ *
+ * The fields are grouped by the threads that write them, each group starting
+ * on a new cache line: settings that are only read after initialization, the
+ * state guarded by cmd_semaphore, the thread caches, the lock-free rings, the
+ * consumer-side statistics, the shared counts, the wait points, and the
+ * transmit, acknowledgement, reactor and receive state.
+ */
+struct serial_ctx {
+    /** @brief File descriptor for the serial port, kept across reconnections */
+    int serial_fd;
+
+    /** @brief Name the serial port was opened under */
+    char port_name[MAX_PORT_NAME + 1];
+
+    /** @brief Speed the serial port was configured with */
+    int port_speed;
+
+    /** @brief Line rate in bits per second the port was configured with, 0 for port_speed */
+    uint32_t port_baud;
+
+    /** @brief Whether the port is a terminal, where end of file means a hang-up */
+    int port_tty;
+
+    /** @brief Line profile applied to the port */
+    serial_line_profile_t line_profile;
+
+    /** @brief Line settings the driver applied, protected by port_mutex */
+    serial_line_info_t line_info;
+
+    /** @brief Flag indicating whether the instance is initialized */
+    int initialized;
+
+    /** @brief Queue backend selected at initialization */
+    queue_backend_t queue_backend;
+
+    /** @brief Whether free entries are kept in thread caches */
+    int thread_cache;
+
+    /** @brief Whether add() replaces superseded commands in place */
+    int coalesce_commands;
+
+    /** @brief Whether pending_entries is kept up to date, for coalescing or OVERFLOW_COALESCE */
+    int track_pending;
+
+    /** @brief Policy of add() for a CMD_SET_PARAMS that finds the pool full */
+    overflow_policy_t overflow_set_params;
+
+    /** @brief Policy of add() for a CMD_ON_OFF that finds the pool full */
+    overflow_policy_t overflow_on_off;
+
+    /** @brief Longest wait of OVERFLOW_BLOCK */
+    int64_t overflow_timeout_ns;
+
+    /** @brief Pool entries routine commands leave for emergency commands */
+    size_t emergency_reserve;
+
+    /** @brief Capture recording the accepted commands, NULL if none */
+    serial_capture_t *capture;
+
+    /** @brief Whether pool memory is page-aligned and locked into RAM */
+    int lock_memory;
+
+    /** @brief Outcome of locking the pool memory: 1 all granted, 0 some refused, -1 not requested */
+    int memory_locked;
+
+    /** @brief Number of bytes of pool memory locked so far */
+    size_t locked_bytes;
+
+    /** @brief Number of commands accepted by the add functions */
+    uint64_t stat_adds CACHE_ALIGNED;
+
+    /** @brief Number of commands rejected because they failed validation */
+    uint64_t stat_rejected_invalid;
+
+    /** @brief Number of commands rejected because the pool was full */
+    uint64_t stat_rejected_pool_full;
+
+    /** @brief Number of commands rejected because the instance was not initialized */
+    uint64_t stat_rejected_not_initialized;
+
+    /** @brief Number of adds rejected because the pool was full and the policy found no other way */
+    uint64_t stat_overflow_rejected;
+
+    /** @brief Number of adds that blocked under OVERFLOW_BLOCK */
+    uint64_t stat_overflow_blocked;
+
+    /** @brief Number of blocked adds that timed out */
+    uint64_t stat_overflow_timeouts;
+
+    /** @brief Number of pending commands discarded by OVERFLOW_DROP_OLDEST */
+    uint64_t stat_overflow_dropped;
+
+    /** @brief Number of pending commands overwritten by OVERFLOW_COALESCE */
+    uint64_t stat_overflow_coalesced;
+
+    /** @brief Number of pending routine commands discarded for an emergency command */
+    uint64_t stat_emergency_displaced;
+
+    /** @brief Semaphore for thread-safe access to the command queues */
+    sem_t cmd_semaphore CACHE_ALIGNED;
+
+    /** @brief Queue head for the active command pool */
+    struct active_cmd_queue active_command_pool;
+
+    /** @brief Queue head for the high-priority emergency command lane */
+    struct active_cmd_queue emergency_command_pool;
+
+    /** @brief Queue head for the unused command pool */
+    struct unused_cmd_queue unused_command_pool;
+
+    /** @brief Number of entries in unused_command_pool, not counting thread caches */
+    size_t unused_list_len;
+
+    /** @brief List of allocated pool chunks */
+    struct pool_chunk *pool_chunks;
+
+    /** @brief Current number of entries in the command pool */
+    size_t pool_capacity;
+
+    /** @brief Upper bound for the pool capacity in growth mode */
+    size_t pool_max_capacity;
+
+    /** @brief Number of entries added by each growth step */
+    size_t pool_chunk_size;
+
+    /** @brief Whether the pool may grow when it runs out of unused entries */
+    int pool_growth;
+
+    /** @brief Number of times the pool has grown */
+    uint64_t pool_grow_events;
+
+    /** @brief Largest number of active commands seen since initialization */
+    uint64_t pool_high_water_mark;
+
+    /**
+     * @brief Pending routine entries that newer commands may replace
+     *
+     * One slot per channel for CMD_ON_OFF, plus one for CMD_SET_PARAMS at
+     * COALESCE_SET_PARAMS. A slot points to the newest such entry in
+     * active_command_pool while it waits there and is NULL otherwise. Only
+     * kept while track_pending is set.
+     */
+    struct cmd_entry *pending_entries[CHANNEL_COUNT + 1];
+
+    /** @brief Number of commands that replaced a pending entry */
+    uint64_t coalesced_commands;
+
+    /** @brief Number of cached operations that reached the shared unused pool */
+    uint64_t cache_slow_path;
+
+    /** @brief Thread caches of free entries, one cache line each */
+    struct entry_cache entry_caches[THREAD_CACHE_SLOTS];
+
+    /** @brief Lock-free ring for routine commands */
+    struct cmd_ring command_ring;
+
+    /** @brief Lock-free ring for the high-priority emergency command lane */
+    struct cmd_ring emergency_ring;
+
+    /**
+     * @brief Emergency commands the ring backend queued while the pool was full, at most pool_capacity
+     *
+     * They hold no entry of the pool and are left out of command_counts, so
+     * active + unused stays equal to the capacity.
+     */
+    size_t emergency_overdraft;
+
+    /** @brief Number of emergency commands dequeued since initialization */
+    uint64_t emergency_dequeued CACHE_ALIGNED;
+
+    /** @brief Sum of the add-to-dequeue latencies of emergency commands */
+    uint64_t emergency_latency_total_ns;
+
+    /** @brief Largest add-to-dequeue latency of an emergency command */
+    uint64_t emergency_latency_max_ns;
+
+    /** @brief Number of commands taken out of the active pool */
+    uint64_t stat_dequeues;
+
+    /** @brief Add-to-dequeue latencies of every command */
+    latency_histogram_t stat_residency;
+
+    /**
+     * @brief Active and unused counts packed into one word
+     *
+     * The active count lives in the upper 32 bits and the unused count in the
+     * lower 32 bits, so a single atomic load returns both numbers from the same
+     * instant and a single atomic add moves an entry between them.
+     */
+    uint64_t command_counts CACHE_ALIGNED;
+
+    /** @brief Mutex protecting the wait points */
+    pthread_mutex_t wait_mutex CACHE_ALIGNED;
+
+    /** @brief Wait point signaled when a command is added to the active pool */
+    struct wait_point cmd_wait;
+
+    /** @brief Wait point signaled when an entry is returned to the unused pool */
+    struct wait_point slot_wait;
+
+    /** @brief Writer thread of the transmit engine */
+    pthread_t tx_thread CACHE_ALIGNED;
+
+    /** @brief Flag telling the writer thread to keep running */
+    int tx_running;
+
+    /** @brief Placement and scheduling requested for the writer thread */
+    serial_thread_options_t tx_thread_opts;
+
+    /** @brief Placement and scheduling the writer thread was granted */
+    serial_thread_info_t tx_thread_info;
+
+    /** @brief Maximum number of frames packed into one write() */
+    size_t tx_frames_per_write;
+
+    /** @brief Sequence number of the next transmitted frame */
+    uint8_t tx_next_seq;
+
+    /** @brief Number of frames written by the transmit engine */
+    uint64_t tx_frames;
+
+    /** @brief Number of bytes written by the transmit engine */
+    uint64_t tx_bytes;
+
+    /** @brief Number of write() calls made by the transmit engine */
+    uint64_t tx_write_calls;
+
+    /** @brief Number of failed write() calls made by the transmit engine */
+    uint64_t tx_write_errors;
 
-/** @brief File descriptor for the serial port */
-static int serial_fd = -1;
+    /** @brief Number of frames the transmit engine gave up on after a write error */
+    uint64_t tx_dropped;
 
-/** @brief Semaphore for thread-safe access to the command queues */
-static sem_t cmd_semaphore;
+    /** @brief Monotonic time at which the transmit engine started */
+    uint64_t tx_start_ns;
 
-/** @brief Queue head for the active command pool */
-static TAILQ_HEAD(active_cmd_queue, cmd_entry) active_command_pool;
+    /** @brief Number of bytes written to the port, never reset */
+    uint64_t stat_bytes_written;
+
+    /** @brief Number of write() calls made on the port, never reset */
+    uint64_t stat_write_calls;
+
+    /** @brief Number of frames given up on after a write error, never reset */
+    uint64_t stat_tx_dropped;
+
+    /** @brief Durations of the write() calls made on the port */
+    latency_histogram_t stat_write_time;
+
+    /** @brief Mutex protecting the timer wheel */
+    pthread_mutex_t timer_mutex CACHE_ALIGNED;
+
+    /** @brief Signaled when a deferred command is due before the timer thread planned to wake */
+    pthread_cond_t timer_cond;
+
+    /** @brief Timer thread releasing deferred commands */
+    pthread_t timer_thread;
+
+    /** @brief Flag telling the timer thread to keep running */
+    int timer_running;
+
+    /** @brief Tick up to which the wheel has been advanced */
+    uint64_t timer_tick;
+
+    /** @brief Tick the timer thread sleeps until, UINT64_MAX for no deadline, 0 while awake */
+    uint64_t timer_wake_tick;
+
+    /** @brief Number of deferred commands in the wheel and the due list */
+    uint64_t timer_pending;
+
+    /** @brief Non-empty slots of each wheel level, one bit per slot */
+    uint64_t timer_bitmap[TIMER_WHEEL_LEVELS];
+
+    /**
+     * @brief Slots of the hierarchical timer wheel
+     *
+     * Level l holds the entries due 64^l to 64^(l+1) ticks after timer_tick,
+     * in the slot selected by bits 6l to 6l+5 of their tick. When the lower
+     * levels wrap around, the next slot of the level above is cascaded down.
+     */
+    struct active_cmd_queue timer_slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+    /** @brief Deferred commands that are due, in deadline order from splices */
+    struct active_cmd_queue timer_due;
+
+    /** @brief Shared-memory ingress region, NULL if none */
+    struct shm_region *shm CACHE_ALIGNED;
+
+    /** @brief Size of the shared-memory mapping in bytes */
+    size_t shm_size;
+
+    /** @brief Number of slots of the ingress ring, kept apart from the region that producers can write */
+    size_t shm_capacity;
+
+    /** @brief Next ingress ring position to drain, kept apart from the region that producers can write */
+    size_t shm_dequeue_pos;
+
+    /** @brief Name of the shared-memory region, unlinked on deinit */
+    char shm_name[SHM_MAX_NAME + 1];
+
+    /** @brief Thread moving commands from the ingress ring into the pool */
+    pthread_t shm_thread;
+
+    /** @brief Flag telling the ingress thread to keep running */
+    int shm_running;
+
+    /** @brief Mutex serializing the reopening of the serial port */
+    pthread_mutex_t port_mutex CACHE_ALIGNED;
+
+    /** @brief Set while the serial port is failed and not reopened yet */
+    int port_down;
+
+    /** @brief Incremented each time the serial port is reopened */
+    unsigned port_generation;
+
+    /** @brief Number of times the serial port was found to have failed */
+    uint64_t stat_port_failures;
+
+    /** @brief Number of times the serial port was reopened */
+    uint64_t stat_reconnects;
+
+    /** @brief Mutex protecting the wake-up of the reconnect thread */
+    pthread_mutex_t reconnect_mutex;
+
+    /** @brief Signaled when the port fails or the reconnect thread has to stop */
+    pthread_cond_t reconnect_cond;
+
+    /** @brief Thread reopening the serial port after a failure */
+    pthread_t reconnect_thread;
+
+    /** @brief Flag telling the reconnect thread to keep running */
+    int reconnect_running;
+
+    /** @brief Delay before the first reconnection attempt */
+    uint64_t reconnect_min_ns;
+
+    /** @brief Upper bound of the delay between reconnection attempts */
+    uint64_t reconnect_max_ns;
+
+    /** @brief Mutex serializing set_channel_state() and protecting the state table */
+    pthread_mutex_t state_mutex CACHE_ALIGNED;
+
+    /** @brief State last passed to set_channel_state() */
+    charger_state_t state_desired;
+
+    /** @brief State the queued commands put the charger into */
+    charger_state_t state_applied;
+
+    /** @brief Whether state_applied is known, cleared on init, invalidation and reconnect */
+    int state_valid;
+
+    /**
+     * @brief Fields of state_applied whose queued command was discarded or overwritten
+     *
+     * One bit per coalesce_key(). The pool sets them with cmd_semaphore held,
+     * without state_mutex, and set_channel_state() takes them over.
+     */
+    uint32_t state_lost;
+
+    /** @brief Number of commands generated by set_channel_state() */
+    uint64_t stat_state_commands;
+
+    /** @brief Number of commands set_channel_state() left out as unchanged */
+    uint64_t stat_state_unchanged;
+
+    /** @brief Mutex protecting the acknowledgement window */
+    pthread_mutex_t ack_mutex CACHE_ALIGNED;
+
+    /** @brief Commands in flight, indexed by sequence number modulo ACK_MAX_WINDOW */
+    struct ack_slot ack_slots[ACK_MAX_WINDOW];
+
+    /** @brief Maximum number of commands in flight, 0 when acknowledgements are not tracked */
+    size_t ack_window;
+
+    /** @brief Time to wait for an acknowledgement before retransmitting */
+    uint64_t ack_timeout_ns;
+
+    /** @brief Number of retransmissions before a command is given up */
+    unsigned ack_retries;
+
+    /** @brief Sequence number of the oldest command still in flight, or tx_next_seq */
+    uint8_t ack_base;
+
+    /** @brief Acknowledgement window counters, see ack_stats_t */
+    ack_stats_t ack_stats;
+
+    /** @brief Reactor the instance is attached to, NULL if none */
+    serial_reactor_t *reactor;
+
+    /** @brief Link in the instance list of the reactor */
+    LIST_ENTRY(serial_ctx) reactor_link;
+
+    /** @brief Eventfd that producers signal to wake the reactor, -1 until first attached */
+    int kick_fd;
+
+    /** @brief Set while a wake-up of the reactor is pending */
+    int reactor_kicked;
+
+    /** @brief Whether the serial port is registered with epoll */
+    int reactor_pollable;
+
+    /** @brief Whether EPOLLOUT is currently requested for the serial port */
+    int reactor_wants_output;
+
+    /** @brief File status flags of the serial port before it was attached */
+    int reactor_saved_flags;
+
+    /** @brief Encoded burst the reactor is writing */
+    uint8_t tx_buf[TX_MAX_FRAMES_PER_WRITE * FRAME_MAX_SIZE];
+
+    /** @brief Number of bytes in tx_buf */
+    size_t tx_len;
+
+    /** @brief Number of bytes of tx_buf already written */
+    size_t tx_off;
+
+    /** @brief Number of frames in tx_buf */
+    size_t tx_burst_frames;
+
+    /** @brief Mutex serializing the parser between the reader thread and rx_feed() */
+    pthread_mutex_t rx_mutex CACHE_ALIGNED;
+
+    /** @brief Ring buffer of received bytes */
+    uint8_t rx_buf[RX_BUFFER_SIZE];
+
+    /** @brief Position after the last received byte */
+    size_t rx_head;
+
+    /** @brief Position of the first byte not yet parsed */
+    size_t rx_tail;
+
+    /** @brief Callback for decoded events, NULL to queue them */
+    rx_callback_t rx_callback;
+
+    /** @brief User pointer passed to rx_callback */
+    void *rx_user;
+
+    /** @brief Lock-free queue of decoded events */
+    struct rx_event_slot rx_events[RX_EVENT_QUEUE_SIZE];
+
+    /** @brief Next event queue position written by the parser */
+    size_t rx_event_head;
+
+    /** @brief Next event queue position claimed by a consumer */
+    size_t rx_event_tail;
+
+    /** @brief Reader thread of the receive path */
+    pthread_t rx_thread;
+
+    /** @brief Whether the reader thread is running */
+    int rx_running;
+
+    /** @brief Eventfd that wakes the reader thread to stop or to resume reading */
+    int rx_stop_fd;
+
+    /** @brief Set when the reader thread has to stop rather than resume */
+    int rx_stopping;
+
+    /** @brief Receive path counters, see rx_stats_t */
+    rx_stats_t rx_stats;
+};
+
+/** @brief Maximum number of epoll events handled per reactor iteration */
+#define REACTOR_MAX_EVENTS 64
+
+/** @brief Bursts written for one instance before the reactor moves on to the next */
+#define REACTOR_BURSTS_PER_EVENT 4
+
+/**
+ * @brief Event loop that drives the transmit side of many instances
+ *
+ * Only the loop thread touches the burst buffers and the epoll registrations
+ * of attached instances. It holds the mutex while handling a batch of events,
+ * and detaches instances between batches, so no event can refer to an
+ * instance that is already gone.
+ */
+struct serial_reactor {
+    /** @brief Epoll instance */
+    int epoll_fd;
+    /** @brief Eventfd that wakes the loop for control requests */
+    int wake_fd;
+    /** @brief Loop thread */
+    pthread_t thread;
+    /** @brief Flag telling the loop thread to keep running */
+    int running;
+    /** @brief Mutex protecting the instance list and control requests */
+    pthread_mutex_t mutex;
+    /** @brief Signaled when a control request has been handled */
+    pthread_cond_t cond;
+    /** @brief Instance the loop thread should detach, NULL if none */
+    serial_ctx_t *detach;
+    /** @brief Attached instances */
+    LIST_HEAD(reactor_ctx_list, serial_ctx) ctxs;
+    /** @brief Placement and scheduling the loop thread was granted */
+    serial_thread_info_t thread_info;
+};
+
+/** @brief Instance behind the legacy functions without a handle */
+static serial_ctx_t default_ctx;
+
+/** @brief Guard for the one-time setup of the default instance */
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+
+/** @brief Get the byte offset of a command field within device_command_t */
+#define FIELD_OFFSET(field) ((uint8_t)offsetof(device_command_t, data.field))
+
+/** @brief Number of command types, whose codes follow CMD_SET_PARAMS */
+#define COMMAND_TYPE_COUNT (CMD_EMERGENCY - CMD_SET_PARAMS + 1)
+
+/**
+ * @brief Range of one byte-sized command field
+ */
+struct field_limit {
+    /** @brief Byte offset of the field within device_command_t */
+    uint8_t offset;
+    /** @brief Smallest valid value */
+    uint8_t min;
+    /** @brief Largest valid value */
+    uint8_t max;
+};
+
+/**
+ * @brief Constraints of one command type
+ *
+ * The fields at lower and upper must satisfy lower <= upper. Types without
+ * such a constraint point both at offset 0, which compares the command type
+ * with itself.
+ */
+struct command_limits {
+    /** @brief Number of entries used in fields */
+    uint8_t nfields;
+    /** @brief Ranges of the payload fields */
+    struct field_limit fields[3];
+    /** @brief Offset of the field that must not exceed upper */
+    uint8_t lower;
+    /** @brief Offset of the field that must not be below lower */
+    uint8_t upper;
+};
+
+/** @brief Constraints by command type, indexed by command_type - CMD_SET_PARAMS */
+static const struct command_limits command_limits[COMMAND_TYPE_COUNT] = {
+    [CMD_SET_PARAMS - CMD_SET_PARAMS] = {
+        3,
+        {
+            { FIELD_OFFSET(set_params.min_level), 0, 100 },
+            { FIELD_OFFSET(set_params.max_level), 0, 100 },
+            { FIELD_OFFSET(set_params.max_time), 1, 240 }
+        },
+        FIELD_OFFSET(set_params.min_level), FIELD_OFFSET(set_params.max_level)
+    },
+    [CMD_ON_OFF - CMD_SET_PARAMS] = {
+        2,
+        {
+            { FIELD_OFFSET(on_off.on_off), 0, 1 },
+            { FIELD_OFFSET(on_off.channel), 0, CHANNEL_COUNT - 1 }
+        },
+        0, 0
+    },
+    [CMD_EMERGENCY - CMD_SET_PARAMS] = { 0, { { 0, 0, 0 } }, 0, 0 }
+};
+
+/**
+ * @brief Validates the given device command
+ *
+ * This function checks the fields of a command against the constraint
+ * table of its type. It does not log, callers report failures with
+ * log_invalid_command().
+ *
+ * @param cmd Pointer to the command structure to validate, not NULL
+ * @return EXIT_SUCCESS if valid, EXIT_FAILURE if invalid
+ */
+static int is_valid_command(const device_command_t *cmd) {
+    unsigned index = (unsigned)cmd->command_type - CMD_SET_PARAMS;
+    if (index >= COMMAND_TYPE_COUNT) {
+        return EXIT_FAILURE;
+    }
+
+    const struct command_limits *limits = &command_limits[index];
+    const uint8_t *bytes = (const uint8_t *)cmd;
+    unsigned invalid = bytes[limits->lower] > bytes[limits->upper];
+    for (unsigned i = 0; i < limits->nfields; i++) {
+        uint8_t value = bytes[limits->fields[i].offset];
+        invalid |= (value < limits->fields[i].min) | (value > limits->fields[i].max);
+    }
+    return invalid ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Log why a command failed validation
+ *
+ * @param cmd Pointer to the invalid command
+ */
+static void log_invalid_command(const device_command_t *cmd) {
+    switch (cmd->command_type) {
+        case CMD_SET_PARAMS:
+            SERIAL_LOG(LOG_WARNING, "Invalid SET_PARAMS command: min_level=%d, max_level=%d, max_time=%d",
+                       cmd->data.set_params.min_level,
+                       cmd->data.set_params.max_level,
+                       cmd->data.set_params.max_time);
+            break;
+
+        case CMD_ON_OFF:
+            SERIAL_LOG(LOG_WARNING, "Invalid ON_OFF command: on_off=%d, channel=%d",
+                       cmd->data.on_off.on_off,
+                       cmd->data.on_off.channel);
+            break;
+
+        default:
+            SERIAL_LOG(LOG_WARNING, "Unknown command type: 0x%x", cmd->command_type);
+            break;
+    }
+}
+
+/**
+ * @brief Get the size of a pool allocation as pool_memory_alloc() makes it
+ *
+ * @param ctx Instance handle
+ * @param size Requested size in bytes
+ * @return Size in bytes, rounded up to whole pages when the pool memory is locked
+ */
+static size_t pool_memory_size(serial_ctx_t *ctx, size_t size) {
+    if (ctx->lock_memory) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size = (size + page - 1) / page * page;
+    }
+    return size;
+}
+
+/**
+ * @brief Allocate zeroed, cache-aligned memory for the command pool
+ *
+ * With lock_memory the block is page-aligned and padded to whole pages, so
+ * that unlocking it on free cannot unlock the pages of other allocations,
+ * and it is locked into RAM. A refused lock is recorded in memory_locked and
+ * leaves the block usable.
+ *
+ * @param ctx Instance handle
+ * @param size Size in bytes
+ * @return Pointer to the block, or NULL if the allocation failed
+ */
+static void *pool_memory_alloc(serial_ctx_t *ctx, size_t size) {
+    void *memory = NULL;
+
+    size = pool_memory_size(ctx, size);
+    if (posix_memalign(&memory, ctx->lock_memory ? (size_t)sysconf(_SC_PAGESIZE) : CACHE_LINE_SIZE, size) != 0) {
+        return NULL;
+    }
+    memset(memory, 0, size);
+    if (ctx->lock_memory) {
+        if (mlock(memory, size) == 0) {
+            __atomic_add_fetch(&ctx->locked_bytes, size, __ATOMIC_RELAXED);
+        } else {
+            SERIAL_LOG(LOG_WARNING, "Failed to lock %zu bytes of pool memory (errno %d)", size, errno);
+            __atomic_store_n(&ctx->memory_locked, 0, __ATOMIC_RELAXED);
+        }
+    }
+    return memory;
+}
+
+/**
+ * @brief Unlock and free a block of pool_memory_alloc()
+ *
+ * @param ctx Instance handle
+ * @param memory Block to free, may be NULL
+ * @param size Size in bytes the block was requested with
+ */
+static void pool_memory_free(serial_ctx_t *ctx, void *memory, size_t size) {
+    if (memory != NULL && ctx->lock_memory) {
+        munlock(memory, pool_memory_size(ctx, size));
+    }
+    free(memory);
+}
+
+/**
+ * @brief Allocate a lock-free ring with every slot free for its first lap
+ *
+ * @param ctx Instance handle
+ * @param ring Ring to initialize
+ * @param capacity Number of slots
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the allocation failed
+ */
+static int ring_init(serial_ctx_t *ctx, struct cmd_ring *ring, size_t capacity) {
+    ring->slots = pool_memory_alloc(ctx, capacity * sizeof(struct cmd_slot));
+    if (ring->slots == NULL) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        ring->slots[i].sequence = (uint32_t)i;
+    }
+    ring->capacity = capacity;
+    ring->enqueue_pos = 0;
+    ring->dequeue_pos = 0;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Free the slots of a lock-free ring
+ *
+ * @param ctx Instance handle
+ * @param ring Ring to free
+ */
+static void ring_free(serial_ctx_t *ctx, struct cmd_ring *ring) {
+    pool_memory_free(ctx, ring->slots, ring->capacity * sizeof(struct cmd_slot));
+    ring->slots = NULL;
+    ring->capacity = 0;
+}
+
+/**
+ * @brief Push a contiguous run of commands into a lock-free ring
+ *
+ * Producers claim all positions of the run with a single CAS on the enqueue
+ * position once every slot in the run is free for the current lap, then
+ * publish each command by storing the slot sequence with release semantics.
+ *
+ * The caller must have reserved the entries in command_counts first, or an
+ * emergency overdraft, so the ring always has room for the run. A slot can only still be busy while
+ * another consumer is finishing its pop, which the producer waits out.
+ *
+ * @param ring Ring to push into
+ * @param cmds Array of commands to push
+ * @param n Number of commands in the run
+ * @param enqueue_ns Timestamp to store with the commands
+ */
+static void ring_push_run(struct cmd_ring *ring, const device_command_t *cmds, size_t n,
+                          uint64_t enqueue_ns) {
+    size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        size_t i;
+
+        // Every slot of the run must be free for this lap
+        for (i = 0; i < n; i++) {
+            struct cmd_slot *slot = &ring->slots[(pos + i) % ring->capacity];
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != (uint32_t)(pos + i)) {
+                break;
+            }
+        }
+
+        if (i == n) {
+            // Run is free for this lap, try to claim all of its positions
+            if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + n, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                for (i = 0; i < n; i++) {
+                    struct cmd_slot *slot = &ring->slots[(pos + i) % ring->capacity];
+                    memcpy(&slot->cmd, &cmds[i], sizeof(device_command_t));
+                    slot->enqueue_ns = enqueue_ns;
+                    __atomic_store_n(&slot->sequence, (uint32_t)(pos + i + 1), __ATOMIC_RELEASE);
+                }
+                return;
+            }
+        } else {
+            // Another producer claimed a position or a consumer is still
+            // releasing a slot, reload and retry
+            pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Pop the oldest command from a lock-free ring
+ *
+ * @param ring Ring to pop from
+ * @param cmd Pointer to store the retrieved command
+ * @param enqueue_ns Pointer to store the timestamp of the command
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the ring is empty
+ */
+static int ring_pop(struct cmd_ring *ring, device_command_t *cmd, uint64_t *enqueue_ns) {
+    size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct cmd_slot *slot = &ring->slots[pos % ring->capacity];
+        uint32_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - (uint32_t)(pos + 1));
+
+        if (diff == 0) {
+            // Slot holds a published command, try to claim it
+            if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                memcpy(cmd, &slot->cmd, sizeof(device_command_t));
+                *enqueue_ns = slot->enqueue_ns;
+                // Release the slot for the next lap of the ring
+                __atomic_store_n(&slot->sequence, (uint32_t)(pos + ring->capacity), __ATOMIC_RELEASE);
+                return EXIT_SUCCESS;
+            }
+        } else if (diff < 0) {
+            // Nothing published at this position yet
+            return EXIT_FAILURE;
+        } else {
+            pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Record the add-to-dequeue latency of an emergency command
+ *
+ * @param ctx Instance handle
+ * @param enqueue_ns Timestamp taken when the command was added
+ * @param now_ns Timestamp taken when the command was dequeued
+ */
+static void record_emergency_latency(serial_ctx_t *ctx, uint64_t enqueue_ns, uint64_t now_ns) {
+    uint64_t latency = now_ns > enqueue_ns ? now_ns - enqueue_ns : 0;
+    uint64_t max = __atomic_load_n(&ctx->emergency_latency_max_ns, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&ctx->emergency_dequeued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->emergency_latency_total_ns, latency, __ATOMIC_RELAXED);
+    while (latency > max &&
+           !__atomic_compare_exchange_n(&ctx->emergency_latency_max_ns, &max, latency, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief Get the monotonic clock in nanoseconds
+ *
+ * @return Current monotonic time in nanoseconds
+ */
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Get the histogram bucket of a value
+ *
+ * The bucket is found from the position of the highest set bit and the two
+ * bits below it, so recording a value never loops over the buckets.
+ *
+ * @param ns Value in nanoseconds
+ * @return Bucket index
+ */
+static size_t histogram_index(uint64_t ns) {
+    if (ns < 4) {
+        return (size_t)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    size_t index = (size_t)(msb - 1) * 4 + (size_t)((ns >> (msb - 2)) & 3);
+    return index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @brief Record a value in a latency histogram
+ *
+ * @param hist Histogram to update
+ * @param ns Value in nanoseconds
+ */
+static void histogram_record(latency_histogram_t *hist, uint64_t ns) {
+    uint64_t max = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&hist->buckets[histogram_index(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->sum_ns, ns, __ATOMIC_RELAXED);
+    while (ns > max &&
+           !__atomic_compare_exchange_n(&hist->max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief Copy a latency histogram updated concurrently
+ *
+ * The count is the sum of the copied buckets, so it always matches them.
+ *
+ * @param dst Histogram to fill
+ * @param src Histogram to read
+ */
+static void histogram_snapshot(latency_histogram_t *dst, const latency_histogram_t *src) {
+    dst->count = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+        dst->count += dst->buckets[i];
+    }
+    dst->sum_ns = __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+    dst->max_ns = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Record a write() call on the serial port
+ *
+ * @param ctx Instance handle
+ * @param start_ns Timestamp taken before the call
+ * @param written Return value of the call
+ */
+static void record_write(serial_ctx_t *ctx, uint64_t start_ns, ssize_t written) {
+    uint64_t now_ns = monotonic_ns();
+
+    SERIAL_TRACE(TRACE_WRITE, written < 0 ? UINT32_MAX : (uint32_t)written);
+    histogram_record(&ctx->stat_write_time, now_ns > start_ns ? now_ns - start_ns : 0);
+    __atomic_add_fetch(&ctx->stat_write_calls, 1, __ATOMIC_RELAXED);
+    if (written > 0) {
+        __atomic_add_fetch(&ctx->stat_bytes_written, (uint64_t)written, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Record the time a command spent in the active pool
+ *
+ * @param ctx Instance handle
+ * @param enqueue_ns Timestamp taken when the command was added
+ * @param now_ns Timestamp taken when the command was dequeued
+ */
+static void record_residency(serial_ctx_t *ctx, uint64_t enqueue_ns, uint64_t now_ns) {
+    histogram_record(&ctx->stat_residency, now_ns > enqueue_ns ? now_ns - enqueue_ns : 0);
+}
+
+/**
+ * @brief Get the key identifying a command in trace events
+ *
+ * @param cmd Command to identify
+ * @return Command key, see TRACE_COMMAND_KEY()
+ */
+static uint32_t trace_command_key(const device_command_t *cmd) {
+    if (cmd->command_type == CMD_ON_OFF || cmd->command_type == CMD_EMERGENCY) {
+        return TRACE_COMMAND_KEY(cmd->command_type, cmd->data.on_off.channel);
+    }
+    return TRACE_COMMAND_KEY(cmd->command_type, 0);
+}
+
+/**
+ * @brief Record one trace event per command
+ *
+ * Callers check SERIAL_TRACE_ACTIVE() first, so disabled tracing costs a
+ * single branch per call rather than one per command.
+ *
+ * @param point Trace point
+ * @param cmds Commands to record
+ * @param n Number of commands
+ */
+static void trace_commands(trace_point_t point, const device_command_t *cmds, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        serial_trace_record(point, trace_command_key(&cmds[i]));
+    }
+}
+
+/**
+ * @brief Allocate a cache-aligned chunk of entries and add it to the unused pool
+ *
+ * Must be called with cmd_semaphore held or before the module is initialized.
+ *
+ * @param ctx Instance handle
+ * @param count Number of entries in the chunk
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the allocation failed
+ */
+static int pool_add_chunk(serial_ctx_t *ctx, size_t count) {
+    struct pool_chunk *chunk = pool_memory_alloc(ctx, CACHE_LINE_SIZE + count * sizeof(struct cmd_entry));
+    if (chunk == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    chunk->count = count;
+    chunk->next = ctx->pool_chunks;
+    ctx->pool_chunks = chunk;
+
+    struct cmd_entry *entries = CHUNK_ENTRIES(chunk);
+    for (size_t i = 0; i < count; i++) {
+        TAILQ_INSERT_TAIL(&ctx->unused_command_pool, &entries[i], entries);
+    }
+    ctx->unused_list_len += count;
+    ctx->pool_capacity += count;
+    __atomic_add_fetch(&ctx->command_counts, (uint64_t)count, __ATOMIC_RELEASE);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Free every pool chunk
+ *
+ * @param ctx Instance handle
+ */
+static void pool_free_chunks(serial_ctx_t *ctx) {
+    while (ctx->pool_chunks != NULL) {
+        struct pool_chunk *next = ctx->pool_chunks->next;
+        pool_memory_free(ctx, ctx->pool_chunks, CACHE_LINE_SIZE + ctx->pool_chunks->count * sizeof(struct cmd_entry));
+        ctx->pool_chunks = next;
+    }
+    ctx->pool_capacity = 0;
+}
+
+/**
+ * @brief Grow the pool so that it has at least the given number of unused entries
+ *
+ * Only entries in unused_command_pool count, not those in thread caches.
+ * Must be called with cmd_semaphore held. Growth happens in steps of
+ * pool_chunk_size entries and never exceeds pool_max_capacity.
+ *
+ * @param ctx Instance handle
+ * @param needed Number of unused entries the caller needs
+ * @return EXIT_SUCCESS if enough entries are unused, EXIT_FAILURE otherwise
+ */
+static int pool_grow(serial_ctx_t *ctx, size_t needed) {
+    size_t unused = ctx->unused_list_len;
+
+    if (unused >= needed) {
+        return EXIT_SUCCESS;
+    }
+    if (!ctx->pool_growth) {
+        return EXIT_FAILURE;
+    }
+
+    size_t missing = needed - unused;
+    size_t step = missing > ctx->pool_chunk_size ? missing : ctx->pool_chunk_size;
+    if (ctx->pool_capacity + step > ctx->pool_max_capacity) {
+        step = ctx->pool_max_capacity - ctx->pool_capacity;
+    }
+    if (step < missing || pool_add_chunk(ctx, step) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    __atomic_add_fetch(&ctx->pool_grow_events, 1, __ATOMIC_RELAXED);
+    SERIAL_LOG(LOG_INFO, "Command pool grown by %zu entries to %zu", step, ctx->pool_capacity);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Take the first entry of the unused pool
+ *
+ * Must be called with cmd_semaphore held and the pool not empty.
+ *
+ * @param ctx Instance handle
+ * @return Unused entry
+ */
+static struct cmd_entry *unused_list_take(serial_ctx_t *ctx) {
+    struct cmd_entry *entry = TAILQ_FIRST(&ctx->unused_command_pool);
+    TAILQ_REMOVE(&ctx->unused_command_pool, entry, entries);
+    ctx->unused_list_len--;
+    return entry;
+}
+
+/**
+ * @brief Return an entry to the unused pool
+ *
+ * Must be called with cmd_semaphore held.
+ *
+ * @param ctx Instance handle
+ * @param entry Entry that is no longer in use
+ */
+static void unused_list_put(serial_ctx_t *ctx, struct cmd_entry *entry) {
+    TAILQ_INSERT_TAIL(&ctx->unused_command_pool, entry, entries);
+    ctx->unused_list_len++;
+}
+
+/**
+ * @brief Get the thread cache of the calling thread
+ *
+ * @param ctx Instance handle
+ * @return Thread cache of the calling thread
+ */
+static struct entry_cache *thread_entry_cache(serial_ctx_t *ctx) {
+    if (thread_cache_slot == 0) {
+        thread_cache_slot = __atomic_add_fetch(&thread_cache_slots_used, 1, __ATOMIC_RELAXED);
+    }
+    return &ctx->entry_caches[(thread_cache_slot - 1) % THREAD_CACHE_SLOTS];
+}
+
+/**
+ * @brief Take up to n entries from a thread cache
+ *
+ * @param cache Thread cache
+ * @param out Array to store the entries
+ * @param n Maximum number of entries to take
+ * @return Number of entries taken
+ */
+static size_t cache_take(struct entry_cache *cache, struct cmd_entry **out, size_t n) {
+    pthread_mutex_lock(&cache->lock);
+    size_t count = n < cache->count ? n : cache->count;
+    cache->count -= count;
+    memcpy(out, &cache->entries[cache->count], count * sizeof(*out));
+    pthread_mutex_unlock(&cache->lock);
+    return count;
+}
+
+/**
+ * @brief Put entries into a thread cache
+ *
+ * Entries that do not fit, because another thread sharing the slot filled
+ * it meanwhile, go back to the unused pool.
+ *
+ * @param ctx Instance handle
+ * @param cache Thread cache
+ * @param in Entries to put
+ * @param n Number of entries
+ */
+static void cache_put(serial_ctx_t *ctx, struct entry_cache *cache, struct cmd_entry **in, size_t n) {
+    pthread_mutex_lock(&cache->lock);
+    size_t count = n < THREAD_CACHE_SIZE - cache->count ? n : THREAD_CACHE_SIZE - cache->count;
+    memcpy(&cache->entries[cache->count], in, count * sizeof(*in));
+    cache->count += count;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (count < n && sem_wait(&ctx->cmd_semaphore) == 0) {
+        __atomic_add_fetch(&ctx->cache_slow_path, 1, __ATOMIC_RELAXED);
+        for (size_t i = count; i < n; i++) {
+            unused_list_put(ctx, in[i]);
+        }
+        sem_post(&ctx->cmd_semaphore);
+    }
+}
+
+/**
+ * @brief Move entries from thread caches to the unused pool
+ *
+ * Must be called with cmd_semaphore held.
+ *
+ * @param ctx Instance handle
+ * @param cache The only cache to drain, or NULL to collect from every cache
+ * @param wanted Number of entries to move
+ * @return Number of entries moved
+ */
+static size_t cache_drain(serial_ctx_t *ctx, struct entry_cache *cache, size_t wanted) {
+    size_t moved = 0;
+
+    for (size_t slot = 0; slot < THREAD_CACHE_SLOTS && moved < wanted; slot++) {
+        struct entry_cache *c = cache != NULL ? cache : &ctx->entry_caches[slot];
+        pthread_mutex_lock(&c->lock);
+        while (c->count > 0 && moved < wanted) {
+            unused_list_put(ctx, c->entries[--c->count]);
+            moved++;
+        }
+        pthread_mutex_unlock(&c->lock);
+        if (cache != NULL) {
+            break;
+        }
+    }
+    return moved;
+}
+
+/**
+ * @brief Update the high-water mark after entries became active
+ *
+ * @param ctx Instance handle
+ * @param counts Packed command counts after the update
+ */
+static void update_high_water_mark(serial_ctx_t *ctx, uint64_t counts) {
+    uint64_t active = counts >> COUNT_ACTIVE_SHIFT;
+    uint64_t mark = __atomic_load_n(&ctx->pool_high_water_mark, __ATOMIC_RELAXED);
+
+    while (active > mark &&
+           !__atomic_compare_exchange_n(&ctx->pool_high_water_mark, &mark, active, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief Reserve unused entries in the packed command counts
+ *
+ * The ring backend uses the counts as its admission check: a producer first
+ * moves entries from unused to active and only then publishes its commands,
+ * so the active count never drops below the number of published commands.
+ * The reservation is all-or-nothing.
+ *
+ * @param ctx Instance handle
+ * @param n Number of entries to reserve
+ * @param keep Number of entries that must stay unused afterwards
+ * @return EXIT_SUCCESS if the entries were reserved, EXIT_FAILURE if not enough are left
+ */
+static int reserve_unused_entries(serial_ctx_t *ctx, size_t n, size_t keep) {
+    uint64_t counts = __atomic_load_n(&ctx->command_counts, __ATOMIC_RELAXED);
+
+    do {
+        if ((counts & COUNT_UNUSED_MASK) < n + keep) {
+            return EXIT_FAILURE;
+        }
+    } while (!__atomic_compare_exchange_n(&ctx->command_counts, &counts,
+                                          counts + n * COUNT_MOVE_TO_ACTIVE, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    update_high_water_mark(ctx, counts + n * COUNT_MOVE_TO_ACTIVE);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Create the wait mutex and conditions of an instance
+ *
+ * The conditions use the monotonic clock. They are created once per
+ * instance and outlive every init()/deinit() cycle of it, so a thread still
+ * waking up from a wait can never touch a destroyed object.
+ *
+ * @param ctx Instance to set up
+ */
+static void ctx_init_waits(serial_ctx_t *ctx) {
+    pthread_condattr_t attr;
+    pthread_mutex_init(&ctx->wait_mutex, NULL);
+    pthread_mutex_init(&ctx->rx_mutex, NULL);
+    pthread_mutex_init(&ctx->ack_mutex, NULL);
+    pthread_mutex_init(&ctx->timer_mutex, NULL);
+    pthread_mutex_init(&ctx->port_mutex, NULL);
+    pthread_mutex_init(&ctx->reconnect_mutex, NULL);
+    pthread_mutex_init(&ctx->state_mutex, NULL);
+    for (size_t i = 0; i < THREAD_CACHE_SLOTS; i++) {
+        pthread_mutex_init(&ctx->entry_caches[i].lock, NULL);
+    }
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ctx->cmd_wait.cond, &attr);
+    pthread_cond_init(&ctx->slot_wait.cond, &attr);
+    pthread_cond_init(&ctx->timer_cond, &attr);
+    pthread_cond_init(&ctx->reconnect_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/**
+ * @brief Destroy the wait mutex and conditions of an instance
+ *
+ * @param ctx Instance without any waiting thread
+ */
+static void ctx_destroy_waits(serial_ctx_t *ctx) {
+    pthread_cond_destroy(&ctx->cmd_wait.cond);
+    pthread_cond_destroy(&ctx->slot_wait.cond);
+    pthread_cond_destroy(&ctx->timer_cond);
+    pthread_cond_destroy(&ctx->reconnect_cond);
+    pthread_mutex_destroy(&ctx->wait_mutex);
+    pthread_mutex_destroy(&ctx->timer_mutex);
+    pthread_mutex_destroy(&ctx->port_mutex);
+    pthread_mutex_destroy(&ctx->reconnect_mutex);
+    pthread_mutex_destroy(&ctx->state_mutex);
+    pthread_mutex_destroy(&ctx->rx_mutex);
+    pthread_mutex_destroy(&ctx->ack_mutex);
+    for (size_t i = 0; i < THREAD_CACHE_SLOTS; i++) {
+        pthread_mutex_destroy(&ctx->entry_caches[i].lock);
+    }
+}
+
+/**
+ * @brief Set up the wait objects of the default instance
+ */
+static void init_default_ctx(void) {
+    ctx_init_waits(&default_ctx);
+}
+
+void serial_options_default(serial_options_t *opts) {
+    if (opts == NULL) {
+        return;
+    }
+    memset(opts, 0, sizeof(*opts));
+    opts->queue_backend = QUEUE_BACKEND_TAILQ;
+    opts->log_sink = SERIAL_LOG_SINK_SYSLOG;
+    opts->pool_capacity = POOL_SIZE;
+    opts->pool_growth = 0;
+    opts->pool_max_capacity = 0;
+    opts->pool_chunk_size = POOL_SIZE;
+    opts->coalesce = 0;
+    opts->thread_cache = 0;
+    opts->transmitter = 0;
+    opts->tx_frames_per_write = TX_DEFAULT_FRAMES_PER_WRITE;
+    opts->receiver = 0;
+    opts->rx_callback = NULL;
+    opts->rx_user = NULL;
+    opts->ack_window = 0;
+    opts->ack_timeout_ms = ACK_DEFAULT_TIMEOUT_MS;
+    opts->ack_retries = ACK_DEFAULT_RETRIES;
+    opts->timers = 0;
+    opts->shm_name = NULL;
+    opts->shm_capacity = SHM_DEFAULT_CAPACITY;
+    opts->auto_reconnect = 0;
+    opts->reconnect_min_ms = RECONNECT_DEFAULT_MIN_MS;
+    opts->reconnect_max_ms = RECONNECT_DEFAULT_MAX_MS;
+    opts->capture_path = NULL;
+    opts->capture_capacity = CAPTURE_DEFAULT_CAPACITY;
+    opts->line_profile = SERIAL_LINE_DEFAULT;
+    opts->baud_rate = 0;
+    opts->overflow_set_params = OVERFLOW_REJECT;
+    opts->overflow_on_off = OVERFLOW_REJECT;
+    opts->overflow_timeout_ms = OVERFLOW_DEFAULT_TIMEOUT_MS;
+    opts->emergency_reserve = 0;
+    opts->tx_thread.cpu = -1;
+    opts->tx_thread.priority = 0;
+    opts->lock_memory = 0;
+}
+
+static void wake_all(serial_ctx_t *ctx, struct wait_point *wp);
+static int ctx_deinit(serial_ctx_t *ctx);
+static void reset_tx_stats(serial_ctx_t *ctx);
+static int start_transmitter(serial_ctx_t *ctx);
+static void stop_transmitter(serial_ctx_t *ctx);
+static void reactor_kick(serial_ctx_t *ctx);
+static void reset_rx(serial_ctx_t *ctx);
+static int start_receiver(serial_ctx_t *ctx);
+static void stop_receiver(serial_ctx_t *ctx);
+static void reset_timers(serial_ctx_t *ctx);
+static int start_timers(serial_ctx_t *ctx);
+static void stop_timers(serial_ctx_t *ctx);
+static int shm_valid_name(const char *name);
+static int start_shm_ingress(serial_ctx_t *ctx, const char *name, size_t capacity);
+static void stop_shm_ingress(serial_ctx_t *ctx);
+static int start_reconnector(serial_ctx_t *ctx);
+static void stop_reconnector(serial_ctx_t *ctx);
+
+/**
+ * @brief Open and configure the serial port of an instance
+ *
+ * Uses the name, rate and line profile stored in the instance. /dev/null is
+ * opened without the terminal setup, for testing.
+ *
+ * @param ctx Instance handle
+ * @param info Structure filled with the line settings the driver applied
+ * @return File descriptor of the port, or -1 on failure
+ */
+static int open_port(serial_ctx_t *ctx, serial_line_info_t *info) {
+    int fd;
+
+    // For testing with /dev/null skip the terminal setup
+    if (!ctx->port_tty) {
+        memset(info, 0, sizeof(*info));
+        fd = open(ctx->port_name, O_RDWR);
+        if (fd < 0) {
+            SERIAL_LOG(LOG_WARNING, "Failed to open %s", ctx->port_name);
+            return -1;
+        }
+        SERIAL_LOG(LOG_INFO, "Serial communication initialized with /dev/null (test mode)");
+        return fd;
+    }
+
+    // Try to open the serial port, readable for the replies of the charger
+    fd = open(ctx->port_name, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to open serial port %s", ctx->port_name);
+        return -1;
+    }
+    SERIAL_LOG(LOG_INFO, "Serial port %s opened successfully", ctx->port_name);
+
+    // Set up the terminal settings
+    if (serial_line_configure(fd, ctx->port_speed, ctx->port_baud, ctx->line_profile, info) != EXIT_SUCCESS) {
+        SERIAL_LOG(LOG_WARNING, "Failed to configure terminal attributes for %s", ctx->port_name);
+        close(fd);
+        return -1;
+    }
+    SERIAL_LOG(LOG_INFO, "Terminal attributes configured for serial port %s: %u baud, VMIN %u, VTIME %u, low latency %d",
+               ctx->port_name, info->output_baud, info->vmin, info->vtime, info->low_latency);
+    return fd;
+}
+
+/**
+ * @brief Check an overflow policy against the queue backend
+ *
+ * Dropping and coalescing rewrite the active pool in place, which only the
+ * TAILQ backend allows.
+ *
+ * @param policy Policy to check
+ * @param backend Queue backend of the instance
+ * @return Non-zero if the policy is known and supported by the backend
+ */
+static int overflow_policy_supported(overflow_policy_t policy, queue_backend_t backend) {
+    switch (policy) {
+        case OVERFLOW_REJECT:
+        case OVERFLOW_BLOCK:
+            return 1;
+        case OVERFLOW_DROP_OLDEST:
+        case OVERFLOW_COALESCE:
+            return backend == QUEUE_BACKEND_TAILQ;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Initialize an instance: open the port and set up the command pools
+ *
+ * The wait objects of the instance must have been created already.
+ *
+ * @param ctx Instance to initialize
+ * @param port_name Serial port name (max 30 characters)
+ * @param speed Communication speed
+ * @param opts Pointer to the options, or NULL for defaults
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+static int ctx_init(serial_ctx_t *ctx, const char *port_name, int speed,
+                    const serial_options_t *opts) {
+    serial_options_t options;
+    // Check if already initialized
+    if (ctx->initialized) {
+        SERIAL_LOG(LOG_WARNING, "Serial communication already initialized");
+        return EXIT_FAILURE;
+    }
+
+    // Resolve the options, falling back to defaults
+    serial_options_default(&options);
+    if (opts != NULL) {
+        options = *opts;
+    }
+    if (options.queue_backend != QUEUE_BACKEND_TAILQ &&
+        options.queue_backend != QUEUE_BACKEND_RING) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: unknown queue backend %d", options.queue_backend);
+        return EXIT_FAILURE;
+    }
+    if (options.pool_capacity == 0 || options.pool_capacity > POOL_MAX_CAPACITY) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: pool_capacity must be 1-%u", POOL_MAX_CAPACITY);
+        return EXIT_FAILURE;
+    }
+    if (options.pool_growth) {
+        if (options.queue_backend == QUEUE_BACKEND_RING) {
+            SERIAL_LOG(LOG_WARNING, "Initialization failed: pool growth is not supported by the ring backend");
+            return EXIT_FAILURE;
+        }
+        if (options.pool_max_capacity == 0) {
+            options.pool_max_capacity = POOL_MAX_CAPACITY;
+        }
+        if (options.pool_max_capacity < options.pool_capacity ||
+            options.pool_max_capacity > POOL_MAX_CAPACITY || options.pool_chunk_size == 0) {
+            SERIAL_LOG(LOG_WARNING, "Initialization failed: invalid pool growth limits");
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.thread_cache && options.queue_backend == QUEUE_BACKEND_RING) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: thread caches are not supported by the ring backend");
+        return EXIT_FAILURE;
+    }
+    if (options.coalesce && options.queue_backend == QUEUE_BACKEND_RING) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: coalescing is not supported by the ring backend");
+        return EXIT_FAILURE;
+    }
+    if (options.timers && options.queue_backend == QUEUE_BACKEND_RING) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: timers are not supported by the ring backend");
+        return EXIT_FAILURE;
+    }
+    if (!overflow_policy_supported(options.overflow_set_params, options.queue_backend) ||
+        !overflow_policy_supported(options.overflow_on_off, options.queue_backend)) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: overflow policy unknown or not supported by the queue backend");
+        return EXIT_FAILURE;
+    }
+    if (options.overflow_timeout_ms == 0 || options.emergency_reserve >= options.pool_capacity) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: invalid overflow timeout or emergency reserve");
+        return EXIT_FAILURE;
+    }
+    if (!serial_sched_valid(&options.tx_thread)) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: invalid tx_thread CPU %d or priority %d",
+                   options.tx_thread.cpu, options.tx_thread.priority);
+        return EXIT_FAILURE;
+    }
+    if (options.shm_name != NULL &&
+        (!shm_valid_name(options.shm_name) || options.shm_capacity == 0 ||
+         options.shm_capacity > SHM_MAX_CAPACITY)) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: invalid shared-memory name or capacity");
+        return EXIT_FAILURE;
+    }
+    if (options.auto_reconnect &&
+        (options.reconnect_min_ms == 0 || options.reconnect_max_ms < options.reconnect_min_ms)) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: invalid reconnection delays");
+        return EXIT_FAILURE;
+    }
+    if (options.capture_path != NULL &&
+        (options.capture_capacity == 0 || options.capture_capacity > CAPTURE_MAX_CAPACITY)) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: capture_capacity must be 1-%u", CAPTURE_MAX_CAPACITY);
+        return EXIT_FAILURE;
+    }
+    if (options.line_profile != SERIAL_LINE_DEFAULT && options.line_profile != SERIAL_LINE_LOW_LATENCY &&
+        options.line_profile != SERIAL_LINE_THROUGHPUT) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: unknown line profile %d", options.line_profile);
+        return EXIT_FAILURE;
+    }
+    if (options.tx_frames_per_write == 0 || options.tx_frames_per_write > TX_MAX_FRAMES_PER_WRITE) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: tx_frames_per_write must be 1-%d", TX_MAX_FRAMES_PER_WRITE);
+        return EXIT_FAILURE;
+    }
+    if (options.ack_window > ACK_MAX_WINDOW) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: ack_window must be 0-%d", ACK_MAX_WINDOW);
+        return EXIT_FAILURE;
+    }
+    if (options.ack_window > 0 && (!options.transmitter || options.ack_timeout_ms == 0)) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: ack_window needs the transmitter and a timeout");
+        return EXIT_FAILURE;
+    }
+
+    // Check for NULL or too long port name
+    if (port_name == NULL || strlen(port_name) > MAX_PORT_NAME) {
+        if (port_name == NULL) {
+            SERIAL_LOG(LOG_WARNING, "Initialization failed: port name is NULL");
+        } else {
+            SERIAL_LOG(LOG_WARNING, "Initialization failed: port name exceeds maximum length (%d characters)", MAX_PORT_NAME);
+        }
+        return EXIT_FAILURE;
+    }
+
+    // Open the log sink
+    if (serial_log_open(options.log_sink) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    SERIAL_LOG(LOG_INFO, "Initializing serial communication module");
+
+    // Open the serial port
+    strcpy(ctx->port_name, port_name);
+    ctx->port_speed = speed;
+    ctx->port_baud = options.baud_rate;
+    ctx->port_tty = strcmp(port_name, "/dev/null") != 0;
+    ctx->line_profile = options.line_profile;
+    ctx->serial_fd = open_port(ctx, &ctx->line_info);
+    if (ctx->serial_fd < 0) {
+        serial_log_close();
+        return EXIT_FAILURE;
+    }
+    __atomic_store_n(&ctx->port_down, 0, __ATOMIC_RELAXED);
+
+    // Initialize the semaphore
+    if (sem_init(&ctx->cmd_semaphore, 0, 1) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to initialize semaphore");
+        if (ctx->serial_fd >= 0) close(ctx->serial_fd);
+        serial_log_close();
+        return EXIT_FAILURE;
+    }
+    SERIAL_LOG(LOG_INFO, "Semaphore initialized successfully");
+
+    __atomic_store_n(&ctx->command_counts, 0, __ATOMIC_RELEASE);
+    ctx->lock_memory = options.lock_memory;
+    __atomic_store_n(&ctx->memory_locked, options.lock_memory ? 1 : -1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->locked_bytes, 0, __ATOMIC_RELAXED);
+    if (options.queue_backend == QUEUE_BACKEND_RING) {
+        // Allocate the routine ring for the pool, and the emergency ring for the
+        // pool and as many emergency commands queued over it
+        if (ring_init(ctx, &ctx->command_ring, options.pool_capacity) != EXIT_SUCCESS ||
+            ring_init(ctx, &ctx->emergency_ring, 2 * options.pool_capacity) != EXIT_SUCCESS) {
+            SERIAL_LOG(LOG_WARNING, "Failed to allocate memory for command ring (capacity=%zu)", options.pool_capacity);
+            ring_free(ctx, &ctx->command_ring);
+            if (ctx->serial_fd >= 0) close(ctx->serial_fd);
+            sem_destroy(&ctx->cmd_semaphore);
+            serial_log_close();
+            return EXIT_FAILURE;
+        }
+        ctx->pool_capacity = options.pool_capacity;
+        __atomic_store_n(&ctx->emergency_overdraft, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&ctx->command_counts, (uint64_t)ctx->pool_capacity, __ATOMIC_RELEASE);
+        SERIAL_LOG(LOG_INFO, "Lock-free command rings initialized with %zu slots", ctx->pool_capacity);
+    } else {
+        // Initialize the active and unused command pools
+        TAILQ_INIT(&ctx->active_command_pool);
+        TAILQ_INIT(&ctx->emergency_command_pool);
+        TAILQ_INIT(&ctx->unused_command_pool);
+        ctx->unused_list_len = 0;
+        for (size_t i = 0; i < THREAD_CACHE_SLOTS; i++) {
+            ctx->entry_caches[i].count = 0;
+        }
+        reset_timers(ctx);
+        SERIAL_LOG(LOG_INFO, "Active and unused command pools initialized");
+
+        // Allocate the first chunk of pool entries and add it to the unused pool
+        if (pool_add_chunk(ctx, options.pool_capacity) != EXIT_SUCCESS) {
+            SERIAL_LOG(LOG_WARNING, "Failed to allocate memory for command pool (capacity=%zu)", options.pool_capacity);
+            if (ctx->serial_fd >= 0) close(ctx->serial_fd);
+            sem_destroy(&ctx->cmd_semaphore);
+            serial_log_close();
+            return EXIT_FAILURE;
+        }
+        SERIAL_LOG(LOG_INFO, "Memory allocated for %zu command pool entries", ctx->pool_capacity);
+    }
+    ctx->queue_backend = options.queue_backend;
+    ctx->pool_growth = options.pool_growth;
+    ctx->pool_max_capacity = options.pool_growth ? options.pool_max_capacity : ctx->pool_capacity;
+    ctx->pool_chunk_size = options.pool_chunk_size;
+    ctx->coalesce_commands = options.coalesce;
+    ctx->overflow_set_params = options.overflow_set_params;
+    ctx->overflow_on_off = options.overflow_on_off;
+    ctx->overflow_timeout_ns = (int64_t)options.overflow_timeout_ms * 1000000;
+    ctx->emergency_reserve = options.emergency_reserve;
+    ctx->track_pending = options.coalesce || options.overflow_set_params == OVERFLOW_COALESCE ||
+                         options.overflow_on_off == OVERFLOW_COALESCE;
+    ctx->thread_cache = options.thread_cache;
+    __atomic_store_n(&ctx->cache_slow_path, 0, __ATOMIC_RELAXED);
+    memset(ctx->pending_entries, 0, sizeof(ctx->pending_entries));
+    __atomic_store_n(&ctx->coalesced_commands, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->pool_grow_events, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->pool_high_water_mark, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->emergency_dequeued, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->emergency_latency_total_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->emergency_latency_max_ns, 0, __ATOMIC_RELAXED);
+    ctx->state_valid = 0;
+    __atomic_store_n(&ctx->state_lost, 0, __ATOMIC_RELAXED);
+
+    // Start the capture before the first command can be accepted
+    if (options.capture_path != NULL) {
+        ctx->capture = serial_capture_start(options.capture_path, options.capture_capacity);
+        if (ctx->capture == NULL) {
+            SERIAL_LOG(LOG_WARNING, "Initialization failed: could not create capture file %s", options.capture_path);
+            pool_free_chunks(ctx);
+            ring_free(ctx, &ctx->command_ring);
+            ring_free(ctx, &ctx->emergency_ring);
+            if (ctx->serial_fd >= 0) close(ctx->serial_fd);
+            sem_destroy(&ctx->cmd_semaphore);
+            serial_log_close();
+            return EXIT_FAILURE;
+        }
+        SERIAL_LOG(LOG_INFO, "Capturing accepted commands to %s", options.capture_path);
+    }
+
+    // Mark as initialized
+    ctx->kick_fd = -1;
+    ctx->rx_callback = options.rx_callback;
+    ctx->rx_user = options.rx_user;
+    reset_rx(ctx);
+    ctx->initialized = 1;
+
+    // Start the receive path if requested
+    if (options.receiver && start_receiver(ctx) != EXIT_SUCCESS) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: could not start receiver");
+        ctx_deinit(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // Start the transmit engine if requested
+    reset_tx_stats(ctx);
+    ctx->tx_frames_per_write = options.tx_frames_per_write;
+    ctx->ack_window = options.ack_window;
+    ctx->ack_timeout_ns = (uint64_t)options.ack_timeout_ms * 1000000u;
+    ctx->ack_retries = options.ack_retries;
+    ctx->tx_thread_opts = options.tx_thread;
+    memset(&ctx->tx_thread_info, 0, sizeof(ctx->tx_thread_info));
+    if (options.transmitter && start_transmitter(ctx) != EXIT_SUCCESS) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: could not start transmit engine");
+        ctx_deinit(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // Start the timer thread of the deferred commands if requested
+    if (options.timers && start_timers(ctx) != EXIT_SUCCESS) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: could not start timer thread");
+        ctx_deinit(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // Open the shared-memory ingress for other processes if requested
+    if (options.shm_name != NULL &&
+        start_shm_ingress(ctx, options.shm_name, options.shm_capacity) != EXIT_SUCCESS) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: could not create shared-memory ingress %s",
+                   options.shm_name);
+        ctx_deinit(ctx);
+        return EXIT_FAILURE;
+    }
+
+    // Start reopening the port in the background after failures if requested
+    ctx->reconnect_min_ns = (uint64_t)options.reconnect_min_ms * 1000000u;
+    ctx->reconnect_max_ns = (uint64_t)options.reconnect_max_ms * 1000000u;
+    if (options.auto_reconnect && start_reconnector(ctx) != EXIT_SUCCESS) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: could not start reconnect thread");
+        ctx_deinit(ctx);
+        return EXIT_FAILURE;
+    }
+
+    SERIAL_LOG(LOG_INFO, "Serial communication module initialized");
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Deinitialize an instance and release every thread blocked on it
+ *
+ * Returns only once no thread is waiting on the instance any more, so the
+ * caller may free it right away.
+ *
+ * @param ctx Instance to deinitialize
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+static int ctx_deinit(serial_ctx_t *ctx) {
+    // Check if initialized
+    if (!ctx->initialized) {
+        SERIAL_LOG(LOG_WARNING, "Deinitialization failed: module not initialized");
+        return EXIT_FAILURE;
+    }
+    SERIAL_LOG(LOG_INFO, "Starting serial communication module deinitialization");
+
+    // Stop the reconnect, reader, ingress, timer and writer threads and leave the reactor before the pools go away
+    stop_reconnector(ctx);
+    stop_receiver(ctx);
+    stop_shm_ingress(ctx);
+    stop_timers(ctx);
+    stop_transmitter(ctx);
+    if (__atomic_load_n(&ctx->reactor, __ATOMIC_ACQUIRE) != NULL) {
+        serial_reactor_remove(ctx->reactor, ctx);
+    }
+
+    // Lock the semaphore
+    if (sem_wait(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to lock semaphore during deinitialization");
+        return EXIT_FAILURE;
+    }
+
+    // Close the serial port
+    if (ctx->serial_fd >= 0) {
+        close(ctx->serial_fd);
+        SERIAL_LOG(LOG_INFO, "Serial port closed");
+        ctx->serial_fd = -1;
+    } else {
+        SERIAL_LOG(LOG_INFO, "Serial port already closed or was not opened");
+    }
+
+    // Free the pool entries
+    if (ctx->pool_chunks != NULL) {
+        pool_free_chunks(ctx);
+        SERIAL_LOG(LOG_INFO, "Command pool memory freed");
+    } else {
+        SERIAL_LOG(LOG_INFO, "Command pool memory already freed or not allocated");
+    }
+
+    // Free the ring slots
+    if (ctx->command_ring.slots != NULL) {
+        ring_free(ctx, &ctx->command_ring);
+        ring_free(ctx, &ctx->emergency_ring);
+        SERIAL_LOG(LOG_INFO, "Command ring memory freed");
+    }
+    ctx->pool_capacity = 0;
+    __atomic_store_n(&ctx->command_counts, 0, __ATOMIC_RELEASE);
+
+    // Finish the capture file
+    if (ctx->capture != NULL) {
+        if (serial_capture_stop(ctx->capture) != EXIT_SUCCESS) {
+            SERIAL_LOG(LOG_WARNING, "Failed to finish capture file");
+        }
+        ctx->capture = NULL;
+    }
+
+    // Unlock and destroy the semaphore
+    if (sem_post(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to unlock semaphore during deinitialization");
+    }
+    if (sem_destroy(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to destroy semaphore");
+    } else {
+        SERIAL_LOG(LOG_INFO, "Semaphore destroyed");
+    }
+
+    // Close the reactor wake-up
+    if (ctx->kick_fd >= 0) {
+        close(ctx->kick_fd);
+        ctx->kick_fd = -1;
+    }
+
+    // Close the log sink
+    SERIAL_LOG(LOG_INFO, "Serial communication module deinitialized");
+    serial_log_close();
+
+    // Mark as not initialized and release any blocked waiters
+    pthread_mutex_lock(&ctx->wait_mutex);
+    ctx->initialized = 0;
+    pthread_mutex_unlock(&ctx->wait_mutex);
+    wake_all(ctx, &ctx->cmd_wait);
+    wake_all(ctx, &ctx->slot_wait);
+
+    // Wait until every released thread has left the wait points
+    while (__atomic_load_n(&ctx->cmd_wait.waiters, __ATOMIC_ACQUIRE) > 0 ||
+           __atomic_load_n(&ctx->slot_wait.waiters, __ATOMIC_ACQUIRE) > 0) {
+        sched_yield();
+    }
+    return EXIT_SUCCESS;
+}
+
+serial_ctx_t *serial_init(const char *port, int speed, const serial_options_t *opts) {
+    // The field groups of the instance are laid out on whole cache lines
+    void *memory = NULL;
+    if (posix_memalign(&memory, CACHE_LINE_SIZE, sizeof(serial_ctx_t)) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Initialization failed: cannot allocate instance");
+        return NULL;
+    }
+    serial_ctx_t *ctx = memory;
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx_init_waits(ctx);
+    if (ctx_init(ctx, port, speed, opts) != EXIT_SUCCESS) {
+        ctx_destroy_waits(ctx);
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+int serial_deinit(serial_ctx_t *ctx) {
+    if (ctx == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Deinitialization failed: NULL instance");
+        return EXIT_FAILURE;
+    }
+
+    int result = ctx_deinit(ctx);
+    ctx_destroy_waits(ctx);
+    free(ctx);
+    return result;
+}
+
+int init(const char *port_name, int speed) {
+    return init_with_options(port_name, speed, NULL);
+}
+
+int init_with_options(const char *port_name, int speed, const serial_options_t *opts) {
+    pthread_once(&default_once, init_default_ctx);
+    return ctx_init(&default_ctx, port_name, speed, opts);
+}
+
+int deinit(void) {
+    return ctx_deinit(&default_ctx);
+}
+
+/**
+ * @brief Unconditionally wake every thread blocked on a wait point
+ *
+ * @param ctx Instance handle
+ * @param wp Wait point to signal
+ */
+static void wake_all(serial_ctx_t *ctx, struct wait_point *wp) {
+    pthread_mutex_lock(&ctx->wait_mutex);
+    __atomic_add_fetch(&wp->generation, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&wp->cond);
+    pthread_mutex_unlock(&ctx->wait_mutex);
+}
+
+/**
+ * @brief Wake the threads blocked on a wait point, if any
+ *
+ * The waiter count is checked after a full fence so that the common case
+ * without blocked threads costs no lock and no syscall. A waiter registers
+ * before retrying its operation, so either it sees the change made by the
+ * caller or the caller sees the waiter.
+ *
+ * @param ctx Instance handle
+ * @param wp Wait point to signal
+ */
+static void wake_waiters(serial_ctx_t *ctx, struct wait_point *wp) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&wp->waiters, __ATOMIC_RELAXED) > 0) {
+        wake_all(ctx, wp);
+    }
+}
+
+/**
+ * @brief Get the coalescing slot of a command
+ *
+ * @param cmd Pointer to the validated command
+ * @return Index into pending_entries, or -1 if the command is never coalesced
+ */
+static int coalesce_key(const device_command_t *cmd) {
+    switch (cmd->command_type) {
+        case CMD_ON_OFF:
+            return cmd->data.on_off.channel;
+        case CMD_SET_PARAMS:
+            return COALESCE_SET_PARAMS;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Mark the field of a pending command as lost to the state table
+ *
+ * Called when a pending routine command is discarded, or overwritten by a
+ * command that did not come from set_channel_state(), so the next
+ * set_channel_state() sends that field again.
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the discarded or overwritten command
+ */
+static void state_field_lost(serial_ctx_t *ctx, const device_command_t *cmd) {
+    int key = coalesce_key(cmd);
+    if (key >= 0) {
+        __atomic_or_fetch(&ctx->state_lost, UINT32_C(1) << key, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Count the entries a run of commands needs from the unused pool
+ *
+ * With coalescing enabled, commands that replace a pending entry, or an
+ * earlier command of the same run, need no entry of their own. Must be
+ * called with cmd_semaphore held.
+ *
+ * @param ctx Instance handle
+ * @param cmds Array of validated commands
+ * @param n Number of commands in the array
+ * @return Number of entries needed
+ */
+static size_t count_new_entries(serial_ctx_t *ctx, const device_command_t *cmds, size_t n) {
+    int seen[CHANNEL_COUNT + 1] = { 0 };
+    size_t needed = 0;
+
+    if (!ctx->coalesce_commands) {
+        return n;
+    }
+    for (size_t i = 0; i < n; i++) {
+        int key = coalesce_key(&cmds[i]);
+        if (key < 0) {
+            needed++;
+        } else if (ctx->pending_entries[key] == NULL && !seen[key]) {
+            seen[key] = 1;
+            needed++;
+        }
+    }
+    return needed;
+}
+
+/**
+ * @brief Get the number of entries a run of commands must leave unused
+ *
+ * @param ctx Instance handle
+ * @param cmds Array of validated commands
+ * @param n Number of commands in the array
+ * @return emergency_reserve if the run holds a routine command, 0 otherwise
+ */
+static size_t admission_reserve(const serial_ctx_t *ctx, const device_command_t *cmds, size_t n) {
+    if (ctx->emergency_reserve == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (cmds[i].command_type != CMD_EMERGENCY) {
+            return ctx->emergency_reserve;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Make sure a run of routine commands leaves the emergency reserve unused
+ *
+ * Entries in thread caches count as unused. Must be called with
+ * cmd_semaphore held.
+ *
+ * @param ctx Instance handle
+ * @param needed Number of entries the run takes
+ * @param reserve Number of entries that must stay unused afterwards
+ * @return EXIT_SUCCESS if enough entries are left, possibly after growing the pool, EXIT_FAILURE otherwise
+ */
+static int keep_reserve(serial_ctx_t *ctx, size_t needed, size_t reserve) {
+    size_t unused = (size_t)(__atomic_load_n(&ctx->command_counts, __ATOMIC_RELAXED) & COUNT_UNUSED_MASK);
+
+    if (reserve == 0 || unused >= needed + reserve) {
+        return EXIT_SUCCESS;
+    }
+    return pool_grow(ctx, ctx->unused_list_len + needed + reserve - unused);
+}
+
+/**
+ * @brief Move a run of validated commands into the active pool
+ *
+ * The run is queued in order and all-or-nothing: if the unused pool cannot
+ * hold every command, nothing is queued. A run holding routine commands
+ * must leave emergency_reserve entries unused.
+ *
+ * @param ctx Instance handle
+ * @param cmds Array of validated commands
+ * @param n Number of commands in the array
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the pool is full or locking failed
+ */
+static int push_commands(serial_ctx_t *ctx, const device_command_t *cmds, size_t n) {
+    // The ring backend publishes the commands without taking the semaphore
+    if (ctx->queue_backend == QUEUE_BACKEND_RING) {
+        if (reserve_unused_entries(ctx, n, admission_reserve(ctx, cmds, n)) != EXIT_SUCCESS) {
+            SERIAL_LOG(LOG_WARNING, "Command pool is full (no unused entries available)");
+            return EXIT_FAILURE;
+        }
+
+        // Trace before publishing, so the add precedes the dequeue
+        if (SERIAL_TRACE_ACTIVE()) {
+            trace_commands(TRACE_ADD, cmds, n);
+        }
+
+        // Push each run of same-lane commands with a single claim
+        uint64_t now_ns = monotonic_ns();
+        size_t start = 0;
+        while (start < n) {
+            int emergency = cmds[start].command_type == CMD_EMERGENCY;
+            size_t end = start + 1;
+            while (end < n && (cmds[end].command_type == CMD_EMERGENCY) == emergency) {
+                end++;
+            }
+            ring_push_run(emergency ? &ctx->emergency_ring : &ctx->command_ring,
+                          &cmds[start], end - start, now_ns);
+            start = end;
+        }
+        if (ctx->capture != NULL) {
+            serial_capture_record(ctx->capture, cmds, n, now_ns);
+        }
+        __atomic_add_fetch(&ctx->stat_adds, n, __ATOMIC_RELAXED);
+        wake_waiters(ctx, &ctx->cmd_wait);
+        reactor_kick(ctx);
+        SERIAL_LOG(LOG_INFO, "Added %zu command(s) successfully, first: 0x%x", n, cmds[0].command_type);
+        return EXIT_SUCCESS;
+    }
+
+    // Take the entries from the thread cache before locking
+    struct cmd_entry *cached[THREAD_CACHE_SIZE];
+    struct entry_cache *cache = NULL;
+    size_t have = 0;
+    size_t used = 0;
+    if (ctx->thread_cache && n <= THREAD_CACHE_SIZE) {
+        cache = thread_entry_cache(ctx);
+        have = cache_take(cache, cached, n);
+    }
+
+    // Lock the semaphore
+    if (sem_wait(&ctx->cmd_semaphore) != 0) {
+        if (cache != NULL) {
+            cache_put(ctx, cache, cached, have);
+        }
+        SERIAL_LOG(LOG_WARNING, "Failed to lock semaphore while adding command");
+        return EXIT_FAILURE;
+    }
+
+    // Check if there are enough unused entries available, growing the pool if allowed
+    size_t needed = count_new_entries(ctx, cmds, n);
+    size_t missing = needed > have ? needed - have : 0;
+    if (missing > 0 && ctx->thread_cache) {
+        __atomic_add_fetch(&ctx->cache_slow_path, 1, __ATOMIC_RELAXED);
+        // Collect what other threads keep cached before growing or failing
+        if (ctx->unused_list_len < missing) {
+            cache_drain(ctx, NULL, missing - ctx->unused_list_len);
+        }
+    }
+    if (pool_grow(ctx, missing) != EXIT_SUCCESS ||
+        keep_reserve(ctx, needed, admission_reserve(ctx, cmds, n)) != EXIT_SUCCESS) {
+        sem_post(&ctx->cmd_semaphore);
+        if (cache != NULL) {
+            cache_put(ctx, cache, cached, have);
+        }
+        SERIAL_LOG(LOG_WARNING, "Command pool is full (no unused entries available)");
+        return EXIT_FAILURE;
+    }
+
+    if (SERIAL_TRACE_ACTIVE()) {
+        trace_commands(TRACE_ADD, cmds, n);
+    }
+
+    uint64_t now_ns = monotonic_ns();
+    size_t added = 0;
+    for (size_t i = 0; i < n; i++) {
+        // Replace a superseded pending command in place
+        int key = ctx->track_pending ? coalesce_key(&cmds[i]) : -1;
+        if (ctx->coalesce_commands && key >= 0 && ctx->pending_entries[key] != NULL) {
+            if (!state_table_push) {
+                state_field_lost(ctx, &ctx->pending_entries[key]->cmd);
+            }
+            memcpy(&ctx->pending_entries[key]->cmd, &cmds[i], sizeof(device_command_t));
+            __atomic_add_fetch(&ctx->coalesced_commands, 1, __ATOMIC_RELAXED);
+            SERIAL_LOG(LOG_INFO, "Coalesced command 0x%x into pending entry", cmds[i].command_type);
+            continue;
+        }
+
+        // Take a cached entry or remove one from the unused pool
+        struct cmd_entry *entry = used < have ? cached[used++] : unused_list_take(ctx);
+
+        // Copy the command into the entry
+        memcpy(&entry->cmd, &cmds[i], sizeof(device_command_t));
+        entry->enqueue_ns = now_ns;
+
+        // Add the entry to its lane of the active pool
+        if (entry->cmd.command_type == CMD_EMERGENCY) {
+            TAILQ_INSERT_TAIL(&ctx->emergency_command_pool, entry, entries);
+        } else {
+            TAILQ_INSERT_TAIL(&ctx->active_command_pool, entry, entries);
+        }
+        if (key >= 0) {
+            ctx->pending_entries[key] = entry;
+        }
+        added++;
+    }
+    update_high_water_mark(ctx, __atomic_add_fetch(&ctx->command_counts, added * COUNT_MOVE_TO_ACTIVE,
+                                              __ATOMIC_RELEASE));
+    SERIAL_LOG(LOG_INFO, "Command(s) copied and added to active command pool");
+
+    // Keep entries left over by coalescing, and refill an exhausted cache
+    size_t keep = have - used;
+    memmove(cached, &cached[used], keep * sizeof(cached[0]));
+    if (cache != NULL && missing > 0) {
+        while (keep < THREAD_CACHE_BATCH && ctx->unused_list_len > 0) {
+            cached[keep++] = unused_list_take(ctx);
+        }
+    }
+
+    // Unlock the semaphore
+    if (sem_post(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to unlock semaphore after adding command");
+    } else {
+        SERIAL_LOG(LOG_INFO, "Semaphore unlocked after adding command");
+    }
+    if (cache != NULL && keep > 0) {
+        cache_put(ctx, cache, cached, keep);
+    }
+    if (ctx->capture != NULL) {
+        serial_capture_record(ctx->capture, cmds, n, now_ns);
+    }
+    __atomic_add_fetch(&ctx->stat_adds, n, __ATOMIC_RELAXED);
+    wake_waiters(ctx, &ctx->cmd_wait);
+    reactor_kick(ctx);
+
+    // Log the success
+    SERIAL_LOG(LOG_INFO, "Added %zu command(s) successfully, first: 0x%x", n, cmds[0].command_type);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Move up to max of the oldest active commands back to the unused pool
+ *
+ * The emergency lane is always drained before routine commands.
+ *
+ * @param ctx Instance handle
+ * @param out Array to store the retrieved commands
+ * @param max Maximum number of commands to retrieve
+ * @return Number of commands retrieved, 0 if none was available
+ */
+static size_t pop_commands(serial_ctx_t *ctx, device_command_t *out, size_t max) {
+    size_t count = 0;
+
+    if (ctx->queue_backend == QUEUE_BACKEND_RING) {
+        uint64_t enqueue_ns;
+        uint64_t now_ns = monotonic_ns();
+        while (count < max && ring_pop(&ctx->emergency_ring, &out[count], &enqueue_ns) == EXIT_SUCCESS) {
+            record_emergency_latency(ctx, enqueue_ns, now_ns);
+            record_residency(ctx, enqueue_ns, now_ns);
+            count++;
+        }
+        // Emergency commands queued over the capacity of the pool hold no entry to return
+        size_t repaid = __atomic_load_n(&ctx->emergency_overdraft, __ATOMIC_RELAXED);
+        while (repaid > 0 && !__atomic_compare_exchange_n(&ctx->emergency_overdraft, &repaid,
+                                                          repaid > count ? repaid - count : 0, 1,
+                                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        repaid = repaid > count ? count : repaid;
+        while (count < max && ring_pop(&ctx->command_ring, &out[count], &enqueue_ns) == EXIT_SUCCESS) {
+            record_residency(ctx, enqueue_ns, now_ns);
+            count++;
+        }
+        if (count == 0) {
+            SERIAL_LOG(LOG_INFO, "No active commands available");
+            return 0;
+        }
+        __atomic_add_fetch(&ctx->stat_dequeues, count, __ATOMIC_RELAXED);
+        if (SERIAL_TRACE_ACTIVE()) {
+            trace_commands(TRACE_DEQUEUE, out, count);
+        }
+        __atomic_add_fetch(&ctx->command_counts, (count - repaid) * COUNT_MOVE_TO_UNUSED, __ATOMIC_RELEASE);
+        wake_waiters(ctx, &ctx->slot_wait);
+        SERIAL_LOG(LOG_INFO, "Retrieved %zu command(s) from command ring", count);
+        return count;
+    }
+
+    // Room for the freed entries in the thread cache, read before locking
+    struct cmd_entry *freed[THREAD_CACHE_SIZE];
+    struct entry_cache *cache = NULL;
+    size_t room = 0;
+    size_t nfreed = 0;
+    if (ctx->thread_cache) {
+        cache = thread_entry_cache(ctx);
+        pthread_mutex_lock(&cache->lock);
+        room = THREAD_CACHE_SIZE - cache->count;
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    // Lock the semaphore
+    if (sem_wait(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to lock semaphore while getting command");
+        return 0;
+    }
+
+    // Drain a full cache in one go rather than one entry per retrieval
+    if (cache != NULL && room < THREAD_CACHE_BATCH && room < max &&
+        (TAILQ_FIRST(&ctx->emergency_command_pool) != NULL || TAILQ_FIRST(&ctx->active_command_pool) != NULL)) {
+        __atomic_add_fetch(&ctx->cache_slow_path, 1, __ATOMIC_RELAXED);
+        room += cache_drain(ctx, cache, THREAD_CACHE_BATCH);
+    }
+
+    struct cmd_entry *entry;
+    uint64_t now_ns = monotonic_ns();
+    while (count < max && (entry = TAILQ_FIRST(&ctx->emergency_command_pool)) != NULL) {
+        // Remove entry from the emergency lane first
+        TAILQ_REMOVE(&ctx->emergency_command_pool, entry, entries);
+        record_emergency_latency(ctx, entry->enqueue_ns, now_ns);
+        record_residency(ctx, entry->enqueue_ns, now_ns);
+
+        memcpy(&out[count], &entry->cmd, sizeof(device_command_t));
+        if (nfreed < room) {
+            freed[nfreed++] = entry;
+        } else {
+            unused_list_put(ctx, entry);
+        }
+        count++;
+    }
+    while (count < max && (entry = TAILQ_FIRST(&ctx->active_command_pool)) != NULL) {
+        // Remove entry from active pool
+        TAILQ_REMOVE(&ctx->active_command_pool, entry, entries);
+        if (ctx->track_pending) {
+            int key = coalesce_key(&entry->cmd);
+            if (key >= 0 && ctx->pending_entries[key] == entry) {
+                ctx->pending_entries[key] = NULL;
+            }
+        }
+
+        // Copy the command to the output parameter
+        memcpy(&out[count], &entry->cmd, sizeof(device_command_t));
+        record_residency(ctx, entry->enqueue_ns, now_ns);
+
+        // Return the entry to the thread cache or the unused pool
+        if (nfreed < room) {
+            freed[nfreed++] = entry;
+        } else {
+            unused_list_put(ctx, entry);
+        }
+        count++;
+    }
+
+    // Check if there were any active commands
+    if (count == 0) {
+        sem_post(&ctx->cmd_semaphore);
+        SERIAL_LOG(LOG_INFO, "No active commands available");
+        return 0;
+    }
+    __atomic_add_fetch(&ctx->stat_dequeues, count, __ATOMIC_RELAXED);
+    if (SERIAL_TRACE_ACTIVE()) {
+        trace_commands(TRACE_DEQUEUE, out, count);
+    }
+    __atomic_add_fetch(&ctx->command_counts, count * COUNT_MOVE_TO_UNUSED, __ATOMIC_RELEASE);
+    SERIAL_LOG(LOG_INFO, "Retrieved %zu command(s) and returned entries to unused pool", count);
+
+    // Unlock the semaphore
+    if (sem_post(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to unlock semaphore after getting command");
+    }
+    // Cache the entries before waking blocked producers, so they can steal them
+    if (nfreed > 0) {
+        cache_put(ctx, cache, freed, nfreed);
+    }
+    wake_waiters(ctx, &ctx->slot_wait);
+
+    return count;
+}
+
+/**
+ * @brief Move a validated command into the active pool
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the validated command
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the pool is full or locking failed
+ */
+static int push_command(serial_ctx_t *ctx, const device_command_t *cmd) {
+    return push_commands(ctx, cmd, 1);
+}
+
+/**
+ * @brief Move the oldest active command back to the unused pool
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to store the retrieved command
+ * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE otherwise
+ */
+static int pop_command(serial_ctx_t *ctx, device_command_t *cmd) {
+    return pop_commands(ctx, cmd, 1) == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Retry a pool operation until it succeeds or the timeout expires
+ *
+ * The operation is always attempted without holding wait_mutex, since a
+ * successful attempt wakes the opposite wait point itself. The caller only
+ * sleeps if the generation of the wait point did not change since its
+ * attempt, so a wake-up in between is never lost. With a negative timeout the
+ * function waits until the operation succeeds or the module is deinitialized.
+ *
+ * @param ctx Instance handle
+ * @param wp Wait point signaled when the operation may succeed
+ * @param attempt Non-blocking operation to retry
+ * @param arg Argument passed to attempt
+ * @param timeout_ns Relative timeout in nanoseconds, or WAIT_FOREVER
+ * @return EXIT_SUCCESS if the operation succeeded, EXIT_FAILURE otherwise
+ */
+static int wait_for(serial_ctx_t *ctx, struct wait_point *wp, int (*attempt)(serial_ctx_t *, void *), void *arg,
+                    int64_t timeout_ns) {
+    // Fast path: no need to block if the operation succeeds right away
+    if (attempt(ctx, arg) == EXIT_SUCCESS) {
+        return EXIT_SUCCESS;
+    }
+    if (timeout_ns == 0) {
+        return EXIT_FAILURE;
+    }
+
+    struct timespec deadline;
+    if (timeout_ns > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t)(timeout_ns / 1000000000);
+        deadline.tv_nsec += (long)(timeout_ns % 1000000000);
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    int result = EXIT_FAILURE;
+    __atomic_add_fetch(&wp->waiters, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        unsigned generation = __atomic_load_n(&wp->generation, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (attempt(ctx, arg) == EXIT_SUCCESS) {
+            result = EXIT_SUCCESS;
+            break;
+        }
+
+        int rc = 0;
+        pthread_mutex_lock(&ctx->wait_mutex);
+        while (ctx->initialized && rc != ETIMEDOUT &&
+               __atomic_load_n(&wp->generation, __ATOMIC_ACQUIRE) == generation) {
+            rc = (timeout_ns > 0) ? pthread_cond_timedwait(&wp->cond, &ctx->wait_mutex, &deadline)
+                                  : pthread_cond_wait(&wp->cond, &ctx->wait_mutex);
+        }
+        int still_initialized = ctx->initialized;
+        pthread_mutex_unlock(&ctx->wait_mutex);
+
+        if (!still_initialized) {
+            break;
+        }
+        if (rc == ETIMEDOUT) {
+            // One last try in case the wake-up raced with the timeout
+            result = attempt(ctx, arg);
+            break;
+        }
+    }
+    __atomic_sub_fetch(&wp->waiters, 1, __ATOMIC_SEQ_CST);
+    return result;
+}
+
+/**
+ * @brief Adapter for retrying push_command() from wait_for()
+ *
+ * @param ctx Instance handle
+ * @param arg Pointer to the validated command
+ * @return Result of push_command()
+ */
+static int push_attempt(serial_ctx_t *ctx, void *arg) {
+    return push_command(ctx, (const device_command_t *)arg);
+}
+
+/**
+ * @brief Queue a command into a full pool by replacing a pending routine command
+ *
+ * With OVERFLOW_COALESCE the newest pending command for the same channel or
+ * parameters is overwritten in place. Otherwise the oldest pending routine
+ * command is discarded and its entry queued again at the end of the lane of
+ * the new command. TAILQ backend only.
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the validated command
+ * @param policy OVERFLOW_COALESCE or OVERFLOW_DROP_OLDEST
+ * @return EXIT_SUCCESS if the command was queued, EXIT_FAILURE if nothing could be replaced
+ */
+static int push_replacing(serial_ctx_t *ctx, const device_command_t *cmd, overflow_policy_t policy) {
+    struct cmd_entry *entry;
+
+    if (sem_wait(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to lock semaphore while adding command");
+        return EXIT_FAILURE;
+    }
+    uint64_t now_ns = monotonic_ns();
+    if (policy == OVERFLOW_COALESCE) {
+        int key = coalesce_key(cmd);
+        entry = key >= 0 ? ctx->pending_entries[key] : NULL;
+        if (entry == NULL) {
+            sem_post(&ctx->cmd_semaphore);
+            return EXIT_FAILURE;
+        }
+        state_field_lost(ctx, &entry->cmd);
+        memcpy(&entry->cmd, cmd, sizeof(device_command_t));
+        __atomic_add_fetch(&ctx->stat_overflow_coalesced, 1, __ATOMIC_RELAXED);
+    } else {
+        entry = TAILQ_FIRST(&ctx->active_command_pool);
+        if (entry == NULL) {
+            sem_post(&ctx->cmd_semaphore);
+            return EXIT_FAILURE;
+        }
+        TAILQ_REMOVE(&ctx->active_command_pool, entry, entries);
+        if (ctx->track_pending) {
+            int key = coalesce_key(&entry->cmd);
+            if (key >= 0 && ctx->pending_entries[key] == entry) {
+                ctx->pending_entries[key] = NULL;
+            }
+        }
+        SERIAL_LOG(LOG_WARNING, "Command pool is full, discarding pending command 0x%x", entry->cmd.command_type);
+        state_field_lost(ctx, &entry->cmd);
+
+        memcpy(&entry->cmd, cmd, sizeof(device_command_t));
+        entry->enqueue_ns = now_ns;
+        if (cmd->command_type == CMD_EMERGENCY) {
+            TAILQ_INSERT_TAIL(&ctx->emergency_command_pool, entry, entries);
+            __atomic_add_fetch(&ctx->stat_emergency_displaced, 1, __ATOMIC_RELAXED);
+        } else {
+            TAILQ_INSERT_TAIL(&ctx->active_command_pool, entry, entries);
+            int key = ctx->track_pending ? coalesce_key(cmd) : -1;
+            if (key >= 0) {
+                ctx->pending_entries[key] = entry;
+            }
+            __atomic_add_fetch(&ctx->stat_overflow_dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (SERIAL_TRACE_ACTIVE()) {
+        trace_commands(TRACE_ADD, cmd, 1);
+    }
+    sem_post(&ctx->cmd_semaphore);
+
+    if (ctx->capture != NULL) {
+        serial_capture_record(ctx->capture, cmd, 1, now_ns);
+    }
+    __atomic_add_fetch(&ctx->stat_adds, 1, __ATOMIC_RELAXED);
+    wake_waiters(ctx, &ctx->cmd_wait);
+    reactor_kick(ctx);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Queue an emergency command over the capacity of a full ring pool
+ *
+ * The ring cannot discard a routine command in the way the TAILQ backend
+ * does, so the emergency command is queued without an entry of the pool:
+ * the emergency ring has pool_capacity slots beyond the pool, the command is
+ * left out of the counts, and the next emergency commands dequeued return
+ * no entry until the overdraft is repaid. Like a displacement, this needs a
+ * pending routine command for every emergency command over the capacity.
+ * Ring backend only.
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the validated emergency command
+ * @return EXIT_SUCCESS if the command was queued, EXIT_FAILURE if the pool holds too few routine commands
+ */
+static int push_emergency_overdraft(serial_ctx_t *ctx, const device_command_t *cmd) {
+    size_t overdraft = __atomic_load_n(&ctx->emergency_overdraft, __ATOMIC_RELAXED);
+
+    do {
+        // A policy check only; the bound on the overdraft keeps the emergency ring from overflowing
+        size_t routine = __atomic_load_n(&ctx->command_ring.enqueue_pos, __ATOMIC_RELAXED) -
+                         __atomic_load_n(&ctx->command_ring.dequeue_pos, __ATOMIC_RELAXED);
+        if (overdraft >= ctx->pool_capacity || overdraft >= routine) {
+            return EXIT_FAILURE;
+        }
+    } while (!__atomic_compare_exchange_n(&ctx->emergency_overdraft, &overdraft, overdraft + 1, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    if (SERIAL_TRACE_ACTIVE()) {
+        trace_commands(TRACE_ADD, cmd, 1);
+    }
+    uint64_t now_ns = monotonic_ns();
+    ring_push_run(&ctx->emergency_ring, cmd, 1, now_ns);
+    if (ctx->capture != NULL) {
+        serial_capture_record(ctx->capture, cmd, 1, now_ns);
+    }
+    __atomic_add_fetch(&ctx->stat_adds, 1, __ATOMIC_RELAXED);
+    wake_waiters(ctx, &ctx->cmd_wait);
+    reactor_kick(ctx);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Apply the overflow policy to a command that found the pool full
+ *
+ * Emergency commands displace the oldest pending routine command on the
+ * TAILQ backend and are queued over the capacity of the pool on the ring
+ * backend; routine commands follow the policy of their type.
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the validated command
+ * @return EXIT_SUCCESS if the command was queued after all, EXIT_FAILURE otherwise
+ */
+static int push_overflow(serial_ctx_t *ctx, const device_command_t *cmd) {
+    overflow_policy_t policy;
+
+    switch (cmd->command_type) {
+        case CMD_EMERGENCY:
+            if (ctx->queue_backend == QUEUE_BACKEND_RING) {
+                if (push_emergency_overdraft(ctx, cmd) == EXIT_SUCCESS) {
+                    return EXIT_SUCCESS;
+                }
+                __atomic_add_fetch(&ctx->stat_overflow_rejected, 1, __ATOMIC_RELAXED);
+                return EXIT_FAILURE;
+            }
+            policy = OVERFLOW_DROP_OLDEST;
+            break;
+        case CMD_SET_PARAMS:
+            policy = ctx->overflow_set_params;
+            break;
+        default:
+            policy = ctx->overflow_on_off;
+            break;
+    }
+
+    int result = EXIT_FAILURE;
+    switch (policy) {
+        case OVERFLOW_BLOCK:
+            __atomic_add_fetch(&ctx->stat_overflow_blocked, 1, __ATOMIC_RELAXED);
+            result = wait_for(ctx, &ctx->slot_wait, push_attempt, (void *)cmd, ctx->overflow_timeout_ns);
+            if (result != EXIT_SUCCESS) {
+                __atomic_add_fetch(&ctx->stat_overflow_timeouts, 1, __ATOMIC_RELAXED);
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        case OVERFLOW_DROP_OLDEST:
+        case OVERFLOW_COALESCE:
+            result = push_replacing(ctx, cmd, policy);
+            break;
+        default:
+            break;
+    }
+    if (result != EXIT_SUCCESS) {
+        __atomic_add_fetch(&ctx->stat_overflow_rejected, 1, __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+/**
+ * @brief Adapter for retrying pop_command() from wait_for()
+ *
+ * @param ctx Instance handle
+ * @param arg Pointer to store the retrieved command
+ * @return Result of pop_command()
+ */
+static int pop_attempt(serial_ctx_t *ctx, void *arg) {
+    return pop_command(ctx, (device_command_t *)arg);
+}
+
+/**
+ * @brief Empty the timer wheel
+ *
+ * The entries of deferred commands belong to the pool chunks, which are
+ * freed separately.
+ *
+ * @param ctx Instance handle
+ */
+static void reset_timers(serial_ctx_t *ctx) {
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (size_t slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            TAILQ_INIT(&ctx->timer_slots[level][slot]);
+        }
+        ctx->timer_bitmap[level] = 0;
+    }
+    TAILQ_INIT(&ctx->timer_due);
+    ctx->timer_tick = monotonic_ns() / TIMER_TICK_NS;
+    ctx->timer_wake_tick = 0;
+    __atomic_store_n(&ctx->timer_pending, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Get the tick at which a deadline is due, never before the deadline
+ *
+ * @param deadline_ns Absolute monotonic deadline
+ * @return Tick of the deadline
+ */
+static uint64_t timer_deadline_tick(uint64_t deadline_ns) {
+    return deadline_ns / TIMER_TICK_NS + (deadline_ns % TIMER_TICK_NS != 0);
+}
+
+/**
+ * @brief Insert a deferred entry into the wheel, or the due list if it is due
+ *
+ * Must be called with timer_mutex held. The deadline is kept in enqueue_ns.
+ *
+ * @param ctx Instance handle
+ * @param entry Entry of the deferred command
+ */
+static void timer_insert(serial_ctx_t *ctx, struct cmd_entry *entry) {
+    uint64_t tick = timer_deadline_tick(entry->enqueue_ns);
+    const uint64_t max_delta = (UINT64_C(1) << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+    if (tick <= ctx->timer_tick) {
+        TAILQ_INSERT_TAIL(&ctx->timer_due, entry, entries);
+        return;
+    }
+    // Beyond the last level, park in its furthest slot and look again on cascade
+    if (tick - ctx->timer_tick > max_delta) {
+        tick = ctx->timer_tick + max_delta;
+    }
+
+    uint64_t delta = tick - ctx->timer_tick;
+    unsigned level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= UINT64_C(1) << (TIMER_WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    unsigned slot = (unsigned)(tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    TAILQ_INSERT_TAIL(&ctx->timer_slots[level][slot], entry, entries);
+    ctx->timer_bitmap[level] |= UINT64_C(1) << slot;
+}
+
+/**
+ * @brief Find the next tick at which the wheel has work
+ *
+ * That is the tick of the next non-empty slot of level 0, or the tick at
+ * which the next non-empty slot of a higher level is cascaded, whichever
+ * comes first. Empty slots are skipped through the bitmaps.
+ *
+ * Must be called with timer_mutex held.
+ *
+ * @param ctx Instance handle
+ * @return Next tick with work, UINT64_MAX if the wheel is empty
+ */
+static uint64_t timer_next_tick(serial_ctx_t *ctx) {
+    uint64_t next = UINT64_MAX;
+
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t bits = ctx->timer_bitmap[level];
+        if (bits == 0) {
+            continue;
+        }
+        unsigned shift = TIMER_WHEEL_BITS * level;
+        unsigned current = (unsigned)(ctx->timer_tick >> shift) & (TIMER_WHEEL_SLOTS - 1);
+        uint64_t base = ctx->timer_tick >> (shift + TIMER_WHEEL_BITS) << (shift + TIMER_WHEEL_BITS);
+        // Slots up to the current one belong to the next rotation of the level
+        uint64_t ahead = bits & ~((UINT64_C(2) << current) - 1);
+        uint64_t tick;
+        if (ahead != 0) {
+            tick = base + ((uint64_t)__builtin_ctzll(ahead) << shift);
+        } else {
+            tick = base + (UINT64_C(1) << (shift + TIMER_WHEEL_BITS)) + ((uint64_t)__builtin_ctzll(bits) << shift);
+        }
+        if (tick < next) {
+            next = tick;
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief Move the entries of a higher level slot down the wheel
+ *
+ * Must be called with timer_mutex held.
+ *
+ * @param ctx Instance handle
+ * @param level Level to cascade, 1 or more
+ */
+static void timer_cascade(serial_ctx_t *ctx, unsigned level) {
+    unsigned slot = (unsigned)(ctx->timer_tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    struct active_cmd_queue entries;
+    struct cmd_entry *entry;
+
+    if (!(ctx->timer_bitmap[level] & (UINT64_C(1) << slot))) {
+        return;
+    }
+    TAILQ_INIT(&entries);
+    TAILQ_CONCAT(&entries, &ctx->timer_slots[level][slot], entries);
+    ctx->timer_bitmap[level] &= ~(UINT64_C(1) << slot);
+    while ((entry = TAILQ_FIRST(&entries)) != NULL) {
+        TAILQ_REMOVE(&entries, entry, entries);
+        timer_insert(ctx, entry);
+    }
+}
+
+/**
+ * @brief Advance the wheel to a tick, moving due entries to the due list
+ *
+ * Jumps from one tick with work to the next, so an idle stretch costs
+ * nothing. Each level 0 slot reaching its tick is spliced onto the due list
+ * as a whole.
+ *
+ * Must be called with timer_mutex held.
+ *
+ * @param ctx Instance handle
+ * @param now_tick Current tick
+ */
+static void timer_advance(serial_ctx_t *ctx, uint64_t now_tick) {
+    for (;;) {
+        uint64_t next = timer_next_tick(ctx);
+        if (next > now_tick) {
+            if (now_tick > ctx->timer_tick) {
+                ctx->timer_tick = now_tick;
+            }
+            return;
+        }
+        ctx->timer_tick = next;
+
+        // Cascade from the top, so entries can fall through several levels
+        for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((next & ((UINT64_C(1) << (TIMER_WHEEL_BITS * level)) - 1)) == 0) {
+                timer_cascade(ctx, level);
+            }
+        }
+        unsigned slot = (unsigned)next & (TIMER_WHEEL_SLOTS - 1);
+        if (ctx->timer_bitmap[0] & (UINT64_C(1) << slot)) {
+            TAILQ_CONCAT(&ctx->timer_due, &ctx->timer_slots[0][slot], entries);
+            ctx->timer_bitmap[0] &= ~(UINT64_C(1) << slot);
+        }
+    }
+}
+
+/**
+ * @brief Append due deferred commands to the active pool
+ *
+ * The whole list is spliced in at once under the semaphore. Each entry
+ * becomes the pending entry of its key, and with coalescing enabled an
+ * entry whose key already has one is coalesced into it instead.
+ *
+ * @param ctx Instance handle
+ * @param due Due entries, emptied
+ * @param n Number of entries in due
+ */
+static void timer_release(serial_ctx_t *ctx, struct active_cmd_queue *due, size_t n) {
+    while (sem_wait(&ctx->cmd_semaphore) != 0) {
+        if (errno != EINTR) {
+            SERIAL_LOG(LOG_WARNING, "Failed to lock semaphore while releasing deferred commands");
+            return;
+        }
+    }
+    if (SERIAL_TRACE_ACTIVE()) {
+        struct cmd_entry *entry;
+        TAILQ_FOREACH(entry, due, entries) {
+            serial_trace_record(TRACE_ADD, trace_command_key(&entry->cmd));
+        }
+    }
+    if (ctx->capture != NULL) {
+        // Deferred commands are captured when they enter the active pool
+        uint64_t now_ns = monotonic_ns();
+        struct cmd_entry *entry;
+        TAILQ_FOREACH(entry, due, entries) {
+            serial_capture_record(ctx->capture, &entry->cmd, 1, now_ns);
+        }
+    }
+    size_t coalesced = 0;
+    if (ctx->track_pending) {
+        struct cmd_entry *entry;
+        struct cmd_entry *next;
+        for (entry = TAILQ_FIRST(due); entry != NULL; entry = next) {
+            next = TAILQ_NEXT(entry, entries);
+            int key = coalesce_key(&entry->cmd);
+            if (key < 0) {
+                continue;
+            }
+            // Replace a superseded pending command in place, as push_commands() does
+            if (ctx->coalesce_commands && ctx->pending_entries[key] != NULL) {
+                if (!state_table_push) {
+                    state_field_lost(ctx, &ctx->pending_entries[key]->cmd);
+                }
+                memcpy(&ctx->pending_entries[key]->cmd, &entry->cmd, sizeof(device_command_t));
+                __atomic_add_fetch(&ctx->coalesced_commands, 1, __ATOMIC_RELAXED);
+                TAILQ_REMOVE(due, entry, entries);
+                unused_list_put(ctx, entry);
+                coalesced++;
+                continue;
+            }
+            ctx->pending_entries[key] = entry;
+        }
+    }
+    TAILQ_CONCAT(&ctx->active_command_pool, due, entries);
+    update_high_water_mark(ctx, __atomic_add_fetch(&ctx->command_counts,
+                                                   ((uint64_t)(n - coalesced) << COUNT_ACTIVE_SHIFT) + coalesced,
+                                                   __ATOMIC_RELEASE));
+    sem_post(&ctx->cmd_semaphore);
+    if (coalesced > 0) {
+        wake_waiters(ctx, &ctx->slot_wait);
+    }
+
+    __atomic_sub_fetch(&ctx->timer_pending, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->stat_adds, n, __ATOMIC_RELAXED);
+    wake_waiters(ctx, &ctx->cmd_wait);
+    reactor_kick(ctx);
+    SERIAL_LOG(LOG_INFO, "Released %zu deferred command(s)", n);
+}
+
+/**
+ * @brief Main loop of the timer thread
+ *
+ * Sleeps until the next tick with work, or until add_at() inserts an
+ * earlier deadline, so pending timers cost no system call of their own.
+ *
+ * @param arg Instance handle
+ * @return NULL
+ */
+static void *timer_thread_main(void *arg) {
+    serial_ctx_t *ctx = arg;
+
+    pthread_mutex_lock(&ctx->timer_mutex);
+    while (ctx->timer_running) {
+        timer_advance(ctx, monotonic_ns() / TIMER_TICK_NS);
+
+        if (TAILQ_FIRST(&ctx->timer_due) != NULL) {
+            struct active_cmd_queue due;
+            struct cmd_entry *entry;
+            size_t n = 0;
+            TAILQ_INIT(&due);
+            TAILQ_CONCAT(&due, &ctx->timer_due, entries);
+            TAILQ_FOREACH(entry, &due, entries) {
+                n++;
+            }
+            pthread_mutex_unlock(&ctx->timer_mutex);
+            timer_release(ctx, &due, n);
+            pthread_mutex_lock(&ctx->timer_mutex);
+            continue;
+        }
+
+        uint64_t next = timer_next_tick(ctx);
+        ctx->timer_wake_tick = next;
+        if (next == UINT64_MAX) {
+            pthread_cond_wait(&ctx->timer_cond, &ctx->timer_mutex);
+        } else {
+            struct timespec deadline;
+            deadline.tv_sec = (time_t)(next * TIMER_TICK_NS / 1000000000u);
+            deadline.tv_nsec = (long)(next * TIMER_TICK_NS % 1000000000u);
+            pthread_cond_timedwait(&ctx->timer_cond, &ctx->timer_mutex, &deadline);
+        }
+        ctx->timer_wake_tick = 0;
+    }
+    pthread_mutex_unlock(&ctx->timer_mutex);
+    return NULL;
+}
+
+/**
+ * @brief Start the timer thread of the deferred commands
+ *
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the thread could not be created
+ */
+static int start_timers(serial_ctx_t *ctx) {
+    __atomic_store_n(&ctx->timer_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&ctx->timer_thread, NULL, timer_thread_main, ctx) != 0) {
+        __atomic_store_n(&ctx->timer_running, 0, __ATOMIC_RELEASE);
+        SERIAL_LOG(LOG_WARNING, "Failed to create timer thread");
+        return EXIT_FAILURE;
+    }
+    SERIAL_LOG(LOG_INFO, "Timer thread started");
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Stop and join the timer thread, if running
+ *
+ * Deferred commands still pending are dropped with the pool.
+ *
+ * @param ctx Instance handle
+ */
+static void stop_timers(serial_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->timer_mutex);
+    int running = ctx->timer_running;
+    __atomic_store_n(&ctx->timer_running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&ctx->timer_cond);
+    pthread_mutex_unlock(&ctx->timer_mutex);
+    if (!running) {
+        return;
+    }
+    pthread_join(ctx->timer_thread, NULL);
+    SERIAL_LOG(LOG_INFO, "Timer thread stopped");
+}
+
+/**
+ * @brief Check the preconditions shared by add() and add_wait()
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to the command structure to add
+ * @return EXIT_SUCCESS if the command can be queued, EXIT_FAILURE otherwise
+ */
+static int check_add(serial_ctx_t *ctx, const device_command_t *cmd) {
+    // Check if initialized
+    if (ctx == NULL || !ctx->initialized) {
+        if (ctx != NULL) {
+            __atomic_add_fetch(&ctx->stat_rejected_not_initialized, 1, __ATOMIC_RELAXED);
+        }
+        SERIAL_LOG(LOG_WARNING, "Failed to add command: module not initialized");
+        return EXIT_FAILURE;
+    }
+
+    // Check if command is valid
+    if (cmd == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to add command: command pointer is NULL");
+        return EXIT_FAILURE;
+    }
+    if (is_valid_command(cmd) != EXIT_SUCCESS) {
+        __atomic_add_fetch(&ctx->stat_rejected_invalid, 1, __ATOMIC_RELAXED);
+        log_invalid_command(cmd);
+        SERIAL_LOG(LOG_WARNING, "Failed to add command: command is invalid");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Count commands the pool could not take
+ *
+ * @param ctx Instance handle
+ * @param n Number of rejected commands
+ * @return EXIT_FAILURE
+ */
+static int reject_pool_full(serial_ctx_t *ctx, size_t n) {
+    __atomic_add_fetch(&ctx->stat_rejected_pool_full, n, __ATOMIC_RELAXED);
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief Move a batch of validated commands into the active pool
+ *
+ * The batch goes in with a single push while the pool has room for it. A
+ * batch the pool cannot hold has its emergency commands queued one by one
+ * under their overflow policy, so routine traffic never keeps them out, and
+ * its routine commands queued all-or-nothing after them.
+ *
+ * @param ctx Instance handle
+ * @param cmds Array of validated commands
+ * @param n Number of commands in the array
+ * @return EXIT_SUCCESS if every command was queued, EXIT_FAILURE otherwise
+ */
+static int push_batch(serial_ctx_t *ctx, const device_command_t *cmds, size_t n) {
+    if (push_commands(ctx, cmds, n) == EXIT_SUCCESS) {
+        return EXIT_SUCCESS;
+    }
+
+    size_t emergencies = 0;
+    for (size_t i = 0; i < n; i++) {
+        emergencies += cmds[i].command_type == CMD_EMERGENCY;
+    }
+    if (emergencies == 0) {
+        return reject_pool_full(ctx, n);
+    }
+
+    // Emergencies overtake the routine commands in the pool anyway, queueing them first keeps the order
+    int result = EXIT_SUCCESS;
+    for (size_t i = 0; i < n; i++) {
+        if (cmds[i].command_type == CMD_EMERGENCY &&
+            push_command(ctx, &cmds[i]) != EXIT_SUCCESS && push_overflow(ctx, &cmds[i]) != EXIT_SUCCESS) {
+            result = reject_pool_full(ctx, 1);
+        }
+    }
+    size_t routine = n - emergencies;
+    if (routine == 0) {
+        return result;
+    }
+
+    device_command_t *rest = malloc(routine * sizeof(*rest));
+    if (rest == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to allocate the routine part of a command batch");
+        return reject_pool_full(ctx, routine);
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (cmds[i].command_type != CMD_EMERGENCY) {
+            rest[count++] = cmds[i];
+        }
+    }
+    if (push_commands(ctx, rest, routine) != EXIT_SUCCESS) {
+        result = reject_pool_full(ctx, routine);
+    }
+    free(rest);
+    return result;
+}
+
+int serial_add(serial_ctx_t *ctx, const device_command_t *cmd) {
+    if (check_add(ctx, cmd) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (push_command(ctx, cmd) != EXIT_SUCCESS && push_overflow(ctx, cmd) != EXIT_SUCCESS) {
+        return reject_pool_full(ctx, 1);
+    }
+    return EXIT_SUCCESS;
+}
+
+int serial_add_wait(serial_ctx_t *ctx, const device_command_t *cmd, int64_t timeout_ns) {
+    if (check_add(ctx, cmd) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    // Emergency commands make room at once instead of waiting behind routine traffic
+    if (cmd->command_type == CMD_EMERGENCY &&
+        (push_command(ctx, cmd) == EXIT_SUCCESS || push_overflow(ctx, cmd) == EXIT_SUCCESS)) {
+        return EXIT_SUCCESS;
+    }
+    if (wait_for(ctx, &ctx->slot_wait, push_attempt, (void *)cmd, timeout_ns) != EXIT_SUCCESS) {
+        return reject_pool_full(ctx, 1);
+    }
+    return EXIT_SUCCESS;
+}
+
+int serial_add_batch(serial_ctx_t *ctx, const device_command_t *cmds, size_t n) {
+    // Check if initialized
+    if (ctx == NULL || !ctx->initialized) {
+        if (ctx != NULL) {
+            __atomic_add_fetch(&ctx->stat_rejected_not_initialized, n, __ATOMIC_RELAXED);
+        }
+        SERIAL_LOG(LOG_WARNING, "Failed to add command batch: module not initialized");
+        return EXIT_FAILURE;
+    }
+    if (cmds == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to add command batch: command pointer is NULL");
+        return EXIT_FAILURE;
+    }
+    if (n == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    // Validate the whole batch before touching the pools
+    for (size_t i = 0; i < n; i++) {
+        if (is_valid_command(&cmds[i]) != EXIT_SUCCESS) {
+            __atomic_add_fetch(&ctx->stat_rejected_invalid, n, __ATOMIC_RELAXED);
+            log_invalid_command(&cmds[i]);
+            SERIAL_LOG(LOG_WARNING, "Failed to add command batch: command %zu is invalid", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    return push_batch(ctx, cmds, n);
+}
+
+int serial_add_prevalidated(serial_ctx_t *ctx, const device_command_t *cmds, size_t n) {
+    // Check if initialized
+    if (ctx == NULL || !ctx->initialized) {
+        if (ctx != NULL) {
+            __atomic_add_fetch(&ctx->stat_rejected_not_initialized, n, __ATOMIC_RELAXED);
+        }
+        SERIAL_LOG(LOG_WARNING, "Failed to add command batch: module not initialized");
+        return EXIT_FAILURE;
+    }
+    if (cmds == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to add command batch: command pointer is NULL");
+        return EXIT_FAILURE;
+    }
+    if (n == 0) {
+        return EXIT_SUCCESS;
+    }
+
+    return push_batch(ctx, cmds, n);
+}
+
+int serial_add_at(serial_ctx_t *ctx, const device_command_t *cmd, uint64_t deadline_ns) {
+    if (check_add(ctx, cmd) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (!__atomic_load_n(&ctx->timer_running, __ATOMIC_ACQUIRE)) {
+        SERIAL_LOG(LOG_WARNING, "Failed to defer command: timers are not enabled");
+        return EXIT_FAILURE;
+    }
+    if (cmd->command_type == CMD_EMERGENCY) {
+        SERIAL_LOG(LOG_WARNING, "Failed to defer command: emergency commands cannot be deferred");
+        return EXIT_FAILURE;
+    }
+
+    // Take an entry of the pool, it counts as neither active nor unused while deferred
+    if (sem_wait(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to lock semaphore while deferring command");
+        return reject_pool_full(ctx, 1);
+    }
+    if (ctx->thread_cache && ctx->unused_list_len == 0) {
+        cache_drain(ctx, NULL, 1);
+    }
+    // A deferred command is routine and cannot be displaced while it waits, so it must leave the reserve
+    if (pool_grow(ctx, 1) != EXIT_SUCCESS ||
+        keep_reserve(ctx, 1, admission_reserve(ctx, cmd, 1)) != EXIT_SUCCESS) {
+        sem_post(&ctx->cmd_semaphore);
+        SERIAL_LOG(LOG_WARNING, "Command pool is full (no unused entries available)");
+        return reject_pool_full(ctx, 1);
+    }
+    struct cmd_entry *entry = unused_list_take(ctx);
+    __atomic_sub_fetch(&ctx->command_counts, 1, __ATOMIC_RELEASE);
+    sem_post(&ctx->cmd_semaphore);
+
+    memcpy(&entry->cmd, cmd, sizeof(device_command_t));
+    entry->enqueue_ns = deadline_ns;
+
+    pthread_mutex_lock(&ctx->timer_mutex);
+    timer_insert(ctx, entry);
+    __atomic_add_fetch(&ctx->timer_pending, 1, __ATOMIC_RELAXED);
+    // Wake the timer thread only if it sleeps past the new deadline
+    if (ctx->timer_wake_tick != 0 && timer_deadline_tick(deadline_ns) < ctx->timer_wake_tick) {
+        pthread_cond_signal(&ctx->timer_cond);
+    }
+    pthread_mutex_unlock(&ctx->timer_mutex);
+    SERIAL_LOG(LOG_INFO, "Deferred command 0x%x", cmd->command_type);
+    return EXIT_SUCCESS;
+}
+
+int serial_set_channel_state(serial_ctx_t *ctx, const charger_state_t *state) {
+    device_command_t candidates[CHANNEL_COUNT + 1];
+    device_command_t cmds[CHANNEL_COUNT + 1];
+    size_t n = 0;
+
+    if (ctx == NULL || !ctx->initialized) {
+        SERIAL_LOG(LOG_WARNING, "Failed to set channel state: module not initialized");
+        return EXIT_FAILURE;
+    }
+    if (state == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to set channel state: state pointer is NULL");
+        return EXIT_FAILURE;
+    }
+
+    // Build and validate every command the state can generate before comparing
+    candidates[0].command_type = CMD_SET_PARAMS;
+    candidates[0].data.set_params = state->params;
+    for (unsigned channel = 0; channel < CHANNEL_COUNT; channel++) {
+        candidates[channel + 1].command_type = CMD_ON_OFF;
+        candidates[channel + 1].data.on_off.on_off = state->on_off[channel];
+        candidates[channel + 1].data.on_off.channel = (uint8_t)channel;
+    }
+    for (size_t i = 0; i < CHANNEL_COUNT + 1; i++) {
+        if (is_valid_command(&candidates[i]) != EXIT_SUCCESS) {
+            log_invalid_command(&candidates[i]);
+            SERIAL_LOG(LOG_WARNING, "Failed to set channel state: state is invalid");
+            return EXIT_FAILURE;
+        }
+    }
+
+    pthread_mutex_lock(&ctx->state_mutex);
+    ctx->state_desired = *state;
+    const charger_state_t *applied = &ctx->state_applied;
+    // Fields whose queued command the pool discarded or overwrote are sent again
+    uint32_t lost = __atomic_exchange_n(&ctx->state_lost, 0, __ATOMIC_ACQUIRE);
+    if (!ctx->state_valid || (lost & UINT32_C(1) << COALESCE_SET_PARAMS) ||
+        applied->params.min_level != state->params.min_level ||
+        applied->params.max_level != state->params.max_level ||
+        applied->params.max_time != state->params.max_time) {
+        cmds[n++] = candidates[0];
+    }
+    for (unsigned channel = 0; channel < CHANNEL_COUNT; channel++) {
+        if (!ctx->state_valid || (lost & UINT32_C(1) << channel) ||
+            applied->on_off[channel] != state->on_off[channel]) {
+            cmds[n++] = candidates[channel + 1];
+        }
+    }
+
+    // Update the table only once the changes are queued, so a full pool retries them
+    state_table_push = 1;
+    int pushed = n == 0 || push_commands(ctx, cmds, n) == EXIT_SUCCESS;
+    state_table_push = 0;
+    if (!pushed) {
+        __atomic_or_fetch(&ctx->state_lost, lost, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&ctx->state_mutex);
+        return reject_pool_full(ctx, n);
+    }
+    ctx->state_applied = *state;
+    ctx->state_valid = 1;
+    pthread_mutex_unlock(&ctx->state_mutex);
+
+    __atomic_add_fetch(&ctx->stat_state_commands, n, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->stat_state_unchanged, CHANNEL_COUNT + 1 - n, __ATOMIC_RELAXED);
+    return EXIT_SUCCESS;
+}
+
+int serial_get_channel_state(serial_ctx_t *ctx, charger_state_t *desired, charger_state_t *applied) {
+    if (ctx == NULL || !ctx->initialized) {
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_lock(&ctx->state_mutex);
+    if (!ctx->state_valid || __atomic_load_n(&ctx->state_lost, __ATOMIC_ACQUIRE) != 0) {
+        pthread_mutex_unlock(&ctx->state_mutex);
+        return EXIT_FAILURE;
+    }
+    if (desired != NULL) {
+        *desired = ctx->state_desired;
+    }
+    if (applied != NULL) {
+        *applied = ctx->state_applied;
+    }
+    pthread_mutex_unlock(&ctx->state_mutex);
+    return EXIT_SUCCESS;
+}
+
+int serial_invalidate_channel_state(serial_ctx_t *ctx) {
+    if (ctx == NULL || !ctx->initialized) {
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_lock(&ctx->state_mutex);
+    ctx->state_valid = 0;
+    pthread_mutex_unlock(&ctx->state_mutex);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Check the name of a shared-memory region
+ *
+ * @param name Name to check
+ * @return Non-zero for a slash followed by 1-SHM_MAX_NAME - 1 other characters
+ */
+static int shm_valid_name(const char *name) {
+    size_t len = strlen(name);
+    return name[0] == '/' && len > 1 && len <= SHM_MAX_NAME && strchr(name + 1, '/') == NULL;
+}
+
+/**
+ * @brief Get the size of a shared-memory region
+ *
+ * @param capacity Number of slots
+ * @return Size of the region in bytes
+ */
+static size_t shm_region_size(size_t capacity) {
+    return sizeof(struct shm_region) + capacity * sizeof(struct cmd_slot);
+}
+
+/**
+ * @brief Push a command into a shared-memory ring, failing if it is full
+ *
+ * @param region Ingress region
+ * @param capacity Number of slots, as checked at attach
+ * @param cmd Command to push
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the ring is full
+ */
+static int shm_ring_push(struct shm_region *region, size_t capacity, const device_command_t *cmd) {
+    size_t pos = __atomic_load_n(&region->enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct cmd_slot *slot = &region->slots[pos % capacity];
+        uint32_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t)(seq - (uint32_t)pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&region->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                memcpy(&slot->cmd, cmd, sizeof(device_command_t));
+                slot->enqueue_ns = monotonic_ns();
+                __atomic_store_n(&slot->sequence, (uint32_t)(pos + 1), __ATOMIC_RELEASE);
+                return EXIT_SUCCESS;
+            }
+        } else if (diff < 0) {
+            return EXIT_FAILURE;
+        } else {
+            pos = __atomic_load_n(&region->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Pop up to max commands from a shared-memory ring
+ *
+ * Only the ingress thread of the owner pops, so no claim is needed. The
+ * capacity and position come from the instance rather than the region,
+ * which any producer can overwrite.
+ *
+ * @param ctx Instance handle
+ * @param out Array to store the commands
+ * @param max Capacity of out
+ * @return Number of commands popped
+ */
+static size_t shm_ring_pop(serial_ctx_t *ctx, device_command_t *out, size_t max) {
+    struct shm_region *region = ctx->shm;
+    size_t pos = ctx->shm_dequeue_pos;
+    size_t count = 0;
+
+    while (count < max) {
+        struct cmd_slot *slot = &region->slots[pos % ctx->shm_capacity];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != (uint32_t)(pos + 1)) {
+            break;
+        }
+        memcpy(&out[count++], &slot->cmd, sizeof(device_command_t));
+        __atomic_store_n(&slot->sequence, (uint32_t)(pos + ctx->shm_capacity), __ATOMIC_RELEASE);
+        pos++;
+    }
+    ctx->shm_dequeue_pos = pos;
+    __atomic_store_n(&region->dequeue_pos, pos, __ATOMIC_RELAXED);
+    return count;
+}
+
+/**
+ * @brief Check whether a shared-memory ring has a command ready
+ *
+ * @param ctx Instance handle
+ * @return Non-zero if the next slot holds a published command
+ */
+static int shm_ring_ready(serial_ctx_t *ctx) {
+    size_t pos = ctx->shm_dequeue_pos;
+    return __atomic_load_n(&ctx->shm->slots[pos % ctx->shm_capacity].sequence, __ATOMIC_ACQUIRE) ==
+           (uint32_t)(pos + 1);
+}
+
+/**
+ * @brief Move drained commands into the active pool, waiting for room
+ *
+ * Commands that fail validation are dropped: the producers are other
+ * processes and are not trusted.
+ *
+ * @param ctx Instance handle
+ * @param cmds Drained commands, compacted in place
+ * @param n Number of commands
+ */
+static void shm_ingress_push(serial_ctx_t *ctx, device_command_t *cmds, size_t n) {
+    size_t valid = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (is_valid_command(&cmds[i]) != EXIT_SUCCESS) {
+            __atomic_add_fetch(&ctx->stat_rejected_invalid, 1, __ATOMIC_RELAXED);
+            log_invalid_command(&cmds[i]);
+            continue;
+        }
+        cmds[valid++] = cmds[i];
+    }
+    if (valid == 0 || push_commands(ctx, cmds, valid) == EXIT_SUCCESS) {
+        return;
+    }
+
+    // The pool is full, hand the commands over one by one as room appears
+    for (size_t i = 0; i < valid; i++) {
+        while (wait_for(ctx, &ctx->slot_wait, push_attempt, &cmds[i], SHM_RETRY_NS) != EXIT_SUCCESS) {
+            if (!__atomic_load_n(&ctx->shm_running, __ATOMIC_ACQUIRE)) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Main loop of the ingress thread
+ *
+ * Drains the shared ring in batches. When the ring is empty, the thread
+ * announces that it is idle, checks the ring once more and sleeps on the
+ * doorbell, which producers post only after seeing the announcement.
+ *
+ * @param arg Instance handle
+ * @return NULL
+ */
+static void *shm_thread_main(void *arg) {
+    serial_ctx_t *ctx = arg;
+    struct shm_region *region = ctx->shm;
+    device_command_t cmds[SHM_DRAIN_BATCH];
+
+    while (__atomic_load_n(&ctx->shm_running, __ATOMIC_ACQUIRE)) {
+        size_t n = shm_ring_pop(ctx, cmds, SHM_DRAIN_BATCH);
+        if (n > 0) {
+            shm_ingress_push(ctx, cmds, n);
+            continue;
+        }
+
+        __atomic_store_n(&region->consumer_idle, 1, __ATOMIC_SEQ_CST);
+        if (!shm_ring_ready(ctx) && __atomic_load_n(&ctx->shm_running, __ATOMIC_ACQUIRE)) {
+            while (sem_wait(&region->doorbell) != 0 && errno == EINTR) {
+            }
+        }
+        __atomic_store_n(&region->consumer_idle, 0, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Create the shared-memory ingress region and start its thread
+ *
+ * A region left behind by a previous owner that did not shut down is
+ * replaced.
+ *
+ * @param ctx Instance handle
+ * @param name Name of the region
+ * @param capacity Number of slots of the ring
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on failure
+ */
+static int start_shm_ingress(serial_ctx_t *ctx, const char *name, size_t capacity) {
+    size_t size = shm_region_size(capacity);
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to create shared-memory region %s", name);
+        return EXIT_FAILURE;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+
+    // The new file is zero-filled, set up everything but the magic
+    struct shm_region *region = memory;
+    region->version = SHM_VERSION;
+    region->capacity = (uint32_t)capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        region->slots[i].sequence = (uint32_t)i;
+    }
+    if (sem_init(&region->doorbell, 1, 0) != 0) {
+        munmap(memory, size);
+        shm_unlink(name);
+        return EXIT_FAILURE;
+    }
+    __atomic_store_n(&region->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    ctx->shm = region;
+    ctx->shm_size = size;
+    ctx->shm_capacity = capacity;
+    ctx->shm_dequeue_pos = 0;
+    strcpy(ctx->shm_name, name);
+    __atomic_store_n(&ctx->shm_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&ctx->shm_thread, NULL, shm_thread_main, ctx) != 0) {
+        __atomic_store_n(&ctx->shm_running, 0, __ATOMIC_RELEASE);
+        SERIAL_LOG(LOG_WARNING, "Failed to create shared-memory ingress thread");
+        sem_destroy(&region->doorbell);
+        munmap(memory, size);
+        shm_unlink(name);
+        ctx->shm = NULL;
+        return EXIT_FAILURE;
+    }
+    SERIAL_LOG(LOG_INFO, "Shared-memory ingress %s opened with %zu slots", name, capacity);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Stop the ingress thread and remove the shared-memory region, if any
+ *
+ * Producers still attached keep their mapping but see the region closed.
+ * Commands left in the ring are dropped.
+ *
+ * @param ctx Instance handle
+ */
+static void stop_shm_ingress(serial_ctx_t *ctx) {
+    struct shm_region *region = ctx->shm;
+    if (region == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&region->closed, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->shm_running, 0, __ATOMIC_RELEASE);
+    sem_post(&region->doorbell);
+    pthread_join(ctx->shm_thread, NULL);
+
+    // The semaphore stays valid for producers that may still post to it
+    shm_unlink(ctx->shm_name);
+    munmap(region, ctx->shm_size);
+    ctx->shm = NULL;
+    SERIAL_LOG(LOG_INFO, "Shared-memory ingress %s closed", ctx->shm_name);
+}
+
+serial_shm_t *serial_shm_attach(const char *name) {
+    struct stat st;
+
+    if (name == NULL || !shm_valid_name(name)) {
+        return NULL;
+    }
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct shm_region)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+
+    // Only accept a region that its owner finished setting up, reading the capacity once
+    struct shm_region *region = memory;
+    int ready = __atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC;
+    size_t capacity = __atomic_load_n(&region->capacity, __ATOMIC_RELAXED);
+    if (!ready || region->version != SHM_VERSION || capacity == 0 || shm_region_size(capacity) > size) {
+        munmap(memory, size);
+        return NULL;
+    }
+
+    serial_shm_t *shm = malloc(sizeof(*shm));
+    if (shm == NULL) {
+        munmap(memory, size);
+        return NULL;
+    }
+    shm->region = region;
+    shm->size = size;
+    shm->capacity = capacity;
+    return shm;
+}
+
+int serial_shm_add(serial_shm_t *shm, const device_command_t *cmd) {
+    if (shm == NULL || cmd == NULL || is_valid_command(cmd) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    struct shm_region *region = shm->region;
+    if (__atomic_load_n(&region->closed, __ATOMIC_ACQUIRE) || shm_ring_push(region, shm->capacity, cmd) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // Ring the doorbell only if the owner announced it is going to sleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&region->consumer_idle, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&region->consumer_idle, 0, __ATOMIC_SEQ_CST)) {
+        sem_post(&region->doorbell);
+    }
+    return EXIT_SUCCESS;
+}
+
+void serial_shm_detach(serial_shm_t *shm) {
+    if (shm == NULL) {
+        return;
+    }
+    munmap(shm->region, shm->size);
+    free(shm);
+}
+
+int validate_command(const device_command_t *cmd) {
+    if (cmd == NULL) {
+        return EXIT_FAILURE;
+    }
+    return is_valid_command(cmd);
+}
+
+/**
+ * @brief Get the next command from the active pool
+ *
+ * This function retrieves the next command from the active pool and moves the entry
+ * back to the unused pool. It is intended to be called by a consumer thread.
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to store the retrieved command
+ * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE otherwise
+ */
+int serial_get_next_command(serial_ctx_t *ctx, device_command_t *cmd) {
+    // Check if initialized
+    if (ctx == NULL || !ctx->initialized || cmd == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to get command: module not initialized or NULL pointer");
+        return EXIT_FAILURE;
+    }
+
+    return pop_command(ctx, cmd);
+}
+
+/**
+ * @brief Get the next command, blocking until one arrives or the timeout expires
+ *
+ * @param ctx Instance handle
+ * @param cmd Pointer to store the retrieved command
+ * @param timeout_ns Relative timeout in nanoseconds, 0 to poll, or WAIT_FOREVER
+ * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE otherwise
+ */
+int serial_get_next_command_wait(serial_ctx_t *ctx, device_command_t *cmd, int64_t timeout_ns) {
+    // Check if initialized
+    if (ctx == NULL || !ctx->initialized || cmd == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to get command: module not initialized or NULL pointer");
+        return EXIT_FAILURE;
+    }
+
+    return wait_for(ctx, &ctx->cmd_wait, pop_attempt, cmd, timeout_ns);
+}
+
+/**
+ * @brief Get up to max commands from the active pool in FIFO order
+ *
+ * @param ctx Instance handle
+ * @param out Array to store the retrieved commands
+ * @param max Maximum number of commands to retrieve
+ * @return Number of commands retrieved, 0 if none was available or on error
+ */
+size_t serial_get_next_commands(serial_ctx_t *ctx, device_command_t *out, size_t max) {
+    // Check if initialized
+    if (ctx == NULL || !ctx->initialized || out == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to get commands: module not initialized or NULL pointer");
+        return 0;
+    }
+    if (max == 0) {
+        return 0;
+    }
+
+    return pop_commands(ctx, out, max);
+}
+
+/**
+ * @brief Get the number of active commands in the pool
+ *
+ * This function returns the current number of commands in the active pool.
+ * It is thread-safe, lock-free and O(1).
+ *
+ * @param ctx Instance handle
+ * @return The number of active commands
+ */
+int serial_get_active_command_count(serial_ctx_t *ctx) {
+    if (ctx == NULL || !ctx->initialized) {
+        return 0;
+    }
+
+    uint64_t counts = __atomic_load_n(&ctx->command_counts, __ATOMIC_ACQUIRE);
+    return (int)(counts >> COUNT_ACTIVE_SHIFT);
+}
+
+/**
+ * @brief Get the number of unused command slots in the pool
+ *
+ * This function returns the current number of unused command slots.
+ * It is thread-safe, lock-free and O(1).
+ *
+ * @param ctx Instance handle
+ * @return The number of unused command slots
+ */
+int serial_get_unused_command_count(serial_ctx_t *ctx) {
+    if (ctx == NULL || !ctx->initialized) {
+        return 0;
+    }
+
+    uint64_t counts = __atomic_load_n(&ctx->command_counts, __ATOMIC_ACQUIRE);
+    return (int)(counts & COUNT_UNUSED_MASK);
+}
+
+/**
+ * @brief Get a consistent snapshot of the active and unused counts
+ *
+ * Both numbers are taken from a single atomic load, so they always describe
+ * the same instant. The function is lock-free and O(1).
+ *
+ * @param ctx Instance handle
+ * @param counts Pointer to store the snapshot
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if not initialized or NULL pointer
+ */
+int serial_get_command_counts(serial_ctx_t *ctx, command_counts_t *counts) {
+    if (counts == NULL) {
+        return EXIT_FAILURE;
+    }
+    if (ctx == NULL || !ctx->initialized) {
+        counts->active = 0;
+        counts->unused = 0;
+        return EXIT_FAILURE;
+    }
+
+    uint64_t packed = __atomic_load_n(&ctx->command_counts, __ATOMIC_ACQUIRE);
+    counts->active = (int)(packed >> COUNT_ACTIVE_SHIFT);
+    counts->unused = (int)(packed & COUNT_UNUSED_MASK);
+    return EXIT_SUCCESS;
+}
+
+size_t encode_frame(const device_command_t *cmd, uint8_t seq, uint8_t *buf) {
+    if (cmd == NULL || buf == NULL) {
+        return 0;
+    }
+
+    size_t len = FRAME_HEADER_SIZE;
+    switch (cmd->command_type) {
+        case CMD_SET_PARAMS:
+            buf[len++] = cmd->data.set_params.min_level;
+            buf[len++] = cmd->data.set_params.max_level;
+            buf[len++] = cmd->data.set_params.max_time;
+            break;
+
+        case CMD_ON_OFF:
+            buf[len++] = cmd->data.on_off.on_off;
+            buf[len++] = cmd->data.on_off.channel;
+            break;
+
+        case CMD_EMERGENCY:
+            break;
+
+        default:
+            return 0;
+    }
+
+    buf[0] = FRAME_START;
+    buf[1] = seq;
+    buf[2] = cmd->command_type;
+    buf[3] = (uint8_t)(len - FRAME_HEADER_SIZE);
+
+    // Checksum covers everything after the start marker
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < len; i++) {
+        checksum ^= buf[i];
+    }
+    buf[len++] = checksum;
+    return len;
+}
+
+/**
+ * @brief Check whether the writer thread has to wait for an acknowledgement
+ *
+ * @param ctx Instance handle
+ * @return Non-zero if the acknowledgement window is full
+ */
+static int ack_window_full(serial_ctx_t *ctx) {
+    uint8_t base = __atomic_load_n(&ctx->ack_base, __ATOMIC_ACQUIRE);
+    return ctx->ack_window > 0 && (uint8_t)(ctx->tx_next_seq - base) >= ctx->ack_window;
+}
+
+/**
+ * @brief Check whether an I/O error means the serial port went away
+ *
+ * @param err errno of the failed call
+ * @return Non-zero for errors of a disconnected or hung-up device
+ */
+static int port_gone_error(int err) {
+    return err == EIO || err == ENXIO || err == ENODEV || err == EPIPE;
+}
+
+/**
+ * @brief Give up on the frames of a burst after a write error
+ *
+ * Errors that do not mean the port is gone would most likely repeat, so the
+ * frames are counted as dropped rather than written again.
+ *
+ * @param ctx Instance handle
+ * @param frames Number of frames in the burst
+ */
+static void tx_drop_burst(serial_ctx_t *ctx, size_t frames) {
+    SERIAL_LOG(LOG_WARNING, "Failed to write %zu frame(s) to serial port (errno %d)", frames, errno);
+    __atomic_add_fetch(&ctx->tx_dropped, frames, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->stat_tx_dropped, frames, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Mark the serial port as failed and pause the transmission
+ *
+ * Only the first report for a given port counts; reports about a descriptor
+ * that a reconnection has already replaced are ignored.
+ *
+ * @param ctx Instance handle
+ * @param generation port_generation seen before the failed operation
+ * @param what Description of the failure for the log
+ */
+static void port_failed(serial_ctx_t *ctx, unsigned generation, const char *what) {
+    if (__atomic_load_n(&ctx->port_generation, __ATOMIC_ACQUIRE) != generation ||
+        __atomic_exchange_n(&ctx->port_down, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    __atomic_add_fetch(&ctx->stat_port_failures, 1, __ATOMIC_RELAXED);
+    SERIAL_LOG(LOG_WARNING, "Serial port %s failed (%s), holding commands until it is reopened",
+               ctx->port_name, what);
+
+    pthread_mutex_lock(&ctx->reconnect_mutex);
+    pthread_cond_signal(&ctx->reconnect_cond);
+    pthread_mutex_unlock(&ctx->reconnect_mutex);
+}
+
+/**
+ * @brief Block the writer thread while the serial port is failed
+ *
+ * serial_reconnect() signals the command wait point once the port is back.
+ *
+ * @param ctx Instance handle
+ */
+static void tx_wait_for_port(serial_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->wait_mutex);
+    while (__atomic_load_n(&ctx->tx_running, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&ctx->port_down, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(&ctx->cmd_wait.cond, &ctx->wait_mutex);
+    }
+    pthread_mutex_unlock(&ctx->wait_mutex);
+}
+
+/**
+ * @brief Block the writer thread until it has something to send
+ *
+ * Uses the same wait point as get_next_command_wait(), so producers only pay
+ * for the wake-up when the writer is actually idle. Acknowledgements signal
+ * the wait point as well, which frees a full window.
+ *
+ * @param ctx Instance handle
+ * @param deadline_ns Monotonic time of the next retransmission, or 0 for none
+ */
+static void tx_wait_for_commands(serial_ctx_t *ctx, uint64_t deadline_ns) {
+    unsigned generation = __atomic_load_n(&ctx->cmd_wait.generation, __ATOMIC_ACQUIRE);
+    __atomic_add_fetch(&ctx->cmd_wait.waiters, 1, __ATOMIC_SEQ_CST);
+
+    uint64_t counts = __atomic_load_n(&ctx->command_counts, __ATOMIC_ACQUIRE);
+    int idle = (counts >> COUNT_ACTIVE_SHIFT) == 0 && __atomic_load_n(&ctx->emergency_overdraft, __ATOMIC_ACQUIRE) == 0;
+    if (idle || ack_window_full(ctx)) {
+        struct timespec deadline;
+        deadline.tv_sec = (time_t)(deadline_ns / 1000000000u);
+        deadline.tv_nsec = (long)(deadline_ns % 1000000000u);
+
+        pthread_mutex_lock(&ctx->wait_mutex);
+        while (__atomic_load_n(&ctx->tx_running, __ATOMIC_ACQUIRE) &&
+               __atomic_load_n(&ctx->cmd_wait.generation, __ATOMIC_ACQUIRE) == generation) {
+            if (deadline_ns == 0) {
+                pthread_cond_wait(&ctx->cmd_wait.cond, &ctx->wait_mutex);
+            } else if (pthread_cond_timedwait(&ctx->cmd_wait.cond, &ctx->wait_mutex,
+                                              &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&ctx->wait_mutex);
+    }
+
+    __atomic_sub_fetch(&ctx->cmd_wait.waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Slide the acknowledgement window past the retired commands
+ *
+ * Must be called with ack_mutex held.
+ *
+ * @param ctx Instance handle
+ */
+static void ack_advance(serial_ctx_t *ctx) {
+    uint8_t base = ctx->ack_base;
+    while (base != ctx->tx_next_seq && !ctx->ack_slots[base % ACK_MAX_WINDOW].in_flight) {
+        base++;
+    }
+    __atomic_store_n(&ctx->ack_base, base, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Encode the commands whose acknowledgement timed out
+ *
+ * Commands past their last retry are given up instead. Only the writer
+ * thread calls this function.
+ *
+ * @param ctx Instance handle
+ * @param buf Buffer to append the frames to
+ * @param len Number of bytes already in buf, updated
+ * @param max Maximum number of frames to encode
+ * @param next_deadline_ns Set to the earliest pending deadline, or 0 if none
+ * @return Number of frames encoded
+ */
+static size_t ack_collect_retransmits(serial_ctx_t *ctx, uint8_t *buf, size_t *len, size_t max,
+                                      uint64_t *next_deadline_ns) {
+    uint64_t now_ns = monotonic_ns();
+    uint64_t next_ns = 0;
+    size_t frames = 0;
+
+    pthread_mutex_lock(&ctx->ack_mutex);
+    for (uint8_t seq = ctx->ack_base; seq != ctx->tx_next_seq; seq++) {
+        struct ack_slot *slot = &ctx->ack_slots[seq % ACK_MAX_WINDOW];
+        if (!slot->in_flight) {
+            continue;
+        }
+        if (slot->deadline_ns <= now_ns) {
+            if (slot->retries >= ctx->ack_retries) {
+                slot->in_flight = 0;
+                ctx->ack_stats.in_flight--;
+                ctx->ack_stats.timeouts++;
+                SERIAL_LOG(LOG_WARNING, "Command 0x%02X (seq %u) not acknowledged, giving up",
+                           slot->cmd.command_type, slot->seq);
+                continue;
+            }
+            if (frames < max) {
+                SERIAL_TRACE(TRACE_RETRANSMIT, slot->seq);
+                *len += encode_frame(&slot->cmd, slot->seq, &buf[*len]);
+                frames++;
+                slot->retries++;
+                slot->deadline_ns = now_ns + ctx->ack_timeout_ns;
+                ctx->ack_stats.retransmits++;
+            }
+        }
+        if (next_ns == 0 || slot->deadline_ns < next_ns) {
+            next_ns = slot->deadline_ns;
+        }
+    }
+    ack_advance(ctx);
+    pthread_mutex_unlock(&ctx->ack_mutex);
+
+    *next_deadline_ns = next_ns;
+    return frames;
+}
+
+/**
+ * @brief Encode a new command into a frame and trace it
+ *
+ * @param cmd Command to encode
+ * @param seq Sequence number of the frame
+ * @param buf Buffer of at least FRAME_MAX_SIZE bytes
+ * @return Number of bytes written to buf
+ */
+static size_t tx_encode_frame(const device_command_t *cmd, uint8_t seq, uint8_t *buf) {
+    SERIAL_TRACE(TRACE_ENCODE, (uint32_t)seq << 16 | trace_command_key(cmd));
+    return encode_frame(cmd, seq, buf);
+}
+
+/**
+ * @brief Assign sequence numbers to new commands and encode them
+ *
+ * With acknowledgements tracked, each command also enters the window.
+ * Only the writer thread calls this function.
+ *
+ * @param ctx Instance handle
+ * @param cmds Commands to send
+ * @param n Number of commands
+ * @param buf Buffer to append the frames to
+ * @param len Number of bytes already in buf, updated
+ */
+static void tx_encode_commands(serial_ctx_t *ctx, const device_command_t *cmds, size_t n,
+                               uint8_t *buf, size_t *len) {
+    if (ctx->ack_window == 0) {
+        for (size_t i = 0; i < n; i++) {
+            *len += tx_encode_frame(&cmds[i], ctx->tx_next_seq++, &buf[*len]);
+        }
+        return;
+    }
+
+    uint64_t deadline_ns = monotonic_ns() + ctx->ack_timeout_ns;
+    pthread_mutex_lock(&ctx->ack_mutex);
+    for (size_t i = 0; i < n; i++) {
+        struct ack_slot *slot = &ctx->ack_slots[ctx->tx_next_seq % ACK_MAX_WINDOW];
+        slot->cmd = cmds[i];
+        slot->seq = ctx->tx_next_seq;
+        slot->deadline_ns = deadline_ns;
+        slot->retries = 0;
+        slot->in_flight = 1;
+        ctx->ack_stats.in_flight++;
+        *len += tx_encode_frame(&cmds[i], ctx->tx_next_seq++, &buf[*len]);
+    }
+    pthread_mutex_unlock(&ctx->ack_mutex);
+}
+
+/**
+ * @brief Retire the command named by an acknowledgement
+ *
+ * Acknowledgements for commands that are not in flight, such as late
+ * duplicates after a retransmission, are ignored.
+ *
+ * @param ctx Instance handle
+ * @param event Decoded RX_EVENT_ACK
+ */
+static void ack_complete(serial_ctx_t *ctx, const rx_event_t *event) {
+    SERIAL_TRACE(TRACE_ACK, event->data.ack.seq);
+    if (ctx->ack_window == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->ack_mutex);
+    struct ack_slot *slot = &ctx->ack_slots[event->data.ack.seq % ACK_MAX_WINDOW];
+    if (slot->in_flight && slot->seq == event->data.ack.seq &&
+        slot->cmd.command_type == event->data.ack.command_type) {
+        slot->in_flight = 0;
+        ctx->ack_stats.in_flight--;
+        if (event->data.ack.status == RSP_ACK_OK) {
+            ctx->ack_stats.acked++;
+        } else {
+            ctx->ack_stats.rejected++;
+            SERIAL_LOG(LOG_WARNING, "Command 0x%02X (seq %u) rejected with status %u",
+                       slot->cmd.command_type, slot->seq, event->data.ack.status);
+        }
+        ack_advance(ctx);
+    }
+    pthread_mutex_unlock(&ctx->ack_mutex);
+
+    // The writer may be waiting for room in the window
+    wake_waiters(ctx, &ctx->cmd_wait);
+}
+
+/**
+ * @brief Write a burst of encoded frames to the serial port
+ *
+ * Short writes are resumed until the whole burst is written, so the usual
+ * case is a single write() for every frame of the burst.
+ *
+ * @param ctx Instance handle
+ * @param buf Buffer holding the encoded frames back to back
+ * @param len Number of bytes in buf
+ * @param frames Number of frames in buf
+ */
+static void tx_write_burst(serial_ctx_t *ctx, const uint8_t *buf, size_t len, size_t frames) {
+    size_t offset = 0;
+
+    while (offset < len) {
+        unsigned generation = __atomic_load_n(&ctx->port_generation, __ATOMIC_ACQUIRE);
+        uint64_t start_ns = monotonic_ns();
+        ssize_t written = write(ctx->serial_fd, buf + offset, len - offset);
+        record_write(ctx, start_ns, written);
+        __atomic_add_fetch(&ctx->tx_write_calls, 1, __ATOMIC_RELAXED);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            __atomic_add_fetch(&ctx->tx_write_errors, 1, __ATOMIC_RELAXED);
+            if (port_gone_error(errno)) {
+                // The device may have missed any part of the burst, send all of it on the new port
+                port_failed(ctx, generation, "write failed");
+                tx_wait_for_port(ctx);
+                if (!__atomic_load_n(&ctx->tx_running, __ATOMIC_ACQUIRE)) {
+                    return;
+                }
+                offset = 0;
+                continue;
+            }
+            tx_drop_burst(ctx, frames);
+            return;
+        }
+        offset += (size_t)written;
+    }
+
+    __atomic_add_fetch(&ctx->tx_frames, frames, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&ctx->tx_bytes, len, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Main loop of the writer thread
+ *
+ * Drains up to tx_frames_per_write commands at a time, encodes them back to
+ * back into one buffer and writes the burst with a single system call. With
+ * acknowledgements tracked, due retransmissions go first in the burst and
+ * new commands only fill the room left in the window.
+ *
+ * @param arg Instance to transmit for
+ * @return NULL
+ */
+static void *tx_thread_main(void *arg) {
+    serial_ctx_t *ctx = arg;
+    device_command_t cmds[TX_MAX_FRAMES_PER_WRITE];
+    uint8_t buf[TX_MAX_FRAMES_PER_WRITE * FRAME_MAX_SIZE];
+
+    while (__atomic_load_n(&ctx->tx_running, __ATOMIC_ACQUIRE)) {
+        size_t room = ctx->tx_frames_per_write;
+        size_t len = 0;
+        size_t resent = 0;
+        uint64_t deadline_ns = 0;
+
+        // Leave the backlog in the pool while the port is failed
+        if (__atomic_load_n(&ctx->port_down, __ATOMIC_ACQUIRE)) {
+            tx_wait_for_port(ctx);
+            continue;
+        }
+
+        if (ctx->ack_window > 0) {
+            resent = ack_collect_retransmits(ctx, buf, &len, room, &deadline_ns);
+            size_t free_slots = ctx->ack_window -
+                                (uint8_t)(ctx->tx_next_seq - __atomic_load_n(&ctx->ack_base, __ATOMIC_ACQUIRE));
+            room -= resent;
+            if (room > free_slots) {
+                room = free_slots;
+            }
+        }
+
+        size_t n = room > 0 ? pop_commands(ctx, cmds, room) : 0;
+        if (n + resent == 0) {
+            tx_wait_for_commands(ctx, deadline_ns);
+            continue;
+        }
+
+        tx_encode_commands(ctx, cmds, n, buf, &len);
+        tx_write_burst(ctx, buf, len, n + resent);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reset the counters of the transmit engine
+ *
+ * @param ctx Instance handle
+ */
+static void reset_tx_stats(serial_ctx_t *ctx) {
+    ctx->tx_next_seq = 0;
+    ctx->ack_base = 0;
+    memset(ctx->ack_slots, 0, sizeof(ctx->ack_slots));
+    memset(&ctx->ack_stats, 0, sizeof(ctx->ack_stats));
+    __atomic_store_n(&ctx->tx_frames, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->tx_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->tx_write_calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->tx_write_errors, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->tx_dropped, 0, __ATOMIC_RELAXED);
+    ctx->tx_start_ns = 0;
+}
+
+/**
+ * @brief Start the writer thread of the transmit engine
+ *
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the thread could not be created
+ */
+static int start_transmitter(serial_ctx_t *ctx) {
+    ctx->tx_start_ns = monotonic_ns();
+
+    __atomic_store_n(&ctx->tx_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&ctx->tx_thread, NULL, tx_thread_main, ctx) != 0) {
+        __atomic_store_n(&ctx->tx_running, 0, __ATOMIC_RELEASE);
+        SERIAL_LOG(LOG_WARNING, "Failed to create transmit engine thread");
+        return EXIT_FAILURE;
+    }
+    serial_sched_apply(ctx->tx_thread, &ctx->tx_thread_opts, &ctx->tx_thread_info);
+    SERIAL_LOG(LOG_INFO, "Transmit engine started (%zu frames per write)", ctx->tx_frames_per_write);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Stop and join the writer thread of the transmit engine, if running
+ *
+ * @param ctx Instance handle
+ */
+static void stop_transmitter(serial_ctx_t *ctx) {
+    if (!__atomic_load_n(&ctx->tx_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    __atomic_store_n(&ctx->tx_running, 0, __ATOMIC_RELEASE);
+    wake_all(ctx, &ctx->cmd_wait);
+    pthread_join(ctx->tx_thread, NULL);
+    SERIAL_LOG(LOG_INFO, "Transmit engine stopped");
+}
+
+/**
+ * @brief Wake the reactor of an instance after commands were added
+ *
+ * Only the first producer after the reactor last looked at the instance pays
+ * for the eventfd write; the others see the pending wake-up and skip it.
+ *
+ * @param ctx Instance handle
+ */
+static void reactor_kick(serial_ctx_t *ctx) {
+    if (__atomic_load_n(&ctx->reactor, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+    if (!__atomic_exchange_n(&ctx->reactor_kicked, 1, __ATOMIC_SEQ_CST)) {
+        uint64_t one = 1;
+        if (write(ctx->kick_fd, &one, sizeof(one)) != sizeof(one)) {
+            SERIAL_LOG(LOG_WARNING, "Failed to wake the reactor");
+        }
+    }
+}
+
+/**
+ * @brief Request or cancel EPOLLOUT for the serial port of an instance
+ *
+ * @param ctx Instance handle
+ * @param wants_output Non-zero to be woken when the port becomes writable
+ */
+static void reactor_want_output(serial_ctx_t *ctx, int wants_output) {
+    if (!ctx->reactor_pollable) {
+        // Ports epoll cannot watch are always writable, come back through the kick
+        if (wants_output) {
+            __atomic_store_n(&ctx->reactor_kicked, 0, __ATOMIC_SEQ_CST);
+            reactor_kick(ctx);
+        }
+        return;
+    }
+    if (ctx->reactor_wants_output == wants_output) {
+        return;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = wants_output ? EPOLLOUT : 0;
+    ev.data.ptr = ctx;
+    if (epoll_ctl(ctx->reactor->epoll_fd, EPOLL_CTL_MOD, ctx->serial_fd, &ev) == 0) {
+        ctx->reactor_wants_output = wants_output;
+    }
+}
+
+/**
+ * @brief Drain the active pool of an instance into its non-blocking port
+ *
+ * Commands are encoded into the burst buffer of the instance and written
+ * without blocking. A partial write keeps the rest of the burst for the next
+ * EPOLLOUT, so the loop never waits for a slow port. At most
+ * REACTOR_BURSTS_PER_EVENT bursts are written per call to stay fair to the
+ * other instances.
+ *
+ * @param ctx Instance handle
+ */
+static void reactor_service(serial_ctx_t *ctx) {
+    device_command_t cmds[TX_MAX_FRAMES_PER_WRITE];
+    uint64_t value;
+    int bursts = 0;
+
+    // Consume the wake-up before looking at the pool so no add is missed
+    if (read(ctx->kick_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        SERIAL_LOG(LOG_WARNING, "Failed to read reactor wake-up");
+    }
+    __atomic_store_n(&ctx->reactor_kicked, 0, __ATOMIC_SEQ_CST);
+
+    // Leave the backlog in the pool while the port is failed, serial_reconnect() kicks the instance
+    if (__atomic_load_n(&ctx->port_down, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    for (;;) {
+        if (ctx->tx_off == ctx->tx_len) {
+            if (bursts == REACTOR_BURSTS_PER_EVENT) {
+                reactor_want_output(ctx, 1);
+                return;
+            }
+            size_t n = pop_commands(ctx, cmds, ctx->tx_frames_per_write);
+            if (n == 0) {
+                reactor_want_output(ctx, 0);
+                return;
+            }
+
+            size_t len = 0;
+            for (size_t i = 0; i < n; i++) {
+                len += tx_encode_frame(&cmds[i], ctx->tx_next_seq++, &ctx->tx_buf[len]);
+            }
+            ctx->tx_len = len;
+            ctx->tx_off = 0;
+            ctx->tx_burst_frames = n;
+            bursts++;
+        }
+
+        unsigned generation = __atomic_load_n(&ctx->port_generation, __ATOMIC_ACQUIRE);
+        uint64_t start_ns = monotonic_ns();
+        ssize_t written = write(ctx->serial_fd, ctx->tx_buf + ctx->tx_off,
+                                ctx->tx_len - ctx->tx_off);
+        record_write(ctx, start_ns, written);
+        __atomic_add_fetch(&ctx->tx_write_calls, 1, __ATOMIC_RELAXED);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Port buffer is full, resume when it drains
+                reactor_want_output(ctx, 1);
+                return;
+            }
+            __atomic_add_fetch(&ctx->tx_write_errors, 1, __ATOMIC_RELAXED);
+            if (port_gone_error(errno)) {
+                // Keep the whole burst for the new port
+                port_failed(ctx, generation, "write failed");
+                ctx->tx_off = 0;
+                return;
+            }
+            tx_drop_burst(ctx, ctx->tx_burst_frames);
+            ctx->tx_off = ctx->tx_len;
+            continue;
+        }
+
+        ctx->tx_off += (size_t)written;
+        if (ctx->tx_off == ctx->tx_len) {
+            __atomic_add_fetch(&ctx->tx_frames, ctx->tx_burst_frames, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&ctx->tx_bytes, ctx->tx_len, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Remove an instance from the epoll set and the list of a reactor
+ *
+ * Must be called by the loop thread, or after it stopped, with the reactor
+ * mutex held.
+ *
+ * @param reactor Reactor the instance is attached to
+ * @param ctx Instance handle
+ */
+static void reactor_detach(serial_reactor_t *reactor, serial_ctx_t *ctx) {
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, ctx->kick_fd, NULL);
+    if (ctx->reactor_pollable) {
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, ctx->serial_fd, NULL);
+    }
+    LIST_REMOVE(ctx, reactor_link);
+    __atomic_store_n(&ctx->reactor, NULL, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Return a detached instance's port to blocking mode
+ *
+ * The rest of a partially written burst is written in blocking mode, so the
+ * next frame on the wire always starts on a frame boundary.
+ *
+ * @param ctx Instance handle
+ */
+static void reactor_release(serial_ctx_t *ctx) {
+    fcntl(ctx->serial_fd, F_SETFL, ctx->reactor_saved_flags);
+    if (ctx->tx_off < ctx->tx_len) {
+        tx_write_burst(ctx, ctx->tx_buf + ctx->tx_off, ctx->tx_len - ctx->tx_off,
+                       ctx->tx_burst_frames);
+    }
+    ctx->tx_len = 0;
+    ctx->tx_off = 0;
+    ctx->reactor_wants_output = 0;
+}
+
+/**
+ * @brief Main loop of the reactor thread
+ *
+ * @param arg Reactor to run
+ * @return NULL
+ */
+static void *reactor_main(void *arg) {
+    serial_reactor_t *reactor = arg;
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    while (__atomic_load_n(&reactor->running, __ATOMIC_ACQUIRE)) {
+        int n = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno != EINTR) {
+                SERIAL_LOG(LOG_WARNING, "Reactor epoll_wait failed");
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&reactor->mutex);
+        for (int i = 0; i < n; i++) {
+            serial_ctx_t *ctx = events[i].data.ptr;
+            if (ctx == NULL) {
+                // Control request, handled below
+                uint64_t value;
+                if (read(reactor->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                    SERIAL_LOG(LOG_WARNING, "Failed to read reactor control wake-up");
+                }
+                continue;
+            }
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) && ctx->reactor_pollable) {
+                // The event may predate a reconnection, so ask the descriptor in place now
+                struct pollfd pfd = { ctx->serial_fd, 0, 0 };
+                unsigned generation = __atomic_load_n(&ctx->port_generation, __ATOMIC_ACQUIRE);
+                if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP))) {
+                    // Stop watching a broken port until it is reopened
+                    SERIAL_LOG(LOG_WARNING, "Serial port error or hang-up reported by epoll");
+                    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, ctx->serial_fd, NULL);
+                    ctx->reactor_pollable = 0;
+                    port_failed(ctx, generation, "hang-up");
+                }
+            }
+            reactor_service(ctx);
+        }
+
+        // Detach between batches so no pending event refers to the instance
+        if (reactor->detach != NULL) {
+            reactor_detach(reactor, reactor->detach);
+            reactor->detach = NULL;
+            pthread_cond_broadcast(&reactor->cond);
+        }
+        pthread_mutex_unlock(&reactor->mutex);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Close the descriptors of a reactor and free it
+ *
+ * @param reactor Reactor to free
+ */
+static void reactor_free(serial_reactor_t *reactor) {
+    if (reactor->epoll_fd >= 0) close(reactor->epoll_fd);
+    if (reactor->wake_fd >= 0) close(reactor->wake_fd);
+    free(reactor);
+}
+
+serial_reactor_t *serial_reactor_create(void) {
+    return serial_reactor_create_with_options(NULL);
+}
+
+serial_reactor_t *serial_reactor_create_with_options(const serial_thread_options_t *opts) {
+    serial_thread_options_t defaults = {-1, 0};
+
+    if (opts == NULL) {
+        opts = &defaults;
+    }
+    if (!serial_sched_valid(opts)) {
+        SERIAL_LOG(LOG_WARNING, "Failed to create reactor: invalid CPU %d or priority %d", opts->cpu, opts->priority);
+        return NULL;
+    }
+    serial_reactor_t *reactor = calloc(1, sizeof(*reactor));
+    if (reactor == NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to allocate reactor");
+        return NULL;
+    }
+
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->epoll_fd < 0 || reactor->wake_fd < 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to create reactor epoll or eventfd descriptor");
+        reactor_free(reactor);
+        return NULL;
+    }
+
+    // The control wake-up is the only event without an instance
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to register reactor wake-up");
+        reactor_free(reactor);
+        return NULL;
+    }
+
+    pthread_mutex_init(&reactor->mutex, NULL);
+    pthread_cond_init(&reactor->cond, NULL);
+    LIST_INIT(&reactor->ctxs);
+    __atomic_store_n(&reactor->running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&reactor->thread, NULL, reactor_main, reactor) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to create reactor thread");
+        pthread_cond_destroy(&reactor->cond);
+        pthread_mutex_destroy(&reactor->mutex);
+        reactor_free(reactor);
+        return NULL;
+    }
+    serial_sched_apply(reactor->thread, opts, &reactor->thread_info);
+    SERIAL_LOG(LOG_INFO, "Reactor started");
+    return reactor;
+}
+
+int serial_reactor_get_thread_info(serial_reactor_t *reactor, serial_thread_info_t *info) {
+    if (reactor == NULL || info == NULL) {
+        return EXIT_FAILURE;
+    }
+    *info = reactor->thread_info;
+    return EXIT_SUCCESS;
+}
+
+int serial_reactor_add(serial_reactor_t *reactor, serial_ctx_t *ctx) {
+    if (reactor == NULL || ctx == NULL || !ctx->initialized) {
+        SERIAL_LOG(LOG_WARNING, "Failed to attach to reactor: NULL reactor or instance not initialized");
+        return EXIT_FAILURE;
+    }
+    if (__atomic_load_n(&ctx->tx_running, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&ctx->reactor, __ATOMIC_ACQUIRE) != NULL) {
+        SERIAL_LOG(LOG_WARNING, "Failed to attach to reactor: instance already has a transmitter");
+        return EXIT_FAILURE;
+    }
+
+    if (ctx->kick_fd < 0) {
+        ctx->kick_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (ctx->kick_fd < 0) {
+            SERIAL_LOG(LOG_WARNING, "Failed to attach to reactor: cannot create eventfd");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Switch the port to non-blocking writes
+    ctx->reactor_saved_flags = fcntl(ctx->serial_fd, F_GETFL);
+    if (ctx->reactor_saved_flags < 0 ||
+        fcntl(ctx->serial_fd, F_SETFL, ctx->reactor_saved_flags | O_NONBLOCK) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to attach to reactor: cannot make port non-blocking");
+        return EXIT_FAILURE;
+    }
+    ctx->tx_len = 0;
+    ctx->tx_off = 0;
+    ctx->reactor_wants_output = 0;
+    __atomic_store_n(&ctx->reactor_kicked, 0, __ATOMIC_RELAXED);
+    reset_tx_stats(ctx);
+    ctx->tx_start_ns = monotonic_ns();
+
+    pthread_mutex_lock(&reactor->mutex);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = ctx;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, ctx->kick_fd, &ev) != 0) {
+        pthread_mutex_unlock(&reactor->mutex);
+        fcntl(ctx->serial_fd, F_SETFL, ctx->reactor_saved_flags);
+        SERIAL_LOG(LOG_WARNING, "Failed to attach to reactor: cannot register eventfd");
+        return EXIT_FAILURE;
+    }
+
+    // Devices epoll cannot watch, like /dev/null, are always writable
+    ev.events = 0;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, ctx->serial_fd, &ev) == 0) {
+        ctx->reactor_pollable = 1;
+    } else if (errno == EPERM) {
+        ctx->reactor_pollable = 0;
+    } else {
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, ctx->kick_fd, NULL);
+        pthread_mutex_unlock(&reactor->mutex);
+        fcntl(ctx->serial_fd, F_SETFL, ctx->reactor_saved_flags);
+        SERIAL_LOG(LOG_WARNING, "Failed to attach to reactor: cannot register serial port");
+        return EXIT_FAILURE;
+    }
+    LIST_INSERT_HEAD(&reactor->ctxs, ctx, reactor_link);
+    __atomic_store_n(&ctx->reactor, reactor, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&reactor->mutex);
+
+    // Pick up commands queued before attaching
+    reactor_kick(ctx);
+    SERIAL_LOG(LOG_INFO, "Instance attached to reactor");
+    return EXIT_SUCCESS;
+}
+
+int serial_reactor_remove(serial_reactor_t *reactor, serial_ctx_t *ctx) {
+    if (reactor == NULL || ctx == NULL ||
+        __atomic_load_n(&ctx->reactor, __ATOMIC_ACQUIRE) != reactor) {
+        SERIAL_LOG(LOG_WARNING, "Failed to detach from reactor: instance not attached");
+        return EXIT_FAILURE;
+    }
+
+    // Let the loop thread detach the instance between two batches
+    pthread_mutex_lock(&reactor->mutex);
+    while (reactor->detach != NULL) {
+        pthread_cond_wait(&reactor->cond, &reactor->mutex);
+    }
+    reactor->detach = ctx;
+    uint64_t one = 1;
+    if (write(reactor->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        SERIAL_LOG(LOG_WARNING, "Failed to wake the reactor");
+    }
+    while (reactor->detach == ctx) {
+        pthread_cond_wait(&reactor->cond, &reactor->mutex);
+    }
+    pthread_mutex_unlock(&reactor->mutex);
+
+    reactor_release(ctx);
+    SERIAL_LOG(LOG_INFO, "Instance detached from reactor");
+    return EXIT_SUCCESS;
+}
+
+int serial_reactor_destroy(serial_reactor_t *reactor) {
+    if (reactor == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    // Stop the loop thread, then detach what is left from this thread
+    __atomic_store_n(&reactor->running, 0, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if (write(reactor->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        SERIAL_LOG(LOG_WARNING, "Failed to wake the reactor");
+    }
+    pthread_join(reactor->thread, NULL);
+
+    pthread_mutex_lock(&reactor->mutex);
+    while (!LIST_EMPTY(&reactor->ctxs)) {
+        serial_ctx_t *ctx = LIST_FIRST(&reactor->ctxs);
+        reactor_detach(reactor, ctx);
+        reactor_release(ctx);
+    }
+    pthread_mutex_unlock(&reactor->mutex);
+
+    pthread_cond_destroy(&reactor->cond);
+    pthread_mutex_destroy(&reactor->mutex);
+    reactor_free(reactor);
+    SERIAL_LOG(LOG_INFO, "Reactor stopped");
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Reset the receive ring, the event queue and the receive counters
+ *
+ * @param ctx Instance handle
+ */
+static void reset_rx(serial_ctx_t *ctx) {
+    ctx->rx_head = 0;
+    ctx->rx_tail = 0;
+    for (size_t i = 0; i < RX_EVENT_QUEUE_SIZE; i++) {
+        ctx->rx_events[i].sequence = i;
+    }
+    ctx->rx_event_head = 0;
+    ctx->rx_event_tail = 0;
+    memset(&ctx->rx_stats, 0, sizeof(ctx->rx_stats));
+}
+
+/**
+ * @brief Deliver a decoded event to the callback or the event queue
+ *
+ * Must be called with rx_mutex held, which makes the parser the only
+ * producer of the queue.
+ *
+ * @param ctx Instance handle
+ * @param event Decoded event
+ */
+static void rx_deliver(serial_ctx_t *ctx, const rx_event_t *event) {
+    if (ctx->rx_callback != NULL) {
+        ctx->rx_callback(event, ctx->rx_user);
+        return;
+    }
+
+    size_t pos = ctx->rx_event_head;
+    struct rx_event_slot *slot = &ctx->rx_events[pos % RX_EVENT_QUEUE_SIZE];
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != pos) {
+        // Queue is full, the consumer is behind
+        __atomic_add_fetch(&ctx->rx_stats.dropped_events, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slot->event = *event;
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+    ctx->rx_event_head = pos + 1;
+}
+
+/**
+ * @brief Decode a complete, checksummed frame at the parse position
+ *
+ * The frame is read straight out of the receive ring.
+ *
+ * @param ctx Instance handle
+ * @param len Payload length of the frame
+ * @return EXIT_SUCCESS if the frame was delivered, EXIT_FAILURE if it is malformed
+ */
+static int rx_decode(serial_ctx_t *ctx, uint8_t len) {
+    rx_event_t event;
+    memset(&event, 0, sizeof(event));
+    event.seq = RX_AT(ctx, 1);
+
+    switch (RX_AT(ctx, 2)) {
+        case RSP_ACK:
+            if (len != 3) {
+                return EXIT_FAILURE;
+            }
+            event.type = RX_EVENT_ACK;
+            event.data.ack.seq = RX_AT(ctx, FRAME_HEADER_SIZE);
+            event.data.ack.command_type = RX_AT(ctx, FRAME_HEADER_SIZE + 1);
+            event.data.ack.status = RX_AT(ctx, FRAME_HEADER_SIZE + 2);
+            ack_complete(ctx, &event);
+            break;
+
+        case RSP_LEVEL:
+            if (len != 2 || RX_AT(ctx, FRAME_HEADER_SIZE) >= CHANNEL_COUNT) {
+                return EXIT_FAILURE;
+            }
+            event.type = RX_EVENT_LEVEL;
+            event.data.level.channel = RX_AT(ctx, FRAME_HEADER_SIZE);
+            event.data.level.level = RX_AT(ctx, FRAME_HEADER_SIZE + 1);
+            break;
+
+        case RSP_STATE:
+            if (len != 2 || RX_AT(ctx, FRAME_HEADER_SIZE) >= CHANNEL_COUNT) {
+                return EXIT_FAILURE;
+            }
+            event.type = RX_EVENT_STATE;
+            event.data.state.channel = RX_AT(ctx, FRAME_HEADER_SIZE);
+            event.data.state.state = RX_AT(ctx, FRAME_HEADER_SIZE + 1);
+            break;
+
+        case RSP_FAULT:
+            if (len != 2 || RX_AT(ctx, FRAME_HEADER_SIZE) >= CHANNEL_COUNT) {
+                return EXIT_FAILURE;
+            }
+            event.type = RX_EVENT_FAULT;
+            event.data.fault.channel = RX_AT(ctx, FRAME_HEADER_SIZE);
+            event.data.fault.code = RX_AT(ctx, FRAME_HEADER_SIZE + 1);
+            break;
+
+        default:
+            return EXIT_FAILURE;
+    }
+
+    rx_deliver(ctx, &event);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Parse every complete frame in the receive ring
+ *
+ * Bytes before a start marker are skipped. A header with an impossible
+ * length or a frame with a wrong checksum only consumes its start marker, so
+ * the parser resynchronizes on the next one. An incomplete frame stays in the
+ * ring until more bytes arrive. Must be called with rx_mutex held.
+ *
+ * @param ctx Instance handle
+ */
+static void rx_parse(serial_ctx_t *ctx) {
+    for (;;) {
+        size_t avail = ctx->rx_head - ctx->rx_tail;
+
+        // Look for the start of a frame
+        while (avail > 0 && RX_AT(ctx, 0) != FRAME_START) {
+            ctx->rx_tail++;
+            avail--;
+            __atomic_add_fetch(&ctx->rx_stats.discarded_bytes, 1, __ATOMIC_RELAXED);
+        }
+        if (avail < FRAME_HEADER_SIZE) {
+            return;
+        }
+
+        uint8_t len = RX_AT(ctx, 3);
+        if (len > FRAME_MAX_PAYLOAD) {
+            ctx->rx_tail++;
+            __atomic_add_fetch(&ctx->rx_stats.discarded_bytes, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        size_t size = FRAME_HEADER_SIZE + len + 1;
+        if (avail < size) {
+            return;
+        }
+
+        // Checksum covers everything after the start marker
+        uint8_t checksum = 0;
+        for (size_t i = 1; i < size - 1; i++) {
+            checksum ^= RX_AT(ctx, i);
+        }
+        if (checksum != RX_AT(ctx, size - 1)) {
+            ctx->rx_tail++;
+            __atomic_add_fetch(&ctx->rx_stats.checksum_errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (rx_decode(ctx, len) == EXIT_SUCCESS) {
+            __atomic_add_fetch(&ctx->rx_stats.frames, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&ctx->rx_stats.malformed_frames, 1, __ATOMIC_RELAXED);
+        }
+        ctx->rx_tail += size;
+    }
+}
+
+/**
+ * @brief Read what the port has into the receive ring and parse it
+ *
+ * @param ctx Instance handle
+ * @return Number of bytes read, 0 at end of file, or -1 on error
+ */
+static ssize_t rx_read(serial_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->rx_mutex);
+
+    // Read straight into the contiguous free space of the ring
+    size_t offset = ctx->rx_head & (RX_BUFFER_SIZE - 1);
+    size_t space = RX_BUFFER_SIZE - (ctx->rx_head - ctx->rx_tail);
+    if (space > RX_BUFFER_SIZE - offset) {
+        space = RX_BUFFER_SIZE - offset;
+    }
+    ssize_t n = read(ctx->serial_fd, &ctx->rx_buf[offset], space);
+    if (n > 0) {
+        ctx->rx_head += (size_t)n;
+        __atomic_add_fetch(&ctx->rx_stats.bytes, (uint64_t)n, __ATOMIC_RELAXED);
+        rx_parse(ctx);
+    }
+
+    pthread_mutex_unlock(&ctx->rx_mutex);
+    return n;
+}
+
+/**
+ * @brief Main loop of the reader thread
+ *
+ * Waits on the serial port and the stop eventfd. After end of file or an
+ * error on the port, the thread waits until it is stopped or a reconnection
+ * tells it to read the new port.
+ *
+ * @param arg Instance to read for
+ * @return NULL
+ */
+static void *rx_thread_main(void *arg) {
+    serial_ctx_t *ctx = arg;
+    struct pollfd fds[2];
+
+    fds[0].fd = ctx->serial_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = ctx->rx_stop_fd;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        unsigned generation = __atomic_load_n(&ctx->port_generation, __ATOMIC_ACQUIRE);
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SERIAL_LOG(LOG_WARNING, "Receiver poll failed");
+            return NULL;
+        }
+        if (fds[1].revents != 0) {
+            uint64_t value;
+            if (__atomic_load_n(&ctx->rx_stopping, __ATOMIC_ACQUIRE)) {
+                return NULL;
+            }
+            // The port was reopened
+            if (read(ctx->rx_stop_fd, &value, sizeof(value)) < 0) {
+                SERIAL_LOG(LOG_WARNING, "Failed to read receiver wake-up");
+            }
+            fds[0].fd = ctx->serial_fd;
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            ssize_t n = rx_read(ctx);
+            if (n < 0 && port_gone_error(errno)) {
+                port_failed(ctx, generation, "read failed");
+                fds[0].fd = -1;
+            } else if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+                // A terminal only reports end of file when it was hung up
+                if (n == 0 && ctx->port_tty) {
+                    port_failed(ctx, generation, "hang-up");
+                }
+                SERIAL_LOG(LOG_INFO, "Receiver reached end of serial port input");
+                fds[0].fd = -1;
+            }
+        } else if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            port_failed(ctx, generation, "hang-up");
+            SERIAL_LOG(LOG_WARNING, "Receiver stopped reading: serial port error or hang-up");
+            fds[0].fd = -1;
+        }
+    }
+}
 
-/** @brief Queue head for the unused command pool */
-static TAILQ_HEAD(unused_cmd_queue, cmd_entry) unused_command_pool;
+/**
+ * @brief Start the reader thread of the receive path
+ *
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the thread could not be created
+ */
+static int start_receiver(serial_ctx_t *ctx) {
+    ctx->rx_stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (ctx->rx_stop_fd < 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to create receiver stop eventfd");
+        return EXIT_FAILURE;
+    }
+    __atomic_store_n(&ctx->rx_stopping, 0, __ATOMIC_RELAXED);
+    if (pthread_create(&ctx->rx_thread, NULL, rx_thread_main, ctx) != 0) {
+        close(ctx->rx_stop_fd);
+        SERIAL_LOG(LOG_WARNING, "Failed to create receiver thread");
+        return EXIT_FAILURE;
+    }
+    ctx->rx_running = 1;
+    SERIAL_LOG(LOG_INFO, "Receiver started");
+    return EXIT_SUCCESS;
+}
 
-/** @brief Array of pool entries */
-static struct cmd_entry *pool_entries = NULL;
+/**
+ * @brief Stop and join the reader thread of the receive path, if running
+ *
+ * @param ctx Instance handle
+ */
+static void stop_receiver(serial_ctx_t *ctx) {
+    if (!ctx->rx_running) {
+        return;
+    }
+    uint64_t one = 1;
+    __atomic_store_n(&ctx->rx_stopping, 1, __ATOMIC_RELEASE);
+    if (write(ctx->rx_stop_fd, &one, sizeof(one)) != sizeof(one)) {
+        SERIAL_LOG(LOG_WARNING, "Failed to signal receiver stop");
+    }
+    pthread_join(ctx->rx_thread, NULL);
+    close(ctx->rx_stop_fd);
+    ctx->rx_running = 0;
+    SERIAL_LOG(LOG_INFO, "Receiver stopped");
+}
 
-/** @brief Flag indicating whether the module is initialized */
-static int initialized = 0;
+/**
+ * @brief Move a newly opened port onto the descriptor number of the old one
+ *
+ * On failure the old port stays in place, still marked down, so the caller
+ * must not resume the threads on it.
+ *
+ * @param ctx Instance handle
+ * @param fd Newly opened port, closed by this function
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if dup2() failed
+ */
+static int replace_port_fd(serial_ctx_t *ctx, int fd) {
+    int err;
+    while ((err = dup2(fd, ctx->serial_fd)) < 0 && errno == EINTR) {
+    }
+    if (err < 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to move the reopened port %s into place (errno %d)", ctx->port_name, errno);
+    }
+    close(fd);
+    return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
 /**
- * @brief Validates the given device command
+ * @brief Put a newly opened port in place of the attached reactor's old one
  *
- * This function checks if a command has valid parameters according to
- * the device specification.
+ * Must be called with the reactor mutex held, so the loop thread does not
+ * service the instance while its registration changes. The old registration
+ * disappears with the old descriptor.
  *
- * @param cmd Pointer to the command structure to validate
- * @return EXIT_SUCCESS if valid, EXIT_FAILURE if invalid
+ * @param ctx Instance handle
+ * @param fd Newly opened port, closed by this function
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the old port is still in place
  */
-static int is_valid_command(const device_command_t *cmd) {
-    if (cmd == NULL) {
-        syslog(LOG_WARNING, "NULL command pointer");
+static int reactor_replace_port(serial_ctx_t *ctx, int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to make the reopened port non-blocking");
+    }
+    if (replace_port_fd(ctx, fd) != EXIT_SUCCESS) {
         return EXIT_FAILURE;
     }
+    ctx->reactor_saved_flags = flags;
 
-    switch (cmd->command_type) {
-        case CMD_SET_PARAMS:
-            if (cmd->data.set_params.min_level > 100 ||
-                cmd->data.set_params.max_level > 100 ||
-                cmd->data.set_params.max_time == 0 ||
-                cmd->data.set_params.max_time > 240 ||
-                cmd->data.set_params.min_level > cmd->data.set_params.max_level) {
-                syslog(LOG_WARNING, "Invalid SET_PARAMS command: min_level=%d, max_level=%d, max_time=%d",
-                       cmd->data.set_params.min_level,
-                       cmd->data.set_params.max_level,
-                       cmd->data.set_params.max_time);
-                return EXIT_FAILURE;
-            }
-            syslog(LOG_INFO, "Validated SET_PARAMS command: min_level=%d, max_level=%d, max_time=%d",
-                   cmd->data.set_params.min_level,
-                   cmd->data.set_params.max_level,
-                   cmd->data.set_params.max_time);
-            return EXIT_SUCCESS;
-
-        case CMD_ON_OFF:
-            if ((cmd->data.on_off.on_off != 0 && cmd->data.on_off.on_off != 1) ||
-                cmd->data.on_off.channel > 7) {
-                syslog(LOG_WARNING, "Invalid ON_OFF command: on_off=%d, channel=%d",
-                       cmd->data.on_off.on_off,
-                       cmd->data.on_off.channel);
-                return EXIT_FAILURE;
-            }
-            syslog(LOG_INFO, "Validated ON_OFF command: on_off=%d, channel=%d",
-                   cmd->data.on_off.on_off,
-                   cmd->data.on_off.channel);
-            return EXIT_SUCCESS;
-
-        case CMD_EMERGENCY:
-            syslog(LOG_INFO, "Validated EMERGENCY command");
-            return EXIT_SUCCESS;
-
-        default:
-            syslog(LOG_WARNING, "Unknown command type: 0x%x", cmd->command_type);
-            return EXIT_FAILURE;
-    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = 0;
+    ev.data.ptr = ctx;
+    ctx->reactor_pollable = epoll_ctl(ctx->reactor->epoll_fd, EPOLL_CTL_ADD, ctx->serial_fd, &ev) == 0;
+    ctx->reactor_wants_output = 0;
+    return EXIT_SUCCESS;
 }
 
-int init(const char *port_name, int speed) {
-    // Check if already initialized
-    if (initialized) {
-        syslog(LOG_WARNING, "Serial communication already initialized");
+int serial_reconnect(serial_ctx_t *ctx) {
+    if (ctx == NULL || !ctx->initialized) {
+        SERIAL_LOG(LOG_WARNING, "Reconnection failed: module not initialized");
         return EXIT_FAILURE;
     }
 
-    // Check for NULL or too long port name
-    if (port_name == NULL || strlen(port_name) > MAX_PORT_NAME) {
-        if (port_name == NULL) {
-            syslog(LOG_WARNING, "Initialization failed: port name is NULL");
-        } else {
-            syslog(LOG_WARNING, "Initialization failed: port name exceeds maximum length (%d characters)", MAX_PORT_NAME);
-        }
+    pthread_mutex_lock(&ctx->port_mutex);
+    serial_line_info_t info;
+    int fd = open_port(ctx, &info);
+    if (fd < 0) {
+        pthread_mutex_unlock(&ctx->port_mutex);
         return EXIT_FAILURE;
     }
+    ctx->line_info = info;
 
-    // Open syslog for logging
-    openlog("serial_comm", LOG_PID | LOG_CONS, LOG_USER);
-    syslog(LOG_INFO, "Initializing serial communication module");
-
-    // For testing with /dev/null just pretend it worked
-    if (strcmp(port_name, "/dev/null") == 0) {
-        serial_fd = 1; // Just a positive value for testing
-        syslog(LOG_INFO, "Serial communication initialized with /dev/null (test mode)");
-    } else {
-        // Try to open the serial port
-        serial_fd = open(port_name, O_WRONLY | O_NOCTTY);
-        if (serial_fd < 0) {
-            syslog(LOG_WARNING, "Failed to open serial port %s", port_name);
-            closelog();
+    // dup2() swaps the port under the descriptor number every thread uses
+    serial_reactor_t *reactor = __atomic_load_n(&ctx->reactor, __ATOMIC_ACQUIRE);
+    if (reactor != NULL) {
+        pthread_mutex_lock(&reactor->mutex);
+        if (reactor_replace_port(ctx, fd) != EXIT_SUCCESS) {
+            pthread_mutex_unlock(&reactor->mutex);
+            pthread_mutex_unlock(&ctx->port_mutex);
             return EXIT_FAILURE;
         }
-        syslog(LOG_INFO, "Serial port %s opened successfully", port_name);
-
-        // Set up the terminal settings
-        struct termios tty;
-        memset(&tty, 0, sizeof tty);
-        if (tcgetattr(serial_fd, &tty) != 0) {
-            syslog(LOG_WARNING, "Failed to get terminal attributes for %s", port_name);
-            close(serial_fd);
-            closelog();
+        __atomic_add_fetch(&ctx->port_generation, 1, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&ctx->port_down, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&reactor->mutex);
+    } else {
+        if (replace_port_fd(ctx, fd) != EXIT_SUCCESS) {
+            pthread_mutex_unlock(&ctx->port_mutex);
             return EXIT_FAILURE;
         }
+        __atomic_add_fetch(&ctx->port_generation, 1, __ATOMIC_ACQ_REL);
+        __atomic_store_n(&ctx->port_down, 0, __ATOMIC_RELEASE);
+    }
+    __atomic_add_fetch(&ctx->stat_reconnects, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctx->port_mutex);
 
-        cfsetospeed(&tty, speed);
-        cfsetispeed(&tty, speed);
-        tty.c_cflag |= (CLOCAL | CREAD);
+    // The charger may have been reset with the port, so send its whole state again
+    pthread_mutex_lock(&ctx->state_mutex);
+    ctx->state_valid = 0;
+    pthread_mutex_unlock(&ctx->state_mutex);
 
-        if (tcsetattr(serial_fd, TCSANOW, &tty) != 0) {
-            syslog(LOG_WARNING, "Failed to set terminal attributes for %s", port_name);
-            close(serial_fd);
-            closelog();
-            return EXIT_FAILURE;
+    // Resume the writer thread, the reactor and the reader on the new port
+    wake_all(ctx, &ctx->cmd_wait);
+    if (reactor != NULL) {
+        __atomic_store_n(&ctx->reactor_kicked, 0, __ATOMIC_SEQ_CST);
+        reactor_kick(ctx);
+    }
+    if (ctx->rx_running) {
+        uint64_t one = 1;
+        if (write(ctx->rx_stop_fd, &one, sizeof(one)) != sizeof(one)) {
+            SERIAL_LOG(LOG_WARNING, "Failed to wake the receiver");
         }
-        syslog(LOG_INFO, "Terminal attributes configured for serial port %s", port_name);
     }
+    SERIAL_LOG(LOG_INFO, "Serial port %s reopened", ctx->port_name);
+    return EXIT_SUCCESS;
+}
 
-    // Initialize the semaphore
-    if (sem_init(&cmd_semaphore, 0, 1) != 0) {
-        syslog(LOG_WARNING, "Failed to initialize semaphore");
-        if (serial_fd >= 0) close(serial_fd);
-        closelog();
-        return EXIT_FAILURE;
-    }
-    syslog(LOG_INFO, "Semaphore initialized successfully");
+/**
+ * @brief Main loop of the reconnect thread
+ *
+ * Sleeps until a failure is reported, then tries to reopen the port,
+ * doubling the delay before each attempt from reconnect_min_ns up to
+ * reconnect_max_ns.
+ *
+ * @param arg Instance handle
+ * @return NULL
+ */
+static void *reconnect_thread_main(void *arg) {
+    serial_ctx_t *ctx = arg;
+    uint64_t delay_ns = ctx->reconnect_min_ns;
 
-    // Initialize the active and unused command pools
-    TAILQ_INIT(&active_command_pool);
-    TAILQ_INIT(&unused_command_pool);
-    syslog(LOG_INFO, "Active and unused command pools initialized");
+    pthread_mutex_lock(&ctx->reconnect_mutex);
+    while (ctx->reconnect_running) {
+        if (!__atomic_load_n(&ctx->port_down, __ATOMIC_ACQUIRE)) {
+            delay_ns = ctx->reconnect_min_ns;
+            pthread_cond_wait(&ctx->reconnect_cond, &ctx->reconnect_mutex);
+            continue;
+        }
 
-    // Allocate memory for pool entries
-    pool_entries = calloc(POOL_SIZE, sizeof(struct cmd_entry));
-    if (!pool_entries) {
-        syslog(LOG_WARNING, "Failed to allocate memory for command pool (POOL_SIZE=%d)", POOL_SIZE);
-        if (serial_fd >= 0) close(serial_fd);
-        sem_destroy(&cmd_semaphore);
-        closelog();
-        return EXIT_FAILURE;
-    }
-    syslog(LOG_INFO, "Memory allocated for %d command pool entries", POOL_SIZE);
+        // Give the device time to come back before each attempt
+        uint64_t deadline_ns = monotonic_ns() + delay_ns;
+        struct timespec deadline;
+        deadline.tv_sec = (time_t)(deadline_ns / 1000000000u);
+        deadline.tv_nsec = (long)(deadline_ns % 1000000000u);
+        while (ctx->reconnect_running &&
+               pthread_cond_timedwait(&ctx->reconnect_cond, &ctx->reconnect_mutex, &deadline) != ETIMEDOUT) {
+        }
+        if (!ctx->reconnect_running) {
+            break;
+        }
 
-    // Initialize all entries in the unused pool
-    for (int i = 0; i < POOL_SIZE; i++) {
-        TAILQ_INSERT_TAIL(&unused_command_pool, &pool_entries[i], entries);
+        pthread_mutex_unlock(&ctx->reconnect_mutex);
+        int result = serial_reconnect(ctx);
+        pthread_mutex_lock(&ctx->reconnect_mutex);
+        if (result != EXIT_SUCCESS) {
+            delay_ns = delay_ns * 2 < ctx->reconnect_max_ns ? delay_ns * 2 : ctx->reconnect_max_ns;
+        }
     }
-    syslog(LOG_INFO, "All entries added to the unused command pool");
+    pthread_mutex_unlock(&ctx->reconnect_mutex);
+    return NULL;
+}
 
-    // Mark as initialized
-    initialized = 1;
-    syslog(LOG_INFO, "Serial communication module initialized");
+/**
+ * @brief Start the reconnect thread
+ *
+ * @param ctx Instance handle
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the thread could not be created
+ */
+static int start_reconnector(serial_ctx_t *ctx) {
+    ctx->reconnect_running = 1;
+    if (pthread_create(&ctx->reconnect_thread, NULL, reconnect_thread_main, ctx) != 0) {
+        ctx->reconnect_running = 0;
+        SERIAL_LOG(LOG_WARNING, "Failed to create reconnect thread");
+        return EXIT_FAILURE;
+    }
+    SERIAL_LOG(LOG_INFO, "Automatic reconnection enabled");
     return EXIT_SUCCESS;
 }
 
-int deinit(void) {
-    // Check if initialized
-    if (!initialized) {
-        syslog(LOG_WARNING, "Deinitialization failed: module not initialized");
-        return EXIT_FAILURE;
+/**
+ * @brief Stop and join the reconnect thread, if running
+ *
+ * @param ctx Instance handle
+ */
+static void stop_reconnector(serial_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->reconnect_mutex);
+    if (!ctx->reconnect_running) {
+        pthread_mutex_unlock(&ctx->reconnect_mutex);
+        return;
     }
-    syslog(LOG_INFO, "Starting serial communication module deinitialization");
+    ctx->reconnect_running = 0;
+    pthread_cond_signal(&ctx->reconnect_cond);
+    pthread_mutex_unlock(&ctx->reconnect_mutex);
+    pthread_join(ctx->reconnect_thread, NULL);
+}
 
-    // Lock the semaphore
-    if (sem_wait(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to lock semaphore during deinitialization");
+int serial_get_rx_event(serial_ctx_t *ctx, rx_event_t *event) {
+    if (ctx == NULL || !ctx->initialized || event == NULL) {
         return EXIT_FAILURE;
     }
 
-    // Close the serial port
-    if (serial_fd >= 0) {
-        close(serial_fd);
-        syslog(LOG_INFO, "Serial port closed");
-        serial_fd = -1;
-    } else {
-        syslog(LOG_INFO, "Serial port already closed or was not opened");
-    }
+    size_t pos = __atomic_load_n(&ctx->rx_event_tail, __ATOMIC_RELAXED);
+    for (;;) {
+        struct rx_event_slot *slot = &ctx->rx_events[pos % RX_EVENT_QUEUE_SIZE];
+        size_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
 
-    // Free the pool entries
-    if (pool_entries != NULL) {
-        free(pool_entries);
-        syslog(LOG_INFO, "Command pool memory freed");
-        pool_entries = NULL;
-    } else {
-        syslog(LOG_INFO, "Command pool memory already freed or not allocated");
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ctx->rx_event_tail, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *event = slot->event;
+                __atomic_store_n(&slot->sequence, pos + RX_EVENT_QUEUE_SIZE, __ATOMIC_RELEASE);
+                return EXIT_SUCCESS;
+            }
+        } else if (diff < 0) {
+            // No event pending
+            return EXIT_FAILURE;
+        } else {
+            pos = __atomic_load_n(&ctx->rx_event_tail, __ATOMIC_RELAXED);
+        }
     }
+}
 
-    // Unlock and destroy the semaphore
-    if (sem_post(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to unlock semaphore during deinitialization");
-    }
-    if (sem_destroy(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to destroy semaphore");
-    } else {
-        syslog(LOG_INFO, "Semaphore destroyed");
+int serial_rx_feed(serial_ctx_t *ctx, const uint8_t *data, size_t len) {
+    if (ctx == NULL || !ctx->initialized || data == NULL) {
+        return EXIT_FAILURE;
     }
 
-    // Close syslog
-    syslog(LOG_INFO, "Serial communication module deinitialized");
-    closelog();
-
-    // Mark as not initialized
-    initialized = 0;
+    pthread_mutex_lock(&ctx->rx_mutex);
+    while (len > 0) {
+        // Copy as much as fits, parsing frees the space again
+        size_t offset = ctx->rx_head & (RX_BUFFER_SIZE - 1);
+        size_t space = RX_BUFFER_SIZE - (ctx->rx_head - ctx->rx_tail);
+        if (space > RX_BUFFER_SIZE - offset) {
+            space = RX_BUFFER_SIZE - offset;
+        }
+        size_t chunk = len < space ? len : space;
+        memcpy(&ctx->rx_buf[offset], data, chunk);
+        ctx->rx_head += chunk;
+        __atomic_add_fetch(&ctx->rx_stats.bytes, chunk, __ATOMIC_RELAXED);
+        rx_parse(ctx);
+        data += chunk;
+        len -= chunk;
+    }
+    pthread_mutex_unlock(&ctx->rx_mutex);
     return EXIT_SUCCESS;
 }
 
-int add(const device_command_t *cmd) {
-    // Check if initialized
-    if (!initialized) {
-        syslog(LOG_WARNING, "Failed to add command: module not initialized");
+int serial_get_rx_stats(serial_ctx_t *ctx, rx_stats_t *stats) {
+    if (ctx == NULL || !ctx->initialized || stats == NULL) {
         return EXIT_FAILURE;
     }
 
-    syslog(LOG_INFO, "Adding new command");
+    stats->bytes = __atomic_load_n(&ctx->rx_stats.bytes, __ATOMIC_RELAXED);
+    stats->frames = __atomic_load_n(&ctx->rx_stats.frames, __ATOMIC_RELAXED);
+    stats->checksum_errors = __atomic_load_n(&ctx->rx_stats.checksum_errors, __ATOMIC_RELAXED);
+    stats->discarded_bytes = __atomic_load_n(&ctx->rx_stats.discarded_bytes, __ATOMIC_RELAXED);
+    stats->malformed_frames = __atomic_load_n(&ctx->rx_stats.malformed_frames, __ATOMIC_RELAXED);
+    stats->dropped_events = __atomic_load_n(&ctx->rx_stats.dropped_events, __ATOMIC_RELAXED);
+    return EXIT_SUCCESS;
+}
 
-    // Check if command is valid
-    if (cmd == NULL) {
-        syslog(LOG_WARNING, "Failed to add command: command pointer is NULL");
+int serial_get_ack_stats(serial_ctx_t *ctx, ack_stats_t *stats) {
+    if (ctx == NULL || !ctx->initialized || stats == NULL) {
         return EXIT_FAILURE;
     }
-    if (is_valid_command(cmd) != EXIT_SUCCESS) {
-        syslog(LOG_WARNING, "Failed to add command: command is invalid");
+
+    pthread_mutex_lock(&ctx->ack_mutex);
+    *stats = ctx->ack_stats;
+    pthread_mutex_unlock(&ctx->ack_mutex);
+    return EXIT_SUCCESS;
+}
+
+int serial_get_tx_stats(serial_ctx_t *ctx, tx_stats_t *stats) {
+    if (ctx == NULL || !ctx->initialized || stats == NULL) {
         return EXIT_FAILURE;
     }
-    syslog(LOG_INFO, "Command is valid");
 
-    // Lock the semaphore
-    if (sem_wait(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to lock semaphore while adding command");
-        return EXIT_FAILURE;
+    memset(stats, 0, sizeof(*stats));
+    stats->frames = __atomic_load_n(&ctx->tx_frames, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&ctx->tx_bytes, __ATOMIC_RELAXED);
+    stats->write_calls = __atomic_load_n(&ctx->tx_write_calls, __ATOMIC_RELAXED);
+    stats->write_errors = __atomic_load_n(&ctx->tx_write_errors, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&ctx->tx_dropped, __ATOMIC_RELAXED);
+
+    if (stats->write_calls > 0) {
+        stats->frames_per_write = (double)stats->frames / (double)stats->write_calls;
+    }
+    if (ctx->tx_start_ns != 0) {
+        uint64_t elapsed_ns = monotonic_ns() - ctx->tx_start_ns;
+        if (elapsed_ns > 0) {
+            stats->bytes_per_sec = (double)stats->bytes * 1e9 / (double)elapsed_ns;
+        }
     }
+    return EXIT_SUCCESS;
+}
 
-    // Check if there are any unused entries available
-    struct cmd_entry *entry = TAILQ_FIRST(&unused_command_pool);
-    if (entry == NULL) {
-        sem_post(&cmd_semaphore);
-        syslog(LOG_WARNING, "Command pool is full (no unused entries available)");
+int serial_get_emergency_latency(serial_ctx_t *ctx, emergency_latency_t *latency) {
+    if (ctx == NULL || !ctx->initialized || latency == NULL) {
         return EXIT_FAILURE;
     }
 
-    // Remove entry from unused pool
-    TAILQ_REMOVE(&unused_command_pool, entry, entries);
-    syslog(LOG_INFO, "Removed entry from unused command pool");
-
-    // Copy the command into the entry
-    memcpy(&entry->cmd, cmd, sizeof(device_command_t));
+    latency->count = __atomic_load_n(&ctx->emergency_dequeued, __ATOMIC_RELAXED);
+    latency->max_ns = __atomic_load_n(&ctx->emergency_latency_max_ns, __ATOMIC_RELAXED);
+    latency->mean_ns = 0;
+    if (latency->count > 0) {
+        latency->mean_ns = __atomic_load_n(&ctx->emergency_latency_total_ns, __ATOMIC_RELAXED) /
+                           latency->count;
+    }
+    return EXIT_SUCCESS;
+}
 
-    // Add the entry to the active pool
-    TAILQ_INSERT_TAIL(&active_command_pool, entry, entries);
-    syslog(LOG_INFO, "Command copied and added to active command pool");
+int serial_get_pool_stats(serial_ctx_t *ctx, pool_stats_t *stats) {
+    if (ctx == NULL || !ctx->initialized || stats == NULL) {
+        return EXIT_FAILURE;
+    }
 
-    // Unlock the semaphore
-    if (sem_post(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to unlock semaphore after adding command");
-    } else {
-        syslog(LOG_INFO, "Semaphore unlocked after adding command");
+    // Capacity only changes under the semaphore, take it for a stable value
+    if (sem_wait(&ctx->cmd_semaphore) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to lock semaphore while reading pool statistics");
+        return EXIT_FAILURE;
     }
+    stats->capacity = ctx->pool_capacity;
+    stats->max_capacity = ctx->pool_max_capacity;
+    sem_post(&ctx->cmd_semaphore);
 
-    // Log the success
-    syslog(LOG_INFO, "Command added successfully: 0x%x", cmd->command_type);
+    stats->high_water_mark = (size_t)__atomic_load_n(&ctx->pool_high_water_mark, __ATOMIC_RELAXED);
+    stats->grow_events = __atomic_load_n(&ctx->pool_grow_events, __ATOMIC_RELAXED);
+    stats->coalesced = __atomic_load_n(&ctx->coalesced_commands, __ATOMIC_RELAXED);
+    stats->cache_slow_path = __atomic_load_n(&ctx->cache_slow_path, __ATOMIC_RELAXED);
     return EXIT_SUCCESS;
 }
 
-/**
- * @brief Get the next command from the active pool
- *
- * This function retrieves the next command from the active pool and moves the entry
- * back to the unused pool. It is intended to be called by a consumer thread.
- *
- * @param cmd Pointer to store the retrieved command
- * @return EXIT_SUCCESS if a command was retrieved, EXIT_FAILURE otherwise
- */
-int get_next_command(device_command_t *cmd) {
-    // Check if initialized
-    if (!initialized || cmd == NULL) {
-        syslog(LOG_WARNING, "Failed to get command: module not initialized or NULL pointer");
+int serial_get_stats(serial_ctx_t *ctx, serial_stats_t *stats) {
+    if (ctx == NULL || stats == NULL) {
         return EXIT_FAILURE;
     }
 
-    // Lock the semaphore
-    if (sem_wait(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to lock semaphore while getting command");
+    stats->adds = __atomic_load_n(&ctx->stat_adds, __ATOMIC_RELAXED);
+    stats->rejected_invalid = __atomic_load_n(&ctx->stat_rejected_invalid, __ATOMIC_RELAXED);
+    stats->rejected_pool_full = __atomic_load_n(&ctx->stat_rejected_pool_full, __ATOMIC_RELAXED);
+    stats->rejected_not_initialized = __atomic_load_n(&ctx->stat_rejected_not_initialized, __ATOMIC_RELAXED);
+    stats->dequeues = __atomic_load_n(&ctx->stat_dequeues, __ATOMIC_RELAXED);
+    stats->active = 0;
+    stats->deferred = 0;
+    if (ctx->initialized) {
+        stats->active = __atomic_load_n(&ctx->command_counts, __ATOMIC_ACQUIRE) >> COUNT_ACTIVE_SHIFT;
+        stats->deferred = __atomic_load_n(&ctx->timer_pending, __ATOMIC_RELAXED);
+    }
+    stats->bytes_written = __atomic_load_n(&ctx->stat_bytes_written, __ATOMIC_RELAXED);
+    stats->write_calls = __atomic_load_n(&ctx->stat_write_calls, __ATOMIC_RELAXED);
+    stats->tx_dropped = __atomic_load_n(&ctx->stat_tx_dropped, __ATOMIC_RELAXED);
+    stats->port_failures = __atomic_load_n(&ctx->stat_port_failures, __ATOMIC_RELAXED);
+    stats->reconnects = __atomic_load_n(&ctx->stat_reconnects, __ATOMIC_RELAXED);
+    stats->port_down = ctx->initialized && __atomic_load_n(&ctx->port_down, __ATOMIC_ACQUIRE);
+    stats->state_commands = __atomic_load_n(&ctx->stat_state_commands, __ATOMIC_RELAXED);
+    stats->state_unchanged = __atomic_load_n(&ctx->stat_state_unchanged, __ATOMIC_RELAXED);
+    stats->overflow_rejected = __atomic_load_n(&ctx->stat_overflow_rejected, __ATOMIC_RELAXED);
+    stats->overflow_blocked = __atomic_load_n(&ctx->stat_overflow_blocked, __ATOMIC_RELAXED);
+    stats->overflow_timeouts = __atomic_load_n(&ctx->stat_overflow_timeouts, __ATOMIC_RELAXED);
+    stats->overflow_dropped = __atomic_load_n(&ctx->stat_overflow_dropped, __ATOMIC_RELAXED);
+    stats->overflow_coalesced = __atomic_load_n(&ctx->stat_overflow_coalesced, __ATOMIC_RELAXED);
+    stats->emergency_displaced = __atomic_load_n(&ctx->stat_emergency_displaced, __ATOMIC_RELAXED);
+    histogram_snapshot(&stats->residency, &ctx->stat_residency);
+    histogram_snapshot(&stats->write_time, &ctx->stat_write_time);
+    return EXIT_SUCCESS;
+}
+
+int serial_get_rt_info(serial_ctx_t *ctx, serial_rt_info_t *info) {
+    if (ctx == NULL || !ctx->initialized || info == NULL) {
         return EXIT_FAILURE;
     }
+    info->transmitter = ctx->tx_thread_info;
+    info->memory_locked = __atomic_load_n(&ctx->memory_locked, __ATOMIC_RELAXED);
+    info->locked_bytes = __atomic_load_n(&ctx->locked_bytes, __ATOMIC_RELAXED);
+    return EXIT_SUCCESS;
+}
 
-    // Check if there are any active commands
-    struct cmd_entry *entry = TAILQ_FIRST(&active_command_pool);
-    if (entry == NULL) {
-        sem_post(&cmd_semaphore);
-        syslog(LOG_INFO, "No active commands available");
+int serial_get_line_info(serial_ctx_t *ctx, serial_line_info_t *info) {
+    if (ctx == NULL || !ctx->initialized || info == NULL) {
         return EXIT_FAILURE;
     }
+    pthread_mutex_lock(&ctx->port_mutex);
+    *info = ctx->line_info;
+    pthread_mutex_unlock(&ctx->port_mutex);
+    return EXIT_SUCCESS;
+}
 
-    // Remove entry from active pool
-    TAILQ_REMOVE(&active_command_pool, entry, entries);
+uint64_t serial_histogram_bucket_limit(size_t index) {
+    // The last bucket also holds every larger value
+    if (index >= HISTOGRAM_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    if (index < 4) {
+        return index + 1;
+    }
+    unsigned msb = (unsigned)(index / 4) + 1;
+    return (uint64_t)(5 + index % 4) << (msb - 2);
+}
 
-    // Copy the command to the output parameter
-    memcpy(cmd, &entry->cmd, sizeof(device_command_t));
+/**
+ * @brief Output buffer of serial_format_prometheus()
+ */
+struct prom_output {
+    /** @brief Destination buffer */
+    char *buf;
+    /** @brief Size of buf in bytes */
+    size_t size;
+    /** @brief Length of the full text so far, may exceed size */
+    size_t len;
+    /** @brief Set if formatting failed */
+    int failed;
+};
 
-    // Return the entry to the unused pool
-    TAILQ_INSERT_TAIL(&unused_command_pool, entry, entries);
-    syslog(LOG_INFO, "Command retrieved and entry returned to unused pool");
+/**
+ * @brief Append formatted text to the Prometheus output, truncating like snprintf()
+ *
+ * @param out Output buffer
+ * @param format printf-style format string
+ */
+static void prom_append(struct prom_output *out, const char *format, ...) {
+    char *dst = out->len < out->size ? out->buf + out->len : NULL;
+    size_t room = out->len < out->size ? out->size - out->len : 0;
+    va_list args;
 
-    // Unlock the semaphore
-    if (sem_post(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to unlock semaphore after getting command");
+    va_start(args, format);
+    int n = vsnprintf(dst, room, format, args);
+    va_end(args);
+    if (n < 0) {
+        out->failed = 1;
+        return;
     }
-
-    return EXIT_SUCCESS;
+    out->len += (size_t)n;
 }
 
 /**
- * @brief Get the number of active commands in the pool
+ * @brief Append a counter or gauge with its metadata
  *
- * This function returns the current number of commands in the active pool.
- * It is thread-safe.
+ * @param out Output buffer
+ * @param name Metric name
+ * @param type Prometheus metric type
+ * @param help Description of the metric
+ * @param labels Labels of the sample, or NULL
+ * @param value Value of the sample
+ */
+static void prom_metric(struct prom_output *out, const char *name, const char *type, const char *help,
+                        const char *labels, uint64_t value) {
+    prom_append(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    prom_append(out, "%s%s%s%s %llu\n", name, labels ? "{" : "", labels ? labels : "", labels ? "}" : "",
+                (unsigned long long)value);
+}
+
+/**
+ * @brief Append a latency histogram with one bucket per power of two
  *
- * @return The number of active commands
+ * @param out Output buffer
+ * @param name Metric name
+ * @param help Description of the metric
+ * @param labels Labels of every sample, or NULL
+ * @param hist Histogram to append
  */
-int get_active_command_count(void) {
-    if (!initialized) {
-        return 0;
+static void prom_histogram(struct prom_output *out, const char *name, const char *help, const char *labels,
+                           const latency_histogram_t *hist) {
+    const char *sep = labels ? "," : "";
+    uint64_t cumulative = 0;
+
+    labels = labels ? labels : "";
+    prom_append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+        cumulative += hist->buckets[i];
+        if (i % 4 == 3) {
+            prom_append(out, "%s_bucket{%s%sle=\"%.6g\"} %llu\n", name, labels, sep,
+                        (double)serial_histogram_bucket_limit(i) / 1e9, (unsigned long long)cumulative);
+        }
+    }
+    prom_append(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)hist->count);
+    prom_append(out, "%s_sum%s%s%s %.9f\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+                (double)hist->sum_ns / 1e9);
+    prom_append(out, "%s_count%s%s%s %llu\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+                (unsigned long long)hist->count);
+}
+
+int serial_format_prometheus(const serial_stats_t *stats, const char *labels, char *buf, size_t size) {
+    if (stats == NULL || (buf == NULL && size > 0)) {
+        return -1;
     }
 
-    int count = 0;
+    struct prom_output out = { buf, size, 0, 0 };
+    const char *sep = labels ? "," : "";
+    const char *base = labels ? labels : "";
+    const char *reasons[] = { "invalid", "pool_full", "not_initialized" };
+    const uint64_t rejected[] = { stats->rejected_invalid, stats->rejected_pool_full,
+                                  stats->rejected_not_initialized };
+    const char *policies[] = { "reject", "block", "drop_oldest", "coalesce" };
+    const uint64_t overflows[] = { stats->overflow_rejected, stats->overflow_blocked, stats->overflow_dropped,
+                                   stats->overflow_coalesced };
 
-    // Lock the semaphore
-    if (sem_wait(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to lock semaphore while counting commands");
-        return 0;
+    if (size > 0) {
+        buf[0] = '\0';
     }
+    prom_metric(&out, "serial_commands_added_total", "counter",
+                "Commands accepted into the active pool.", labels, stats->adds);
 
-    // Count the active commands
-    struct cmd_entry *entry;
-    TAILQ_FOREACH(entry, &active_command_pool, entries) {
-        count++;
+    prom_append(&out, "# HELP serial_commands_rejected_total Commands rejected by the add functions.\n"
+                      "# TYPE serial_commands_rejected_total counter\n");
+    for (size_t i = 0; i < sizeof(reasons) / sizeof(reasons[0]); i++) {
+        prom_append(&out, "serial_commands_rejected_total{%s%sreason=\"%s\"} %llu\n", base, sep, reasons[i],
+                    (unsigned long long)rejected[i]);
     }
 
-    // Unlock the semaphore
-    if (sem_post(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to unlock semaphore after counting commands");
+    prom_metric(&out, "serial_commands_dequeued_total", "counter",
+                "Commands taken out of the active pool.", labels, stats->dequeues);
+    prom_metric(&out, "serial_commands_active", "gauge",
+                "Commands waiting in the active pool.", labels, stats->active);
+    prom_metric(&out, "serial_commands_deferred", "gauge",
+                "Commands of add_at() waiting for their deadline.", labels, stats->deferred);
+    prom_metric(&out, "serial_tx_bytes_total", "counter",
+                "Bytes written to the serial port.", labels, stats->bytes_written);
+    prom_metric(&out, "serial_tx_write_calls_total", "counter",
+                "write() calls made on the serial port.", labels, stats->write_calls);
+    prom_metric(&out, "serial_tx_dropped_frames_total", "counter",
+                "Frames given up on after a write error.", labels, stats->tx_dropped);
+    prom_metric(&out, "serial_port_failures_total", "counter",
+                "Failures of the serial port.", labels, stats->port_failures);
+    prom_metric(&out, "serial_port_reconnects_total", "counter",
+                "Times the serial port was reopened.", labels, stats->reconnects);
+    prom_metric(&out, "serial_port_down", "gauge",
+                "Whether the serial port is failed and not reopened yet.", labels, stats->port_down);
+    prom_metric(&out, "serial_state_commands_total", "counter",
+                "Commands generated by set_channel_state().", labels, stats->state_commands);
+    prom_metric(&out, "serial_state_unchanged_total", "counter",
+                "Commands set_channel_state() left out as unchanged.", labels, stats->state_unchanged);
+    prom_append(&out, "# HELP serial_overflow_total Adds that found the pool full, by how the overflow was handled.\n"
+                      "# TYPE serial_overflow_total counter\n");
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        prom_append(&out, "serial_overflow_total{%s%spolicy=\"%s\"} %llu\n", base, sep, policies[i],
+                    (unsigned long long)overflows[i]);
     }
+    prom_metric(&out, "serial_overflow_block_timeouts_total", "counter",
+                "Adds that blocked under the block policy and timed out.", labels, stats->overflow_timeouts);
+    prom_metric(&out, "serial_emergency_displaced_total", "counter",
+                "Routine commands discarded to make room for emergency commands.", labels,
+                stats->emergency_displaced);
+    prom_histogram(&out, "serial_queue_residency_seconds",
+                   "Time commands spent in the active pool.", labels, &stats->residency);
+    prom_histogram(&out, "serial_write_duration_seconds",
+                   "Duration of the write() calls on the serial port.", labels, &stats->write_time);
 
-    return count;
+    if (out.failed || out.len > INT_MAX) {
+        return -1;
+    }
+    return (int)out.len;
+}
+
+int reconnect(void) {
+    return serial_reconnect(&default_ctx);
+}
+
+int add(const device_command_t *cmd) {
+    return serial_add(&default_ctx, cmd);
+}
+
+int add_wait(const device_command_t *cmd, int64_t timeout_ns) {
+    return serial_add_wait(&default_ctx, cmd, timeout_ns);
+}
+
+int add_batch(const device_command_t *cmds, size_t n) {
+    return serial_add_batch(&default_ctx, cmds, n);
+}
+
+int add_prevalidated(const device_command_t *cmds, size_t n) {
+    return serial_add_prevalidated(&default_ctx, cmds, n);
+}
+
+int add_at(const device_command_t *cmd, uint64_t deadline_ns) {
+    return serial_add_at(&default_ctx, cmd, deadline_ns);
+}
+
+int set_channel_state(const charger_state_t *state) {
+    return serial_set_channel_state(&default_ctx, state);
+}
+
+int get_channel_state(charger_state_t *desired, charger_state_t *applied) {
+    return serial_get_channel_state(&default_ctx, desired, applied);
+}
+
+int invalidate_channel_state(void) {
+    return serial_invalidate_channel_state(&default_ctx);
+}
+
+int get_next_command(device_command_t *cmd) {
+    return serial_get_next_command(&default_ctx, cmd);
+}
+
+int get_next_command_wait(device_command_t *cmd, int64_t timeout_ns) {
+    return serial_get_next_command_wait(&default_ctx, cmd, timeout_ns);
+}
+
+size_t get_next_commands(device_command_t *out, size_t max) {
+    return serial_get_next_commands(&default_ctx, out, max);
+}
+
+int get_active_command_count(void) {
+    return serial_get_active_command_count(&default_ctx);
 }
 
-/**
- * @brief Get the number of unused command slots in the pool
- *
- * This function returns the current number of unused command slots.
- * It is thread-safe.
- *
- * @return The number of unused command slots
- */
 int get_unused_command_count(void) {
-    if (!initialized) {
-        return 0;
-    }
+    return serial_get_unused_command_count(&default_ctx);
+}
 
-    int count = 0;
+int get_command_counts(command_counts_t *counts) {
+    return serial_get_command_counts(&default_ctx, counts);
+}
 
-    // Lock the semaphore
-    if (sem_wait(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to lock semaphore while counting unused slots");
-        return 0;
-    }
+int get_tx_stats(tx_stats_t *stats) {
+    return serial_get_tx_stats(&default_ctx, stats);
+}
 
-    // Count the unused command slots
-    struct cmd_entry *entry;
-    TAILQ_FOREACH(entry, &unused_command_pool, entries) {
-        count++;
-    }
+int get_emergency_latency(emergency_latency_t *latency) {
+    return serial_get_emergency_latency(&default_ctx, latency);
+}
 
-    // Unlock the semaphore
-    if (sem_post(&cmd_semaphore) != 0) {
-        syslog(LOG_WARNING, "Failed to unlock semaphore after counting unused slots");
-    }
+int get_pool_stats(pool_stats_t *stats) {
+    return serial_get_pool_stats(&default_ctx, stats);
+}
 
-    return count;
+int get_line_info(serial_line_info_t *info) {
+    return serial_get_line_info(&default_ctx, info);
+}
+
+int get_rt_info(serial_rt_info_t *info) {
+    return serial_get_rt_info(&default_ctx, info);
+}
+
+int get_stats(serial_stats_t *stats) {
+    return serial_get_stats(&default_ctx, stats);
+}
+
+int get_rx_event(rx_event_t *event) {
+    return serial_get_rx_event(&default_ctx, event);
+}
+
+int rx_feed(const uint8_t *data, size_t len) {
+    return serial_rx_feed(&default_ctx, data, len);
+}
+
+int get_rx_stats(rx_stats_t *stats) {
+    return serial_get_rx_stats(&default_ctx, stats);
+}
+
+int get_ack_stats(ack_stats_t *stats) {
+    return serial_get_ack_stats(&default_ctx, stats);
 }
@@ -0,0 +1,189 @@
+/**
+ * @file serial_capture.c
+ * @brief Implementation of the binary command capture of the serial module
+ *
+ * This file implements the interface defined in serial_capture.h. Writers
+ * claim record positions with an atomic counter and fill the claimed records
+ * of the shared mapping directly. Each record carries its own index, stored
+ * last, so readers of a capture that is still running, or whose writer
+ * crashed, know which records are complete.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "serial_capture.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Capture being recorded
+ */
+struct serial_capture {
+    /** @brief Start of the mapping, holding the header */
+    capture_file_header_t *header;
+    /** @brief Records following the header */
+    capture_record_t *records;
+    /** @brief Number of records the file was sized for */
+    size_t capacity;
+    /** @brief Size of the mapping in bytes */
+    size_t size;
+    /** @brief Descriptor of the capture file */
+    int fd;
+    /** @brief CLOCK_MONOTONIC time at which the capture started */
+    uint64_t start_ns;
+    /** @brief Number of records claimed so far, may exceed capacity */
+    uint64_t claimed;
+};
+
+/**
+ * @brief Get the time of a clock in nanoseconds
+ *
+ * @param clock Clock to read
+ * @return Current time of the clock in nanoseconds
+ */
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+serial_capture_t *serial_capture_start(const char *path, size_t capacity) {
+    if (path == NULL || capacity == 0 || capacity > CAPTURE_MAX_CAPACITY) {
+        return NULL;
+    }
+    serial_capture_t *capture = calloc(1, sizeof(*capture));
+    if (capture == NULL) {
+        return NULL;
+    }
+
+    capture->size = sizeof(capture_file_header_t) + capacity * sizeof(capture_record_t);
+    capture->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (capture->fd < 0) {
+        free(capture);
+        return NULL;
+    }
+    if (ftruncate(capture->fd, (off_t)capture->size) != 0) {
+        close(capture->fd);
+        free(capture);
+        return NULL;
+    }
+    void *memory = mmap(NULL, capture->size, PROT_READ | PROT_WRITE, MAP_SHARED, capture->fd, 0);
+    if (memory == MAP_FAILED) {
+        close(capture->fd);
+        free(capture);
+        return NULL;
+    }
+
+    // The file is zero-filled, so no record is complete yet
+    capture->header = memory;
+    capture->records = (capture_record_t *)(capture->header + 1);
+    capture->capacity = capacity;
+    capture->start_ns = clock_ns(CLOCK_MONOTONIC);
+    memcpy(capture->header->magic, SERIAL_CAPTURE_MAGIC, sizeof(capture->header->magic));
+    capture->header->version = SERIAL_CAPTURE_VERSION;
+    capture->header->record_size = sizeof(capture_record_t);
+    capture->header->capacity = capacity;
+    capture->header->start_realtime_ns = clock_ns(CLOCK_REALTIME);
+    return capture;
+}
+
+void serial_capture_record(serial_capture_t *capture, const device_command_t *cmds, size_t n,
+                           uint64_t now_ns) {
+    uint64_t pos = __atomic_fetch_add(&capture->claimed, n, __ATOMIC_RELAXED);
+    size_t stored = 0;
+
+    if (pos < capture->capacity) {
+        stored = capture->capacity - pos < n ? (size_t)(capture->capacity - pos) : n;
+    }
+    for (size_t i = 0; i < stored; i++) {
+        capture_record_t *record = &capture->records[pos + i];
+        record->timestamp_ns = now_ns - capture->start_ns;
+        record->cmd = cmds[i];
+        __atomic_store_n(&record->sequence, (uint32_t)(pos + i + 1), __ATOMIC_RELEASE);
+    }
+    if (stored < n) {
+        __atomic_add_fetch(&capture->header->dropped, n - stored, __ATOMIC_RELAXED);
+    }
+}
+
+int serial_capture_stop(serial_capture_t *capture) {
+    int result = EXIT_SUCCESS;
+
+    if (capture == NULL) {
+        return EXIT_FAILURE;
+    }
+    uint64_t count = capture->claimed < capture->capacity ? capture->claimed : capture->capacity;
+    capture->header->count = count;
+    if (munmap(capture->header, capture->size) != 0 ||
+        ftruncate(capture->fd, (off_t)(sizeof(capture_file_header_t) + count * sizeof(capture_record_t))) != 0) {
+        result = EXIT_FAILURE;
+    }
+    if (close(capture->fd) != 0) {
+        result = EXIT_FAILURE;
+    }
+    free(capture);
+    return result;
+}
+
+int serial_capture_map(const char *path, capture_file_t *file) {
+    struct stat st;
+
+    if (path == NULL || file == NULL) {
+        return EXIT_FAILURE;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(capture_file_header_t)) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    size_t size = (size_t)st.st_size;
+    void *memory = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return EXIT_FAILURE;
+    }
+
+    const capture_file_header_t *header = memory;
+    if (memcmp(header->magic, SERIAL_CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SERIAL_CAPTURE_VERSION || header->record_size != sizeof(capture_record_t)) {
+        munmap(memory, size);
+        return EXIT_FAILURE;
+    }
+
+    // Count the complete records up to the first gap
+    const capture_record_t *records = (const capture_record_t *)(header + 1);
+    size_t available = (size - sizeof(capture_file_header_t)) / sizeof(capture_record_t);
+    size_t count = 0;
+    while (count < available &&
+           __atomic_load_n(&records[count].sequence, __ATOMIC_ACQUIRE) == (uint32_t)(count + 1)) {
+        count++;
+    }
+
+    file->header = header;
+    file->records = records;
+    file->count = count;
+    file->mapping = memory;
+    file->size = size;
+    return EXIT_SUCCESS;
+}
+
+void serial_capture_unmap(capture_file_t *file) {
+    if (file == NULL || file->mapping == NULL) {
+        return;
+    }
+    munmap(file->mapping, file->size);
+    file->mapping = NULL;
+    file->header = NULL;
+    file->records = NULL;
+    file->count = 0;
+}
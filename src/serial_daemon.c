@@ -0,0 +1,347 @@
+/**
+ * @file serial_daemon.c
+ * @brief Implementation of the configuration and requests of the battery daemon
+ *
+ * This file implements the interface defined in serial_daemon.h. It holds
+ * everything of bin/battery that does not touch the control socket or the
+ * process: main.c owns the sockets, the signals and the lifetime of the
+ * instances, and hands every request packet to this file.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "serial_daemon.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @brief Longest line of the configuration */
+#define DAEMON_MAX_LINE 512
+
+/**
+ * @brief Name of an option value
+ */
+typedef struct {
+    /** @brief Name in the configuration */
+    const char *name;
+    /** @brief Value of the enumeration */
+    int value;
+} daemon_name_t;
+
+/** @brief Values of the backend option */
+static const daemon_name_t backend_names[] = {
+    { "tailq", QUEUE_BACKEND_TAILQ },
+    { "ring", QUEUE_BACKEND_RING },
+    { NULL, 0 }
+};
+
+/** @brief Values of the overflow option; block would stall the control loop */
+static const daemon_name_t overflow_names[] = {
+    { "reject", OVERFLOW_REJECT },
+    { "drop_oldest", OVERFLOW_DROP_OLDEST },
+    { "coalesce", OVERFLOW_COALESCE },
+    { NULL, 0 }
+};
+
+/** @brief Values of the profile option */
+static const daemon_name_t profile_names[] = {
+    { "default", SERIAL_LINE_DEFAULT },
+    { "low_latency", SERIAL_LINE_LOW_LATENCY },
+    { "throughput", SERIAL_LINE_THROUGHPUT },
+    { NULL, 0 }
+};
+
+/**
+ * @brief Parse an unsigned decimal number
+ *
+ * @param text Text to parse
+ * @param max Largest accepted value
+ * @param value Pointer to store the value
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the text is not a number up to max
+ */
+static int parse_number(const char *text, unsigned long max, unsigned long *value) {
+    char *end;
+
+    if (text[0] < '0' || text[0] > '9') {
+        return EXIT_FAILURE;
+    }
+    errno = 0;
+    *value = strtoul(text, &end, 10);
+    return errno == 0 && *end == '\0' && *value <= max ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Look up the value of a named option value
+ *
+ * @param names Table of names, terminated by a NULL name
+ * @param text Name to look up
+ * @param value Pointer to store the value
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE if the name is not in the table
+ */
+static int parse_name(const daemon_name_t *names, const char *text, int *value) {
+    for (; names->name != NULL; names++) {
+        if (strcmp(names->name, text) == 0) {
+            *value = names->value;
+            return EXIT_SUCCESS;
+        }
+    }
+    return EXIT_FAILURE;
+}
+
+int serial_daemon_parse_port_option(serial_options_t *opts, const char *key, const char *text) {
+    unsigned long number;
+    int value;
+
+    if (strcmp(key, "backend") == 0 && parse_name(backend_names, text, &value) == EXIT_SUCCESS) {
+        opts->queue_backend = (queue_backend_t)value;
+    } else if (strcmp(key, "overflow") == 0 && parse_name(overflow_names, text, &value) == EXIT_SUCCESS) {
+        opts->overflow_set_params = (overflow_policy_t)value;
+        opts->overflow_on_off = (overflow_policy_t)value;
+    } else if (strcmp(key, "profile") == 0 && parse_name(profile_names, text, &value) == EXIT_SUCCESS) {
+        opts->line_profile = (serial_line_profile_t)value;
+    } else if (parse_number(text, POOL_MAX_CAPACITY, &number) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    } else if (strcmp(key, "pool") == 0) {
+        opts->pool_capacity = number;
+        opts->pool_chunk_size = number;
+    } else if (strcmp(key, "growth") == 0) {
+        opts->pool_growth = number != 0;
+        opts->pool_max_capacity = number;
+    } else if (strcmp(key, "emergency_reserve") == 0) {
+        opts->emergency_reserve = number;
+    } else if (number > 1) {
+        return EXIT_FAILURE;
+    } else if (strcmp(key, "coalesce") == 0) {
+        opts->coalesce = (int)number;
+    } else if (strcmp(key, "reconnect") == 0) {
+        opts->auto_reconnect = (int)number;
+    } else if (strcmp(key, "lock_memory") == 0) {
+        opts->lock_memory = (int)number;
+    } else {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Parse the options of a reactor line
+ *
+ * @param rt Placement and scheduling of the reactor thread
+ * @param key Option name
+ * @param text Option value
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE for an unknown option or value
+ */
+static int parse_reactor_option(serial_thread_options_t *rt, const char *key, const char *text) {
+    unsigned long number;
+
+    if (parse_number(text, 65535, &number) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    if (strcmp(key, "cpu") == 0) {
+        rt->cpu = (int)number;
+    } else if (strcmp(key, "priority") == 0) {
+        rt->priority = (int)number;
+    } else {
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Parse a port line after the directive
+ *
+ * @param cfg Configuration to add the port to
+ * @param save strtok_r() state of the line
+ * @return EXIT_SUCCESS on success, EXIT_FAILURE on a malformed line
+ */
+static int parse_port(daemon_config_t *cfg, char **save) {
+    const char *name = strtok_r(NULL, " \t", save);
+    const char *device = strtok_r(NULL, " \t", save);
+    const char *baud = strtok_r(NULL, " \t", save);
+    unsigned long number;
+    char *option;
+
+    if (name == NULL || device == NULL || baud == NULL || strlen(name) > DAEMON_MAX_NAME ||
+        strlen(device) > MAX_PORT_NAME || parse_number(baud, UINT32_MAX, &number) != EXIT_SUCCESS ||
+        number == 0 || cfg->nports == DAEMON_MAX_PORTS) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < cfg->nports; i++) {
+        if (strcmp(cfg->ports[i].name, name) == 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    daemon_port_t *port = &cfg->ports[cfg->nports];
+    strcpy(port->name, name);
+    strcpy(port->device, device);
+    port->baud = (uint32_t)number;
+    serial_options_default(&port->opts);
+    port->opts.log_sink = SERIAL_LOG_SINK_ASYNC;
+    while ((option = strtok_r(NULL, " \t", save)) != NULL) {
+        char *value = strchr(option, '=');
+        if (value == NULL) {
+            return EXIT_FAILURE;
+        }
+        *value++ = '\0';
+        if (serial_daemon_parse_port_option(&port->opts, option, value) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    cfg->nports++;
+    return EXIT_SUCCESS;
+}
+
+int serial_daemon_parse_config(const char *path, daemon_config_t *cfg) {
+    char line[DAEMON_MAX_LINE];
+    unsigned lineno = 0;
+    int result = EXIT_SUCCESS;
+
+    memset(cfg, 0, sizeof(*cfg));
+    strcpy(cfg->socket_path, DAEMON_DEFAULT_SOCKET);
+    cfg->reactor.cpu = -1;
+    cfg->reactor.priority = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "battery: cannot open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    while (result == EXIT_SUCCESS && fgets(line, sizeof(line), file) != NULL) {
+        char *save = NULL;
+        lineno++;
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        const char *directive = strtok_r(line, " \t", &save);
+        if (directive == NULL) {
+            continue;
+        }
+        if (strcmp(directive, "port") == 0) {
+            result = parse_port(cfg, &save);
+        } else if (strcmp(directive, "socket") == 0) {
+            const char *socket_path = strtok_r(NULL, " \t", &save);
+            if (socket_path == NULL || strlen(socket_path) >= sizeof(cfg->socket_path) ||
+                strtok_r(NULL, " \t", &save) != NULL) {
+                result = EXIT_FAILURE;
+            } else {
+                strcpy(cfg->socket_path, socket_path);
+            }
+        } else if (strcmp(directive, "reactor") == 0) {
+            char *option;
+            while (result == EXIT_SUCCESS && (option = strtok_r(NULL, " \t", &save)) != NULL) {
+                char *value = strchr(option, '=');
+                if (value == NULL) {
+                    result = EXIT_FAILURE;
+                } else {
+                    *value++ = '\0';
+                    result = parse_reactor_option(&cfg->reactor, option, value);
+                }
+            }
+        } else {
+            result = EXIT_FAILURE;
+        }
+    }
+    if (result != EXIT_SUCCESS) {
+        fprintf(stderr, "battery: %s:%u: invalid directive\n", path, lineno);
+    } else if (ferror(file)) {
+        fprintf(stderr, "battery: cannot read %s\n", path);
+        result = EXIT_FAILURE;
+    } else if (cfg->nports == 0) {
+        fprintf(stderr, "battery: %s configures no port\n", path);
+        result = EXIT_FAILURE;
+    }
+    fclose(file);
+    return result;
+}
+
+/**
+ * @brief Queue the validated commands of a submit
+ *
+ * A lone command goes through serial_add() and gets the overflow policy of
+ * the port; more commands go through serial_add_batch().
+ *
+ * @param ctx Instance of the port
+ * @param cmds Array of validated commands
+ * @param n Number of commands in the array
+ * @return DAEMON_OK on success, DAEMON_ERR_REJECTED if a command was not accepted
+ */
+static daemon_status_t submit_commands(serial_ctx_t *ctx, const device_command_t *cmds, size_t n) {
+    int result = n == 1 ? serial_add(ctx, cmds) : serial_add_batch(ctx, cmds, n);
+    if (result != EXIT_SUCCESS) {
+        return DAEMON_ERR_REJECTED;
+    }
+    return DAEMON_OK;
+}
+
+size_t serial_daemon_handle_request(daemon_config_t *cfg, const uint8_t *request, size_t len, uint8_t *reply) {
+    daemon_header_t header;
+    uint8_t *payload = reply + sizeof(header);
+    size_t room = DAEMON_MAX_PACKET - sizeof(header);
+    size_t payload_len = 0;
+    daemon_status_t status = DAEMON_OK;
+
+    memset(&header, 0, sizeof(header));
+    if (len < sizeof(header)) {
+        header.status = DAEMON_ERR_MALFORMED;
+        memcpy(reply, &header, sizeof(header));
+        return sizeof(header);
+    }
+    memcpy(&header, request, sizeof(header));
+    request += sizeof(header);
+    len -= sizeof(header);
+
+    daemon_port_t *port = header.port < cfg->nports ? &cfg->ports[header.port] : NULL;
+    if (port == NULL && header.type != DAEMON_MSG_PORTS) {
+        status = DAEMON_ERR_PORT;
+    } else if (header.type == DAEMON_MSG_SUBMIT) {
+        device_command_t cmds[DAEMON_MAX_BATCH];
+        size_t n = len / sizeof(daemon_command_t);
+
+        if (n == 0 || n > DAEMON_MAX_BATCH || len % sizeof(daemon_command_t) != 0) {
+            status = DAEMON_ERR_MALFORMED;
+        }
+        for (size_t i = 0; status == DAEMON_OK && i < n; i++) {
+            daemon_command_t wire;
+            memcpy(&wire, request + i * sizeof(wire), sizeof(wire));
+            memset(&cmds[i], 0, sizeof(cmds[i]));
+            cmds[i].command_type = wire.command_type;
+            memcpy(&cmds[i].data, wire.args, sizeof(cmds[i].data));
+            if (validate_command(&cmds[i]) != EXIT_SUCCESS) {
+                status = DAEMON_ERR_INVALID;
+            }
+        }
+        if (status == DAEMON_OK) {
+            status = submit_commands(port->ctx, cmds, n);
+        }
+    } else if (len != 0) {
+        status = DAEMON_ERR_MALFORMED;
+    } else if (header.type == DAEMON_MSG_PORTS) {
+        for (size_t i = 0; i < cfg->nports; i++) {
+            size_t size = strlen(cfg->ports[i].name) + 1;
+            memcpy(payload + payload_len, cfg->ports[i].name, size);
+            payload_len += size;
+        }
+    } else if (header.type == DAEMON_MSG_STATS) {
+        serial_stats_t stats;
+        serial_get_stats(port->ctx, &stats);
+        memcpy(payload, &stats, sizeof(stats));
+        payload_len = sizeof(stats);
+    } else if (header.type == DAEMON_MSG_METRICS) {
+        char labels[DAEMON_MAX_NAME + sizeof("port=\"\"")];
+        serial_stats_t stats;
+
+        snprintf(labels, sizeof(labels), "port=\"%s\"", port->name);
+        serial_get_stats(port->ctx, &stats);
+        int n = serial_format_prometheus(&stats, labels, (char *)payload, room);
+        payload_len = n < 0 ? 0 : (size_t)n < room ? (size_t)n : room - 1;
+    } else {
+        status = DAEMON_ERR_MALFORMED;
+    }
+
+    header.status = (uint8_t)status;
+    memcpy(reply, &header, sizeof(header));
+    return sizeof(header) + payload_len;
+}
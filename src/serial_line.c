@@ -0,0 +1,115 @@
+/**
+ * @file serial_line.c
+ * @brief Implementation of the terminal and driver configuration
+ *
+ * This file implements the interface defined in serial_line.h with the
+ * termios2 ioctls, so rates outside the B* constants can be set with BOTHER,
+ * and with TIOCGSERIAL/TIOCSSERIAL for ASYNC_LOW_LATENCY. On USB adapters
+ * such as the FTDI ones, ASYNC_LOW_LATENCY also drops the latency timer of
+ * the chip to one millisecond.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "serial_line.h"
+#include "serial_log.h"
+#include <errno.h>
+#include <string.h>
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+
+/** @brief VMIN of the throughput profile: a whole frame per read */
+#define LINE_THROUGHPUT_VMIN FRAME_MAX_SIZE
+
+/** @brief VTIME of the throughput profile: return after a pause of a tenth of a second */
+#define LINE_THROUGHPUT_VTIME 1
+
+/**
+ * @brief Apply the profile's low-latency setting and read the flag back
+ *
+ * @param fd Descriptor of the open terminal
+ * @param profile Line profile to apply
+ * @return 1 if ASYNC_LOW_LATENCY is set, 0 if it is clear, -1 if the driver does not support it
+ */
+static int line_apply_low_latency(int fd, serial_line_profile_t profile) {
+    struct serial_struct serial;
+
+    memset(&serial, 0, sizeof(serial));
+    if (ioctl(fd, TIOCGSERIAL, &serial) != 0) {
+        return -1;
+    }
+    if (profile != SERIAL_LINE_DEFAULT) {
+        int flags = serial.flags;
+        if (profile == SERIAL_LINE_LOW_LATENCY) {
+            serial.flags |= ASYNC_LOW_LATENCY;
+        } else {
+            serial.flags &= ~ASYNC_LOW_LATENCY;
+        }
+        if (serial.flags != flags && ioctl(fd, TIOCSSERIAL, &serial) != 0) {
+            SERIAL_LOG(LOG_WARNING, "Driver refused to change ASYNC_LOW_LATENCY (errno %d)", errno);
+        }
+        if (ioctl(fd, TIOCGSERIAL, &serial) != 0) {
+            return -1;
+        }
+    }
+    return (serial.flags & ASYNC_LOW_LATENCY) != 0;
+}
+
+int serial_line_configure(int fd, int speed, uint32_t baud_rate, serial_line_profile_t profile,
+                          serial_line_info_t *info) {
+    struct termios2 tty;
+
+    memset(info, 0, sizeof(*info));
+    memset(&tty, 0, sizeof(tty));
+    if (ioctl(fd, TCGETS2, &tty) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to get terminal attributes (errno %d)", errno);
+        return EXIT_FAILURE;
+    }
+
+    // Rate either as a B* constant or in bits per second
+    tty.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    if (baud_rate != 0) {
+        tty.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+        tty.c_ospeed = baud_rate;
+        tty.c_ispeed = baud_rate;
+    } else {
+        tty.c_cflag |= (tcflag_t)speed & CBAUD;
+    }
+    tty.c_cflag |= (CLOCAL | CREAD);
+
+    // Raw binary frames in both directions, no line discipline or echo
+    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tty.c_oflag &= ~OPOST;
+    tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    if (profile == SERIAL_LINE_THROUGHPUT) {
+        tty.c_cc[VMIN] = LINE_THROUGHPUT_VMIN;
+        tty.c_cc[VTIME] = LINE_THROUGHPUT_VTIME;
+    } else {
+        tty.c_cc[VMIN] = 1;
+        tty.c_cc[VTIME] = 0;
+    }
+
+    if (ioctl(fd, TCSETS2, &tty) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to set terminal attributes (errno %d)", errno);
+        return EXIT_FAILURE;
+    }
+
+    // Report what the driver kept, not what was asked for
+    if (ioctl(fd, TCGETS2, &tty) != 0) {
+        SERIAL_LOG(LOG_WARNING, "Failed to read back terminal attributes (errno %d)", errno);
+        return EXIT_FAILURE;
+    }
+    info->configured = 1;
+    info->profile = profile;
+    info->output_baud = tty.c_ospeed;
+    info->input_baud = tty.c_ispeed;
+    info->custom_baud = (tty.c_cflag & CBAUD) == BOTHER;
+    info->raw = !(tty.c_lflag & (ICANON | ECHO | ISIG | IEXTEN)) && !(tty.c_oflag & OPOST);
+    info->vmin = tty.c_cc[VMIN];
+    info->vtime = tty.c_cc[VTIME];
+    info->low_latency = line_apply_low_latency(fd, profile);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,271 @@
+/**
+ * @file serial_log.c
+ * @brief Implementation of the log sink for the serial communication module
+ *
+ * This file implements the interface defined in serial_log.h. The
+ * asynchronous sink is a bounded lock-free ring of preformatted messages:
+ * producers never block and drop the message if the ring is full, and a
+ * background thread writes the queued messages to syslog.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "serial_log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief Message queued in the asynchronous ring
+ */
+struct log_record {
+    /** @brief Ring position for which the record is ready */
+    size_t sequence;
+    /** @brief Syslog priority of the message */
+    int priority;
+    /** @brief Formatted message */
+    char message[SERIAL_LOG_MSG_MAX];
+};
+
+/** @brief Records of the asynchronous ring */
+static struct log_record log_ring[SERIAL_LOG_RING_SIZE];
+
+/** @brief Next ring position to be claimed by a producer */
+static size_t log_enqueue_pos = 0;
+
+/** @brief Next ring position to be flushed */
+static size_t log_dequeue_pos = 0;
+
+/** @brief Number of messages dropped because the ring was full */
+static uint64_t log_dropped = 0;
+
+/** @brief Sink in use, syslog until the log is opened */
+static serial_log_sink_t log_sink = SERIAL_LOG_SINK_SYSLOG;
+
+/** @brief Runtime threshold, the most verbose priority that is logged */
+static int log_level = LOG_DEBUG;
+
+/** @brief Number of open calls not yet matched by a close */
+static int log_open_count = 0;
+
+/** @brief Mutex protecting open/close and the flusher wake-up */
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Signaled to wake the flusher thread */
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+
+/** @brief Flusher thread of the asynchronous sink */
+static pthread_t log_thread;
+
+/** @brief Flag telling the flusher thread to keep running */
+static int log_running = 0;
+
+/** @brief Set while the flusher thread sleeps on log_cond */
+static int log_flusher_idle = 0;
+
+/**
+ * @brief Queue a formatted message in the asynchronous ring
+ *
+ * @param priority Syslog priority of the message
+ * @param message Formatted message
+ */
+static void log_ring_push(int priority, const char *message) {
+    size_t pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct log_record *record = &log_ring[pos % SERIAL_LOG_RING_SIZE];
+        size_t seq = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log_enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                record->priority = priority;
+                memcpy(record->message, message, SERIAL_LOG_MSG_MAX);
+                __atomic_store_n(&record->sequence, pos + 1, __ATOMIC_RELEASE);
+                break;
+            }
+        } else if (diff < 0) {
+            // Ring is full, never block the caller
+            __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&log_enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Only pay for a wake-up when the flusher is asleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&log_flusher_idle, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&log_mutex);
+        pthread_cond_signal(&log_cond);
+        pthread_mutex_unlock(&log_mutex);
+    }
+}
+
+/**
+ * @brief Write every queued message to syslog
+ *
+ * Only the flusher thread, or the closing thread after it stopped, calls
+ * this function.
+ *
+ * @return Number of messages written
+ */
+static size_t log_ring_flush(void) {
+    size_t flushed = 0;
+
+    for (;;) {
+        size_t pos = log_dequeue_pos;
+        struct log_record *record = &log_ring[pos % SERIAL_LOG_RING_SIZE];
+        if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+            return flushed;
+        }
+        syslog(record->priority, "%s", record->message);
+        __atomic_store_n(&record->sequence, pos + SERIAL_LOG_RING_SIZE, __ATOMIC_RELEASE);
+        log_dequeue_pos = pos + 1;
+        flushed++;
+    }
+}
+
+/**
+ * @brief Main loop of the flusher thread
+ *
+ * @param arg Unused
+ * @return NULL
+ */
+static void *log_thread_main(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&log_mutex);
+    while (log_running) {
+        pthread_mutex_unlock(&log_mutex);
+        log_ring_flush();
+        pthread_mutex_lock(&log_mutex);
+
+        // Announce the sleep, then make sure nothing slipped in meanwhile
+        __atomic_store_n(&log_flusher_idle, 1, __ATOMIC_SEQ_CST);
+        size_t pos = log_dequeue_pos;
+        struct log_record *record = &log_ring[pos % SERIAL_LOG_RING_SIZE];
+        if (log_running && __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+            pthread_cond_wait(&log_cond, &log_mutex);
+        }
+        __atomic_store_n(&log_flusher_idle, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&log_mutex);
+    return NULL;
+}
+
+int serial_log_open(serial_log_sink_t sink) {
+    if (sink != SERIAL_LOG_SINK_SYSLOG && sink != SERIAL_LOG_SINK_ASYNC &&
+        sink != SERIAL_LOG_SINK_NONE) {
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_lock(&log_mutex);
+    if (log_open_count++ > 0) {
+        pthread_mutex_unlock(&log_mutex);
+        return EXIT_SUCCESS;
+    }
+
+    openlog("serial_comm", LOG_PID | LOG_CONS, LOG_USER);
+    if (sink == SERIAL_LOG_SINK_ASYNC) {
+        for (size_t i = 0; i < SERIAL_LOG_RING_SIZE; i++) {
+            log_ring[i].sequence = i;
+        }
+        log_enqueue_pos = 0;
+        log_dequeue_pos = 0;
+        log_running = 1;
+        if (pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0) {
+            log_running = 0;
+            log_open_count = 0;
+            closelog();
+            pthread_mutex_unlock(&log_mutex);
+            return EXIT_FAILURE;
+        }
+    }
+    __atomic_store_n(&log_sink, sink, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_mutex);
+    return EXIT_SUCCESS;
+}
+
+void serial_log_close(void) {
+    pthread_mutex_lock(&log_mutex);
+    if (log_open_count == 0 || --log_open_count > 0) {
+        pthread_mutex_unlock(&log_mutex);
+        return;
+    }
+
+    int stop_thread = log_running;
+    __atomic_store_n(&log_sink, SERIAL_LOG_SINK_SYSLOG, __ATOMIC_RELEASE);
+    log_running = 0;
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_mutex);
+
+    if (stop_thread) {
+        pthread_join(log_thread, NULL);
+        // Messages queued while the thread was stopping
+        log_ring_flush();
+    }
+    closelog();
+}
+
+void serial_log_set_level(int priority) {
+    __atomic_store_n(&log_level, priority, __ATOMIC_RELAXED);
+}
+
+int serial_log_enabled(int priority) {
+    return priority <= __atomic_load_n(&log_level, __ATOMIC_RELAXED) &&
+           __atomic_load_n(&log_sink, __ATOMIC_RELAXED) != SERIAL_LOG_SINK_NONE;
+}
+
+int serial_log_ratelimit(serial_log_ratelimit_t *ratelimit, int priority) {
+    int64_t now = (int64_t)time(NULL);
+    int64_t window = __atomic_load_n(&ratelimit->window, __ATOMIC_RELAXED);
+
+    // Start a new window, reporting what the previous ones suppressed
+    if (now - window >= SERIAL_LOG_RATE_WINDOW &&
+        __atomic_compare_exchange_n(&ratelimit->window, &window, now, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&ratelimit->count, 0, __ATOMIC_RELAXED);
+        uint32_t suppressed = __atomic_exchange_n(&ratelimit->suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed > 0) {
+            serial_log_write(priority, "%u similar messages suppressed by rate limit", suppressed);
+        }
+    }
+
+    if (__atomic_add_fetch(&ratelimit->count, 1, __ATOMIC_RELAXED) > SERIAL_LOG_RATE_BURST) {
+        __atomic_add_fetch(&ratelimit->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void serial_log_write(int priority, const char *format, ...) {
+    serial_log_sink_t sink = __atomic_load_n(&log_sink, __ATOMIC_ACQUIRE);
+    char message[SERIAL_LOG_MSG_MAX];
+    va_list args;
+
+    if (sink == SERIAL_LOG_SINK_NONE) {
+        return;
+    }
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (sink == SERIAL_LOG_SINK_ASYNC) {
+        log_ring_push(priority, message);
+    } else {
+        syslog(priority, "%s", message);
+    }
+}
+
+uint64_t serial_log_dropped(void) {
+    return __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,71 @@
+/**
+ * @file serial_sched.c
+ * @brief Implementation of the thread placement and scheduling
+ *
+ * This file implements the interface defined in serial_sched.h with
+ * pthread_setaffinity_np() and pthread_setschedparam(). The settings are
+ * applied from the creating thread once the target is running, and read back
+ * with the matching getters, so the report reflects what the kernel kept.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#define _GNU_SOURCE
+
+#include "serial_sched.h"
+#include "serial_log.h"
+#include <sched.h>
+#include <string.h>
+
+int serial_sched_valid(const serial_thread_options_t *opts) {
+    if (opts->cpu < -1 || opts->cpu >= CPU_SETSIZE) {
+        return 0;
+    }
+    return opts->priority == 0 || (opts->priority >= sched_get_priority_min(SCHED_FIFO) &&
+                                   opts->priority <= sched_get_priority_max(SCHED_FIFO));
+}
+
+void serial_sched_apply(pthread_t thread, const serial_thread_options_t *opts, serial_thread_info_t *info) {
+    struct sched_param param;
+    cpu_set_t set;
+    int policy;
+    int err;
+
+    memset(info, 0, sizeof(*info));
+    info->running = 1;
+    info->affinity = -1;
+    info->sched_fifo = -1;
+
+    if (opts->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(opts->cpu, &set);
+        err = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (err != 0) {
+            SERIAL_LOG(LOG_WARNING, "Failed to pin thread to CPU %d (errno %d)", opts->cpu, err);
+        }
+        info->affinity = err == 0;
+    }
+    if (opts->priority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = opts->priority;
+        err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+        if (err != 0) {
+            SERIAL_LOG(LOG_WARNING, "Failed to set SCHED_FIFO priority %d (errno %d)", opts->priority, err);
+        }
+        info->sched_fifo = err == 0;
+    }
+
+    // Report what is in effect, not what was asked for
+    info->cpu = -1;
+    if (pthread_getaffinity_np(thread, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                info->cpu = cpu;
+                break;
+            }
+        }
+    }
+    if (pthread_getschedparam(thread, &policy, &param) == 0 && policy == SCHED_FIFO) {
+        info->priority = param.sched_priority;
+    }
+}
@@ -0,0 +1,282 @@
+/**
+ * @file serial_trace.c
+ * @brief Implementation of the hot-path tracing of the serial module
+ *
+ * This file implements the interface defined in serial_trace.h. Every thread
+ * that records an event claims one ring out of a static array and is its
+ * only writer. A thread-specific key returns the ring to a free list when
+ * the thread exits; the ring keeps its events until another thread claims
+ * it. Readers copy a ring while it is being written, seqlock style:
+ * the writer announces each slot before reusing it, and the slots announced
+ * while a reader was copying are thrown away.
+ *
+ * Created on: May 16, 2025
+ * @author Zhanibekuly Darkhan
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "serial_trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** @brief Size of a cache line in bytes */
+#define TRACE_CACHE_LINE 64
+
+/**
+ * @brief Event ring of one thread
+ *
+ * An event is stored as two words, the timestamp and the argument, point and
+ * thread packed together, so readers can load them atomically.
+ */
+struct trace_ring {
+    /** @brief Number of events ever recorded, written only by the owner */
+    uint64_t head __attribute__((aligned(TRACE_CACHE_LINE)));
+    /** @brief Number of events ever started, ahead of head while one is written */
+    uint64_t claimed;
+    /** @brief Events below this position were cleared, written by readers and by a new owner */
+    uint64_t floor;
+    /** @brief Events, indexed by position modulo SERIAL_TRACE_RING_SIZE */
+    uint64_t words[SERIAL_TRACE_RING_SIZE][2];
+};
+
+int serial_trace_on = 0;
+
+/** @brief Rings of the threads that recorded events */
+static struct trace_ring trace_rings[SERIAL_TRACE_MAX_THREADS];
+
+/** @brief Number of rings claimed so far, including those freed since */
+static unsigned trace_rings_used = 0;
+
+/** @brief Mutex protecting the free list */
+static pthread_mutex_t trace_free_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Indices of the rings of threads that exited, used as a stack */
+static uint16_t trace_free_rings[SERIAL_TRACE_MAX_THREADS];
+
+/** @brief Number of rings on the free list, read without the mutex to skip it */
+static unsigned trace_free_count = 0;
+
+/** @brief Key whose destructor frees the ring of an exiting thread */
+static pthread_key_t trace_ring_key;
+
+/** @brief Creates trace_ring_key once */
+static pthread_once_t trace_ring_key_once = PTHREAD_ONCE_INIT;
+
+/** @brief Number of events lost because every ring was taken */
+static uint64_t trace_dropped = 0;
+
+/** @brief Ring of the calling thread, NULL until its first event */
+static __thread struct trace_ring *trace_ring_self = NULL;
+
+/** @brief Index of the ring of the calling thread */
+static __thread uint16_t trace_ring_index = 0;
+
+/**
+ * @brief Return the ring of an exiting thread to the free list
+ *
+ * The events stay in the ring, so they can still be read until another
+ * thread claims it.
+ *
+ * @param ring Ring of the thread
+ */
+static void trace_free_ring(void *ring) {
+    pthread_mutex_lock(&trace_free_mutex);
+    trace_free_rings[trace_free_count] = (uint16_t)((struct trace_ring *)ring - trace_rings);
+    __atomic_store_n(&trace_free_count, trace_free_count + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&trace_free_mutex);
+}
+
+/**
+ * @brief Create the key that frees the rings of exiting threads
+ */
+static void trace_create_key(void) {
+    pthread_key_create(&trace_ring_key, trace_free_ring);
+}
+
+/**
+ * @brief Claim a ring for the calling thread
+ *
+ * A freed ring is reused before a new one is taken. Its old events are
+ * cleared, since they would carry the thread index of the new owner.
+ *
+ * @return Ring of the thread, NULL if every ring is taken
+ */
+static struct trace_ring *trace_claim_ring(void) {
+    unsigned index = __atomic_load_n(&trace_rings_used, __ATOMIC_RELAXED);
+    int reused = 0;
+
+    // Every ring taken and none freed: drop the event without locking
+    if (index >= SERIAL_TRACE_MAX_THREADS && __atomic_load_n(&trace_free_count, __ATOMIC_RELAXED) == 0) {
+        return NULL;
+    }
+    pthread_once(&trace_ring_key_once, trace_create_key);
+    pthread_mutex_lock(&trace_free_mutex);
+    if (trace_free_count > 0) {
+        __atomic_store_n(&trace_free_count, trace_free_count - 1, __ATOMIC_RELAXED);
+        index = trace_free_rings[trace_free_count];
+        reused = 1;
+    }
+    pthread_mutex_unlock(&trace_free_mutex);
+    while (!reused) {
+        if (index >= SERIAL_TRACE_MAX_THREADS) {
+            return NULL;
+        }
+        reused = __atomic_compare_exchange_n(&trace_rings_used, &index, index + 1, 1,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    }
+
+    struct trace_ring *ring = &trace_rings[index];
+    if (pthread_setspecific(trace_ring_key, ring) != 0) {
+        trace_free_ring(ring);
+        return NULL;
+    }
+    __atomic_store_n(&ring->floor, __atomic_load_n(&ring->head, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    trace_ring_index = (uint16_t)index;
+    trace_ring_self = ring;
+    return ring;
+}
+
+void serial_trace_enable(int on) {
+    __atomic_store_n(&serial_trace_on, on != 0, __ATOMIC_RELAXED);
+}
+
+void serial_trace_record(trace_point_t point, uint32_t arg) {
+    struct trace_ring *ring = trace_ring_self;
+    struct timespec ts;
+
+    if (ring == NULL && (ring = trace_claim_ring()) == NULL) {
+        __atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t pos = ring->head;
+    uint64_t *slot = ring->words[pos % SERIAL_TRACE_RING_SIZE];
+    // Readers that see the new slot contents must also see the claim that discards them
+    __atomic_store_n(&ring->claimed, pos + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&slot[0], (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot[1], (uint64_t)arg | (uint64_t)(uint16_t)point << 32 |
+                               (uint64_t)trace_ring_index << 48, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, pos + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Copy the valid events of one ring
+ *
+ * @param ring Ring to copy
+ * @param out Array to store the events
+ * @param max Capacity of out
+ * @return Number of events stored in out
+ */
+static size_t trace_copy_ring(struct trace_ring *ring, trace_event_t *out, size_t max) {
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t start = __atomic_load_n(&ring->floor, __ATOMIC_RELAXED);
+    if (head > SERIAL_TRACE_RING_SIZE && start < head - SERIAL_TRACE_RING_SIZE) {
+        start = head - SERIAL_TRACE_RING_SIZE;
+    }
+    if (head - start > max) {
+        start = head - max;
+    }
+
+    size_t count = 0;
+    for (uint64_t pos = start; pos < head; pos++) {
+        const uint64_t *slot = ring->words[pos % SERIAL_TRACE_RING_SIZE];
+        uint64_t packed = __atomic_load_n(&slot[1], __ATOMIC_RELAXED);
+        out[count].timestamp_ns = __atomic_load_n(&slot[0], __ATOMIC_RELAXED);
+        out[count].arg = (uint32_t)packed;
+        out[count].point = (uint16_t)(packed >> 32);
+        out[count].thread = (uint16_t)(packed >> 48);
+        count++;
+    }
+
+    // Drop the slots the writer may have reused while they were copied
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t claimed = __atomic_load_n(&ring->claimed, __ATOMIC_RELAXED);
+    if (claimed > start + SERIAL_TRACE_RING_SIZE) {
+        size_t stale = (size_t)(claimed - start - SERIAL_TRACE_RING_SIZE);
+        stale = stale < count ? stale : count;
+        memmove(out, out + stale, (count - stale) * sizeof(out[0]));
+        count -= stale;
+    }
+    return count;
+}
+
+/**
+ * @brief Compare two events by time for qsort()
+ */
+static int trace_compare(const void *a, const void *b) {
+    const trace_event_t *x = a;
+    const trace_event_t *y = b;
+    if (x->timestamp_ns != y->timestamp_ns) {
+        return x->timestamp_ns < y->timestamp_ns ? -1 : 1;
+    }
+    return (x->thread > y->thread) - (x->thread < y->thread);
+}
+
+size_t serial_trace_snapshot(trace_event_t *out, size_t max) {
+    unsigned used = __atomic_load_n(&trace_rings_used, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+
+    if (out == NULL) {
+        return 0;
+    }
+    for (unsigned i = 0; i < used && i < SERIAL_TRACE_MAX_THREADS && count < max; i++) {
+        count += trace_copy_ring(&trace_rings[i], out + count, max - count);
+    }
+    qsort(out, count, sizeof(out[0]), trace_compare);
+    return count;
+}
+
+int serial_trace_dump(const char *path) {
+    size_t capacity = (size_t)SERIAL_TRACE_MAX_THREADS * SERIAL_TRACE_RING_SIZE;
+    trace_file_header_t header;
+    int result = EXIT_SUCCESS;
+
+    if (path == NULL) {
+        return EXIT_FAILURE;
+    }
+    trace_event_t *events = malloc(capacity * sizeof(trace_event_t));
+    if (events == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SERIAL_TRACE_MAGIC, sizeof(header.magic));
+    header.version = SERIAL_TRACE_VERSION;
+    header.event_size = sizeof(trace_event_t);
+    header.count = serial_trace_snapshot(events, capacity);
+    header.dropped = serial_trace_dropped();
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        free(events);
+        return EXIT_FAILURE;
+    }
+    if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+        fwrite(events, sizeof(trace_event_t), (size_t)header.count, file) != header.count) {
+        result = EXIT_FAILURE;
+    }
+    if (fclose(file) != 0) {
+        result = EXIT_FAILURE;
+    }
+    free(events);
+    return result;
+}
+
+void serial_trace_clear(void) {
+    unsigned used = __atomic_load_n(&trace_rings_used, __ATOMIC_ACQUIRE);
+
+    for (unsigned i = 0; i < used && i < SERIAL_TRACE_MAX_THREADS; i++) {
+        __atomic_store_n(&trace_rings[i].floor, __atomic_load_n(&trace_rings[i].head, __ATOMIC_ACQUIRE),
+                         __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&trace_dropped, 0, __ATOMIC_RELAXED);
+}
+
+uint64_t serial_trace_dropped(void) {
+    return __atomic_load_n(&trace_dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,529 @@
+/**
+* @file stress.c
+* @brief Multi-threaded stress test of the command queues
+*
+* This file hammers add(), the get_next_command() family and the count
+* functions from many threads at once and checks the invariants the queues
+* promise:
+*
+* - conservation: every snapshot of get_command_counts() has active + unused
+*   equal to the pool capacity, and every command added is dequeued exactly
+*   once;
+* - per-producer FIFO order: each consumer sees the commands of a producer
+*   in the order the producer added them.
+*
+* Every command carries its producer and sequence number in its three
+* payload bytes. CMD_EMERGENCY commands, whose payload is not validated,
+* store them as bit fields. Routine CMD_SET_PARAMS commands go through add()
+* like any caller's, so they number the valid payloads instead, each
+* producer taking a range of the code space. Order and uniqueness are
+* checked per lane, since emergencies overtake routine commands. An emergency command
+* that finds the pool full displaces the oldest routine command, so the
+* routine commands missing at the end must match the emergency_displaced
+* counter; nothing else may be missing.
+* Built with -fsanitize=thread by the stress target of test/Makefile.
+*
+* Usage: stress [-r] [-t] [-p producers] [-c consumers] [-o observers] [-n commands] [-m every] [-s pool]
+*
+* Created on: May 16, 2025
+* @author Zhanibekuly Darkhan
+*/
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "serial.h"
+
+/** @brief Largest number of producer threads, limited by the 4-bit producer field */
+#define STRESS_MAX_PRODUCERS 16
+
+/** @brief Largest number of consumer or observer threads */
+#define STRESS_MAX_THREADS 64
+
+/** @brief Largest number of commands per producer, limited by the 20-bit sequence field */
+#define STRESS_MAX_COMMANDS ((1u << 20) - 1)
+
+/** @brief Commands taken by one get_next_commands() call of a consumer */
+#define STRESS_BATCH 8
+
+/** @brief Time without progress after which a consumer gives up, in nanoseconds */
+#define STRESS_STALL_NS 10000000000ULL
+
+/** @brief Number of failures printed before the rest are only counted */
+#define STRESS_MAX_REPORTS 10
+
+/** @brief Largest level of a valid CMD_SET_PARAMS command */
+#define STRESS_MAX_LEVEL 100
+
+/** @brief Number of valid max_time values of a CMD_SET_PARAMS command, from 1 */
+#define STRESS_TIMES 240
+
+/** @brief Number of valid min_level, max_level pairs of a CMD_SET_PARAMS command */
+#define STRESS_LEVEL_PAIRS ((STRESS_MAX_LEVEL + 1) * (STRESS_MAX_LEVEL + 2) / 2)
+
+/** @brief Number of valid CMD_SET_PARAMS payloads, the code space of the routine lane */
+#define STRESS_ROUTINE_CODES (STRESS_LEVEL_PAIRS * STRESS_TIMES)
+
+/** @brief Parameters and shared state of a run */
+static struct {
+    /** @brief Number of producer threads */
+    unsigned producers;
+    /** @brief Number of consumer threads */
+    unsigned consumers;
+    /** @brief Number of observer threads reading the counts */
+    unsigned observers;
+    /** @brief Number of commands added by each producer */
+    unsigned commands;
+    /** @brief Every how many commands a producer adds a routine command, 0 for none */
+    unsigned routine_every;
+    /** @brief Capacity of the command pool */
+    size_t pool;
+    /** @brief Routine codes of each producer */
+    unsigned routine_codes;
+    /** @brief min_level and max_level of each level pair, in code order */
+    uint8_t level_pairs[STRESS_LEVEL_PAIRS][2];
+    /** @brief Level pair of each min_level and max_level, in code order */
+    uint16_t pair_index[STRESS_MAX_LEVEL + 1][STRESS_MAX_LEVEL + 1];
+    /** @brief One bit per producer and sequence number, set when the command is dequeued */
+    uint8_t *seen;
+    /** @brief Number of commands dequeued so far */
+    uint64_t taken;
+    /** @brief Number of producers that added all their commands */
+    unsigned producers_done;
+    /** @brief Number of count snapshots checked by the observers */
+    uint64_t snapshots;
+    /** @brief Set once every command is dequeued */
+    int done;
+    /** @brief Number of invariant violations found */
+    uint64_t failures;
+} run;
+
+/**
+* @brief Get the monotonic clock in nanoseconds
+*
+* @return Current monotonic time in nanoseconds
+*/
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+* @brief Record an invariant violation
+*
+* @param fmt printf-style format of the message
+*/
+static void fail(const char *fmt, ...) {
+    va_list args;
+
+    if (__atomic_fetch_add(&run.failures, 1, __ATOMIC_RELAXED) < STRESS_MAX_REPORTS) {
+        va_start(args, fmt);
+        fprintf(stderr, "stress: ");
+        vfprintf(stderr, fmt, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+    }
+}
+
+/**
+* @brief Check whether a sequence number of a producer is a routine command
+*
+* @param seq Sequence number within the producer
+* @return Non-zero if the producer adds a routine command at seq
+*/
+static int is_routine(unsigned seq) {
+    return run.routine_every != 0 && seq % run.routine_every == run.routine_every - 1;
+}
+
+/**
+* @brief Number the valid min_level, max_level pairs of CMD_SET_PARAMS
+*/
+static void init_level_pairs(void) {
+    unsigned pair = 0;
+    for (unsigned min = 0; min <= STRESS_MAX_LEVEL; min++) {
+        for (unsigned max = min; max <= STRESS_MAX_LEVEL; max++) {
+            run.level_pairs[pair][0] = (uint8_t)min;
+            run.level_pairs[pair][1] = (uint8_t)max;
+            run.pair_index[min][max] = (uint16_t)pair++;
+        }
+    }
+}
+
+/**
+* @brief Build the command a producer adds at a sequence number
+*
+* @param producer Index of the producer
+* @param seq Sequence number within the producer
+* @param cmd Pointer to store the command
+*/
+static void make_command(unsigned producer, unsigned seq, device_command_t *cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+    if (!is_routine(seq)) {
+        cmd->command_type = CMD_EMERGENCY;
+        cmd->data.set_params.min_level = (uint8_t)(producer << 4 | seq >> 16);
+        cmd->data.set_params.max_level = (uint8_t)(seq >> 8);
+        cmd->data.set_params.max_time = (uint8_t)seq;
+        return;
+    }
+
+    // Routine commands are numbered within their lane, which holds one in routine_every
+    unsigned code = producer * run.routine_codes + seq / run.routine_every;
+    cmd->command_type = CMD_SET_PARAMS;
+    cmd->data.set_params.min_level = run.level_pairs[code / STRESS_TIMES][0];
+    cmd->data.set_params.max_level = run.level_pairs[code / STRESS_TIMES][1];
+    cmd->data.set_params.max_time = (uint8_t)(1 + code % STRESS_TIMES);
+}
+
+/**
+* @brief Recover the producer and sequence number a command was built with
+*
+* @param cmd Dequeued command of a known type
+* @param producer Pointer to store the index of the producer
+* @param seq Pointer to store the sequence number within the producer
+* @return EXIT_SUCCESS on success, EXIT_FAILURE if the payload cannot come from make_command()
+*/
+static int decode_command(const device_command_t *cmd, unsigned *producer, unsigned *seq) {
+    const uint8_t min = cmd->data.set_params.min_level;
+    const uint8_t max = cmd->data.set_params.max_level;
+    const uint8_t time = cmd->data.set_params.max_time;
+
+    if (cmd->command_type == CMD_EMERGENCY) {
+        *producer = min >> 4;
+        *seq = (unsigned)(min & 0x0F) << 16 | (unsigned)max << 8 | time;
+        return EXIT_SUCCESS;
+    }
+    if (min > max || max > STRESS_MAX_LEVEL || time < 1 || time > STRESS_TIMES) {
+        return EXIT_FAILURE;
+    }
+    unsigned code = (unsigned)run.pair_index[min][max] * STRESS_TIMES + time - 1;
+    *producer = code / run.routine_codes;
+    *seq = code % run.routine_codes * run.routine_every + run.routine_every - 1;
+    return EXIT_SUCCESS;
+}
+
+/**
+* @brief Thread body that adds the commands of one producer in order
+*
+* Emergency commands fall back to add_wait() with a short timeout while the
+* pool is full, so both the non-blocking and the blocking add paths are
+* exercised. Routine commands retry add(), yielding while the pool is full.
+*
+* @param arg Index of the producer
+* @return NULL
+*/
+static void *producer_main(void *arg) {
+    unsigned producer = (unsigned)(uintptr_t)arg;
+    device_command_t cmd;
+
+    for (unsigned seq = 0; seq < run.commands; seq++) {
+        make_command(producer, seq, &cmd);
+        if (cmd.command_type != CMD_EMERGENCY) {
+            while (add(&cmd) != EXIT_SUCCESS) {
+                sched_yield();
+            }
+        } else if (add(&cmd) != EXIT_SUCCESS) {
+            while (add_wait(&cmd, 1000000) != EXIT_SUCCESS) {
+            }
+        }
+    }
+    __atomic_add_fetch(&run.producers_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+* @brief Check a dequeued command and mark it as seen
+*
+* @param cmd Dequeued command
+* @param last Last sequence number this consumer saw of each producer in each lane, plus one
+*/
+static void check_command(const device_command_t *cmd, unsigned (*last)[STRESS_MAX_PRODUCERS]) {
+    if (cmd->command_type != CMD_EMERGENCY && cmd->command_type != CMD_SET_PARAMS) {
+        fail("unexpected command type 0x%x", cmd->command_type);
+        return;
+    }
+
+    unsigned producer;
+    unsigned seq;
+    int routine = cmd->command_type == CMD_SET_PARAMS;
+    if (decode_command(cmd, &producer, &seq) != EXIT_SUCCESS) {
+        fail("corrupted command 0x%x: invalid payload", cmd->command_type);
+        return;
+    }
+    if (producer >= run.producers || seq >= run.commands || is_routine(seq) != routine) {
+        fail("corrupted command 0x%x: producer %u, sequence %u", cmd->command_type, producer, seq);
+        return;
+    }
+    if (seq + 1 <= last[routine][producer]) {
+        fail("producer %u: sequence %u dequeued after %u", producer, seq, last[routine][producer] - 1);
+    }
+    last[routine][producer] = seq + 1;
+
+    size_t bit = (size_t)producer * run.commands + seq;
+    uint8_t mask = (uint8_t)(1u << (bit % 8));
+    if (__atomic_fetch_or(&run.seen[bit / 8], mask, __ATOMIC_RELAXED) & mask) {
+        fail("producer %u: sequence %u dequeued twice", producer, seq);
+    }
+}
+
+/**
+* @brief Thread body that dequeues commands until the producers are done and the pool is empty
+*
+* Alternates between get_next_commands(), get_next_command() and
+* get_next_command_wait(). Gives up when no command arrives for
+* STRESS_STALL_NS while producers are still adding, which means they are
+* stuck on a pool that looks full but hands nothing out.
+*
+* @param arg Unused
+* @return NULL
+*/
+static void *consumer_main(void *arg) {
+    (void)arg;
+    unsigned last[2][STRESS_MAX_PRODUCERS] = { { 0 } };
+    device_command_t cmds[STRESS_BATCH];
+    unsigned round = 0;
+    uint64_t progress_ns = now_ns();
+
+    for (;;) {
+        size_t n;
+        switch (round++ % 3) {
+            case 0:
+                n = get_next_commands(cmds, STRESS_BATCH);
+                break;
+            case 1:
+                n = get_next_command(&cmds[0]) == EXIT_SUCCESS;
+                break;
+            default:
+                n = get_next_command_wait(&cmds[0], 1000000) == EXIT_SUCCESS;
+                break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            check_command(&cmds[i], last);
+        }
+        if (n > 0) {
+            __atomic_add_fetch(&run.taken, n, __ATOMIC_RELAXED);
+            progress_ns = now_ns();
+        } else if (__atomic_load_n(&run.producers_done, __ATOMIC_ACQUIRE) == run.producers &&
+                   get_active_command_count() == 0) {
+            break;
+        } else if (now_ns() - progress_ns > STRESS_STALL_NS) {
+            fail("no command dequeued for %llu s, %llu taken", STRESS_STALL_NS / 1000000000ULL,
+                 (unsigned long long)__atomic_load_n(&run.taken, __ATOMIC_RELAXED));
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/**
+* @brief Thread body that checks the pool counts until the run is done
+*
+* @param arg Unused
+* @return NULL
+*/
+static void *observer_main(void *arg) {
+    (void)arg;
+    command_counts_t counts;
+    uint64_t snapshots = 0;
+
+    while (!__atomic_load_n(&run.done, __ATOMIC_ACQUIRE)) {
+        if (get_command_counts(&counts) != EXIT_SUCCESS) {
+            fail("get_command_counts() failed");
+            break;
+        }
+        if (counts.active < 0 || counts.unused < 0 || (size_t)(counts.active + counts.unused) != run.pool) {
+            fail("counts not conserved: %d active + %d unused != %zu", counts.active, counts.unused, run.pool);
+        }
+        int active = get_active_command_count();
+        int unused = get_unused_command_count();
+        if (active < 0 || (size_t)active > run.pool || unused < 0 || (size_t)unused > run.pool) {
+            fail("count out of range: %d active, %d unused", active, unused);
+        }
+        snapshots++;
+    }
+    __atomic_add_fetch(&run.snapshots, snapshots, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/**
+* @brief Print the command line usage
+*
+* @param prog Program name
+*/
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-r] [-t] [-p producers] [-c consumers] [-o observers] [-n commands] [-m every] [-s pool]\n"
+            "  -r  use the lock-free ring backend\n"
+            "  -t  enable the per-thread entry caches (TAILQ backend)\n"
+            "  -p  producer threads, 1-%d (default 4)\n"
+            "  -c  consumer threads (default 2)\n"
+            "  -o  observer threads reading the counts (default 1)\n"
+            "  -n  commands per producer, 1-%u (default 250000)\n"
+            "  -m  add a routine command every m commands, 0 for none (default 2)\n"
+            "  -s  command pool capacity (default 64)\n",
+            prog, STRESS_MAX_PRODUCERS, STRESS_MAX_COMMANDS);
+}
+
+/**
+* @brief Main entry point of the stress test
+*
+* @param argc Number of arguments
+* @param argv Arguments
+* @return EXIT_SUCCESS if every invariant held, EXIT_FAILURE otherwise
+*/
+int main(int argc, char *argv[]) {
+    pthread_t threads[STRESS_MAX_PRODUCERS + 2 * STRESS_MAX_THREADS];
+    serial_options_t opts;
+    serial_stats_t before;
+    serial_stats_t stats;
+    int opt;
+
+    serial_options_default(&opts);
+    opts.log_sink = SERIAL_LOG_SINK_NONE;
+    run.producers = 4;
+    run.consumers = 2;
+    run.observers = 1;
+    run.commands = 250000;
+    run.routine_every = 2;
+    run.pool = 64;
+    while ((opt = getopt(argc, argv, "rtp:c:o:n:m:s:h")) != -1) {
+        switch (opt) {
+            case 'r':
+                opts.queue_backend = QUEUE_BACKEND_RING;
+                break;
+            case 't':
+                opts.thread_cache = 1;
+                break;
+            case 'p':
+                run.producers = (unsigned)atoi(optarg);
+                break;
+            case 'c':
+                run.consumers = (unsigned)atoi(optarg);
+                break;
+            case 'o':
+                run.observers = (unsigned)atoi(optarg);
+                break;
+            case 'n':
+                run.commands = (unsigned)atol(optarg);
+                break;
+            case 'm':
+                run.routine_every = (unsigned)atoi(optarg);
+                break;
+            case 's':
+                run.pool = (size_t)atol(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc || run.producers == 0 || run.producers > STRESS_MAX_PRODUCERS || run.consumers == 0 ||
+        run.consumers > STRESS_MAX_THREADS || run.observers > STRESS_MAX_THREADS || run.commands == 0 ||
+        run.commands > STRESS_MAX_COMMANDS || run.pool == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    run.routine_codes = STRESS_ROUTINE_CODES / run.producers;
+    if (run.routine_every != 0 && run.commands / run.routine_every > run.routine_codes) {
+        fprintf(stderr, "stress: at most %u routine commands per producer with %u producers\n",
+                run.routine_codes, run.producers);
+        return EXIT_FAILURE;
+    }
+    init_level_pairs();
+
+    size_t seen_size = ((size_t)run.producers * run.commands + 7) / 8;
+    run.seen = calloc(1, seen_size);
+    if (run.seen == NULL) {
+        fprintf(stderr, "stress: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    opts.pool_capacity = run.pool;
+    if (init_with_options("/dev/null", B9600, &opts) != EXIT_SUCCESS) {
+        fprintf(stderr, "stress: init failed\n");
+        free(run.seen);
+        return EXIT_FAILURE;
+    }
+    get_stats(&before);
+
+    size_t nthreads = 0;
+    int created = 1;
+    for (unsigned i = 0; created && i < run.observers; i++) {
+        created = pthread_create(&threads[nthreads++], NULL, observer_main, NULL) == 0;
+    }
+    for (unsigned i = 0; created && i < run.consumers; i++) {
+        created = pthread_create(&threads[nthreads++], NULL, consumer_main, NULL) == 0;
+    }
+    for (unsigned i = 0; created && i < run.producers; i++) {
+        created = pthread_create(&threads[nthreads++], NULL, producer_main, (void *)(uintptr_t)i) == 0;
+    }
+    if (!created) {
+        fprintf(stderr, "stress: could not create the threads\n");
+        return EXIT_FAILURE;
+    }
+
+    // Join the producers and consumers before telling the observers to stop
+    for (size_t i = run.observers; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    __atomic_store_n(&run.done, 1, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < run.observers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Every command must have been dequeued exactly once, routine commands may
+    // only be missing where an emergency command displaced them
+    uint64_t total = (uint64_t)run.producers * run.commands;
+    uint64_t missing = 0;
+    for (unsigned producer = 0; producer < run.producers; producer++) {
+        for (unsigned seq = 0; seq < run.commands; seq++) {
+            size_t bit = (size_t)producer * run.commands + seq;
+            if (run.seen[bit / 8] & (1u << (bit % 8))) {
+                continue;
+            }
+            if (is_routine(seq)) {
+                missing++;
+            } else {
+                fail("producer %u: sequence %u never dequeued", producer, seq);
+            }
+        }
+    }
+    get_stats(&stats);
+    uint64_t displaced = stats.emergency_displaced - before.emergency_displaced;
+    if (missing != displaced) {
+        fail("%llu routine commands missing, %llu displaced", (unsigned long long)missing,
+             (unsigned long long)displaced);
+    }
+    command_counts_t counts;
+    get_command_counts(&counts);
+    if (counts.active != 0 || (size_t)counts.unused != run.pool) {
+        fail("pool not empty at the end: %d active, %d unused", counts.active, counts.unused);
+    }
+    if (stats.adds - before.adds != total || stats.dequeues - before.dequeues != total - displaced ||
+        run.taken != total - displaced) {
+        fail("stats disagree: %llu adds, %llu dequeues, %llu taken, %llu expected",
+             (unsigned long long)(stats.adds - before.adds),
+             (unsigned long long)(stats.dequeues - before.dequeues), (unsigned long long)run.taken,
+             (unsigned long long)total);
+    }
+
+    printf("%s%s: %u producers, %u consumers, %u observers, pool %zu: %llu commands, %llu count snapshots, "
+           "%llu rejected while full, %llu displaced, %llu failures\n",
+           opts.queue_backend == QUEUE_BACKEND_RING ? "ring" : "tailq", opts.thread_cache ? "+cache" : "",
+           run.producers, run.consumers, run.observers, run.pool, (unsigned long long)total,
+           (unsigned long long)run.snapshots,
+           (unsigned long long)(stats.rejected_pool_full - before.rejected_pool_full),
+           (unsigned long long)displaced, (unsigned long long)run.failures);
+
+    deinit();
+    free(run.seen);
+    return run.failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
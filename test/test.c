@@ -11,13 +11,50 @@ various valid and
 * Created on: May 16, 2025
 * @author Zhanibekuly Darkhan
 */
+#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700
+
 #include <stdarg.h>
 #include <stddef.h>
 #include <setjmp.h>
 #include <cmocka.h>
 #include <termios.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include "serial.h"
+#include "serial_capture.h"
+#include "serial_daemon.h"
+#include "serial_trace.h"
+
+/**
+* @brief Sleep for the given number of milliseconds
+*
+* @param ms Time to sleep in milliseconds
+*/
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/**
+* @brief Get the monotonic clock in milliseconds
+*
+* @return Current monotonic time in milliseconds
+*/
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 /**
 * @defgroup initialization_tests Initialization Tests
@@ -421,6 +458,84 @@ static void test_add_null_command(void **state) {
     assert_int_equal(add(NULL), EXIT_FAILURE);
     assert_int_equal(deinit(), EXIT_SUCCESS);
 }
+
+/**
+* @brief Test the limits checked by validate_command()
+*
+* This test verifies the field ranges of every command type, the ordering of
+* min_level and max_level, and the codes next to the valid command types.
+*
+* @param state Test state (unused)
+*/
+static void test_validate_command_limits(void **state) {
+    (void)state;
+    device_command_t cmd = {
+        .command_type = CMD_SET_PARAMS,
+        .data.set_params = { .min_level = 0, .max_level = 100, .max_time = 240 }
+    };
+    assert_int_equal(validate_command(&cmd), EXIT_SUCCESS);
+    cmd.data.set_params.max_time = 0;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+    cmd.data.set_params.max_time = 241;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+    cmd.data.set_params.max_time = 1;
+    cmd.data.set_params.max_level = 101;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+    cmd.data.set_params.min_level = 50;
+    cmd.data.set_params.max_level = 49;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+    cmd.data.set_params.max_level = 50;
+    assert_int_equal(validate_command(&cmd), EXIT_SUCCESS);
+
+    cmd.command_type = CMD_ON_OFF;
+    cmd.data.on_off.on_off = 1;
+    cmd.data.on_off.channel = CHANNEL_COUNT - 1;
+    assert_int_equal(validate_command(&cmd), EXIT_SUCCESS);
+    cmd.data.on_off.channel = CHANNEL_COUNT;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+    cmd.data.on_off.channel = 0;
+    cmd.data.on_off.on_off = 2;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+
+    cmd.command_type = CMD_EMERGENCY;
+    assert_int_equal(validate_command(&cmd), EXIT_SUCCESS);
+    cmd.command_type = CMD_SET_PARAMS - 1;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+    cmd.command_type = CMD_EMERGENCY + 1;
+    assert_int_equal(validate_command(&cmd), EXIT_FAILURE);
+    assert_int_equal(validate_command(NULL), EXIT_FAILURE);
+}
+
+/**
+* @brief Test adding a batch of commands without re-validating them
+*
+* @param state Test state (unused)
+*/
+static void test_add_prevalidated(void **state) {
+    (void)state;
+    device_command_t cmds[3] = {
+        { .command_type = CMD_ON_OFF, .data.on_off = { .on_off = 1, .channel = 2 } },
+        { .command_type = CMD_EMERGENCY },
+        { .command_type = CMD_SET_PARAMS, .data.set_params = { .min_level = 20, .max_level = 80, .max_time = 60 } }
+    };
+    assert_int_equal(add_prevalidated(cmds, 3), EXIT_FAILURE);
+
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+    assert_int_equal(add_prevalidated(NULL, 3), EXIT_FAILURE);
+    assert_int_equal(add_prevalidated(cmds, 0), EXIT_SUCCESS);
+    assert_int_equal(add_prevalidated(cmds, 3), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), 3);
+
+    // The emergency command overtakes the routine ones
+    device_command_t cmd;
+    assert_int_equal(get_next_command(&cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.command_type, CMD_EMERGENCY);
+    assert_int_equal(get_next_command(&cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.command_type, CMD_ON_OFF);
+    assert_int_equal(get_next_command(&cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.command_type, CMD_SET_PARAMS);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
 /** @} */ /* End of invalid_cmd_tests group */
 
 /**
@@ -721,67 +836,3820 @@ static void test_command_count_with_activity(void **state) {
 
     assert_int_equal(deinit(), EXIT_SUCCESS);
 }
+
+/**
+* @brief Test the combined command count snapshot
+*
+* This test verifies that get_command_counts() reports the same numbers as the
+* individual count functions and fails without initialization.
+*
+* @param state Test state (unused)
+*/
+static void test_command_counts_snapshot(void **state) {
+    (void)state;
+    command_counts_t counts;
+    assert_int_equal(get_command_counts(&counts), EXIT_FAILURE);
+    assert_int_equal(counts.active, 0);
+    assert_int_equal(counts.unused, 0);
+
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+    assert_int_equal(get_command_counts(NULL), EXIT_FAILURE);
+
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+
+    assert_int_equal(get_command_counts(&counts), EXIT_SUCCESS);
+    assert_int_equal(counts.active, 2);
+    assert_int_equal(counts.unused, POOL_SIZE - 2);
+    assert_int_equal(counts.active + counts.unused, POOL_SIZE);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
 /** @} */ /* End of count_tests group */
 
 /**
-* @brief Main function for the test suite
+* @defgroup wait_tests Blocking Wait Tests
+* @brief Tests for get_next_command_wait() and add_wait()
+* @{
+*/
+
+/**
+* @brief Thread body that adds an EMERGENCY command after a short delay
 *
-* This function sets up and runs all the tests with enhanced verbosity.
+* @param arg Unused
+* @return NULL
+*/
+static void *delayed_add_thread(void *arg) {
+    (void)arg;
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    sleep_ms(20);
+    add(&cmd);
+    return NULL;
+}
+
+/**
+* @brief Thread body that retrieves one command after a short delay
 *
-* @return Result of the test execution
+* @param arg Unused
+* @return NULL
 */
-int main(void) {
-    // Set cmocka to output all test information with maximum verbosity
-    cmocka_set_message_output(CM_OUTPUT_STDOUT);
-    printf("\n============= Starting Battery Charger Serial Communication Tests =============\n\n");
+static void *delayed_get_thread(void *arg) {
+    (void)arg;
+    device_command_t cmd;
+    sleep_ms(20);
+    get_next_command(&cmd);
+    return NULL;
+}
 
-    const struct CMUnitTest tests[] = {
-        /* Initialization Tests */
-        cmocka_unit_test(test_init_valid_port),
-        cmocka_unit_test(test_init_long_port),
-        cmocka_unit_test(test_init_null_port),
-        cmocka_unit_test(test_init_double_initialization),
-        cmocka_unit_test(test_init_various_speeds),
+/**
+* @brief Test waiting for a command on an empty pool with a timeout
+*
+* This test verifies that get_next_command_wait() gives up after the timeout
+* when nothing is added.
+*
+* @param state Test state (unused)
+*/
+static void test_get_next_command_wait_timeout(void **state) {
+    (void)state;
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
 
-        /* Deinitialization Tests */
-        cmocka_unit_test(test_deinit_without_init),
-        cmocka_unit_test(test_deinit_double_deinit),
+    device_command_t cmd_get;
+    assert_int_equal(get_next_command_wait(&cmd_get, 0), EXIT_FAILURE);
 
-        /* Set Params Command Tests */
-        cmocka_unit_test(test_add_valid_set_params_command),
-        cmocka_unit_test(test_add_boundary_set_params_command),
-        cmocka_unit_test(test_add_invalid_min_level_params_command),
-        cmocka_unit_test(test_add_invalid_max_level_params_command),
-        cmocka_unit_test(test_add_invalid_max_time_params_command),
-        cmocka_unit_test(test_add_invalid_level_range_params_command),
+    long long start = now_ms();
+    assert_int_equal(get_next_command_wait(&cmd_get, 20000000), EXIT_FAILURE);
+    assert_true(now_ms() - start >= 19);
 
-        /* On/Off Command Tests */
-        cmocka_unit_test(test_add_valid_on_off_command),
-        cmocka_unit_test(test_add_boundary_on_off_command),
-        cmocka_unit_test(test_add_invalid_on_off_value_command),
-        cmocka_unit_test(test_add_invalid_channel_value_command),
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
 
-        /* Emergency Command Tests */
-        cmocka_unit_test(test_add_emergency_command),
+/**
+* @brief Test that a waiting consumer wakes up when a command arrives
+*
+* This test verifies that get_next_command_wait() returns the command added
+* by another thread while it was blocked.
+*
+* @param state Test state (unused)
+*/
+static void test_get_next_command_wait_wakeup(void **state) {
+    (void)state;
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
 
-        /* Invalid Command Tests */
-        cmocka_unit_test(test_add_invalid_command_type),
-        cmocka_unit_test(test_add_null_command),
+    pthread_t producer;
+    assert_int_equal(pthread_create(&producer, NULL, delayed_add_thread, NULL), 0);
 
-        /* Pool Tests */
-        cmocka_unit_test(test_add_commands_to_fill_pool),
-        cmocka_unit_test(test_add_command_without_init),
+    device_command_t cmd_get;
+    assert_int_equal(get_next_command_wait(&cmd_get, WAIT_FOREVER), EXIT_SUCCESS);
+    assert_int_equal(cmd_get.command_type, CMD_EMERGENCY);
+    pthread_join(producer, NULL);
 
-        /* Get Command Tests */
-        cmocka_unit_test(test_get_next_command),
-        cmocka_unit_test(test_get_next_command_null_pointer),
-        cmocka_unit_test(test_get_next_command_without_init),
-        cmocka_unit_test(test_get_commands_fifo_order),
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
 
-        /* Command Count Tests */
-        cmocka_unit_test(test_command_count_without_init),
-        cmocka_unit_test(test_command_count_with_empty_pools),
-        cmocka_unit_test(test_command_count_with_activity),
+/**
+* @brief Test waiting for a free entry when the pool is full
+*
+* This test verifies that add_wait() times out on a full pool and succeeds
+* once another thread retrieves a command.
+*
+* @param state Test state (unused)
+*/
+static void test_add_wait_full_pool(void **state) {
+    (void)state;
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    for (int i = 0; i < POOL_SIZE; i++) {
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(add_wait(&cmd, 10000000), EXIT_FAILURE);
+
+    pthread_t consumer;
+    assert_int_equal(pthread_create(&consumer, NULL, delayed_get_thread, NULL), 0);
+    assert_int_equal(add_wait(&cmd, WAIT_FOREVER), EXIT_SUCCESS);
+    pthread_join(consumer, NULL);
+    assert_int_equal(get_active_command_count(), POOL_SIZE);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test that add_wait() rejects invalid commands without blocking
+*
+* @param state Test state (unused)
+*/
+static void test_add_wait_invalid_command(void **state) {
+    (void)state;
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+
+    device_command_t cmd = { .command_type = 0xFF };
+    long long start = now_ms();
+    assert_int_equal(add_wait(&cmd, WAIT_FOREVER), EXIT_FAILURE);
+    assert_int_equal(add_wait(NULL, WAIT_FOREVER), EXIT_FAILURE);
+    assert_true(now_ms() - start < 1000);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+/** @} */ /* End of wait_tests group */
+
+/**
+* @defgroup batch_tests Batch Command Tests
+* @brief Tests for add_batch() and get_next_commands()
+* @{
+*/
+
+/**
+* @brief Build a charging profile batch of SET_PARAMS plus 8 ON_OFF commands
+*
+* @param batch Array of at least 9 commands to fill
+* @return Number of commands written
+*/
+static size_t make_profile_batch(device_command_t *batch) {
+    batch[0].command_type = CMD_SET_PARAMS;
+    batch[0].data.set_params.min_level = 20;
+    batch[0].data.set_params.max_level = 80;
+    batch[0].data.set_params.max_time = 120;
+    for (int ch = 0; ch < 8; ch++) {
+        batch[ch + 1].command_type = CMD_ON_OFF;
+        batch[ch + 1].data.on_off.on_off = 1;
+        batch[ch + 1].data.on_off.channel = ch;
+    }
+    return 9;
+}
+
+/**
+* @brief Check a round trip of a profile batch on the given backend
+*
+* @param backend Queue backend to initialize the module with
+*/
+static void check_batch_round_trip(queue_backend_t backend) {
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = backend;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t batch[9];
+    size_t n = make_profile_batch(batch);
+    assert_int_equal(add_batch(batch, n), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), n);
+
+    // Retrieve in two runs and check FIFO order
+    device_command_t out[9];
+    assert_int_equal(get_next_commands(out, 4), 4);
+    assert_int_equal(get_next_commands(&out[4], 9), 5);
+    assert_memory_equal(out, batch, sizeof(batch));
+    assert_int_equal(get_next_commands(out, 9), 0);
+    assert_int_equal(get_unused_command_count(), POOL_SIZE);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test a batch round trip on both queue backends
+*
+* This test verifies that a batch is queued and retrieved in order.
+*
+* @param state Test state (unused)
+*/
+static void test_batch_round_trip(void **state) {
+    (void)state;
+    check_batch_round_trip(QUEUE_BACKEND_TAILQ);
+    check_batch_round_trip(QUEUE_BACKEND_RING);
+}
+
+/**
+* @brief Test that a batch is all-or-nothing
+*
+* This test verifies that a batch with an invalid command or without room for
+* all of its commands leaves the pools untouched.
+*
+* @param state Test state (unused)
+*/
+static void test_batch_all_or_nothing(void **state) {
+    (void)state;
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+
+    device_command_t batch[9];
+    size_t n = make_profile_batch(batch);
+
+    // One invalid command rejects the whole batch
+    batch[5].data.on_off.channel = 8;
+    assert_int_equal(add_batch(batch, n), EXIT_FAILURE);
+    assert_int_equal(get_active_command_count(), 0);
+    batch[5].data.on_off.channel = 4;
+
+    // Leave room for fewer commands than the batch holds
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    for (int i = 0; i < POOL_SIZE - 8; i++) {
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(add_batch(batch, n), EXIT_FAILURE);
+    assert_int_equal(get_unused_command_count(), 8);
+    assert_int_equal(add_batch(batch, 8), EXIT_SUCCESS);
+    assert_int_equal(get_unused_command_count(), 0);
+
+    assert_int_equal(add_batch(NULL, n), EXIT_FAILURE);
+    assert_int_equal(add_batch(batch, 0), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(NULL, 4), 0);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+    assert_int_equal(add_batch(batch, n), EXIT_FAILURE);
+}
+/** @} */ /* End of batch_tests group */
+
+/**
+* @defgroup transmit_tests Transmit Engine Tests
+* @brief Tests for frame encoding and the writer thread
+* @{
+*/
+
+/**
+* @brief Test encoding of each command type into a wire frame
+*
+* This test verifies the frame layout and checksum for each command type and
+* that unknown command types are not encoded.
+*
+* @param state Test state (unused)
+*/
+static void test_encode_frame(void **state) {
+    (void)state;
+    uint8_t buf[FRAME_MAX_SIZE];
+
+    device_command_t set_params = {
+        .command_type = CMD_SET_PARAMS,
+        .data.set_params = { .min_level = 10, .max_level = 90, .max_time = 60 }
+    };
+    const uint8_t set_params_frame[] = {
+        FRAME_START, 0x05, CMD_SET_PARAMS, 3, 10, 90, 60,
+        0x05 ^ CMD_SET_PARAMS ^ 3 ^ 10 ^ 90 ^ 60
+    };
+    assert_int_equal(encode_frame(&set_params, 0x05, buf), sizeof(set_params_frame));
+    assert_memory_equal(buf, set_params_frame, sizeof(set_params_frame));
+
+    device_command_t on_off = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 7 }
+    };
+    const uint8_t on_off_frame[] = {
+        FRAME_START, 0x00, CMD_ON_OFF, 2, 1, 7, CMD_ON_OFF ^ 2 ^ 1 ^ 7
+    };
+    assert_int_equal(encode_frame(&on_off, 0x00, buf), sizeof(on_off_frame));
+    assert_memory_equal(buf, on_off_frame, sizeof(on_off_frame));
+
+    device_command_t emergency = { .command_type = CMD_EMERGENCY };
+    const uint8_t emergency_frame[] = {
+        FRAME_START, 0xFF, CMD_EMERGENCY, 0, 0xFF ^ CMD_EMERGENCY
+    };
+    assert_int_equal(encode_frame(&emergency, 0xFF, buf), sizeof(emergency_frame));
+    assert_memory_equal(buf, emergency_frame, sizeof(emergency_frame));
+
+    device_command_t unknown = { .command_type = 0xFF };
+    assert_int_equal(encode_frame(&unknown, 0, buf), 0);
+    assert_int_equal(encode_frame(NULL, 0, buf), 0);
+}
+
+/**
+* @brief Test that the transmit engine drains the pool in coalesced writes
+*
+* This test verifies that queued commands are written to the port by the
+* writer thread and that the statistics account for every frame.
+*
+* @param state Test state (unused)
+*/
+static void test_transmitter_drains_pool(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    opts.tx_frames_per_write = 0;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+
+    opts.tx_frames_per_write = 16;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t batch[9];
+    size_t n = make_profile_batch(batch);
+    assert_int_equal(add_batch(batch, n), EXIT_SUCCESS);
+
+    tx_stats_t stats;
+    long long start = now_ms();
+    do {
+        sleep_ms(1);
+        assert_int_equal(get_tx_stats(&stats), EXIT_SUCCESS);
+    } while (stats.frames < n && now_ms() - start < 2000);
+
+    assert_int_equal(stats.frames, n);
+    // One SET_PARAMS frame of 8 bytes and eight ON_OFF frames of 7 bytes
+    assert_int_equal(stats.bytes, 8 + 8 * 7);
+    assert_in_range(stats.write_calls, 1, n);
+    assert_int_equal(stats.write_errors, 0);
+    assert_int_equal(stats.dropped, 0);
+    assert_true(stats.frames_per_write >= 1.0);
+    assert_int_equal(get_active_command_count(), 0);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+    assert_int_equal(get_tx_stats(&stats), EXIT_FAILURE);
+}
+
+/**
+* @brief Find the highest descriptor open on /dev/null
+*
+* @return Descriptor, or -1 if there is none
+*/
+static int last_null_fd(void) {
+    char path[32];
+    char target[16];
+    for (int fd = 1023; fd >= 0; fd--) {
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+        if (len == 9 && memcmp(target, "/dev/null", 9) == 0) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+/**
+* @brief Test that frames the port refuses are counted as dropped
+*
+* This test verifies that a write error that does not mean the port is gone,
+* ENOSPC from /dev/full put in place of the port, drops the burst without
+* failing the port, and that the frames show up in the transmit, module and
+* Prometheus statistics.
+*
+* @param state Test state (unused)
+*/
+static void test_transmitter_counts_dropped(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    int before = last_null_fd();
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    int port = last_null_fd();
+    assert_true(port > before);
+    int full = open("/dev/full", O_WRONLY);
+    assert_true(full >= 0);
+    assert_int_equal(dup2(full, port), port);
+    close(full);
+
+    device_command_t cmd = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 2 }
+    };
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    tx_stats_t stats;
+    long long start = now_ms();
+    do {
+        sleep_ms(1);
+        assert_int_equal(serial_get_tx_stats(ctx, &stats), EXIT_SUCCESS);
+    } while (stats.dropped < 1 && now_ms() - start < 2000);
+    assert_int_equal(stats.dropped, 1);
+    assert_int_equal(stats.frames, 0);
+    assert_true(stats.write_errors >= 1);
+
+    serial_stats_t totals;
+    assert_int_equal(serial_get_stats(ctx, &totals), EXIT_SUCCESS);
+    assert_int_equal(totals.tx_dropped, 1);
+    assert_int_equal(totals.port_failures, 0);
+    assert_int_equal(totals.port_down, 0);
+
+    char metrics[16384];
+    assert_true(serial_format_prometheus(&totals, NULL, metrics, sizeof(metrics)) > 0);
+    assert_non_null(strstr(metrics, "\nserial_tx_dropped_frames_total 1\n"));
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+/** @} */ /* End of transmit_tests group */
+
+/**
+* @defgroup emergency_lane_tests Emergency Lane Tests
+* @brief Tests for the high-priority emergency command lane
+* @{
+*/
+
+/**
+* @brief Check that an emergency command overtakes a full backlog
+*
+* @param backend Queue backend to initialize the module with
+*/
+static void check_emergency_overtakes_backlog(queue_backend_t backend) {
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = backend;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t set_params = {
+        .command_type = CMD_SET_PARAMS,
+        .data.set_params = { .min_level = 10, .max_level = 90, .max_time = 60 }
+    };
+    for (int i = 0; i < POOL_SIZE - 1; i++) {
+        assert_int_equal(add(&set_params), EXIT_SUCCESS);
+    }
+    device_command_t emergency = { .command_type = CMD_EMERGENCY };
+    assert_int_equal(add(&emergency), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), POOL_SIZE);
+
+    // The emergency stop comes out first, then the backlog in FIFO order
+    device_command_t cmd_get;
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    assert_int_equal(cmd_get.command_type, CMD_EMERGENCY);
+    for (int i = 0; i < POOL_SIZE - 1; i++) {
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.command_type, CMD_SET_PARAMS);
+    }
+    assert_int_equal(get_next_command(&cmd_get), EXIT_FAILURE);
+
+    emergency_latency_t latency;
+    assert_int_equal(get_emergency_latency(&latency), EXIT_SUCCESS);
+    assert_int_equal(latency.count, 1);
+    assert_true(latency.max_ns >= latency.mean_ns);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+    assert_int_equal(get_emergency_latency(&latency), EXIT_FAILURE);
+}
+
+/**
+* @brief Test that emergency commands bypass the routine backlog
+*
+* This test verifies on both backends that an emergency command added behind
+* 31 SET_PARAMS commands is dequeued first and its latency is measured.
+*
+* @param state Test state (unused)
+*/
+static void test_emergency_overtakes_backlog(void **state) {
+    (void)state;
+    check_emergency_overtakes_backlog(QUEUE_BACKEND_TAILQ);
+    check_emergency_overtakes_backlog(QUEUE_BACKEND_RING);
+}
+
+/**
+* @brief Test lane order for a batch mixing emergency and routine commands
+*
+* This test verifies that emergency commands of a batch are dequeued first
+* and that each lane keeps its own FIFO order.
+*
+* @param state Test state (unused)
+*/
+static void test_emergency_lane_batch_order(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t batch[4] = {
+        { .command_type = CMD_ON_OFF, .data.on_off = { .on_off = 1, .channel = 0 } },
+        { .command_type = CMD_EMERGENCY },
+        { .command_type = CMD_ON_OFF, .data.on_off = { .on_off = 1, .channel = 1 } },
+        { .command_type = CMD_EMERGENCY }
+    };
+    assert_int_equal(add_batch(batch, 4), EXIT_SUCCESS);
+
+    device_command_t out[4];
+    assert_int_equal(get_next_commands(out, 4), 4);
+    assert_int_equal(out[0].command_type, CMD_EMERGENCY);
+    assert_int_equal(out[1].command_type, CMD_EMERGENCY);
+    assert_int_equal(out[2].data.on_off.channel, 0);
+    assert_int_equal(out[3].data.on_off.channel, 1);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+/** @} */ /* End of emergency_lane_tests group */
+
+/**
+* @defgroup pool_capacity_tests Pool Capacity Tests
+* @brief Tests for configurable and growable command pools
+* @{
+*/
+
+/**
+* @brief Test a pool with a configured capacity on both backends
+*
+* This test verifies that the pool accepts exactly pool_capacity commands and
+* that the high-water mark follows the occupancy.
+*
+* @param state Test state (unused)
+*/
+static void test_pool_configured_capacity(void **state) {
+    (void)state;
+    const queue_backend_t backends[] = { QUEUE_BACKEND_TAILQ, QUEUE_BACKEND_RING };
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+
+    for (size_t b = 0; b < 2; b++) {
+        serial_options_t opts;
+        serial_options_default(&opts);
+        opts.queue_backend = backends[b];
+        opts.pool_capacity = 100;
+        assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+        assert_int_equal(get_unused_command_count(), 100);
+
+        for (int i = 0; i < 100; i++) {
+            assert_int_equal(add(&cmd), EXIT_SUCCESS);
+        }
+        assert_int_equal(add(&cmd), EXIT_FAILURE);
+
+        device_command_t out[40];
+        assert_int_equal(get_next_commands(out, 40), 40);
+
+        pool_stats_t stats;
+        assert_int_equal(get_pool_stats(&stats), EXIT_SUCCESS);
+        assert_int_equal(stats.capacity, 100);
+        assert_int_equal(stats.max_capacity, 100);
+        assert_int_equal(stats.high_water_mark, 100);
+        assert_int_equal(stats.grow_events, 0);
+
+        assert_int_equal(deinit(), EXIT_SUCCESS);
+    }
+}
+
+/**
+* @brief Test invalid pool capacity options
+*
+* This test verifies that initialization rejects a zero capacity, growth on
+* the ring backend and a growth limit below the initial capacity.
+*
+* @param state Test state (unused)
+*/
+static void test_pool_invalid_options(void **state) {
+    (void)state;
+    serial_options_t opts;
+
+    serial_options_default(&opts);
+    opts.pool_capacity = 0;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    opts.pool_growth = 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+
+    serial_options_default(&opts);
+    opts.pool_growth = 1;
+    opts.pool_max_capacity = POOL_SIZE - 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+}
+
+/**
+* @brief Test slab growth of the pool up to its limit
+*
+* This test verifies that a growable pool adds chunks when it runs out of
+* unused entries, keeps queued commands intact and stops at the limit.
+*
+* @param state Test state (unused)
+*/
+static void test_pool_growth(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.pool_capacity = 4;
+    opts.pool_growth = 1;
+    opts.pool_chunk_size = 4;
+    opts.pool_max_capacity = 10;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    for (int i = 0; i < 10; i++) {
+        device_command_t cmd = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = 1, .channel = i % 8 }
+        };
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    }
+    device_command_t cmd = {
+        .command_type = CMD_SET_PARAMS,
+        .data.set_params = { .min_level = 10, .max_level = 90, .max_time = 60 }
+    };
+    assert_int_equal(add(&cmd), EXIT_FAILURE);
+
+    pool_stats_t stats;
+    assert_int_equal(get_pool_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.capacity, 10);
+    assert_int_equal(stats.grow_events, 2);
+    assert_int_equal(stats.high_water_mark, 10);
+    assert_int_equal(get_unused_command_count(), 0);
+
+    // Commands queued before and after growing keep their FIFO order
+    for (int i = 0; i < 10; i++) {
+        device_command_t cmd_get;
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.data.on_off.channel, i % 8);
+    }
+    assert_int_equal(get_unused_command_count(), 10);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+    assert_int_equal(get_pool_stats(&stats), EXIT_FAILURE);
+}
+
+/**
+* @brief Test that a thread reuses its cached entries
+*
+* This test verifies that after the first add refills the thread cache,
+* add/get cycles of one thread no longer reach the shared unused pool, and
+* that the thread cache is rejected by the ring backend.
+*
+* @param state Test state (unused)
+*/
+static void test_thread_cache_fast_path(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    opts.thread_cache = 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+
+    opts.queue_backend = QUEUE_BACKEND_TAILQ;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    device_command_t cmd = { .command_type = CMD_EMERGENCY };
+    for (int i = 0; i < 100; i++) {
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+        assert_int_equal(get_next_command(&cmd), EXIT_SUCCESS);
+    }
+
+    pool_stats_t stats;
+    assert_int_equal(get_pool_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.cache_slow_path, 1);
+    assert_int_equal(get_unused_command_count(), POOL_SIZE);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Add one command from a separate thread
+*
+* @param arg Instance handle
+* @return NULL
+*/
+static void *cache_add_thread(void *arg) {
+    device_command_t cmd = { .command_type = CMD_EMERGENCY };
+    assert_int_equal(serial_add((serial_ctx_t *)arg, &cmd), EXIT_SUCCESS);
+    return NULL;
+}
+
+/**
+* @brief Test that entries cached by another thread are not lost
+*
+* This test verifies that a thread can fill the whole pool even though
+* another thread keeps free entries in its cache.
+*
+* @param state Test state (unused)
+*/
+static void test_thread_cache_steal(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.pool_capacity = 16;
+    opts.thread_cache = 1;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+
+    // The other thread leaves a refilled cache behind
+    pthread_t thread;
+    assert_int_equal(pthread_create(&thread, NULL, cache_add_thread, ctx), 0);
+    pthread_join(thread, NULL);
+    assert_int_equal(serial_get_unused_command_count(ctx), 15);
+
+    device_command_t cmd = { .command_type = CMD_EMERGENCY };
+    for (int i = 0; i < 15; i++) {
+        assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_FAILURE);
+    assert_int_equal(serial_get_active_command_count(ctx), 16);
+    assert_int_equal(serial_get_unused_command_count(ctx), 0);
+
+    device_command_t out[16];
+    assert_int_equal(serial_get_next_commands(ctx, out, 16), 16);
+    assert_int_equal(serial_get_unused_command_count(ctx), 16);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+/** @} */ /* End of pool_capacity_tests group */
+
+/**
+* @defgroup log_tests Log Sink Tests
+* @brief Tests for the rate-limited, asynchronous log sink
+* @{
+*/
+
+/**
+* @brief Test the per-call-site rate limit
+*
+* This test verifies that a call site may log SERIAL_LOG_RATE_BURST messages
+* per window and that further messages are suppressed.
+*
+* @param state Test state (unused)
+*/
+static void test_log_ratelimit(void **state) {
+    (void)state;
+    serial_log_ratelimit_t ratelimit = { 0, 0, 0 };
+    for (int i = 0; i < SERIAL_LOG_RATE_BURST; i++) {
+        assert_true(serial_log_ratelimit(&ratelimit, LOG_INFO));
+    }
+    assert_false(serial_log_ratelimit(&ratelimit, LOG_INFO));
+    assert_int_equal(ratelimit.suppressed, 1);
+}
+
+/**
+* @brief Test the module with the asynchronous and disabled sinks
+*
+* This test verifies that commands flow normally with the asynchronous sink
+* and that the disabled sink turns every message off.
+*
+* @param state Test state (unused)
+*/
+static void test_log_sinks(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.log_sink = SERIAL_LOG_SINK_ASYNC;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    device_command_t cmd_get;
+    for (int i = 0; i < 4 * POOL_SIZE; i++) {
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    }
+    assert_true(serial_log_enabled(LOG_WARNING));
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    opts.log_sink = SERIAL_LOG_SINK_NONE;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_false(serial_log_enabled(LOG_WARNING));
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+    assert_true(serial_log_enabled(LOG_WARNING));
+
+    opts.log_sink = (serial_log_sink_t)42;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+}
+/** @} */ /* End of log_tests group */
+
+/**
+* @defgroup coalesce_tests Command Coalescing Tests
+* @brief Tests for replacing superseded pending commands
+* @{
+*/
+
+/**
+* @brief Test coalescing of ON_OFF commands per channel
+*
+* This test verifies that ON/OFF/ON for one channel leaves a single entry
+* with the last value at the position of the first, while other channels and
+* emergency commands get entries of their own.
+*
+* @param state Test state (unused)
+*/
+static void test_coalesce_on_off(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.coalesce = 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t cmds[] = {
+        { .command_type = CMD_ON_OFF, .data.on_off = { .channel = 3, .on_off = 1 } },
+        { .command_type = CMD_ON_OFF, .data.on_off = { .channel = 5, .on_off = 1 } },
+        { .command_type = CMD_ON_OFF, .data.on_off = { .channel = 3, .on_off = 0 } },
+        { .command_type = CMD_EMERGENCY },
+        { .command_type = CMD_ON_OFF, .data.on_off = { .channel = 3, .on_off = 1 } }
+    };
+    assert_int_equal(add_batch(cmds, 2), EXIT_SUCCESS);
+    for (size_t i = 2; i < 5; i++) {
+        assert_int_equal(add(&cmds[i]), EXIT_SUCCESS);
+    }
+    assert_int_equal(get_active_command_count(), 3);
+
+    device_command_t out[4];
+    assert_int_equal(get_next_commands(out, 4), 3);
+    assert_int_equal(out[0].command_type, CMD_EMERGENCY);
+    assert_int_equal(out[1].data.on_off.channel, 3);
+    assert_int_equal(out[1].data.on_off.on_off, 1);
+    assert_int_equal(out[2].data.on_off.channel, 5);
+
+    // Once dequeued, the channel queues a fresh entry again
+    assert_int_equal(add(&cmds[2]), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), 1);
+
+    pool_stats_t stats;
+    assert_int_equal(get_pool_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.coalesced, 2);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test coalescing of SET_PARAMS commands
+*
+* This test verifies that a batch of SET_PARAMS commands fits into a single
+* entry even when the pool has one free entry, that the last one wins, and
+* that coalescing is rejected with the ring backend.
+*
+* @param state Test state (unused)
+*/
+static void test_coalesce_set_params(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.coalesce = 1;
+    opts.pool_capacity = 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t cmds[3];
+    for (int i = 0; i < 3; i++) {
+        cmds[i].command_type = CMD_SET_PARAMS;
+        cmds[i].data.set_params.min_level = 10 + i;
+        cmds[i].data.set_params.max_level = 90;
+        cmds[i].data.set_params.max_time = 60;
+    }
+    assert_int_equal(add_batch(cmds, 3), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), 1);
+
+    device_command_t out;
+    assert_int_equal(get_next_command(&out), EXIT_SUCCESS);
+    assert_int_equal(out.data.set_params.min_level, 12);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    serial_options_default(&opts);
+    opts.coalesce = 1;
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+}
+
+/** @} */ /* End of coalesce_tests group */
+
+/**
+* @defgroup instance_tests Instance Handle Tests
+* @brief Tests for driving several chargers through serial_ctx_t handles
+* @{
+*/
+
+/**
+* @brief Thread body that waits forever for a command on an instance
+*
+* @param arg Instance handle
+* @return Result of serial_get_next_command_wait() cast to a pointer
+*/
+static void *instance_wait_thread(void *arg) {
+    device_command_t cmd;
+    return (void *)(intptr_t)serial_get_next_command_wait(arg, &cmd, WAIT_FOREVER);
+}
+
+/**
+* @brief Test that instances have independent pools
+*
+* This test verifies that filling the pool of one instance leaves another
+* instance and the default instance untouched.
+*
+* @param state Test state (unused)
+*/
+static void test_instances_independent(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.pool_capacity = 4;
+    opts.queue_backend = QUEUE_BACKEND_RING;
+
+    serial_ctx_t *a = serial_init("/dev/null", B9600, NULL);
+    serial_ctx_t *b = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(a);
+    assert_non_null(b);
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+
+    device_command_t cmd = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 2 }
+    };
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(serial_add(b, &cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(serial_add(b, &cmd), EXIT_FAILURE);
+    assert_int_equal(serial_add(a, &cmd), EXIT_SUCCESS);
+
+    assert_int_equal(serial_get_active_command_count(a), 1);
+    assert_int_equal(serial_get_unused_command_count(a), POOL_SIZE - 1);
+    assert_int_equal(serial_get_active_command_count(b), 4);
+    assert_int_equal(get_active_command_count(), 0);
+
+    device_command_t out[8];
+    assert_int_equal(serial_get_next_commands(b, out, 8), 4);
+    assert_int_equal(get_next_command(&out[0]), EXIT_FAILURE);
+
+    assert_int_equal(serial_deinit(a), EXIT_SUCCESS);
+    assert_int_equal(serial_deinit(b), EXIT_SUCCESS);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test invalid handles and deinitialization of a waited-on instance
+*
+* This test verifies that a NULL handle is rejected and that serial_deinit()
+* releases a thread blocked on the instance before freeing it.
+*
+* @param state Test state (unused)
+*/
+static void test_instance_deinit_releases_waiters(void **state) {
+    (void)state;
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    assert_null(serial_init(NULL, B9600, NULL));
+    assert_int_equal(serial_add(NULL, &cmd), EXIT_FAILURE);
+    assert_int_equal(serial_get_active_command_count(NULL), 0);
+    assert_int_equal(serial_deinit(NULL), EXIT_FAILURE);
+
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, NULL);
+    assert_non_null(ctx);
+
+    pthread_t waiter;
+    void *result;
+    assert_int_equal(pthread_create(&waiter, NULL, instance_wait_thread, ctx), 0);
+    sleep_ms(20);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    pthread_join(waiter, &result);
+    assert_int_equal((intptr_t)result, EXIT_FAILURE);
+}
+
+/** @} */ /* End of instance_tests group */
+
+/**
+* @defgroup reactor_tests I/O Reactor Tests
+* @brief Tests for the epoll event loop that transmits for many instances
+* @{
+*/
+
+/**
+* @brief Wait until the transmit engine of an instance wrote a number of frames
+*
+* @param ctx Instance handle
+* @param frames Number of frames to wait for
+* @return Number of frames written when the wait ended
+*/
+static uint64_t wait_tx_frames(serial_ctx_t *ctx, uint64_t frames) {
+    tx_stats_t stats = { 0 };
+    for (int i = 0; i < 500; i++) {
+        assert_int_equal(serial_get_tx_stats(ctx, &stats), EXIT_SUCCESS);
+        if (stats.frames >= frames) {
+            break;
+        }
+        sleep_ms(2);
+    }
+    return stats.frames;
+}
+
+/**
+* @brief Test one reactor driving several instances
+*
+* This test verifies that a reactor drains the pools of every attached
+* instance, including commands queued before attaching, and that destroying
+* it detaches the remaining instances.
+*
+* @param state Test state (unused)
+*/
+static void test_reactor_many_instances(void **state) {
+    (void)state;
+    serial_ctx_t *ctxs[8];
+    device_command_t batch[9];
+    make_profile_batch(batch);
+
+    // Room for every batch even if the reactor has not started draining yet
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.pool_capacity = 64;
+
+    serial_reactor_t *reactor = serial_reactor_create();
+    assert_non_null(reactor);
+    for (int i = 0; i < 8; i++) {
+        ctxs[i] = serial_init("/dev/null", B115200, &opts);
+        assert_non_null(ctxs[i]);
+        assert_int_equal(serial_add_batch(ctxs[i], batch, 9), EXIT_SUCCESS);
+        assert_int_equal(serial_reactor_add(reactor, ctxs[i]), EXIT_SUCCESS);
+    }
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 8; i++) {
+            assert_int_equal(serial_add_batch(ctxs[i], batch, 9), EXIT_SUCCESS);
+        }
+    }
+
+    for (int i = 0; i < 8; i++) {
+        assert_int_equal(wait_tx_frames(ctxs[i], 36), 36);
+        assert_int_equal(serial_get_active_command_count(ctxs[i]), 0);
+    }
+
+    // Detached instances are served by the application again
+    assert_int_equal(serial_reactor_remove(reactor, ctxs[0]), EXIT_SUCCESS);
+    assert_int_equal(serial_add(ctxs[0], &batch[0]), EXIT_SUCCESS);
+    sleep_ms(10);
+    assert_int_equal(serial_get_active_command_count(ctxs[0]), 1);
+
+    assert_int_equal(serial_reactor_destroy(reactor), EXIT_SUCCESS);
+    for (int i = 0; i < 8; i++) {
+        assert_int_equal(serial_deinit(ctxs[i]), EXIT_SUCCESS);
+    }
+}
+
+/**
+* @brief Test the reactor on a port that fills up
+*
+* This test uses a pseudo terminal whose master side is not read at first,
+* so the non-blocking writes hit EAGAIN and must resume on EPOLLOUT once the
+* master drains the data.
+*
+* @param state Test state (unused)
+*/
+static void test_reactor_partial_writes(void **state) {
+    (void)state;
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    assert_true(master >= 0);
+    assert_int_equal(grantpt(master), 0);
+    assert_int_equal(unlockpt(master), 0);
+    assert_true(strlen(ptsname(master)) <= MAX_PORT_NAME);
+
+    serial_ctx_t *ctx = serial_init(ptsname(master), B115200, NULL);
+    assert_non_null(ctx);
+    serial_reactor_t *reactor = serial_reactor_create();
+    assert_non_null(reactor);
+    assert_int_equal(serial_reactor_add(reactor, ctx), EXIT_SUCCESS);
+
+    // Far more than the pty buffers, so the reactor has to stop on EAGAIN
+    device_command_t cmd = {
+        .command_type = CMD_SET_PARAMS,
+        .data.set_params = { .min_level = 20, .max_level = 80, .max_time = 60 }
+    };
+    const int total = 20000;
+    int added = 0;
+    while (added < total && serial_add_wait(ctx, &cmd, 50000000) == EXIT_SUCCESS) {
+        added++;
+    }
+    assert_true(added < total);
+
+    tx_stats_t stats;
+    assert_int_equal(serial_get_tx_stats(ctx, &stats), EXIT_SUCCESS);
+    uint64_t stalled = stats.frames;
+    sleep_ms(20);
+    assert_int_equal(serial_get_tx_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.frames, stalled);
+
+    // Drain the master side and queue the rest
+    char buf[4096];
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    for (int i = 0; i < 10000 && stats.frames < (uint64_t)total; i++) {
+        while (read(master, buf, sizeof(buf)) > 0) {
+        }
+        while (added < total && serial_add(ctx, &cmd) == EXIT_SUCCESS) {
+            added++;
+        }
+        assert_int_equal(serial_get_tx_stats(ctx, &stats), EXIT_SUCCESS);
+        sleep_ms(1);
+    }
+    assert_int_equal(stats.frames, total);
+    assert_int_equal(stats.write_errors, 0);
+    assert_true(stats.write_calls > stats.frames / TX_DEFAULT_FRAMES_PER_WRITE);
+
+    assert_int_equal(serial_reactor_destroy(reactor), EXIT_SUCCESS);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    close(master);
+}
+
+/**
+* @brief Test invalid reactor use
+*
+* This test verifies that NULL handles, instances with their own transmitter
+* and double attachments are rejected, and that deinitializing an attached
+* instance detaches it.
+*
+* @param state Test state (unused)
+*/
+static void test_reactor_invalid_use(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+
+    serial_reactor_t *reactor = serial_reactor_create();
+    assert_non_null(reactor);
+    serial_ctx_t *with_tx = serial_init("/dev/null", B9600, &opts);
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, NULL);
+    assert_non_null(with_tx);
+    assert_non_null(ctx);
+
+    assert_int_equal(serial_reactor_add(NULL, ctx), EXIT_FAILURE);
+    assert_int_equal(serial_reactor_add(reactor, NULL), EXIT_FAILURE);
+    assert_int_equal(serial_reactor_add(reactor, with_tx), EXIT_FAILURE);
+    assert_int_equal(serial_reactor_remove(reactor, ctx), EXIT_FAILURE);
+    assert_int_equal(serial_reactor_add(reactor, ctx), EXIT_SUCCESS);
+    assert_int_equal(serial_reactor_add(reactor, ctx), EXIT_FAILURE);
+
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    assert_int_equal(serial_deinit(with_tx), EXIT_SUCCESS);
+    assert_int_equal(serial_reactor_destroy(reactor), EXIT_SUCCESS);
+    assert_int_equal(serial_reactor_destroy(NULL), EXIT_FAILURE);
+}
+
+/** @} */ /* End of reactor_tests group */
+
+/**
+* @defgroup rx_tests Receive Path Tests
+* @brief Tests for parsing charger replies into events
+* @{
+*/
+
+/**
+* @brief Build a reply frame as the charger would send it
+*
+* @param buf Buffer of at least FRAME_MAX_SIZE bytes
+* @param seq Sequence number of the reply
+* @param code RSP_* code of the reply
+* @param payload Payload bytes
+* @param len Number of payload bytes
+* @return Size of the frame
+*/
+static size_t make_reply(uint8_t *buf, uint8_t seq, uint8_t code, const uint8_t *payload, uint8_t len) {
+    buf[0] = FRAME_START;
+    buf[1] = seq;
+    buf[2] = code;
+    buf[3] = len;
+    memcpy(&buf[FRAME_HEADER_SIZE], payload, len);
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < (size_t)FRAME_HEADER_SIZE + len; i++) {
+        checksum ^= buf[i];
+    }
+    buf[FRAME_HEADER_SIZE + len] = checksum;
+    return FRAME_HEADER_SIZE + len + 1;
+}
+
+/**
+* @brief Test parsing a byte stream with noise and split frames
+*
+* This test feeds an ACK and a level report split at every byte, surrounded
+* by garbage, a frame with a bad checksum and a frame with an unknown code,
+* and verifies the decoded events and the receive counters.
+*
+* @param state Test state (unused)
+*/
+static void test_rx_feed_stream(void **state) {
+    (void)state;
+    uint8_t stream[64];
+    size_t len = 0;
+    const uint8_t ack[] = { 7, CMD_ON_OFF, RSP_ACK_OK };
+    const uint8_t level[] = { 3, 55 };
+    const uint8_t unknown[] = { 1, 2 };
+
+    stream[len++] = 0x11;
+    stream[len++] = 0x22;
+    len += make_reply(&stream[len], 1, RSP_ACK, ack, 3);
+    len += make_reply(&stream[len], 2, RSP_FAULT, level, 2);
+    stream[len - 1] ^= 0xFF;
+    len += make_reply(&stream[len], 3, 0x90, unknown, 2);
+    len += make_reply(&stream[len], 4, RSP_LEVEL, level, 2);
+
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+    for (size_t i = 0; i < len; i++) {
+        assert_int_equal(rx_feed(&stream[i], 1), EXIT_SUCCESS);
+    }
+
+    rx_event_t event;
+    assert_int_equal(get_rx_event(&event), EXIT_SUCCESS);
+    assert_int_equal(event.type, RX_EVENT_ACK);
+    assert_int_equal(event.seq, 1);
+    assert_int_equal(event.data.ack.seq, 7);
+    assert_int_equal(event.data.ack.command_type, CMD_ON_OFF);
+    assert_int_equal(event.data.ack.status, RSP_ACK_OK);
+    assert_int_equal(get_rx_event(&event), EXIT_SUCCESS);
+    assert_int_equal(event.type, RX_EVENT_LEVEL);
+    assert_int_equal(event.seq, 4);
+    assert_int_equal(event.data.level.channel, 3);
+    assert_int_equal(event.data.level.level, 55);
+    assert_int_equal(get_rx_event(&event), EXIT_FAILURE);
+
+    // The bad frame only costs its start marker, the rest is skipped as noise
+    rx_stats_t stats;
+    assert_int_equal(get_rx_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.bytes, len);
+    assert_int_equal(stats.frames, 2);
+    assert_int_equal(stats.checksum_errors, 1);
+    assert_int_equal(stats.malformed_frames, 1);
+    assert_int_equal(stats.discarded_bytes, 2 + (FRAME_HEADER_SIZE + 2 + 1) - 1);
+    assert_int_equal(stats.dropped_events, 0);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+    assert_int_equal(rx_feed(stream, len), EXIT_FAILURE);
+    assert_int_equal(get_rx_event(&event), EXIT_FAILURE);
+}
+
+/**
+* @brief Receive callback counting the events it is given
+*
+* @param event Decoded event
+* @param user Counter to increment
+*/
+static void count_rx_event(const rx_event_t *event, void *user) {
+    if (event->type == RX_EVENT_STATE) {
+        (*(int *)user)++;
+    }
+}
+
+/**
+* @brief Test event delivery through a callback and a full event queue
+*
+* @param state Test state (unused)
+*/
+static void test_rx_callback_and_overflow(void **state) {
+    (void)state;
+    uint8_t frame[FRAME_MAX_SIZE];
+    const uint8_t report[] = { 0, 1 };
+    size_t size = make_reply(frame, 0, RSP_STATE, report, 2);
+    int count = 0;
+
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.rx_callback = count_rx_event;
+    opts.rx_user = &count;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    assert_int_equal(serial_rx_feed(ctx, frame, size), EXIT_SUCCESS);
+    assert_int_equal(serial_rx_feed(ctx, frame, size), EXIT_SUCCESS);
+    assert_int_equal(count, 2);
+    rx_event_t event;
+    assert_int_equal(serial_get_rx_event(ctx, &event), EXIT_FAILURE);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+
+    // Without a callback, events beyond the queue are dropped and counted
+    ctx = serial_init("/dev/null", B9600, NULL);
+    assert_non_null(ctx);
+    for (int i = 0; i < RX_EVENT_QUEUE_SIZE + 3; i++) {
+        assert_int_equal(serial_rx_feed(ctx, frame, size), EXIT_SUCCESS);
+    }
+    rx_stats_t stats;
+    assert_int_equal(serial_get_rx_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.frames, RX_EVENT_QUEUE_SIZE + 3);
+    assert_int_equal(stats.dropped_events, 3);
+    for (int i = 0; i < RX_EVENT_QUEUE_SIZE; i++) {
+        assert_int_equal(serial_get_rx_event(ctx, &event), EXIT_SUCCESS);
+        assert_int_equal(event.type, RX_EVENT_STATE);
+    }
+    assert_int_equal(serial_get_rx_event(ctx, &event), EXIT_FAILURE);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test the reader thread on a pseudo terminal
+*
+* This test verifies that replies written to the master side of a pty are
+* read and decoded by the receiver, and that the receiver starts and stops
+* cleanly on /dev/null.
+*
+* @param state Test state (unused)
+*/
+static void test_rx_receiver_thread(void **state) {
+    (void)state;
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    assert_true(master >= 0);
+    assert_int_equal(grantpt(master), 0);
+    assert_int_equal(unlockpt(master), 0);
+    assert_true(strlen(ptsname(master)) <= MAX_PORT_NAME);
+
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.receiver = 1;
+    serial_ctx_t *ctx = serial_init(ptsname(master), B115200, &opts);
+    assert_non_null(ctx);
+
+    uint8_t frame[FRAME_MAX_SIZE];
+    const uint8_t fault[] = { 5, 0x42 };
+    size_t size = make_reply(frame, 9, RSP_FAULT, fault, 2);
+    assert_int_equal(write(master, frame, size), (ssize_t)size);
+
+    rx_event_t event;
+    int result = EXIT_FAILURE;
+    for (int i = 0; i < 500 && result != EXIT_SUCCESS; i++) {
+        result = serial_get_rx_event(ctx, &event);
+        if (result != EXIT_SUCCESS) {
+            sleep_ms(2);
+        }
+    }
+    assert_int_equal(result, EXIT_SUCCESS);
+    assert_int_equal(event.type, RX_EVENT_FAULT);
+    assert_int_equal(event.seq, 9);
+    assert_int_equal(event.data.fault.channel, 5);
+    assert_int_equal(event.data.fault.code, 0x42);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    close(master);
+
+    // End of file right away, the receiver then only waits to be stopped
+    ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    sleep_ms(5);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/** @} */ /* End of rx_tests group */
+
+/**
+* @defgroup ack_tests Acknowledgement Window Tests
+* @brief Tests for pipelined commands tracked by sequence number
+* @{
+*/
+
+/**
+* @brief Feed the acknowledgement of a command frame to an instance
+*
+* @param ctx Instance handle
+* @param seq Sequence number of the acknowledged frame
+* @param command_type Command code of the acknowledged frame
+* @param status RSP_ACK_OK or an error status
+*/
+static void feed_ack(serial_ctx_t *ctx, uint8_t seq, uint8_t command_type, uint8_t status) {
+    uint8_t frame[FRAME_MAX_SIZE];
+    const uint8_t payload[] = { seq, command_type, status };
+    size_t size = make_reply(frame, 0, RSP_ACK, payload, 3);
+    assert_int_equal(serial_rx_feed(ctx, frame, size), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test that the window limits and slides the commands in flight
+*
+* This test verifies that only ack_window commands are sent before their
+* acknowledgements arrive, that out-of-order acknowledgements do not slide
+* the window past an outstanding command, and that rejections are counted.
+*
+* @param state Test state (unused)
+*/
+static void test_ack_window_pipelining(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    opts.ack_window = 4;
+    opts.ack_timeout_ms = 10000;
+    serial_ctx_t *ctx = serial_init("/dev/null", B115200, &opts);
+    assert_non_null(ctx);
+
+    device_command_t cmd = { .command_type = CMD_ON_OFF, .data.on_off = { .on_off = 1, .channel = 0 } };
+    for (int i = 0; i < 8; i++) {
+        cmd.data.on_off.channel = i;
+        assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(wait_tx_frames(ctx, 4), 4);
+    sleep_ms(10);
+    ack_stats_t stats;
+    assert_int_equal(serial_get_ack_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.in_flight, 4);
+    assert_int_equal(wait_tx_frames(ctx, 5), 4);
+
+    // The oldest command still holds the window
+    feed_ack(ctx, 3, CMD_ON_OFF, RSP_ACK_OK);
+    feed_ack(ctx, 1, CMD_ON_OFF, RSP_ACK_OK);
+    feed_ack(ctx, 2, CMD_ON_OFF, RSP_ACK_OK);
+    sleep_ms(10);
+    assert_int_equal(wait_tx_frames(ctx, 5), 4);
+
+    feed_ack(ctx, 0, CMD_ON_OFF, RSP_ACK_OK);
+    assert_int_equal(wait_tx_frames(ctx, 8), 8);
+    feed_ack(ctx, 4, CMD_ON_OFF, RSP_ACK_OK);
+    feed_ack(ctx, 5, CMD_ON_OFF, 1);
+    feed_ack(ctx, 6, CMD_ON_OFF, RSP_ACK_OK);
+    feed_ack(ctx, 7, CMD_ON_OFF, RSP_ACK_OK);
+
+    assert_int_equal(serial_get_ack_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.in_flight, 0);
+    assert_int_equal(stats.acked, 7);
+    assert_int_equal(stats.rejected, 1);
+    assert_int_equal(stats.retransmits, 0);
+    assert_int_equal(stats.timeouts, 0);
+
+    // ACK events still reach the application
+    rx_event_t event;
+    assert_int_equal(serial_get_rx_event(ctx, &event), EXIT_SUCCESS);
+    assert_int_equal(event.type, RX_EVENT_ACK);
+    assert_int_equal(event.data.ack.seq, 3);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test retransmission and giving up on an unacknowledged command
+*
+* @param state Test state (unused)
+*/
+static void test_ack_retransmit_timeout(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    opts.ack_window = 2;
+    opts.ack_timeout_ms = 20;
+    opts.ack_retries = 2;
+    serial_ctx_t *ctx = serial_init("/dev/null", B115200, &opts);
+    assert_non_null(ctx);
+
+    device_command_t cmd = { .command_type = CMD_EMERGENCY };
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+
+    ack_stats_t stats = { 0 };
+    for (int i = 0; i < 500 && stats.timeouts == 0; i++) {
+        sleep_ms(2);
+        assert_int_equal(serial_get_ack_stats(ctx, &stats), EXIT_SUCCESS);
+    }
+    assert_int_equal(stats.timeouts, 1);
+    assert_int_equal(stats.retransmits, 2);
+    assert_int_equal(stats.in_flight, 0);
+    assert_int_equal(wait_tx_frames(ctx, 3), 3);
+
+    // A late acknowledgement is ignored, the next command gets a new number
+    feed_ack(ctx, 0, CMD_EMERGENCY, RSP_ACK_OK);
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    assert_int_equal(wait_tx_frames(ctx, 4), 4);
+    feed_ack(ctx, 1, CMD_EMERGENCY, RSP_ACK_OK);
+    assert_int_equal(serial_get_ack_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.acked, 1);
+    assert_int_equal(stats.in_flight, 0);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test that invalid acknowledgement options are rejected
+*
+* @param state Test state (unused)
+*/
+static void test_ack_invalid_options(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.ack_window = 4;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+
+    opts.transmitter = 1;
+    opts.ack_window = ACK_MAX_WINDOW + 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+
+    opts.ack_window = 4;
+    opts.ack_timeout_ms = 0;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+
+    ack_stats_t stats;
+    assert_int_equal(get_ack_stats(&stats), EXIT_FAILURE);
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+    assert_int_equal(get_ack_stats(NULL), EXIT_FAILURE);
+    assert_int_equal(get_ack_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.in_flight, 0);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/** @} */ /* End of ack_tests group */
+
+/**
+* @defgroup metrics_tests Metrics Tests
+* @brief Tests for the counters, latency histograms and Prometheus output
+* @{
+*/
+
+/**
+* @brief Test the add, rejection and dequeue counters
+*
+* This test verifies that every rejection is counted under its reason, that
+* rejected batches count each of their commands and that adds made while the
+* module is not initialized are counted as well.
+*
+* @param state Test state (unused)
+*/
+static void test_stats_counters(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.pool_capacity = 4;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+
+    device_command_t cmd = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 2 }
+    };
+    device_command_t bad[2] = {
+        { .command_type = CMD_ON_OFF, .data.on_off = { .on_off = 1, .channel = 2 } },
+        { .command_type = CMD_ON_OFF, .data.on_off = { .on_off = 5, .channel = 2 } }
+    };
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_FAILURE);
+    assert_int_equal(serial_add(ctx, &bad[1]), EXIT_FAILURE);
+    assert_int_equal(serial_add_batch(ctx, bad, 2), EXIT_FAILURE);
+
+    device_command_t out[3];
+    assert_int_equal(serial_get_next_commands(ctx, out, 3), 3);
+
+    serial_stats_t stats;
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.adds, 4);
+    assert_int_equal(stats.rejected_pool_full, 1);
+    assert_int_equal(stats.rejected_invalid, 3);
+    assert_int_equal(stats.rejected_not_initialized, 0);
+    assert_int_equal(stats.dequeues, 3);
+    assert_int_equal(stats.active, 1);
+    assert_int_equal(stats.residency.count, 3);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+
+    // The legacy counters keep counting while the module is down
+    serial_stats_t before;
+    assert_int_equal(get_stats(&before), EXIT_SUCCESS);
+    assert_int_equal(add(&cmd), EXIT_FAILURE);
+    assert_int_equal(get_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.rejected_not_initialized, before.rejected_not_initialized + 1);
+    assert_int_equal(stats.active, 0);
+    assert_int_equal(get_stats(NULL), EXIT_FAILURE);
+}
+
+/**
+* @brief Test the buckets of the residency histogram
+*
+* This test verifies that the bucket limits grow strictly, and that a command
+* held for a millisecond lands in a bucket whose bounds cover its residency.
+*
+* @param state Test state (unused)
+*/
+static void test_stats_residency_histogram(void **state) {
+    (void)state;
+    assert_int_equal(serial_histogram_bucket_limit(0), 1);
+    assert_int_equal(serial_histogram_bucket_limit(4), 5);
+    assert_int_equal(serial_histogram_bucket_limit(7), 8);
+    assert_true(serial_histogram_bucket_limit(HISTOGRAM_BUCKETS - 1) == UINT64_MAX);
+    assert_true(serial_histogram_bucket_limit(HISTOGRAM_BUCKETS) == UINT64_MAX);
+    for (size_t i = 1; i < HISTOGRAM_BUCKETS; i++) {
+        assert_true(serial_histogram_bucket_limit(i) > serial_histogram_bucket_limit(i - 1));
+    }
+
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, NULL);
+    assert_non_null(ctx);
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    struct timespec hold = { 0, 1000000 };
+    nanosleep(&hold, NULL);
+    assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_SUCCESS);
+
+    serial_stats_t stats;
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.residency.count, 1);
+    assert_true(stats.residency.max_ns >= 1000000);
+    assert_true(stats.residency.sum_ns == stats.residency.max_ns);
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (stats.residency.buckets[i] == 0) {
+            continue;
+        }
+        assert_int_equal(stats.residency.buckets[i], 1);
+        assert_true(stats.residency.max_ns < serial_histogram_bucket_limit(i));
+        assert_true(stats.residency.max_ns >= serial_histogram_bucket_limit(i - 1));
+    }
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test the Prometheus text output
+*
+* This test verifies the samples written for counters and histograms, the
+* labels added to them and truncation to a small buffer.
+*
+* @param state Test state (unused)
+*/
+static void test_stats_prometheus_format(void **state) {
+    (void)state;
+    serial_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.adds = 42;
+    stats.rejected_pool_full = 7;
+    stats.active = 3;
+    stats.residency.buckets[4] = 2;
+    stats.residency.buckets[12] = 1;
+    stats.residency.count = 3;
+    stats.residency.sum_ns = 1500000000;
+
+    char buf[16384];
+    int len = serial_format_prometheus(&stats, "port=\"ttyS0\"", buf, sizeof(buf));
+    assert_true(len > 0 && (size_t)len < sizeof(buf));
+    assert_int_equal(strlen(buf), (size_t)len);
+    assert_non_null(strstr(buf, "# TYPE serial_commands_added_total counter\n"));
+    assert_non_null(strstr(buf, "serial_commands_added_total{port=\"ttyS0\"} 42\n"));
+    assert_non_null(strstr(buf, "serial_commands_rejected_total{port=\"ttyS0\",reason=\"pool_full\"} 7\n"));
+    assert_non_null(strstr(buf, "serial_commands_active{port=\"ttyS0\"} 3\n"));
+    assert_non_null(strstr(buf, "# TYPE serial_queue_residency_seconds histogram\n"));
+    assert_non_null(strstr(buf, "serial_queue_residency_seconds_bucket{port=\"ttyS0\",le=\"4e-09\"} 0\n"));
+    assert_non_null(strstr(buf, "serial_queue_residency_seconds_bucket{port=\"ttyS0\",le=\"8e-09\"} 2\n"));
+    assert_non_null(strstr(buf, "serial_queue_residency_seconds_bucket{port=\"ttyS0\",le=\"3.2e-08\"} 3\n"));
+    assert_non_null(strstr(buf, "serial_queue_residency_seconds_bucket{port=\"ttyS0\",le=\"+Inf\"} 3\n"));
+    assert_non_null(strstr(buf, "serial_queue_residency_seconds_sum{port=\"ttyS0\"} 1.500000000\n"));
+    assert_non_null(strstr(buf, "serial_queue_residency_seconds_count{port=\"ttyS0\"} 3\n"));
+
+    // Without labels, and truncated like snprintf()
+    assert_int_equal(serial_format_prometheus(&stats, NULL, buf, sizeof(buf)), (int)strlen(buf));
+    assert_non_null(strstr(buf, "serial_commands_added_total 42\n"));
+    assert_non_null(strstr(buf, "serial_commands_rejected_total{reason=\"invalid\"} 0\n"));
+    assert_non_null(strstr(buf, "serial_write_duration_seconds_count 0\n"));
+    char small[32];
+    assert_int_equal(serial_format_prometheus(&stats, NULL, small, sizeof(small)), (int)strlen(buf));
+    assert_int_equal(strlen(small), sizeof(small) - 1);
+    assert_int_equal(strncmp(small, buf, sizeof(small) - 1), 0);
+    assert_int_equal(serial_format_prometheus(NULL, NULL, buf, sizeof(buf)), -1);
+}
+
+/** @} */ /* End of metrics_tests group */
+
+/**
+* @defgroup trace_tests Trace Tests
+* @brief Tests for the per-thread trace rings and their dump
+* @{
+*/
+
+/**
+* @brief Find the first traced event of a trace point
+*
+* @param events Events in time order
+* @param n Number of events
+* @param point Trace point to look for
+* @return Index of the event, or n if there is none
+*/
+static size_t find_trace_event(const trace_event_t *events, size_t n, trace_point_t point) {
+    size_t i = 0;
+    while (i < n && events[i].point != point) {
+        i++;
+    }
+    return i;
+}
+
+/**
+* @brief Test tracing a command from add to write()
+*
+* This test verifies that a command sent by the writer thread leaves an add,
+* dequeue, encode and write event in that order, and that nothing is
+* recorded while tracing is off.
+*
+* @param state Test state (unused)
+*/
+static void test_trace_command_path(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    serial_trace_clear();
+    serial_trace_enable(1);
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+
+    device_command_t cmd = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 3 }
+    };
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    tx_stats_t stats;
+    long long start = now_ms();
+    do {
+        sleep_ms(1);
+        assert_int_equal(serial_get_tx_stats(ctx, &stats), EXIT_SUCCESS);
+    } while (stats.frames < 1 && now_ms() - start < 2000);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    serial_trace_enable(0);
+
+    trace_event_t events[64];
+    size_t n = serial_trace_snapshot(events, 64);
+    size_t added = find_trace_event(events, n, TRACE_ADD);
+    size_t dequeued = find_trace_event(events, n, TRACE_DEQUEUE);
+    size_t encoded = find_trace_event(events, n, TRACE_ENCODE);
+    size_t written = find_trace_event(events, n, TRACE_WRITE);
+    assert_true(added < dequeued && dequeued < encoded && encoded < written && written < n);
+    assert_int_equal(events[added].arg, TRACE_COMMAND_KEY(CMD_ON_OFF, 3));
+    assert_int_equal(events[dequeued].arg, TRACE_COMMAND_KEY(CMD_ON_OFF, 3));
+    assert_int_equal(events[encoded].arg, TRACE_COMMAND_KEY(CMD_ON_OFF, 3));
+    assert_int_equal(events[written].arg, 7);
+    // The writer thread records into a ring of its own
+    assert_true(events[added].thread != events[dequeued].thread);
+
+    // Nothing is recorded while tracing is off
+    serial_trace_clear();
+    ctx = serial_init("/dev/null", B9600, NULL);
+    assert_non_null(ctx);
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_SUCCESS);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    assert_int_equal(serial_trace_snapshot(events, 64), 0);
+}
+
+/**
+* @brief Test dumping the trace rings to a file
+*
+* This test verifies the header and time order of a dump, and that a ring
+* only keeps its newest SERIAL_TRACE_RING_SIZE events.
+*
+* @param state Test state (unused)
+*/
+static void test_trace_dump(void **state) {
+    (void)state;
+    serial_trace_clear();
+    for (uint32_t i = 0; i < SERIAL_TRACE_RING_SIZE + 10; i++) {
+        serial_trace_record(TRACE_ACK, i);
+    }
+
+    char path[] = "/tmp/serial_trace_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+    assert_int_equal(serial_trace_dump(path), EXIT_SUCCESS);
+    assert_int_equal(serial_trace_dump(NULL), EXIT_FAILURE);
+
+    FILE *file = fopen(path, "rb");
+    assert_non_null(file);
+    trace_file_header_t header;
+    assert_int_equal(fread(&header, sizeof(header), 1, file), 1);
+    assert_memory_equal(header.magic, SERIAL_TRACE_MAGIC, sizeof(header.magic));
+    assert_int_equal(header.version, SERIAL_TRACE_VERSION);
+    assert_int_equal(header.event_size, sizeof(trace_event_t));
+    assert_int_equal(header.count, SERIAL_TRACE_RING_SIZE);
+
+    trace_event_t prev, event;
+    assert_int_equal(fread(&prev, sizeof(prev), 1, file), 1);
+    assert_int_equal(prev.point, TRACE_ACK);
+    assert_int_equal(prev.arg, 10);
+    for (uint64_t i = 1; i < header.count; i++) {
+        assert_int_equal(fread(&event, sizeof(event), 1, file), 1);
+        assert_true(event.timestamp_ns >= prev.timestamp_ns);
+        assert_int_equal(event.arg, prev.arg + 1);
+        prev = event;
+    }
+    assert_int_equal(fread(&event, sizeof(event), 1, file), 0);
+    fclose(file);
+    unlink(path);
+    serial_trace_clear();
+}
+
+/**
+* @brief Record one event from a short-lived thread
+*
+* @param arg Argument of the event, cast from uintptr_t
+* @return NULL
+*/
+static void *trace_once_thread(void *arg) {
+    serial_trace_record(TRACE_ACK, (uint32_t)(uintptr_t)arg);
+    return NULL;
+}
+
+/**
+* @brief Test that the rings of exited threads are reused
+*
+* This test verifies that more threads than SERIAL_TRACE_MAX_THREADS can
+* record events as long as they do not all run at once, and that the events
+* of a thread that exited stay readable until its ring is claimed again.
+*
+* @param state Test state (unused)
+*/
+static void test_trace_ring_reuse(void **state) {
+    (void)state;
+    pthread_t thread;
+    serial_trace_clear();
+    for (uintptr_t i = 0; i < 2 * SERIAL_TRACE_MAX_THREADS; i++) {
+        assert_int_equal(pthread_create(&thread, NULL, trace_once_thread, (void *)i), 0);
+        assert_int_equal(pthread_join(thread, NULL), 0);
+    }
+    assert_int_equal(serial_trace_dropped(), 0);
+
+    // Each thread took over the ring of the one before, which cleared it
+    trace_event_t events[8];
+    assert_int_equal(serial_trace_snapshot(events, 8), 1);
+    assert_int_equal(events[0].point, TRACE_ACK);
+    assert_int_equal(events[0].arg, 2 * SERIAL_TRACE_MAX_THREADS - 1);
+    serial_trace_clear();
+}
+
+/** @} */ /* End of trace_tests group */
+
+/**
+* @defgroup timer_tests Deferred Command Tests
+* @brief Tests for add_at() and the timer wheel
+* @{
+*/
+
+/**
+* @brief Get the monotonic clock in nanoseconds
+*
+* @return Current monotonic time in nanoseconds
+*/
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+* @brief Test the release of deferred commands at their deadline
+*
+* This test verifies that deferred commands stay out of the active pool
+* until their deadline, come out in deadline order rather than insertion
+* order, and that a deadline in the past is released right away.
+*
+* @param state Test state (unused)
+*/
+static void test_add_at_deadline_order(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.timers = 1;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+
+    uint64_t base = now_ns();
+    uint64_t deadlines[3] = { base + 60000000, base + 20000000, base - 1 };
+    for (int i = 0; i < 3; i++) {
+        device_command_t cmd = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = 1, .channel = i }
+        };
+        assert_int_equal(serial_add_at(ctx, &cmd, deadlines[i]), EXIT_SUCCESS);
+    }
+    serial_stats_t stats;
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_true(stats.deferred + stats.active == 3);
+    assert_int_equal(serial_get_unused_command_count(ctx), POOL_SIZE - 3);
+
+    const int order[3] = { 2, 1, 0 };
+    for (int i = 0; i < 3; i++) {
+        device_command_t cmd;
+        assert_int_equal(serial_get_next_command_wait(ctx, &cmd, 1000000000LL), EXIT_SUCCESS);
+        assert_int_equal(cmd.data.on_off.channel, order[i]);
+        assert_true(now_ns() >= deadlines[order[i]]);
+    }
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.deferred, 0);
+    assert_int_equal(stats.adds, 3);
+    assert_int_equal(serial_get_unused_command_count(ctx), POOL_SIZE);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test many deferred commands spread over several wheel levels
+*
+* This test verifies that commands due within a few hundred milliseconds,
+* which cascade down from the second wheel level, are released in deadline
+* order, while a command due hours later stays pending.
+*
+* @param state Test state (unused)
+*/
+static void test_add_at_many_levels(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.timers = 1;
+    opts.pool_capacity = 256;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+
+    // 200 distinct deadlines in whole milliseconds, added out of order and far enough ahead to all be pending
+    uint64_t base = now_ns() + 100000000u;
+    for (int i = 0; i < 200; i++) {
+        device_command_t cmd = {
+            .command_type = CMD_SET_PARAMS,
+            .data.set_params = { .min_level = 10, .max_level = 90, .max_time = (i * 7) % 200 + 1 }
+        };
+        assert_int_equal(serial_add_at(ctx, &cmd, base + (uint64_t)((i * 7) % 200) * 1000000u), EXIT_SUCCESS);
+    }
+    device_command_t far = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 0, .channel = 5 }
+    };
+    assert_int_equal(serial_add_at(ctx, &far, base + 5ULL * 3600 * 1000000000u), EXIT_SUCCESS);
+
+    for (int i = 0; i < 200; i++) {
+        device_command_t cmd;
+        assert_int_equal(serial_get_next_command_wait(ctx, &cmd, 1000000000LL), EXIT_SUCCESS);
+        assert_int_equal(cmd.command_type, CMD_SET_PARAMS);
+        assert_int_equal(cmd.data.set_params.max_time, i + 1);
+    }
+    device_command_t cmd;
+    assert_int_equal(serial_get_next_command_wait(ctx, &cmd, 20000000LL), EXIT_FAILURE);
+
+    serial_stats_t stats;
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.deferred, 1);
+    assert_int_equal(serial_get_unused_command_count(ctx), 255);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test the rejections of add_at()
+*
+* This test verifies that add_at() fails without the timer thread, for
+* emergency and invalid commands, and once the pool is exhausted, that
+* deferred commands leave the emergency reserve, and that the ring backend
+* refuses timers.
+*
+* @param state Test state (unused)
+*/
+static void test_add_at_invalid(void **state) {
+    (void)state;
+    device_command_t cmd = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 0 }
+    };
+    device_command_t emergency = {
+        .command_type = CMD_EMERGENCY
+    };
+    device_command_t bad = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 2, .channel = 0 }
+    };
+    uint64_t later = now_ns() + 1000000000u;
+
+    assert_int_equal(add_at(&cmd, later), EXIT_FAILURE);
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, NULL);
+    assert_non_null(ctx);
+    assert_int_equal(serial_add_at(ctx, &cmd, later), EXIT_FAILURE);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.timers = 1;
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    assert_null(serial_init("/dev/null", B9600, &opts));
+
+    opts.queue_backend = QUEUE_BACKEND_TAILQ;
+    opts.pool_capacity = 2;
+    ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    assert_int_equal(serial_add_at(ctx, &emergency, later), EXIT_FAILURE);
+    assert_int_equal(serial_add_at(ctx, &bad, later), EXIT_FAILURE);
+    assert_int_equal(serial_add_at(ctx, NULL, later), EXIT_FAILURE);
+    assert_int_equal(serial_add_at(ctx, &cmd, later), EXIT_SUCCESS);
+    assert_int_equal(serial_add_at(ctx, &cmd, later), EXIT_SUCCESS);
+    assert_int_equal(serial_add_at(ctx, &cmd, later), EXIT_FAILURE);
+    assert_int_equal(serial_add(ctx, &cmd), EXIT_FAILURE);
+
+    serial_stats_t stats;
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.rejected_pool_full, 2);
+    assert_int_equal(stats.rejected_invalid, 1);
+    assert_int_equal(stats.deferred, 2);
+    // Pending deferred commands are dropped with the instance
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+
+    // Deferred commands cannot be displaced, so they stay out of the reserve
+    opts.pool_capacity = 3;
+    opts.emergency_reserve = 1;
+    ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    assert_int_equal(serial_add_at(ctx, &cmd, later), EXIT_SUCCESS);
+    assert_int_equal(serial_add_at(ctx, &cmd, later), EXIT_SUCCESS);
+    assert_int_equal(serial_add_at(ctx, &cmd, later), EXIT_FAILURE);
+    assert_int_equal(serial_add(ctx, &emergency), EXIT_SUCCESS);
+    assert_int_equal(serial_get_active_command_count(ctx), 1);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Wait until the timer thread released every deferred command
+*
+* @param ctx Instance handle
+*/
+static void wait_deferred_released(serial_ctx_t *ctx) {
+    serial_stats_t stats;
+    for (int i = 0; i < 1000; i++) {
+        assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+        if (stats.deferred == 0) {
+            return;
+        }
+        sleep_ms(1);
+    }
+    assert_int_equal(stats.deferred, 0);
+}
+
+/**
+* @brief Test coalescing with released deferred commands
+*
+* This test verifies that a released deferred command is the pending entry
+* of its channel, so a later add() coalesces into it, and that a deferred
+* command released over a pending command of its channel coalesces into it.
+*
+* @param state Test state (unused)
+*/
+static void test_add_at_coalesce(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.timers = 1;
+    opts.coalesce = 1;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+
+    device_command_t on = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 3 }
+    };
+    device_command_t off = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 0, .channel = 3 }
+    };
+    device_command_t cmd;
+
+    assert_int_equal(serial_add_at(ctx, &on, now_ns() - 1), EXIT_SUCCESS);
+    wait_deferred_released(ctx);
+    assert_int_equal(serial_add(ctx, &off), EXIT_SUCCESS);
+    assert_int_equal(serial_get_active_command_count(ctx), 1);
+    assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.data.on_off.on_off, 0);
+    assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_FAILURE);
+
+    assert_int_equal(serial_add(ctx, &off), EXIT_SUCCESS);
+    assert_int_equal(serial_add_at(ctx, &on, now_ns() - 1), EXIT_SUCCESS);
+    wait_deferred_released(ctx);
+    assert_int_equal(serial_get_active_command_count(ctx), 1);
+    assert_int_equal(serial_get_unused_command_count(ctx), POOL_SIZE - 1);
+    assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.data.on_off.on_off, 1);
+    assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_FAILURE);
+
+    pool_stats_t stats;
+    assert_int_equal(serial_get_pool_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.coalesced, 2);
+    assert_int_equal(serial_get_unused_command_count(ctx), POOL_SIZE);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/** @} */ /* End of timer_tests group */
+
+/**
+* @defgroup shm_tests Shared-Memory Ingress Tests
+* @brief Tests for commands added by other processes through shared memory
+* @{
+*/
+
+/** @brief Name of the shared-memory region used by the tests */
+#define TEST_SHM_NAME "/serial_test_ingress"
+
+/**
+* @brief Test commands added by a child process
+*
+* This test verifies that commands a forked producer adds through the
+* shared-memory ingress reach the owner's queue in order, and that an
+* invalid command is refused by the producer side.
+*
+* @param state Test state (unused)
+*/
+static void test_shm_child_producer(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.shm_name = TEST_SHM_NAME;
+    opts.shm_capacity = 8;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+
+    pid_t pid = fork();
+    assert_true(pid >= 0);
+    if (pid == 0) {
+        // More commands than the ring holds, so the child waits for the owner to drain it
+        serial_shm_t *shm = serial_shm_attach(TEST_SHM_NAME);
+        int failures = shm == NULL;
+        device_command_t bad = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = 2, .channel = 0 }
+        };
+        failures += shm != NULL && serial_shm_add(shm, &bad) == EXIT_SUCCESS;
+        for (int i = 0; shm != NULL && i < 64; i++) {
+            device_command_t cmd = {
+                .command_type = CMD_ON_OFF,
+                .data.on_off = { .on_off = i & 1, .channel = i % CHANNEL_COUNT }
+            };
+            while (serial_shm_add(shm, &cmd) != EXIT_SUCCESS) {
+                nanosleep(&(struct timespec){ .tv_nsec = 100000 }, NULL);
+            }
+        }
+        serial_shm_detach(shm);
+        _exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    for (int i = 0; i < 64; i++) {
+        device_command_t cmd;
+        assert_int_equal(serial_get_next_command_wait(ctx, &cmd, 5000000000LL), EXIT_SUCCESS);
+        assert_int_equal(cmd.command_type, CMD_ON_OFF);
+        assert_int_equal(cmd.data.on_off.on_off, i & 1);
+        assert_int_equal(cmd.data.on_off.channel, i % CHANNEL_COUNT);
+    }
+    int status;
+    assert_int_equal(waitpid(pid, &status, 0), pid);
+    assert_true(WIFEXITED(status));
+    assert_int_equal(WEXITSTATUS(status), EXIT_SUCCESS);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test the lifetime of the shared-memory region
+*
+* This test verifies that invalid names and capacities are refused, that
+* attaching fails without an owner, and that a producer still attached when
+* the owner goes away can no longer add.
+*
+* @param state Test state (unused)
+*/
+static void test_shm_lifetime(void **state) {
+    (void)state;
+    device_command_t cmd = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 3 }
+    };
+    serial_options_t opts;
+    serial_options_default(&opts);
+
+    opts.shm_name = "no_slash";
+    assert_null(serial_init("/dev/null", B9600, &opts));
+    opts.shm_name = "/two/slashes";
+    assert_null(serial_init("/dev/null", B9600, &opts));
+    opts.shm_name = TEST_SHM_NAME;
+    opts.shm_capacity = 0;
+    assert_null(serial_init("/dev/null", B9600, &opts));
+    opts.shm_capacity = SHM_MAX_CAPACITY + 1;
+    assert_null(serial_init("/dev/null", B9600, &opts));
+    assert_null(serial_shm_attach(TEST_SHM_NAME));
+    assert_null(serial_shm_attach(NULL));
+
+    opts.shm_capacity = SHM_DEFAULT_CAPACITY;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    serial_shm_t *shm = serial_shm_attach(TEST_SHM_NAME);
+    assert_non_null(shm);
+    assert_int_equal(serial_shm_add(shm, &cmd), EXIT_SUCCESS);
+
+    device_command_t out;
+    assert_int_equal(serial_get_next_command_wait(ctx, &out, 1000000000LL), EXIT_SUCCESS);
+    assert_int_equal(out.data.on_off.channel, 3);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+
+    assert_int_equal(serial_shm_add(shm, &cmd), EXIT_FAILURE);
+    serial_shm_detach(shm);
+    assert_null(serial_shm_attach(TEST_SHM_NAME));
+}
+
+/**
+* @brief Test that the owner does not trust the header of the region
+*
+* This test verifies that a producer overwriting the capacity in the shared
+* header, the third 32-bit word of the region, cannot make the owner or an
+* attached producer divide by zero or index out of bounds.
+*
+* @param state Test state (unused)
+*/
+static void test_shm_forged_header(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.shm_name = TEST_SHM_NAME;
+    opts.shm_capacity = 4;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    serial_shm_t *shm = serial_shm_attach(TEST_SHM_NAME);
+    assert_non_null(shm);
+
+    int fd = shm_open(TEST_SHM_NAME, O_RDWR, 0);
+    assert_true(fd >= 0);
+    uint32_t *header = mmap(NULL, 3 * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert_true(header != MAP_FAILED);
+    const uint32_t forged[] = { 0, UINT32_MAX };
+    for (size_t f = 0; f < 2; f++) {
+        header[2] = forged[f];
+        // Laps of the ring, so positions wrap past the real capacity
+        for (int i = 0; i < 10; i++) {
+            device_command_t cmd = {
+                .command_type = CMD_ON_OFF,
+                .data.on_off = { .on_off = 1, .channel = i % CHANNEL_COUNT }
+            };
+            device_command_t out;
+            assert_int_equal(serial_shm_add(shm, &cmd), EXIT_SUCCESS);
+            assert_int_equal(serial_get_next_command_wait(ctx, &out, 1000000000LL), EXIT_SUCCESS);
+            assert_int_equal(out.data.on_off.channel, i % CHANNEL_COUNT);
+        }
+    }
+    munmap(header, 3 * sizeof(uint32_t));
+    serial_shm_detach(shm);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/** @} */ /* End of shm_tests group */
+
+/**
+* @defgroup reconnect_tests Reconnection Tests
+* @brief Tests for reopening the serial port without losing commands
+* @{
+*/
+
+/** @brief Link the reconnection tests point the module at, repointed to a new pty on reconnection */
+#define TEST_PORT_LINK "/tmp/serial_test_port"
+
+/**
+* @brief Open a pty master and point TEST_PORT_LINK at its slave
+*
+* @return File descriptor of the master, or -1 on failure
+*/
+static int open_test_pty(void) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        return -1;
+    }
+    unlink(TEST_PORT_LINK);
+    if (symlink(ptsname(master), TEST_PORT_LINK) != 0) {
+        close(master);
+        return -1;
+    }
+    return master;
+}
+
+/**
+* @brief Read exactly len bytes from a descriptor, waiting up to a second for each
+*
+* @return EXIT_SUCCESS if len bytes were read, EXIT_FAILURE otherwise
+*/
+static int read_exact(int fd, uint8_t *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 1000) <= 0) {
+            return EXIT_FAILURE;
+        }
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n <= 0) {
+            return EXIT_FAILURE;
+        }
+        done += (size_t)n;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+* @brief Test reconnecting by hand
+*
+* This test verifies that serial_reconnect() keeps the queued commands and
+* their order, that reconnect() fails before init(), and that invalid
+* reconnection delays are refused.
+*
+* @param state Test state (unused)
+*/
+static void test_reconnect_keeps_pool(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.auto_reconnect = 1;
+    opts.reconnect_min_ms = 100;
+    opts.reconnect_max_ms = 10;
+    assert_null(serial_init("/dev/null", B9600, &opts));
+    opts.reconnect_min_ms = 0;
+    assert_null(serial_init("/dev/null", B9600, &opts));
+    assert_int_equal(reconnect(), EXIT_FAILURE);
+    assert_int_equal(serial_reconnect(NULL), EXIT_FAILURE);
+
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, NULL);
+    assert_non_null(ctx);
+    for (int i = 0; i < 5; i++) {
+        device_command_t cmd = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = 1, .channel = i }
+        };
+        assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(serial_reconnect(ctx), EXIT_SUCCESS);
+    assert_int_equal(serial_reconnect(ctx), EXIT_SUCCESS);
+    assert_int_equal(serial_get_active_command_count(ctx), 5);
+
+    for (int i = 0; i < 5; i++) {
+        device_command_t cmd;
+        assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_SUCCESS);
+        assert_int_equal(cmd.data.on_off.channel, i);
+    }
+    serial_stats_t stats;
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.reconnects, 2);
+    assert_int_equal(stats.port_failures, 0);
+    assert_int_equal(stats.port_down, 0);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test the automatic reconnection after a hang-up
+*
+* This test verifies that when the pty behind the port is closed, the
+* transmitter holds the command it could not write, and that the reconnect
+* thread reopens the port once it reappears and the command is written to
+* the new pty.
+*
+* @param state Test state (unused)
+*/
+static void test_auto_reconnect_pty(void **state) {
+    (void)state;
+    device_command_t first = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 1 }
+    };
+    device_command_t second = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 0, .channel = 2 }
+    };
+    uint8_t expected[FRAME_MAX_SIZE];
+    uint8_t buf[FRAME_MAX_SIZE];
+
+    int master = open_test_pty();
+    assert_true(master >= 0);
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    opts.auto_reconnect = 1;
+    opts.reconnect_min_ms = 5;
+    opts.reconnect_max_ms = 20;
+    serial_ctx_t *ctx = serial_init(TEST_PORT_LINK, B9600, &opts);
+    assert_non_null(ctx);
+
+    size_t len = encode_frame(&first, 0, expected);
+    assert_int_equal(serial_add(ctx, &first), EXIT_SUCCESS);
+    assert_int_equal(read_exact(master, buf, len), EXIT_SUCCESS);
+    assert_memory_equal(buf, expected, len);
+
+    // Hang up the port; the next write fails and the command waits for the new pty
+    close(master);
+    assert_int_equal(serial_add(ctx, &second), EXIT_SUCCESS);
+    serial_stats_t stats;
+    for (int i = 0; i < 1000; i++) {
+        assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+        if (stats.port_down) {
+            break;
+        }
+        nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    }
+    assert_int_equal(stats.port_down, 1);
+
+    master = open_test_pty();
+    assert_true(master >= 0);
+    len = encode_frame(&second, 1, expected);
+    assert_int_equal(read_exact(master, buf, len), EXIT_SUCCESS);
+    assert_memory_equal(buf, expected, len);
+
+    assert_int_equal(serial_get_stats(ctx, &stats), EXIT_SUCCESS);
+    assert_int_equal(stats.port_failures, 1);
+    assert_true(stats.reconnects >= 1);
+    assert_int_equal(stats.port_down, 0);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    close(master);
+    unlink(TEST_PORT_LINK);
+}
+
+/** @} */ /* End of reconnect_tests group */
+
+/**
+* @defgroup capture_tests Command Capture Tests
+* @brief Tests for the binary capture of the accepted commands
+* @{
+*/
+
+/** @brief Path of the capture file used by the tests */
+#define TEST_CAPTURE_PATH "/tmp/serial_test_capture.bin"
+
+/**
+* @brief Test capturing the accepted commands
+*
+* This test verifies that every accepted command is recorded in order with
+* non-decreasing timestamps, that rejected commands are not, that commands
+* beyond the capacity are counted as dropped and that the finished file is
+* truncated to its records.
+*
+* @param state Test state (unused)
+*/
+static void test_capture_records(void **state) {
+    (void)state;
+    device_command_t cmds[3];
+    for (int i = 0; i < 3; i++) {
+        cmds[i].command_type = CMD_ON_OFF;
+        cmds[i].data.on_off.on_off = 1;
+        cmds[i].data.on_off.channel = i;
+    }
+    device_command_t emergency = {
+        .command_type = CMD_EMERGENCY
+    };
+    device_command_t bad = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 2, .channel = 0 }
+    };
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.capture_path = TEST_CAPTURE_PATH;
+    opts.capture_capacity = 0;
+    assert_null(serial_init("/dev/null", B9600, &opts));
+
+    opts.capture_capacity = 4;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    assert_int_equal(serial_add_batch(ctx, cmds, 3), EXIT_SUCCESS);
+    assert_int_equal(serial_add(ctx, &bad), EXIT_FAILURE);
+    assert_int_equal(serial_add(ctx, &emergency), EXIT_SUCCESS);
+
+    // Records can be read while the capture runs
+    capture_file_t file;
+    assert_int_equal(serial_capture_map(TEST_CAPTURE_PATH, &file), EXIT_SUCCESS);
+    assert_int_equal(file.count, 4);
+    assert_int_equal(file.header->count, 0);
+    serial_capture_unmap(&file);
+
+    assert_int_equal(serial_add(ctx, &cmds[0]), EXIT_SUCCESS);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+
+    assert_int_equal(serial_capture_map(TEST_CAPTURE_PATH, &file), EXIT_SUCCESS);
+    assert_int_equal(file.count, 4);
+    assert_int_equal(file.header->count, 4);
+    assert_int_equal(file.header->capacity, 4);
+    assert_int_equal(file.header->dropped, 1);
+    assert_int_equal(file.size, sizeof(capture_file_header_t) + 4 * sizeof(capture_record_t));
+    for (int i = 0; i < 3; i++) {
+        assert_memory_equal(&file.records[i].cmd, &cmds[i], sizeof(device_command_t));
+    }
+    assert_int_equal(file.records[3].cmd.command_type, CMD_EMERGENCY);
+    assert_true(file.records[3].timestamp_ns >= file.records[2].timestamp_ns);
+    serial_capture_unmap(&file);
+    unlink(TEST_CAPTURE_PATH);
+}
+
+/**
+* @brief Test mapping files that are not captures
+*
+* This test verifies that serial_capture_map() refuses a missing file, a
+* file too short for a header and a file with the wrong magic.
+*
+* @param state Test state (unused)
+*/
+static void test_capture_map_invalid(void **state) {
+    (void)state;
+    capture_file_t file;
+    char junk[sizeof(capture_file_header_t)];
+
+    unlink(TEST_CAPTURE_PATH);
+    assert_int_equal(serial_capture_map(TEST_CAPTURE_PATH, &file), EXIT_FAILURE);
+    assert_int_equal(serial_capture_map(NULL, &file), EXIT_FAILURE);
+
+    FILE *f = fopen(TEST_CAPTURE_PATH, "wb");
+    assert_non_null(f);
+    assert_int_equal(fwrite("SRL", 1, 3, f), 3);
+    fclose(f);
+    assert_int_equal(serial_capture_map(TEST_CAPTURE_PATH, &file), EXIT_FAILURE);
+
+    memset(junk, 'x', sizeof(junk));
+    f = fopen(TEST_CAPTURE_PATH, "wb");
+    assert_non_null(f);
+    assert_int_equal(fwrite(junk, 1, sizeof(junk), f), sizeof(junk));
+    fclose(f);
+    assert_int_equal(serial_capture_map(TEST_CAPTURE_PATH, &file), EXIT_FAILURE);
+    unlink(TEST_CAPTURE_PATH);
+}
+
+/** @} */ /* End of capture_tests group */
+
+/**
+* @defgroup line_tests Line Profile Tests
+* @brief Tests for the terminal settings and line profiles of the port
+* @{
+*/
+
+/**
+* @brief Test the low-latency profile with a custom rate on a pty
+*
+* This test verifies that a rate outside the B* constants is applied with
+* BOTHER and read back, that the port is left in raw mode with VMIN 1 and
+* VTIME 0, and that a driver without TIOCSSERIAL is reported as such.
+*
+* @param state Test state (unused)
+*/
+static void test_line_low_latency_custom_baud(void **state) {
+    (void)state;
+    serial_line_info_t info;
+
+    int master = open_test_pty();
+    assert_true(master >= 0);
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.line_profile = SERIAL_LINE_LOW_LATENCY;
+    opts.baud_rate = 250000;
+    serial_ctx_t *ctx = serial_init(TEST_PORT_LINK, B9600, &opts);
+    assert_non_null(ctx);
+
+    assert_int_equal(serial_get_line_info(ctx, &info), EXIT_SUCCESS);
+    assert_int_equal(info.configured, 1);
+    assert_int_equal(info.profile, SERIAL_LINE_LOW_LATENCY);
+    assert_int_equal(info.output_baud, 250000);
+    assert_int_equal(info.input_baud, 250000);
+    assert_int_equal(info.custom_baud, 1);
+    assert_int_equal(info.raw, 1);
+    assert_int_equal(info.vmin, 1);
+    assert_int_equal(info.vtime, 0);
+    assert_int_equal(info.low_latency, -1);
+
+    // The settings survive a reconnect to the same port
+    assert_int_equal(serial_reconnect(ctx), EXIT_SUCCESS);
+    memset(&info, 0, sizeof(info));
+    assert_int_equal(serial_get_line_info(ctx, &info), EXIT_SUCCESS);
+    assert_int_equal(info.output_baud, 250000);
+    assert_int_equal(info.custom_baud, 1);
+
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    close(master);
+    unlink(TEST_PORT_LINK);
+}
+
+/**
+* @brief Test the throughput profile and the test port
+*
+* This test verifies that the throughput profile asks for whole frames per
+* read with a B* rate, and that /dev/null reports no terminal settings.
+*
+* @param state Test state (unused)
+*/
+static void test_line_throughput_profile(void **state) {
+    (void)state;
+    serial_line_info_t info;
+
+    int master = open_test_pty();
+    assert_true(master >= 0);
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.line_profile = SERIAL_LINE_THROUGHPUT;
+    serial_ctx_t *ctx = serial_init(TEST_PORT_LINK, B9600, &opts);
+    assert_non_null(ctx);
+    assert_int_equal(serial_get_line_info(ctx, &info), EXIT_SUCCESS);
+    assert_int_equal(info.configured, 1);
+    assert_int_equal(info.output_baud, 9600);
+    assert_int_equal(info.custom_baud, 0);
+    assert_int_equal(info.raw, 1);
+    assert_int_equal(info.vmin, FRAME_MAX_SIZE);
+    assert_int_equal(info.vtime, 1);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+    close(master);
+    unlink(TEST_PORT_LINK);
+
+    ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    assert_int_equal(serial_get_line_info(ctx, &info), EXIT_SUCCESS);
+    assert_int_equal(info.configured, 0);
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test invalid line profile use
+*
+* This test verifies that an unknown profile is refused at initialization
+* and that the line settings cannot be read from an uninitialized module.
+*
+* @param state Test state (unused)
+*/
+static void test_line_invalid_use(void **state) {
+    (void)state;
+    serial_line_info_t info;
+    serial_options_t opts;
+
+    serial_options_default(&opts);
+    opts.line_profile = (serial_line_profile_t)42;
+    assert_null(serial_init("/dev/null", B9600, &opts));
+    assert_int_equal(get_line_info(&info), EXIT_FAILURE);
+    assert_int_equal(serial_get_line_info(NULL, &info), EXIT_FAILURE);
+}
+
+/** @} */ /* End of line_tests group */
+
+/**
+* @defgroup state_tests Channel State Tests
+* @brief Tests for the charger state table and set_channel_state()
+* @{
+*/
+
+/**
+* @brief Test that set_channel_state() queues only what changed
+*
+* This test verifies that the first call sends the whole state, parameters
+* first, that repeating the state queues nothing, that a changed channel or
+* changed parameters queue one command each, and that invalidation sends
+* the whole state again.
+*
+* @param state Test state (unused)
+*/
+static void test_channel_state_diff(void **state) {
+    (void)state;
+    charger_state_t desired = { .params = { .min_level = 20, .max_level = 80, .max_time = 60 } };
+    charger_state_t applied;
+    device_command_t out[CHANNEL_COUNT + 2];
+    serial_stats_t stats;
+
+    desired.on_off[0] = 1;
+    desired.on_off[5] = 1;
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_FAILURE);
+    assert_int_equal(get_stats(&stats), EXIT_SUCCESS);
+    uint64_t commands = stats.state_commands;
+    uint64_t unchanged = stats.state_unchanged;
+
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), CHANNEL_COUNT + 1);
+    assert_int_equal(out[0].command_type, CMD_SET_PARAMS);
+    assert_int_equal(out[0].data.set_params.max_level, 80);
+    for (unsigned channel = 0; channel < CHANNEL_COUNT; channel++) {
+        assert_int_equal(out[channel + 1].command_type, CMD_ON_OFF);
+        assert_int_equal(out[channel + 1].data.on_off.channel, channel);
+        assert_int_equal(out[channel + 1].data.on_off.on_off, desired.on_off[channel]);
+    }
+
+    // An unchanged state queues nothing
+    for (int cycle = 0; cycle < 10; cycle++) {
+        assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    }
+    assert_int_equal(get_active_command_count(), 0);
+
+    desired.on_off[3] = 1;
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), 1);
+    assert_int_equal(out[0].command_type, CMD_ON_OFF);
+    assert_int_equal(out[0].data.on_off.channel, 3);
+    assert_int_equal(out[0].data.on_off.on_off, 1);
+
+    desired.params.max_time = 90;
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), 1);
+    assert_int_equal(out[0].command_type, CMD_SET_PARAMS);
+    assert_int_equal(out[0].data.set_params.max_time, 90);
+
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_SUCCESS);
+    assert_memory_equal(&applied, &desired, sizeof(desired));
+
+    assert_int_equal(invalidate_channel_state(), EXIT_SUCCESS);
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_FAILURE);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), CHANNEL_COUNT + 1);
+
+    assert_int_equal(get_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.state_commands - commands, 2 * (CHANNEL_COUNT + 1) + 2);
+    assert_int_equal(stats.state_unchanged - unchanged, 12 * (CHANNEL_COUNT + 1) - 2);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test that changes refused by a full pool are retried
+*
+* This test verifies that a change the pool has no room for leaves the
+* applied state as it was, so the next call with the same state queues it,
+* and that invalid states and an uninitialized module are refused.
+*
+* @param state Test state (unused)
+*/
+static void test_channel_state_pool_full(void **state) {
+    (void)state;
+    charger_state_t desired = { .params = { .min_level = 10, .max_level = 90, .max_time = 120 } };
+    charger_state_t requested;
+    charger_state_t applied;
+    device_command_t filler = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 0, .channel = 7 }
+    };
+    device_command_t out[POOL_SIZE];
+
+    assert_int_equal(set_channel_state(&desired), EXIT_FAILURE);
+    assert_int_equal(invalidate_channel_state(), EXIT_FAILURE);
+    assert_int_equal(init("/dev/null", B9600), EXIT_SUCCESS);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    while (get_unused_command_count() > 0) {
+        assert_int_equal(add(&filler), EXIT_SUCCESS);
+    }
+
+    desired.on_off[2] = 1;
+    assert_int_equal(set_channel_state(&desired), EXIT_FAILURE);
+    assert_int_equal(get_channel_state(&requested, &applied), EXIT_SUCCESS);
+    assert_int_equal(requested.on_off[2], 1);
+    assert_int_equal(applied.on_off[2], 0);
+
+    assert_int_equal(get_next_commands(out, POOL_SIZE), POOL_SIZE);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, POOL_SIZE), 1);
+    assert_int_equal(out[0].data.on_off.channel, 2);
+    assert_int_equal(out[0].data.on_off.on_off, 1);
+
+    // Invalid states are refused without touching the table
+    charger_state_t invalid = desired;
+    invalid.on_off[4] = 2;
+    assert_int_equal(set_channel_state(&invalid), EXIT_FAILURE);
+    invalid = desired;
+    invalid.params.min_level = 95;
+    assert_int_equal(set_channel_state(&invalid), EXIT_FAILURE);
+    assert_int_equal(set_channel_state(NULL), EXIT_FAILURE);
+    assert_int_equal(get_channel_state(&requested, NULL), EXIT_SUCCESS);
+    assert_memory_equal(&requested, &desired, sizeof(desired));
+    assert_int_equal(get_active_command_count(), 0);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test that queued state commands lost from the pool are sent again
+*
+* This test verifies that a state command discarded by drop-oldest, one
+* displaced by an emergency and one overwritten by coalescing with another
+* add() make the applied state unknown and are sent again by the next call,
+* while set_channel_state() coalescing into its own commands does not.
+*
+* @param state Test state (unused)
+*/
+static void test_channel_state_lost(void **state) {
+    (void)state;
+    charger_state_t desired = { .params = { .min_level = 10, .max_level = 90, .max_time = 120 } };
+    charger_state_t applied;
+    device_command_t other = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 2 }
+    };
+    device_command_t emergency = {
+        .command_type = CMD_EMERGENCY
+    };
+    device_command_t out[CHANNEL_COUNT + 2];
+    serial_options_t opts;
+
+    // Drop-oldest discards the oldest pending command, the SET_PARAMS
+    serial_options_default(&opts);
+    opts.pool_capacity = CHANNEL_COUNT + 1;
+    opts.overflow_on_off = OVERFLOW_DROP_OLDEST;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_SUCCESS);
+    assert_int_equal(add(&other), EXIT_SUCCESS);
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_FAILURE);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), CHANNEL_COUNT + 1);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), 1);
+    assert_int_equal(out[0].command_type, CMD_SET_PARAMS);
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_SUCCESS);
+
+    // Two emergencies displace the SET_PARAMS and channel 0
+    assert_int_equal(invalidate_channel_state(), EXIT_SUCCESS);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(add(&emergency), EXIT_SUCCESS);
+    assert_int_equal(add(&emergency), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), CHANNEL_COUNT + 1);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), 2);
+    assert_int_equal(out[0].command_type, CMD_SET_PARAMS);
+    assert_int_equal(out[1].command_type, CMD_ON_OFF);
+    assert_int_equal(out[1].data.on_off.channel, 0);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    // Coalescing with another add() loses the field, with set_channel_state() it does not
+    serial_options_default(&opts);
+    opts.coalesce = 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    desired.on_off[3] = 1;
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_SUCCESS);
+    assert_int_equal(add(&other), EXIT_SUCCESS);
+    assert_int_equal(get_channel_state(NULL, &applied), EXIT_FAILURE);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), CHANNEL_COUNT + 1);
+    assert_int_equal(set_channel_state(&desired), EXIT_SUCCESS);
+    assert_int_equal(get_next_commands(out, CHANNEL_COUNT + 2), 1);
+    assert_int_equal(out[0].data.on_off.channel, 2);
+    assert_int_equal(out[0].data.on_off.on_off, 0);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/** @} */ /* End of state_tests group */
+
+/**
+* @defgroup overflow_tests Overflow Policy Tests
+* @brief Tests for what add() does when the pool is full
+* @{
+*/
+
+/**
+* @brief Test the drop-oldest and coalesce policies
+*
+* This test verifies that OVERFLOW_DROP_OLDEST discards the oldest pending
+* command and queues the new one at the end, that OVERFLOW_COALESCE
+* overwrites the pending command it supersedes, and that a coalescing add
+* with nothing to replace is rejected.
+*
+* @param state Test state (unused)
+*/
+static void test_overflow_drop_and_coalesce(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_stats_t before;
+    serial_stats_t stats;
+    device_command_t cmd_get;
+    device_command_t params = {
+        .command_type = CMD_SET_PARAMS,
+        .data.set_params = { .min_level = 10, .max_level = 50, .max_time = 30 }
+    };
+
+    serial_options_default(&opts);
+    opts.pool_capacity = 4;
+    opts.overflow_on_off = OVERFLOW_DROP_OLDEST;
+    opts.overflow_set_params = OVERFLOW_COALESCE;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(get_stats(&before), EXIT_SUCCESS);
+
+    for (int channel = 0; channel < 5; channel++) {
+        device_command_t cmd = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = 1, .channel = channel }
+        };
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(get_active_command_count(), 4);
+    for (int channel = 1; channel < 5; channel++) {
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.data.on_off.channel, channel);
+    }
+
+    // A full pool without a pending SET_PARAMS rejects the coalescing add
+    for (int channel = 0; channel < 4; channel++) {
+        device_command_t cmd = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = 0, .channel = channel }
+        };
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(add(&params), EXIT_FAILURE);
+
+    // With one pending, the newer parameters overwrite it in place
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    assert_int_equal(add(&params), EXIT_SUCCESS);
+    params.data.set_params.max_level = 90;
+    assert_int_equal(add(&params), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), 4);
+    for (int i = 0; i < 3; i++) {
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.command_type, CMD_ON_OFF);
+    }
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    assert_int_equal(cmd_get.command_type, CMD_SET_PARAMS);
+    assert_int_equal(cmd_get.data.set_params.max_level, 90);
+
+    assert_int_equal(get_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.overflow_dropped - before.overflow_dropped, 1);
+    assert_int_equal(stats.overflow_coalesced - before.overflow_coalesced, 1);
+    assert_int_equal(stats.overflow_rejected - before.overflow_rejected, 1);
+    assert_int_equal(stats.rejected_pool_full - before.rejected_pool_full, 1);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test the block policy
+*
+* This test verifies that OVERFLOW_BLOCK gives up after overflow_timeout_ms
+* when nothing is freed and succeeds once another thread frees an entry.
+*
+* @param state Test state (unused)
+*/
+static void test_overflow_block(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_stats_t before;
+    serial_stats_t stats;
+    device_command_t cmd = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 6 }
+    };
+
+    serial_options_default(&opts);
+    opts.pool_capacity = 2;
+    opts.overflow_on_off = OVERFLOW_BLOCK;
+    opts.overflow_timeout_ms = 500;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(get_stats(&before), EXIT_SUCCESS);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+
+    pthread_t consumer;
+    assert_int_equal(pthread_create(&consumer, NULL, delayed_get_thread, NULL), 0);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    pthread_join(consumer, NULL);
+    assert_int_equal(get_active_command_count(), 2);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    opts.overflow_timeout_ms = 20;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    assert_int_equal(add(&cmd), EXIT_FAILURE);
+
+    assert_int_equal(get_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.overflow_blocked - before.overflow_blocked, 2);
+    assert_int_equal(stats.overflow_timeouts - before.overflow_timeouts, 1);
+    assert_int_equal(stats.overflow_rejected - before.overflow_rejected, 0);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test that routine traffic cannot lock out emergency commands
+*
+* This test verifies that routine commands leave the emergency reserve
+* unused on the ring backend, that an emergency command displaces the
+* oldest routine command from a full TAILQ pool and is dequeued first, and
+* that unsupported overflow options are refused.
+*
+* @param state Test state (unused)
+*/
+static void test_overflow_emergency(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_stats_t before;
+    serial_stats_t stats;
+    device_command_t cmd_get;
+    device_command_t routine = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 2 }
+    };
+    device_command_t emergency = {
+        .command_type = CMD_EMERGENCY
+    };
+
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    opts.pool_capacity = 4;
+    opts.emergency_reserve = 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    for (int i = 0; i < 3; i++) {
+        assert_int_equal(add(&routine), EXIT_SUCCESS);
+    }
+    assert_int_equal(add(&routine), EXIT_FAILURE);
+    assert_int_equal(add_batch(&routine, 1), EXIT_FAILURE);
+    assert_int_equal(add(&emergency), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), 4);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    // Without a reserve the ring queues emergencies over the capacity of the pool
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    opts.pool_capacity = 4;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(add(&routine), EXIT_SUCCESS);
+    }
+    assert_int_equal(add(&routine), EXIT_FAILURE);
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(add(&emergency), EXIT_SUCCESS);
+    }
+    assert_int_equal(add(&emergency), EXIT_FAILURE);
+    // The emergencies over the capacity hold no entry of the pool
+    assert_int_equal(get_active_command_count(), 4);
+    assert_int_equal(get_unused_command_count(), 0);
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.command_type, CMD_EMERGENCY);
+    }
+    assert_int_equal(get_active_command_count(), 4);
+    assert_int_equal(get_unused_command_count(), 0);
+    assert_int_equal(add(&routine), EXIT_FAILURE);
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    assert_int_equal(cmd_get.command_type, CMD_ON_OFF);
+    assert_int_equal(get_active_command_count(), 3);
+    assert_int_equal(get_unused_command_count(), 1);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    serial_options_default(&opts);
+    opts.pool_capacity = 4;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(get_stats(&before), EXIT_SUCCESS);
+    assert_int_equal(add_wait(&emergency, 0), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), 1);
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    for (int i = 0; i < 4; i++) {
+        assert_int_equal(add(&routine), EXIT_SUCCESS);
+    }
+    assert_int_equal(add(&emergency), EXIT_SUCCESS);
+    assert_int_equal(add_wait(&emergency, 0), EXIT_SUCCESS);
+    assert_int_equal(get_active_command_count(), 4);
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    assert_int_equal(cmd_get.command_type, CMD_EMERGENCY);
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    assert_int_equal(cmd_get.command_type, CMD_EMERGENCY);
+    assert_int_equal(get_stats(&stats), EXIT_SUCCESS);
+    assert_int_equal(stats.emergency_displaced - before.emergency_displaced, 2);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    // Unsupported combinations are refused at initialization
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    opts.overflow_on_off = OVERFLOW_DROP_OLDEST;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+    serial_options_default(&opts);
+    opts.overflow_set_params = (overflow_policy_t)42;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+    serial_options_default(&opts);
+    opts.overflow_timeout_ms = 0;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+    serial_options_default(&opts);
+    opts.emergency_reserve = opts.pool_capacity;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+}
+
+/**
+* @brief Test that batched emergency commands get through a full pool
+*
+* This test verifies that add_batch() and add_prevalidated() queue the
+* emergency commands of a batch the full pool cannot hold on both queue
+* backends, ahead of the routine commands, and reject only the routine part.
+*
+* @param state Test state (unused)
+*/
+static void test_overflow_emergency_batch(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_stats_t before;
+    serial_stats_t stats;
+    device_command_t cmd_get;
+    device_command_t routine = {
+        .command_type = CMD_ON_OFF,
+        .data.on_off = { .on_off = 1, .channel = 2 }
+    };
+    device_command_t emergency = {
+        .command_type = CMD_EMERGENCY
+    };
+    const device_command_t mixed[3] = { routine, emergency, routine };
+    const device_command_t emergencies[2] = { emergency, emergency };
+    const queue_backend_t backends[2] = { QUEUE_BACKEND_TAILQ, QUEUE_BACKEND_RING };
+
+    for (int b = 0; b < 2; b++) {
+        serial_options_default(&opts);
+        opts.queue_backend = backends[b];
+        opts.pool_capacity = 4;
+        assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+        for (int i = 0; i < 4; i++) {
+            assert_int_equal(add(&routine), EXIT_SUCCESS);
+        }
+        assert_int_equal(get_stats(&before), EXIT_SUCCESS);
+        assert_int_equal(add_batch(mixed, 3), EXIT_FAILURE);
+        assert_int_equal(add_prevalidated(emergencies, 2), EXIT_SUCCESS);
+        assert_int_equal(get_stats(&stats), EXIT_SUCCESS);
+        assert_int_equal(stats.rejected_pool_full - before.rejected_pool_full, 2);
+        for (int i = 0; i < 3; i++) {
+            assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+            assert_int_equal(cmd_get.command_type, CMD_EMERGENCY);
+        }
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.command_type, CMD_ON_OFF);
+        assert_int_equal(deinit(), EXIT_SUCCESS);
+    }
+}
+
+/** @} */ /* End of overflow_tests group */
+
+/**
+* @defgroup rt_tests Real-Time Settings Tests
+* @brief Tests for thread placement, SCHED_FIFO and memory locking
+* @{
+*/
+
+/**
+* @brief Check that a thread report matches a request the system may refuse
+*
+* @param info Reported placement and scheduling
+* @param cpu Requested CPU, or -1
+* @param priority Requested SCHED_FIFO priority, or 0
+*/
+static void check_thread_info(const serial_thread_info_t *info, int cpu, int priority) {
+    assert_int_equal(info->running, 1);
+    if (cpu < 0) {
+        assert_int_equal(info->affinity, -1);
+    } else {
+        assert_true(info->affinity == 0 || info->affinity == 1);
+        if (info->affinity == 1) {
+            assert_int_equal(info->cpu, cpu);
+        }
+    }
+    if (priority == 0) {
+        assert_int_equal(info->sched_fifo, -1);
+        assert_int_equal(info->priority, 0);
+    } else {
+        assert_true(info->sched_fifo == 0 || info->sched_fifo == 1);
+        assert_int_equal(info->priority, info->sched_fifo == 1 ? priority : 0);
+    }
+}
+
+/**
+* @brief Test the real-time settings of the transmit engine and the pool
+*
+* This test verifies that nothing is requested by default, that a pinned
+* SCHED_FIFO writer thread and locked pool memory are either granted or
+* reported as refused without failing initialization, that locked memory
+* comes in whole pages and grows with the pool, and that the module still
+* transmits.
+*
+* @param state Test state (unused)
+*/
+static void test_rt_transmitter_and_memory(void **state) {
+    (void)state;
+    serial_rt_info_t info;
+    serial_options_t opts;
+    device_command_t cmd = {CMD_ON_OFF, {.on_off = {1, 0}}};
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    // Nothing requested
+    serial_options_default(&opts);
+    assert_int_equal(opts.tx_thread.cpu, -1);
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(get_rt_info(&info), EXIT_SUCCESS);
+    assert_int_equal(info.transmitter.running, 0);
+    assert_int_equal(info.memory_locked, -1);
+    assert_int_equal(info.locked_bytes, 0);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    // Pinned writer under SCHED_FIFO with a locked, growing pool
+    serial_options_default(&opts);
+    opts.transmitter = 1;
+    opts.tx_thread.cpu = 0;
+    opts.tx_thread.priority = 10;
+    opts.lock_memory = 1;
+    opts.pool_capacity = 4;
+    opts.pool_growth = 1;
+    opts.pool_chunk_size = 256;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(get_rt_info(&info), EXIT_SUCCESS);
+    check_thread_info(&info.transmitter, 0, 10);
+    assert_true(info.memory_locked == 0 || info.memory_locked == 1);
+    if (info.memory_locked == 1) {
+        assert_true(info.locked_bytes > 0);
+        assert_int_equal(info.locked_bytes % page, 0);
+    }
+    size_t initial = info.locked_bytes;
+    for (int i = 0; i < 64; i++) {
+        assert_int_equal(add_wait(&cmd, WAIT_FOREVER), EXIT_SUCCESS);
+    }
+    tx_stats_t tx;
+    long long start = now_ms();
+    do {
+        sleep_ms(1);
+        assert_int_equal(get_tx_stats(&tx), EXIT_SUCCESS);
+    } while (tx.frames < 64 && now_ms() - start < 2000);
+    assert_int_equal(tx.frames, 64);
+    assert_int_equal(get_rt_info(&info), EXIT_SUCCESS);
+    if (info.memory_locked == 1) {
+        pool_stats_t pool;
+        assert_int_equal(get_pool_stats(&pool), EXIT_SUCCESS);
+        assert_true(pool.grow_events == 0 || info.locked_bytes > initial);
+    }
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+
+    // The ring backend locks its slots the same way
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    opts.lock_memory = 1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+    assert_int_equal(get_rt_info(&info), EXIT_SUCCESS);
+    assert_true(info.memory_locked == 0 || info.memory_locked == 1);
+    assert_int_equal(info.locked_bytes % page, 0);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test the reactor thread settings and invalid requests
+*
+* This test verifies that a reactor reports the settings of its loop thread,
+* the defaults included, and that out-of-range CPUs and priorities are
+* refused by both the reactor and initialization.
+*
+* @param state Test state (unused)
+*/
+static void test_rt_reactor_and_invalid(void **state) {
+    (void)state;
+    serial_thread_info_t thread;
+    serial_thread_options_t rt = {0, 5};
+    serial_rt_info_t info;
+    serial_options_t opts;
+
+    serial_reactor_t *reactor = serial_reactor_create();
+    assert_non_null(reactor);
+    assert_int_equal(serial_reactor_get_thread_info(reactor, &thread), EXIT_SUCCESS);
+    check_thread_info(&thread, -1, 0);
+    assert_int_equal(serial_reactor_destroy(reactor), EXIT_SUCCESS);
+
+    reactor = serial_reactor_create_with_options(&rt);
+    assert_non_null(reactor);
+    assert_int_equal(serial_reactor_get_thread_info(reactor, &thread), EXIT_SUCCESS);
+    check_thread_info(&thread, 0, 5);
+    assert_int_equal(serial_reactor_get_thread_info(NULL, &thread), EXIT_FAILURE);
+    assert_int_equal(serial_reactor_destroy(reactor), EXIT_SUCCESS);
+
+    rt.cpu = -2;
+    assert_null(serial_reactor_create_with_options(&rt));
+    rt.cpu = -1;
+    rt.priority = 100;
+    assert_null(serial_reactor_create_with_options(&rt));
+
+    serial_options_default(&opts);
+    opts.tx_thread.priority = -1;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+    serial_options_default(&opts);
+    opts.tx_thread.cpu = 1 << 20;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+    assert_int_equal(get_rt_info(&info), EXIT_FAILURE);
+    assert_int_equal(serial_get_rt_info(NULL, &info), EXIT_FAILURE);
+}
+
+/** @} */ /* End of rt_tests group */
+
+/**
+* @defgroup ring_backend_tests Lock-free Ring Backend Tests
+* @brief Tests for the QUEUE_BACKEND_RING command queue
+* @{
+*/
+
+/**
+* @brief Test initialization with an unknown queue backend
+*
+* This test verifies that initialization fails when the options select a
+* queue backend that does not exist.
+*
+* @param state Test state (unused)
+*/
+static void test_ring_init_invalid_backend(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = (queue_backend_t)42;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_FAILURE);
+}
+
+/**
+* @brief Test filling the ring backend to capacity
+*
+* This test verifies that the ring accepts exactly POOL_SIZE commands and
+* that the counts follow the ring occupancy.
+*
+* @param state Test state (unused)
+*/
+static void test_ring_fill_pool(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t cmd = {
+        .command_type = CMD_EMERGENCY
+    };
+    for (int i = 0; i < POOL_SIZE; i++) {
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+    }
+    assert_int_equal(add(&cmd), EXIT_FAILURE);
+    assert_int_equal(get_active_command_count(), POOL_SIZE);
+    assert_int_equal(get_unused_command_count(), 0);
+
+    // Drain one and make sure the freed slot can be reused
+    device_command_t cmd_get;
+    assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+    assert_int_equal(get_unused_command_count(), 1);
+    assert_int_equal(add(&cmd), EXIT_SUCCESS);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+
+/**
+* @brief Test FIFO order of the ring backend across several laps
+*
+* This test verifies that commands come out of the ring in the order they
+* were added, including after the positions wrap around the slot array.
+*
+* @param state Test state (unused)
+*/
+static void test_ring_fifo_order(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    assert_int_equal(init_with_options("/dev/null", B9600, &opts), EXIT_SUCCESS);
+
+    device_command_t cmd_get;
+    for (int lap = 0; lap < 3 * POOL_SIZE; lap++) {
+        device_command_t cmd = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = lap & 1, .channel = lap % 8 }
+        };
+        device_command_t cmd_next = {
+            .command_type = CMD_ON_OFF,
+            .data.on_off = { .on_off = (lap + 1) & 1, .channel = (lap + 1) % 8 }
+        };
+        assert_int_equal(add(&cmd), EXIT_SUCCESS);
+        assert_int_equal(add(&cmd_next), EXIT_SUCCESS);
+
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.data.on_off.channel, lap % 8);
+        assert_int_equal(get_next_command(&cmd_get), EXIT_SUCCESS);
+        assert_int_equal(cmd_get.data.on_off.channel, (lap + 1) % 8);
+    }
+    assert_int_equal(get_next_command(&cmd_get), EXIT_FAILURE);
+
+    assert_int_equal(deinit(), EXIT_SUCCESS);
+}
+/**
+* @brief Test the compact slot layout of the ring backend
+*
+* This test verifies that a ring slot takes half the size of a TAILQ entry,
+* so whole slots pack four to a cache line, and that the ring still works
+* with capacities that are not a power of two.
+*
+* @param state Test state (unused)
+*/
+static void test_ring_slot_layout(void **state) {
+    (void)state;
+    assert_int_equal(sizeof(struct cmd_slot), 16);
+    assert_true(sizeof(struct cmd_slot) * 2 <= sizeof(struct cmd_entry));
+
+    serial_options_t opts;
+    serial_options_default(&opts);
+    opts.queue_backend = QUEUE_BACKEND_RING;
+    opts.pool_capacity = 7;
+    serial_ctx_t *ctx = serial_init("/dev/null", B9600, &opts);
+    assert_non_null(ctx);
+    for (int lap = 0; lap < 5; lap++) {
+        for (int i = 0; i < 7; i++) {
+            device_command_t cmd = {
+                .command_type = CMD_ON_OFF,
+                .data.on_off = { .on_off = 1, .channel = i }
+            };
+            assert_int_equal(serial_add(ctx, &cmd), EXIT_SUCCESS);
+        }
+        for (int i = 0; i < 7; i++) {
+            device_command_t cmd;
+            assert_int_equal(serial_get_next_command(ctx, &cmd), EXIT_SUCCESS);
+            assert_int_equal(cmd.data.on_off.channel, i);
+        }
+    }
+    assert_int_equal(serial_deinit(ctx), EXIT_SUCCESS);
+}
+
+/** @} */ /* End of ring_backend_tests group */
+
+/**
+* @defgroup daemon_tests Daemon Tests
+* @brief Tests for the configuration and the control requests of bin/battery
+* @{
+*/
+
+/** @brief Path of the configuration file used by the tests */
+#define TEST_CONFIG_PATH "/tmp/serial_test_battery.conf"
+
+/** @brief Configuration of the daemon tests, too large for the stack */
+static daemon_config_t test_config;
+
+/**
+* @brief Write a configuration file and parse it into test_config
+*
+* @param text Content of the file
+* @return Result of serial_daemon_parse_config()
+*/
+static int parse_test_config(const char *text) {
+    FILE *file = fopen(TEST_CONFIG_PATH, "w");
+    assert_non_null(file);
+    assert_true(fputs(text, file) >= 0);
+    assert_int_equal(fclose(file), 0);
+    int result = serial_daemon_parse_config(TEST_CONFIG_PATH, &test_config);
+    unlink(TEST_CONFIG_PATH);
+    return result;
+}
+
+/**
+* @brief Test the options of a port line
+*
+* This test verifies that every option reaches its field of
+* serial_options_t, and that unknown options, out-of-range values and
+* overflow=block are refused.
+*
+* @param state Test state (unused)
+*/
+static void test_daemon_parse_port_option(void **state) {
+    (void)state;
+    serial_options_t opts;
+    serial_options_default(&opts);
+
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "backend", "ring"), EXIT_SUCCESS);
+    assert_int_equal(opts.queue_backend, QUEUE_BACKEND_RING);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "overflow", "drop_oldest"), EXIT_SUCCESS);
+    assert_int_equal(opts.overflow_set_params, OVERFLOW_DROP_OLDEST);
+    assert_int_equal(opts.overflow_on_off, OVERFLOW_DROP_OLDEST);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "profile", "low_latency"), EXIT_SUCCESS);
+    assert_int_equal(opts.line_profile, SERIAL_LINE_LOW_LATENCY);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "pool", "256"), EXIT_SUCCESS);
+    assert_int_equal(opts.pool_capacity, 256);
+    assert_int_equal(opts.pool_chunk_size, 256);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "growth", "1024"), EXIT_SUCCESS);
+    assert_int_equal(opts.pool_growth, 1);
+    assert_int_equal(opts.pool_max_capacity, 1024);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "emergency_reserve", "2"), EXIT_SUCCESS);
+    assert_int_equal(opts.emergency_reserve, 2);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "coalesce", "1"), EXIT_SUCCESS);
+    assert_int_equal(opts.coalesce, 1);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "reconnect", "1"), EXIT_SUCCESS);
+    assert_int_equal(opts.auto_reconnect, 1);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "lock_memory", "1"), EXIT_SUCCESS);
+    assert_int_equal(opts.lock_memory, 1);
+
+    // A blocked add() would stall the control socket of every port
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "overflow", "block"), EXIT_FAILURE);
+    assert_int_equal(opts.overflow_on_off, OVERFLOW_DROP_OLDEST);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "overflow", "later"), EXIT_FAILURE);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "backend", "list"), EXIT_FAILURE);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "coalesce", "2"), EXIT_FAILURE);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "pool", "-1"), EXIT_FAILURE);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "pool", "12k"), EXIT_FAILURE);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "pool", ""), EXIT_FAILURE);
+    assert_int_equal(serial_daemon_parse_port_option(&opts, "speed", "1"), EXIT_FAILURE);
+}
+
+/**
+* @brief Test reading a configuration file
+*
+* This test verifies that the directives of a valid file fill the
+* configuration in order, with defaults for what it leaves out, and that a
+* malformed line, a duplicate port, a file without ports and a missing file
+* are refused.
+*
+* @param state Test state (unused)
+*/
+static void test_daemon_parse_config(void **state) {
+    (void)state;
+
+    assert_int_equal(parse_test_config("# chargers of the test bench\n"
+                                       "socket /tmp/battery.sock\n"
+                                       "\n"
+                                       "reactor cpu=1 priority=0\n"
+                                       "port a /dev/ttyUSB0 115200 pool=64 overflow=coalesce # first\n"
+                                       "port b /dev/ttyUSB1 250000 backend=ring emergency_reserve=1\n"),
+                     EXIT_SUCCESS);
+    assert_string_equal(test_config.socket_path, "/tmp/battery.sock");
+    assert_int_equal(test_config.reactor.cpu, 1);
+    assert_int_equal(test_config.reactor.priority, 0);
+    assert_int_equal(test_config.nports, 2);
+    assert_string_equal(test_config.ports[0].name, "a");
+    assert_string_equal(test_config.ports[0].device, "/dev/ttyUSB0");
+    assert_int_equal(test_config.ports[0].baud, 115200);
+    assert_int_equal(test_config.ports[0].opts.pool_capacity, 64);
+    assert_int_equal(test_config.ports[0].opts.overflow_on_off, OVERFLOW_COALESCE);
+    assert_int_equal(test_config.ports[0].opts.log_sink, SERIAL_LOG_SINK_ASYNC);
+    assert_null(test_config.ports[0].ctx);
+    assert_string_equal(test_config.ports[1].name, "b");
+    assert_int_equal(test_config.ports[1].baud, 250000);
+    assert_int_equal(test_config.ports[1].opts.queue_backend, QUEUE_BACKEND_RING);
+    assert_int_equal(test_config.ports[1].opts.emergency_reserve, 1);
+    assert_int_equal(test_config.ports[1].opts.pool_capacity, POOL_SIZE);
+
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 9600\n"), EXIT_SUCCESS);
+    assert_string_equal(test_config.socket_path, DAEMON_DEFAULT_SOCKET);
+    assert_int_equal(test_config.reactor.cpu, -1);
+
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 9600 overflow=block\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 9600\nport a /dev/ttyUSB1 9600\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 0\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 9600 pool\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 9600\nsocket /a /b\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 9600\nreactor nice=1\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("port a /dev/ttyUSB0 9600\nlisten /a\n"), EXIT_FAILURE);
+    assert_int_equal(parse_test_config("# nothing\nsocket /tmp/battery.sock\n"), EXIT_FAILURE);
+    assert_int_equal(serial_daemon_parse_config("/nonexistent/battery.conf", &test_config), EXIT_FAILURE);
+}
+
+/**
+* @brief Send a request to the daemon code and check the status of its reply
+*
+* @param type Message type
+* @param port Port index
+* @param cmds Commands of a DAEMON_MSG_SUBMIT, or NULL
+* @param n Number of commands
+* @param reply Buffer for the reply, DAEMON_MAX_PACKET bytes
+* @return Status of the reply
+*/
+static int daemon_request(uint8_t type, uint8_t port, const daemon_command_t *cmds, size_t n, uint8_t *reply) {
+    static uint8_t request[DAEMON_MAX_PACKET];
+    static uint32_t id;
+    daemon_header_t header = { .type = type, .port = port, .id = ++id };
+    daemon_header_t echo;
+
+    memcpy(request, &header, sizeof(header));
+    if (n > 0) {
+        memcpy(request + sizeof(header), cmds, n * sizeof(*cmds));
+    }
+    size_t len = serial_daemon_handle_request(&test_config, request, sizeof(header) + n * sizeof(*cmds), reply);
+    assert_true(len >= sizeof(echo));
+    memcpy(&echo, reply, sizeof(echo));
+    assert_int_equal(echo.type, type);
+    assert_int_equal(echo.port, port);
+    assert_int_equal(echo.id, id);
+    return echo.status;
+}
+
+/**
+* @brief Test the control requests of the daemon
+*
+* This test verifies the replies to malformed requests, to unknown ports and
+* to each message type, that a single routine command gets the overflow
+* policy of its port while a larger batch stays all-or-nothing, and that an
+* emergency command makes room in a full pool.
+*
+* @param state Test state (unused)
+*/
+static void test_daemon_handle_request(void **state) {
+    (void)state;
+    static uint8_t reply[DAEMON_MAX_PACKET];
+    const daemon_command_t on = { .command_type = CMD_ON_OFF, .args = { 1, 3 } };
+    const daemon_command_t batch[2] = {
+        { .command_type = CMD_ON_OFF, .args = { 0, 3 } },
+        { .command_type = CMD_SET_PARAMS, .args = { 10, 90, 60 } }
+    };
+    const daemon_command_t emergency = { .command_type = CMD_EMERGENCY };
+    const daemon_command_t bad = { .command_type = CMD_ON_OFF, .args = { 2, 0 } };
+    daemon_header_t header;
+    serial_stats_t stats;
+
+    assert_int_equal(parse_test_config("port a /dev/null 9600 pool=2 overflow=drop_oldest\n"
+                                       "port b /dev/null 9600 pool=2\n"),
+                     EXIT_SUCCESS);
+    for (size_t i = 0; i < test_config.nports; i++) {
+        test_config.ports[i].opts.log_sink = SERIAL_LOG_SINK_NONE;
+        test_config.ports[i].ctx = serial_init(test_config.ports[i].device, B9600, &test_config.ports[i].opts);
+        assert_non_null(test_config.ports[i].ctx);
+    }
+    serial_ctx_t *a = test_config.ports[0].ctx;
+    serial_ctx_t *b = test_config.ports[1].ctx;
+
+    // Malformed requests and unknown ports
+    assert_int_equal(serial_daemon_handle_request(&test_config, reply, 3, reply), sizeof(header));
+    memcpy(&header, reply, sizeof(header));
+    assert_int_equal(header.status, DAEMON_ERR_MALFORMED);
+    assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 0, NULL, 0, reply), DAEMON_ERR_MALFORMED);
+    assert_int_equal(daemon_request(DAEMON_MSG_STATS, 0, &on, 1, reply), DAEMON_ERR_MALFORMED);
+    assert_int_equal(daemon_request(42, 0, NULL, 0, reply), DAEMON_ERR_MALFORMED);
+    assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 2, &on, 1, reply), DAEMON_ERR_PORT);
+    assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 0, &bad, 1, reply), DAEMON_ERR_INVALID);
+    assert_int_equal(serial_get_active_command_count(a), 0);
+
+    // Listing, statistics and metrics
+    assert_int_equal(daemon_request(DAEMON_MSG_PORTS, 0, NULL, 0, reply), DAEMON_OK);
+    assert_memory_equal(reply + sizeof(header), "a\0b", 4);
+    assert_int_equal(daemon_request(DAEMON_MSG_PORTS, 9, NULL, 0, reply), DAEMON_OK);
+    assert_int_equal(daemon_request(DAEMON_MSG_METRICS, 1, NULL, 0, reply), DAEMON_OK);
+    assert_non_null(strstr((const char *)reply + sizeof(header), "port=\"b\""));
+
+    // A lone routine command follows the overflow policy of the port
+    for (int i = 0; i < 3; i++) {
+        assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 0, &on, 1, reply), DAEMON_OK);
+        assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 1, &on, 1, reply), i < 2 ? DAEMON_OK : DAEMON_ERR_REJECTED);
+    }
+    assert_int_equal(daemon_request(DAEMON_MSG_STATS, 0, NULL, 0, reply), DAEMON_OK);
+    memcpy(&stats, reply + sizeof(header), sizeof(stats));
+    assert_int_equal(stats.overflow_dropped, 1);
+    assert_int_equal(serial_get_active_command_count(a), 2);
+
+    // A batch stays all-or-nothing, an emergency displaces a routine command
+    assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 0, batch, 2, reply), DAEMON_ERR_REJECTED);
+    assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 1, &emergency, 1, reply), DAEMON_OK);
+    assert_int_equal(serial_get_active_command_count(b), 2);
+    device_command_t cmd;
+    assert_int_equal(serial_get_next_command(b, &cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.command_type, CMD_EMERGENCY);
+    assert_int_equal(serial_get_next_command(b, &cmd), EXIT_SUCCESS);
+    assert_int_equal(serial_get_next_command(b, &cmd), EXIT_FAILURE);
+
+    // Emergencies of a mixed batch go first
+    const daemon_command_t mixed[2] = { on, emergency };
+    assert_int_equal(daemon_request(DAEMON_MSG_SUBMIT, 1, mixed, 2, reply), DAEMON_OK);
+    assert_int_equal(serial_get_next_command(b, &cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.command_type, CMD_EMERGENCY);
+    assert_int_equal(serial_get_next_command(b, &cmd), EXIT_SUCCESS);
+    assert_int_equal(cmd.command_type, CMD_ON_OFF);
+
+    for (size_t i = 0; i < test_config.nports; i++) {
+        assert_int_equal(serial_deinit(test_config.ports[i].ctx), EXIT_SUCCESS);
+    }
+}
+
+/** @} */ /* End of daemon_tests group */
+
+/**
+* @brief Main function for the test suite
+*
+* This function sets up and runs all the tests with enhanced verbosity.
+*
+* @return Result of the test execution
+*/
+int main(void) {
+    // Set cmocka to output all test information with maximum verbosity
+    cmocka_set_message_output(CM_OUTPUT_STDOUT);
+    printf("\n============= Starting Battery Charger Serial Communication Tests =============\n\n");
+
+    const struct CMUnitTest tests[] = {
+        /* Initialization Tests */
+        cmocka_unit_test(test_init_valid_port),
+        cmocka_unit_test(test_init_long_port),
+        cmocka_unit_test(test_init_null_port),
+        cmocka_unit_test(test_init_double_initialization),
+        cmocka_unit_test(test_init_various_speeds),
+
+        /* Deinitialization Tests */
+        cmocka_unit_test(test_deinit_without_init),
+        cmocka_unit_test(test_deinit_double_deinit),
+
+        /* Set Params Command Tests */
+        cmocka_unit_test(test_add_valid_set_params_command),
+        cmocka_unit_test(test_add_boundary_set_params_command),
+        cmocka_unit_test(test_add_invalid_min_level_params_command),
+        cmocka_unit_test(test_add_invalid_max_level_params_command),
+        cmocka_unit_test(test_add_invalid_max_time_params_command),
+        cmocka_unit_test(test_add_invalid_level_range_params_command),
+
+        /* On/Off Command Tests */
+        cmocka_unit_test(test_add_valid_on_off_command),
+        cmocka_unit_test(test_add_boundary_on_off_command),
+        cmocka_unit_test(test_add_invalid_on_off_value_command),
+        cmocka_unit_test(test_add_invalid_channel_value_command),
+
+        /* Emergency Command Tests */
+        cmocka_unit_test(test_add_emergency_command),
+
+        /* Invalid Command Tests */
+        cmocka_unit_test(test_add_invalid_command_type),
+        cmocka_unit_test(test_add_null_command),
+        cmocka_unit_test(test_validate_command_limits),
+        cmocka_unit_test(test_add_prevalidated),
+
+        /* Pool Tests */
+        cmocka_unit_test(test_add_commands_to_fill_pool),
+        cmocka_unit_test(test_add_command_without_init),
+
+        /* Get Command Tests */
+        cmocka_unit_test(test_get_next_command),
+        cmocka_unit_test(test_get_next_command_null_pointer),
+        cmocka_unit_test(test_get_next_command_without_init),
+        cmocka_unit_test(test_get_commands_fifo_order),
+
+        /* Command Count Tests */
+        cmocka_unit_test(test_command_count_without_init),
+        cmocka_unit_test(test_command_count_with_empty_pools),
+        cmocka_unit_test(test_command_count_with_activity),
+        cmocka_unit_test(test_command_counts_snapshot),
+
+        /* Blocking Wait Tests */
+        cmocka_unit_test(test_get_next_command_wait_timeout),
+        cmocka_unit_test(test_get_next_command_wait_wakeup),
+        cmocka_unit_test(test_add_wait_full_pool),
+        cmocka_unit_test(test_add_wait_invalid_command),
+
+        /* Batch Command Tests */
+        cmocka_unit_test(test_batch_round_trip),
+        cmocka_unit_test(test_batch_all_or_nothing),
+
+        /* Transmit Engine Tests */
+        cmocka_unit_test(test_encode_frame),
+        cmocka_unit_test(test_transmitter_drains_pool),
+        cmocka_unit_test(test_transmitter_counts_dropped),
+
+        /* Emergency Lane Tests */
+        cmocka_unit_test(test_emergency_overtakes_backlog),
+        cmocka_unit_test(test_emergency_lane_batch_order),
+
+        /* Pool Capacity Tests */
+        cmocka_unit_test(test_pool_configured_capacity),
+        cmocka_unit_test(test_pool_invalid_options),
+        cmocka_unit_test(test_pool_growth),
+        cmocka_unit_test(test_thread_cache_fast_path),
+        cmocka_unit_test(test_thread_cache_steal),
+
+        /* Log Sink Tests */
+        cmocka_unit_test(test_log_ratelimit),
+        cmocka_unit_test(test_log_sinks),
+
+        /* Command Coalescing Tests */
+        cmocka_unit_test(test_coalesce_on_off),
+        cmocka_unit_test(test_coalesce_set_params),
+
+        /* Instance Handle Tests */
+        cmocka_unit_test(test_instances_independent),
+        cmocka_unit_test(test_instance_deinit_releases_waiters),
+
+        /* I/O Reactor Tests */
+        cmocka_unit_test(test_reactor_many_instances),
+        cmocka_unit_test(test_reactor_partial_writes),
+        cmocka_unit_test(test_reactor_invalid_use),
+
+        /* Receive Path Tests */
+        cmocka_unit_test(test_rx_feed_stream),
+        cmocka_unit_test(test_rx_callback_and_overflow),
+        cmocka_unit_test(test_rx_receiver_thread),
+
+        /* Acknowledgement Window Tests */
+        cmocka_unit_test(test_ack_window_pipelining),
+        cmocka_unit_test(test_ack_retransmit_timeout),
+        cmocka_unit_test(test_ack_invalid_options),
+
+        /* Metrics Tests */
+        cmocka_unit_test(test_stats_counters),
+        cmocka_unit_test(test_stats_residency_histogram),
+        cmocka_unit_test(test_stats_prometheus_format),
+
+        /* Trace Tests */
+        cmocka_unit_test(test_trace_command_path),
+        cmocka_unit_test(test_trace_dump),
+        cmocka_unit_test(test_trace_ring_reuse),
+
+        /* Deferred Command Tests */
+        cmocka_unit_test(test_add_at_deadline_order),
+        cmocka_unit_test(test_add_at_many_levels),
+        cmocka_unit_test(test_add_at_invalid),
+        cmocka_unit_test(test_add_at_coalesce),
+
+        /* Shared-Memory Ingress Tests */
+        cmocka_unit_test(test_shm_child_producer),
+        cmocka_unit_test(test_shm_lifetime),
+        cmocka_unit_test(test_shm_forged_header),
+
+        /* Reconnection Tests */
+        cmocka_unit_test(test_reconnect_keeps_pool),
+        cmocka_unit_test(test_auto_reconnect_pty),
+
+        /* Command Capture Tests */
+        cmocka_unit_test(test_capture_records),
+        cmocka_unit_test(test_capture_map_invalid),
+
+        /* Line Profile Tests */
+        cmocka_unit_test(test_line_low_latency_custom_baud),
+        cmocka_unit_test(test_line_throughput_profile),
+        cmocka_unit_test(test_line_invalid_use),
+
+        /* Channel State Tests */
+        cmocka_unit_test(test_channel_state_diff),
+        cmocka_unit_test(test_channel_state_pool_full),
+        cmocka_unit_test(test_channel_state_lost),
+
+        /* Overflow Policy Tests */
+        cmocka_unit_test(test_overflow_drop_and_coalesce),
+        cmocka_unit_test(test_overflow_block),
+        cmocka_unit_test(test_overflow_emergency),
+        cmocka_unit_test(test_overflow_emergency_batch),
+
+        /* Real-Time Settings Tests */
+        cmocka_unit_test(test_rt_transmitter_and_memory),
+        cmocka_unit_test(test_rt_reactor_and_invalid),
+
+        /* Ring Backend Tests */
+        cmocka_unit_test(test_ring_init_invalid_backend),
+        cmocka_unit_test(test_ring_fill_pool),
+        cmocka_unit_test(test_ring_fifo_order),
+        cmocka_unit_test(test_ring_slot_layout),
+
+        /* Daemon Tests */
+        cmocka_unit_test(test_daemon_parse_port_option),
+        cmocka_unit_test(test_daemon_parse_config),
+        cmocka_unit_test(test_daemon_handle_request),
     };
 
     // Print each test as it's about to run (extra logging)